@@ -23,10 +23,34 @@
 #include <cups/array.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <signal.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/wait.h>
+#ifdef HAVE_MEMFD_CREATE
+#  include <sys/mman.h>
+#endif // HAVE_MEMFD_CREATE
+
+
+//
+// Local types...
+//
+
+typedef struct beh_spool_s		// Spool for job data read from stdin
+{
+  int		fd;			// File descriptor, -1 if not open
+  int		in_memory;		// 1 if memory-backed (memfd)
+  size_t	bytes,			// Number of bytes spooled
+		max_memory;		// Spill to disk beyond this size
+  char		filename[1024];		// Name to pass to the backend
+  char		tmpfilename[1024];	// Temporary file to unlink, if any
+} beh_spool_t;
 
 
 //
@@ -40,9 +64,18 @@ static volatile int	job_canceled = 0; // Set to 1 on SIGTERM
 // Local functions...
 //
 
+static double		backoff_delay(int delay, int attempt, double factor,
+				      int max_delay, int jitter);
 static int		call_backend(char *uri, int argc, char **argv,
-				     char *tempfile);
+				     char *tempfile, beh_spool_t *spool);
 static void		sigterm_handler(int sig);
+static void		spool_close(beh_spool_t *spool);
+static int		spool_open(beh_spool_t *spool, size_t max_memory);
+static int		spool_spill(beh_spool_t *spool);
+static int		spool_stdin(beh_spool_t *spool, int pipe_fd);
+static int		spool_write(beh_spool_t *spool, const char *buf,
+				    size_t bytes);
+static int		write_all(int fd, const char *buf, size_t bytes);
 
 
 //
@@ -53,9 +86,20 @@ int					// O - Exit status
 main(int  argc,				// I - Number of command-line args
      char *argv[])			// I - Command-line arguments
 {
-  char *uri, *ptr, *filename;
-  char tmpfilename[1024], buf[8192];
-  int dd, att, delay, retval;
+  char *uri, *ptr, *filename, *end;
+  char name[32], value[32];
+  int dd, att, delay, retval, attempt, i;
+  int max_delay = 0,			// Upper limit for backoff delay
+      jitter = 0,			// Random variation of delay in percent
+      deadline = 0,			// Give up after this many seconds
+      stream = 1;			// Feed the first attempt from stdin?
+  double factor = 1.0,			// Backoff factor
+      wait_time;			// Time to wait before next attempt
+  size_t max_memory = 16384 * 1024;	// Keep smaller jobs in memory
+  long kbytes;				// Memory spool size from URI
+  time_t start_time;			// Time when we started
+  beh_spool_t spool;			// Spool for data from stdin
+  struct timespec ts;			// Time for nanosleep()
 #if defined(HAVE_SIGACTION) && !defined(HAVE_SIGSET)
   struct sigaction action;		// Actions for POSIX signals
 #endif // HAVE_SIGACTION && !HAVE_SIGSET
@@ -68,14 +112,19 @@ main(int  argc,				// I - Number of command-line args
 
 #ifdef HAVE_SIGSET // Use System V signals over POSIX to avoid bugs
   sigset(SIGTERM, sigterm_handler);
+  sigset(SIGPIPE, SIG_IGN);
 #elif defined(HAVE_SIGACTION)
   memset(&action, 0, sizeof(action));
 
   sigemptyset(&action.sa_mask);
   action.sa_handler = sigterm_handler;
   sigaction(SIGTERM, &action, NULL);
+
+  action.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &action, NULL);
 #else
   signal(SIGTERM, sigterm_handler);
+  signal(SIGPIPE, SIG_IGN);
 #endif // HAVE_SIGSET
 
   //
@@ -144,43 +193,114 @@ main(int  argc,				// I - Number of command-line args
   if (*ptr != '/')
     goto bad_uri;
   ptr ++;
+
+  //
+  // Optional "<name>=<value>/" fields between the delay and the original
+  // URI. A URI scheme never contains '=', so a field with an '=' before
+  // the first ':' or '/' cannot be the beginning of the original URI.
+  //
+
+  while (ptr[strcspn(ptr, "=:/")] == '=')
+  {
+    for (i = 0; *ptr != '=' && i < sizeof(name) - 1; ptr ++)
+      name[i ++] = *ptr;
+    name[i] = '\0';
+    if (*ptr != '=')
+      goto bad_uri;
+    ptr ++;
+    for (i = 0; *ptr && *ptr != '/' && i < sizeof(value) - 1; ptr ++)
+      value[i ++] = *ptr;
+    value[i] = '\0';
+    if (*ptr != '/')
+      goto bad_uri;
+    ptr ++;
+
+    if (!strcasecmp(name, "backoff"))
+    {
+      factor = atof(value);
+      if (factor < 1.0)
+	factor = 1.0;
+    }
+    else if (!strcasecmp(name, "maxdelay"))
+      max_delay = atoi(value);
+    else if (!strcasecmp(name, "jitter"))
+    {
+      jitter = atoi(value);
+      if (jitter < 0)
+	jitter = 0;
+      else if (jitter > 100)
+	jitter = 100;
+    }
+    else if (!strcasecmp(name, "deadline"))
+      deadline = atoi(value);
+    else if (!strcasecmp(name, "spool"))
+    {
+      errno = 0;
+      kbytes = strtol(value, &end, 10);
+      if (errno || end == value || *end || kbytes < 0 ||
+	  (unsigned long)kbytes > SIZE_MAX / 1024)
+      {
+	fprintf(stderr,
+		"ERROR: beh: Invalid memory spool size \"%s\" KB.\n", value);
+	return (CUPS_BACKEND_FAILED);
+      }
+      max_memory = (size_t)kbytes * 1024;
+    }
+    else if (!strcasecmp(name, "stream"))
+      stream = (!strcasecmp(value, "yes") || !strcasecmp(value, "on") ||
+		!strcasecmp(value, "true") || !strcmp(value, "1"));
+    else
+      fprintf(stderr,
+	      "DEBUG: beh: Ignoring unknown option \"%s=%s\".\n",
+	      name, value);
+  }
+
   fprintf(stderr,
 	  "DEBUG: beh: Don't disable: %d; Attempts: %d; Delay: %d; Destination URI: %s\n",
 	  dd, att, delay, ptr);
+  fprintf(stderr,
+	  "DEBUG: beh: Backoff factor: %.2f; Maximum delay: %d; Jitter: %d%%; Deadline: %d; Memory spool: %ld KB; Stream first attempt: %s\n",
+	  factor, max_delay, jitter, deadline, (long)(max_memory / 1024),
+	  stream ? "yes" : "no");
+
+  start_time = time(NULL);
+  CUPS_SRAND((unsigned)start_time ^ (unsigned)getpid());
 
   //
-  // If reading from stdin, write everything into a temporary file
+  // If reading from stdin, spool everything, in memory if the job is small
+  // enough, so that we can repeat it. Unless told otherwise the first
+  // attempt gets the data while it is spooled, so the printer starts
+  // before the job is completely received.
   //
 
+  retval = CUPS_BACKEND_FAILED;
+  attempt = 0;
+
   if (argc == 6)
   {
-    char *tmpdir;
-    int fd;
-    FILE *tmpfile;
-    size_t bytes;
-
-    tmpdir = getenv("TMPDIR");
-    if (!tmpdir)
-      tmpdir = "/tmp";
-    snprintf(tmpfilename, sizeof(tmpfilename), "%s/beh-XXXXXX", tmpdir);
-    fd = mkstemp(tmpfilename);
-    if (fd < 0)
+    if (spool_open(&spool, max_memory))
+      return (CUPS_BACKEND_FAILED);
+
+    if (stream)
     {
-      fprintf(stderr,
-	      "ERROR: beh: Could not create temporary file: %s\n",
-	      strerror(errno));
+      attempt ++;
+      retval = call_backend(ptr, argc, argv, NULL, &spool);
+      if (spool.fd < 0)
+	return (CUPS_BACKEND_FAILED);
+    }
+    else if (spool_stdin(&spool, -1))
+    {
+      spool_close(&spool);
       return (CUPS_BACKEND_FAILED);
     }
-    tmpfile = fdopen(fd, "r+");
-    while ((bytes = fread(buf, 1, sizeof(buf), stdin)))
-      fwrite(buf, 1, bytes, tmpfile);
-    fclose(tmpfile);
-		    
-    filename = tmpfilename;
+
+    fprintf(stderr, "DEBUG: beh: Spooled %ld bytes %s.\n",
+	    (long)spool.bytes, spool.in_memory ? "in memory" : "on disk");
+    filename = spool.filename;
   }
   else
   {
-    tmpfilename[0] = '\0';
+    spool.fd = -1;
     filename = argv[6];
   }
 
@@ -188,22 +308,43 @@ main(int  argc,				// I - Number of command-line args
   // Do it!
   //
 
-  while ((retval = call_backend(ptr, argc, argv, filename)) !=
-	 CUPS_BACKEND_OK &&
-	 !job_canceled)
+  while (!job_canceled)
   {
-    if (att > 0)
+    if (attempt > 0)
     {
-      att --;
-      if (att == 0)
+      if (retval == CUPS_BACKEND_OK)
+	break;
+      if (att > 0 && attempt >= att)
 	break;
+
+      wait_time = backoff_delay(delay, attempt, factor, max_delay, jitter);
+      if (deadline > 0 &&
+	  difftime(time(NULL), start_time) + wait_time >= deadline)
+      {
+	fprintf(stderr,
+		"DEBUG: beh: Deadline of %d seconds reached after %d attempt(s), giving up.\n",
+		deadline, attempt);
+	break;
+      }
+
+      if (wait_time > 0.0)
+      {
+	fprintf(stderr,
+		"DEBUG: beh: Attempt %d failed, retrying in %.1f seconds.\n",
+		attempt, wait_time);
+	ts.tv_sec  = (time_t)wait_time;
+	ts.tv_nsec = (long)((wait_time - ts.tv_sec) * 1000000000.0);
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR && !job_canceled);
+	if (job_canceled)
+	  break;
+      }
     }
-    if (delay > 0)
-      sleep (delay);
+
+    attempt ++;
+    retval = call_backend(ptr, argc, argv, filename, NULL);
   }
 
-  if (strlen(tmpfilename) > 0)
-    unlink(tmpfilename);
+  spool_close(&spool);
 
   //
   // Return the exit value of the backend only if requested
@@ -221,11 +362,37 @@ main(int  argc,				// I - Number of command-line args
  bad_uri:
 
   fprintf(stderr,
-	  "ERROR: URI must be \"beh:/<dd>/<att>/<delay>/<original uri>\"!\n");
+	  "ERROR: URI must be \"beh:/<dd>/<att>/<delay>/[<option>=<value>/...]<original uri>\"!\n");
   return (CUPS_BACKEND_FAILED);
 }
 
 
+//
+// 'backoff_delay()' - Compute the time to wait before the next attempt.
+//
+
+static double				// O - Delay in seconds
+backoff_delay(int    delay,		// I - Base delay in seconds
+	      int    attempt,		// I - Number of failed attempts
+	      double factor,		// I - Backoff factor
+	      int    max_delay,		// I - Upper limit, 0 for none
+	      int    jitter)		// I - Random variation in percent
+{
+  double	wait_time;		// Delay
+
+
+  wait_time = delay * pow(factor, attempt - 1);
+  if (max_delay > 0 && wait_time > max_delay)
+    wait_time = max_delay;
+
+  if (jitter > 0)
+    wait_time += wait_time * jitter / 100.0 *
+		 ((CUPS_RAND() % 20001) / 10000.0 - 1.0);
+
+  return (wait_time > 0.0 ? wait_time : 0.0);
+}
+
+
 //
 // 'call_backend()' - Execute the command line of the destination backend
 //
@@ -235,7 +402,9 @@ call_backend(char *uri,                 // I - URI of final destination
 	     int  argc,                 // I - Number of command line
 	                                //     arguments
 	     char **argv,		// I - Command-line arguments
-	     char *filename)            // I - File name of input data
+	     char *filename,            // I - File name of input data
+	     beh_spool_t *spool)	// I - Spool to fill from stdin while
+					//     the backend reads it, or NULL
 {
   const char	*cups_serverbin;	// Location of programs
   char          *backend_argv[8];       // Arguments for called CUPS backend
@@ -247,6 +416,7 @@ call_backend(char *uri,                 // I - URI of final destination
                 wait_status,
                 retval = 0;
   int           bytes;
+  int           pipe_fds[2] = { -1, -1 }; // Pipe to feed the backend's stdin
 
 
   //
@@ -321,8 +491,23 @@ call_backend(char *uri,                 // I - URI of final destination
 	  "DEBUG: beh: Using device URI: %s\n",
 	  uri);
 
+  if (spool && pipe(pipe_fds))
+  {
+    fprintf(stderr, "ERROR: beh: Unable to create pipe for backend: %s\n",
+	    strerror(errno));
+    return (CUPS_BACKEND_FAILED);
+  }
+
   if ((pid = fork()) == 0)
   {
+    if (spool)
+    {
+      dup2(pipe_fds[0], 0);
+      close(pipe_fds[0]);
+      close(pipe_fds[1]);
+    }
+    signal(SIGPIPE, SIG_DFL);
+
     retval = execv(backend_path, backend_argv);
 
     if (retval == -1)
@@ -333,10 +518,31 @@ call_backend(char *uri,                 // I - URI of final destination
   else if (pid < 0)
   {
     fprintf(stderr, "ERROR: Unable to fork for backend\n");
+    if (spool)
+    {
+      close(pipe_fds[0]);
+      close(pipe_fds[1]);
+    }
     return (CUPS_BACKEND_FAILED);
   }
 
-  while ((wait_pid = wait(&wait_status)) < 0 && errno == EINTR);
+  //
+  // When streaming, copy stdin into the spool and to the backend. If the
+  // backend stops reading we complete the spool for the next attempt.
+  //
+
+  if (spool)
+  {
+    close(pipe_fds[0]);
+    if (spool_stdin(spool, pipe_fds[1]))
+    {
+      spool_close(spool);
+      kill(pid, SIGTERM);
+      retval = CUPS_BACKEND_FAILED;
+    }
+  }
+
+  while ((wait_pid = waitpid(pid, &wait_status, 0)) < 0 && errno == EINTR);
 
   if (wait_pid >= 0 && wait_status)
   {
@@ -352,6 +558,218 @@ call_backend(char *uri,                 // I - URI of final destination
 }
 
 
+//
+// 'spool_close()' - Close the spool and remove its temporary file.
+//
+
+static void
+spool_close(beh_spool_t *spool)		// I - Spool
+{
+  if (spool->fd >= 0)
+    close(spool->fd);
+  spool->fd = -1;
+
+  if (spool->tmpfilename[0])
+    unlink(spool->tmpfilename);
+  spool->tmpfilename[0] = '\0';
+}
+
+
+//
+// 'spool_open()' - Create an empty spool, in memory if possible.
+//
+
+static int				// O - 0 on success, -1 on error
+spool_open(beh_spool_t *spool,		// I - Spool
+	   size_t      max_memory)	// I - Maximum size to keep in memory
+{
+  memset(spool, 0, sizeof(beh_spool_t));
+  spool->fd         = -1;
+  spool->max_memory = max_memory;
+
+#ifdef HAVE_MEMFD_CREATE
+  //
+  // The memfd is deliberately inherited by the backend, which opens it
+  // via /dev/fd/<n> as if it were an ordinary file.
+  //
+
+  if (max_memory > 0 && (spool->fd = memfd_create("beh-spool", 0)) >= 0)
+  {
+    spool->in_memory = 1;
+    snprintf(spool->filename, sizeof(spool->filename), "/dev/fd/%d",
+	     spool->fd);
+    return (0);
+  }
+#endif // HAVE_MEMFD_CREATE
+
+  return (spool_spill(spool));
+}
+
+
+//
+// 'spool_spill()' - Move the spool into a temporary file on disk.
+//
+
+static int				// O - 0 on success, -1 on error
+spool_spill(beh_spool_t *spool)		// I - Spool
+{
+  char		*tmpdir;		// Directory for temporary files
+  int		fd;			// Temporary file
+  char		buf[8192];		// Copy buffer
+  ssize_t	bytes;			// Bytes read
+
+
+  tmpdir = getenv("TMPDIR");
+  if (!tmpdir)
+    tmpdir = "/tmp";
+  snprintf(spool->tmpfilename, sizeof(spool->tmpfilename), "%s/beh-XXXXXX",
+	   tmpdir);
+  if ((fd = mkstemp(spool->tmpfilename)) < 0)
+  {
+    fprintf(stderr,
+	    "ERROR: beh: Could not create temporary file: %s\n",
+	    strerror(errno));
+    spool->tmpfilename[0] = '\0';
+    return (-1);
+  }
+
+  if (spool->fd >= 0)
+  {
+    //
+    // Copy what we have got in memory so far...
+    //
+
+    fprintf(stderr,
+	    "DEBUG: beh: Job exceeds %ld KB, spooling to %s.\n",
+	    (long)(spool->max_memory / 1024), spool->tmpfilename);
+
+    lseek(spool->fd, 0, SEEK_SET);
+    while ((bytes = read(spool->fd, buf, sizeof(buf))) > 0)
+      if (write_all(fd, buf, (size_t)bytes))
+	break;
+    if (bytes != 0)
+    {
+      fprintf(stderr,
+	      "ERROR: beh: Could not write temporary file: %s\n",
+	      strerror(errno));
+      close(fd);
+      unlink(spool->tmpfilename);
+      spool->tmpfilename[0] = '\0';
+      return (-1);
+    }
+    close(spool->fd);
+  }
+
+  spool->fd        = fd;
+  spool->in_memory = 0;
+  strncpy(spool->filename, spool->tmpfilename, sizeof(spool->filename));
+
+  return (0);
+}
+
+
+//
+// 'spool_stdin()' - Spool stdin, optionally passing it on to a backend.
+//
+
+static int				// O - 0 on success, -1 on error
+spool_stdin(beh_spool_t *spool,		// I - Spool
+	    int         pipe_fd)	// I - Pipe to the backend or -1
+{
+  char		buf[8192];		// Copy buffer
+  ssize_t	bytes;			// Bytes read
+
+
+  while ((bytes = read(0, buf, sizeof(buf))) != 0)
+  {
+    if (bytes < 0)
+    {
+      if (errno == EINTR && !job_canceled)
+	continue;
+      break;
+    }
+
+    if (spool_write(spool, buf, (size_t)bytes))
+      break;
+
+    if (pipe_fd >= 0 && write_all(pipe_fd, buf, (size_t)bytes))
+    {
+      //
+      // Backend exited or closed its input, it will be tried again with
+      // the spooled data...
+      //
+
+      fprintf(stderr,
+	      "DEBUG: beh: Backend stopped reading the job: %s\n",
+	      strerror(errno));
+      close(pipe_fd);
+      pipe_fd = -1;
+    }
+  }
+
+  if (pipe_fd >= 0)
+    close(pipe_fd);
+
+  return (bytes == 0 ? 0 : -1);
+}
+
+
+//
+// 'spool_write()' - Append data to the spool.
+//
+
+static int				// O - 0 on success, -1 on error
+spool_write(beh_spool_t *spool,		// I - Spool
+	    const char  *buf,		// I - Data
+	    size_t      bytes)		// I - Number of bytes
+{
+  if (spool->in_memory && spool->bytes + bytes > spool->max_memory &&
+      spool_spill(spool))
+    return (-1);
+
+  if (write_all(spool->fd, buf, bytes))
+  {
+    fprintf(stderr,
+	    "ERROR: beh: Could not write temporary file: %s\n",
+	    strerror(errno));
+    return (-1);
+  }
+
+  spool->bytes += bytes;
+
+  return (0);
+}
+
+
+//
+// 'write_all()' - Write a complete buffer to a file descriptor.
+//
+
+static int				// O - 0 on success, -1 on error
+write_all(int        fd,		// I - File descriptor
+	  const char *buf,		// I - Data
+	  size_t     bytes)		// I - Number of bytes
+{
+  ssize_t	written;		// Bytes written
+
+
+  while (bytes > 0)
+  {
+    if ((written = write(fd, buf, bytes)) < 0)
+    {
+      if (errno == EINTR && !job_canceled)
+	continue;
+      return (-1);
+    }
+
+    buf   += written;
+    bytes -= (size_t)written;
+  }
+
+  return (0);
+}
+
+
 //
 // 'sigterm_handler()' - Handle termination signals.
 //
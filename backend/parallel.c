@@ -10,6 +10,8 @@
 // Contents:
 //
 //   main()         - Send a file to the specified parallel port.
+//   buffer_read()  - Read print data into the print buffer.
+//   buffer_write() - Write print data from the print buffer to the device.
 //   drain_output() - Drain pending print data to the device.
 //   list_devices() - List all parallel devices.
 //   run_loop()     - Read and write print and back-channel data.
@@ -27,18 +29,44 @@
 #include <fcntl.h>
 #include <termios.h>
 #include <stdio.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+
+
+//
+// Local types...
+//
+
+typedef struct print_buffer_s		// Ring buffer for print data
+{
+  char		*data;			// Buffer memory
+  size_t	size,			// Size of buffer
+		start,			// Offset of first pending byte
+		used;			// Number of pending bytes
+} print_buffer_t;
+
+
+//
+// Local globals...
+//
+
+static int	DebugIO = 0;		// Log every read and write?
 
 
 //
 // Local functions...
 //
 
-static int	drain_output(int print_fd, int device_fd);
+static ssize_t	buffer_read(print_buffer_t *buf, int fd);
+static ssize_t	buffer_write(print_buffer_t *buf, int fd);
+static int	drain_output(int print_fd, int device_fd,
+			     print_buffer_t *buf);
 static void	list_devices(void);
 static ssize_t	run_loop(int print_fd, int device_fd, int use_bc,
-		         int update_state);
-static int	side_cb(int print_fd, int device_fd, int use_bc);
+		         int update_state, print_buffer_t *buf);
+static int	side_cb(int print_fd, int device_fd, int use_bc,
+			print_buffer_t *buf);
 
 
 //
@@ -58,13 +86,17 @@ main(int  argc,				// I - Number of command-line arguments
 		hostname[1024],		// Hostname
 		username[255],		// Username info (not used)
 		resource[1024],		// Resource info (device and options)
-		*options;		// Pointer to options
+		*options,		// Pointer to options
+		*name,			// Name of option
+		*value,			// Value of option
+		sep;			// Option separator
   int		port;			// Port number (not used)
   int		print_fd,		// Print file
 		device_fd,		// Parallel device
 		use_bc;			// Read back-channel data?
   int		copies;			// Number of copies to print
   ssize_t	tbytes;			// Total number of bytes written
+  print_buffer_t buf;			// Print data buffer
   struct termios opts;			// Parallel port options
 #if defined(HAVE_SIGACTION) && !defined(HAVE_SIGSET)
   struct sigaction action;		// Actions for POSIX signals
@@ -235,10 +267,87 @@ main(int  argc,				// I - Number of command-line arguments
 
   opts.c_lflag &= ~(ICANON | ECHO | ISIG);	// Raw mode
 
-  // **** No options supported yet ****
-
   tcsetattr(device_fd, TCSANOW, &opts);
 
+  memset(&buf, 0, sizeof(buf));
+  buf.size = 262144;			// 256k by default
+
+  if (options)
+  {
+    while (*options)
+    {
+      //
+      // Get the name...
+      //
+
+      name = options;
+
+      while (*options && *options != '=' && *options != '+' && *options != '&')
+        options ++;
+
+      if ((sep = *options) != '\0')
+        *options++ = '\0';
+
+      if (sep == '=')
+      {
+	//
+        // Get the value...
+	//
+
+        value = options;
+
+	while (*options && *options != '+' && *options != '&')
+	  options ++;
+
+        if (*options)
+	  *options++ = '\0';
+      }
+      else
+        value = (char *)"";
+
+      //
+      // Process the option...
+      //
+
+      if (!strcasecmp(name, "buffer"))
+      {
+	//
+	// Set the size of the print data buffer in kilobytes, between 8k
+	// and 64M...
+	//
+
+	int kbytes = atoi(value);
+
+	if (kbytes < 8)
+	  kbytes = 8;
+	else if (kbytes > 65536)
+	  kbytes = 65536;
+
+	buf.size = (size_t)kbytes * 1024;
+      }
+      else if (!strcasecmp(name, "debug"))
+      {
+	//
+	// Log every read and write of print data...
+	//
+
+	DebugIO = !strcasecmp(value, "yes") || !strcasecmp(value, "on") ||
+		  !strcasecmp(value, "true");
+      }
+    }
+  }
+
+  if ((buf.data = malloc(buf.size)) == NULL)
+  {
+    perror("ERROR: Unable to allocate print buffer");
+    close(device_fd);
+    if (print_fd != 0)
+      close(print_fd);
+    return (CUPS_BACKEND_FAILED);
+  }
+
+  fprintf(stderr, "DEBUG: Using a %d byte print buffer.\n", (int)buf.size);
+
   //
   // Finally, send the print file...
   //
@@ -255,7 +364,13 @@ main(int  argc,				// I - Number of command-line arguments
       lseek(print_fd, 0, SEEK_SET);
     }
 
-    tbytes = run_loop(print_fd, device_fd, use_bc, 1);
+    buf.start = 0;
+    buf.used  = 0;
+
+    tbytes = run_loop(print_fd, device_fd, use_bc, 1, &buf);
+
+    if (tbytes >= 0)
+      fprintf(stderr, "DEBUG: Sent %ld bytes of print data.\n", (long)tbytes);
 
     if (print_fd != 0 && tbytes >= 0)
       fputs("INFO: Print file sent.\n", stderr);
@@ -265,6 +380,8 @@ main(int  argc,				// I - Number of command-line arguments
   // Close the socket connection and input file and return...
   //
 
+  free(buf.data);
+
   close(device_fd);
 
   if (print_fd != 0)
@@ -275,52 +392,152 @@ main(int  argc,				// I - Number of command-line arguments
 
 
 //
-// 'drain_output()' - Drain pending print data to the device.
+// 'buffer_read()' - Read print data into the print buffer.
+//
+// As much data as fits into the free space of the buffer is read with a
+// single readv() call, also if the free space wraps around the end of the
+// buffer.
 //
 
-static int				// O - 0 on success, -1 on error
-drain_output(int print_fd,		// I - Print file descriptor
-             int device_fd)		// I - Device file descriptor
+static ssize_t				// O - Bytes read, 0 on EOF, -1 on error
+buffer_read(print_buffer_t *buf,	// I - Print buffer
+	    int            fd)		// I - File to read from
 {
-  int		nfds;			// Maximum file descriptor value + 1
-  fd_set	input;			// Input set for reading
-  ssize_t	print_bytes,		// Print bytes read
-		bytes;			// Bytes written
-  char		print_buffer[8192],	// Print data buffer
-		*print_ptr;		// Pointer into print data buffer
-  struct timeval timeout;		// Timeout for read...
+  struct iovec	iov[2];			// Free regions of the buffer
+  int		iovcnt;			// Number of free regions
+  size_t	tail;			// Offset of first free byte
+  ssize_t	bytes;			// Bytes read
 
 
-  //
-  // Figure out the maximum file descriptor value to use with select()...
-  //
+  tail = (buf->start + buf->used) % buf->size;
+
+  iov[0].iov_base = buf->data + tail;
+  if (tail >= buf->start && buf->used < buf->size)
+  {
+    iov[0].iov_len  = buf->size - tail;
+    iov[1].iov_base = buf->data;
+    iov[1].iov_len  = buf->start;
+    iovcnt          = buf->start ? 2 : 1;
+  }
+  else
+  {
+    iov[0].iov_len = buf->size - buf->used;
+    iovcnt         = 1;
+  }
+
+  if ((bytes = readv(fd, iov, iovcnt)) > 0)
+  {
+    buf->used += (size_t)bytes;
+
+    if (DebugIO)
+      fprintf(stderr, "DEBUG: Read %d bytes of print data.\n", (int)bytes);
+  }
+
+  return (bytes);
+}
+
+
+//
+// 'buffer_write()' - Write print data from the print buffer to the device.
+//
+// All pending data is handed to the device with a single writev() call,
+// also if it wraps around the end of the buffer.
+//
+
+static ssize_t				// O - Bytes written or -1 on error
+buffer_write(print_buffer_t *buf,	// I - Print buffer
+	     int            fd)		// I - Device to write to
+{
+  struct iovec	iov[2];			// Pending regions of the buffer
+  int		iovcnt;			// Number of pending regions
+  ssize_t	bytes;			// Bytes written
+
+
+  iov[0].iov_base = buf->data + buf->start;
+  if (buf->start + buf->used > buf->size)
+  {
+    iov[0].iov_len  = buf->size - buf->start;
+    iov[1].iov_base = buf->data;
+    iov[1].iov_len  = buf->used - iov[0].iov_len;
+    iovcnt          = 2;
+  }
+  else
+  {
+    iov[0].iov_len = buf->used;
+    iovcnt         = 1;
+  }
+
+  if ((bytes = writev(fd, iov, iovcnt)) > 0)
+  {
+    buf->start = (buf->start + (size_t)bytes) % buf->size;
+    buf->used  -= (size_t)bytes;
+
+    if (buf->used == 0)
+      buf->start = 0;
+
+    if (DebugIO)
+      fprintf(stderr, "DEBUG: Wrote %d bytes of print data.\n", (int)bytes);
+  }
+
+  return (bytes);
+}
+
+
+//
+// 'drain_output()' - Drain pending print data to the device.
+//
+
+static int				// O - 0 on success, -1 on error
+drain_output(int            print_fd,	// I - Print file descriptor
+             int            device_fd,	// I - Device file descriptor
+	     print_buffer_t *buf)	// I - Print buffer
+{
+  struct pollfd	pfd;			// Print file to poll
+  ssize_t	print_bytes;		// Print bytes read
 
-  nfds = (print_fd > device_fd ? print_fd : device_fd) + 1;
 
   //
-  // Now loop until we are out of data from print_fd...
+  // Now loop until the buffer is empty and we are out of data from
+  // print_fd...
   //
 
   for (;;)
   {
     //
-    // Use select() to determine whether we have data to copy around...
+    // Send what we have in the buffer...
     //
 
-    FD_ZERO(&input);
-    FD_SET(print_fd, &input);
+    while (buf->used > 0)
+    {
+      if (buffer_write(buf, device_fd) < 0)
+      {
+	//
+        // Write error - bail if we don't see an error we can retry...
+	//
+
+        if (errno != ENOSPC && errno != ENXIO && errno != EAGAIN &&
+	    errno != EINTR && errno != ENOTTY)
+	{
+	  perror("ERROR: Unable to write print data");
+	  return (-1);
+	}
+      }
+    }
+
+    //
+    // Use poll() to determine whether we have more data...
+    //
 
-    timeout.tv_sec  = 0;
-    timeout.tv_usec = 0;
+    pfd.fd     = print_fd;
+    pfd.events = POLLIN;
 
-    if (select(nfds, &input, NULL, NULL, &timeout) < 0)
+    if (poll(&pfd, 1, 0) < 0)
       return (-1);
 
-    if (!FD_ISSET(print_fd, &input))
+    if (!(pfd.revents & (POLLIN | POLLHUP)))
       return (0);
 
-    if ((print_bytes = read(print_fd, print_buffer,
-			    sizeof(print_buffer))) < 0)
+    if ((print_bytes = buffer_read(buf, print_fd)) < 0)
     {
       //
       // Read error - bail if we don't see EAGAIN or EINTR...
@@ -331,8 +548,6 @@ drain_output(int print_fd,		// I - Print file descriptor
         perror("ERROR: Unable to read print data");
 	return (-1);
       }
-
-      print_bytes = 0;
     }
     else if (print_bytes == 0)
     {
@@ -342,33 +557,6 @@ drain_output(int print_fd,		// I - Print file descriptor
 
       return (0);
     }
-
-    fprintf(stderr, "DEBUG: Read %d bytes of print data.\n",
-	    (int)print_bytes);
-
-    for (print_ptr = print_buffer; print_bytes > 0;)
-    {
-      if ((bytes = write(device_fd, print_ptr, print_bytes)) < 0)
-      {
-	//
-        // Write error - bail if we don't see an error we can retry...
-	//
-
-        if (errno != ENOSPC && errno != ENXIO && errno != EAGAIN &&
-	    errno != EINTR && errno != ENOTTY)
-	{
-	  perror("ERROR: Unable to write print data");
-	  return (-1);
-	}
-      }
-      else
-      {
-        fprintf(stderr, "DEBUG: Wrote %d bytes of print data.\n", (int)bytes);
-
-        print_bytes -= bytes;
-	print_ptr   += bytes;
-      }
-    }
   }
 }
 
@@ -536,26 +724,32 @@ list_devices(void)
 //
 // 'run_loop()' - Read and write print and back-channel data.
 //
+// Print data is copied through the ring buffer "buf": poll() tells us
+// whether there is room for more data from print_fd and whether the device
+// can take data, so that we read and write as large blocks as possible and
+// service the side and back channels in between.
+//
 
 static ssize_t				// O - Total bytes on success, -1 on error
-run_loop(int print_fd,			// I - Print file descriptor
-	int device_fd,			// I - Device file descriptor
-	int use_bc,			// I - Use back-channel?
-	int update_state)		// I - Update printer-state-reasons?
+run_loop(int            print_fd,	// I - Print file descriptor
+	 int            device_fd,	// I - Device file descriptor
+	 int            use_bc,		// I - Use back-channel?
+	 int            update_state,	// I - Update printer-state-reasons?
+	 print_buffer_t *buf)		// I - Print buffer
 {
-  int		nfds;			// Maximum file descriptor value + 1
-  fd_set	input,			// Input set for reading
-		output;			// Output set for writing
+  struct pollfd	pfds[3];		// Files to poll
+  int		nfds;			// Number of files to poll
+  struct pollfd	*print_pfd,		// Print file in pfds
+		*device_pfd,		// Device in pfds
+		*sc_pfd;		// Side channel in pfds
   ssize_t	print_bytes,		// Print bytes read
 		bc_bytes,		// Backchannel bytes read
 		total_bytes,		// Total bytes written
 		bytes;			// Bytes written
+  int		print_eof;		// Reached end of print data?
   int		paperout;		// "Paper out" status
   int		offline;		// "Off-line" status
-  char		print_buffer[8192],	// Print data buffer
-		*print_ptr,		// Pointer into print data buffer
-		bc_buffer[1024];	// Back-channel data buffer
-  struct timeval timeout;		// Timeout for select()
+  char		bc_buffer[1024];	// Back-channel data buffer
   int           sc_ok;                  // Flag a side channel error and
 					// stop using the side channel
 					// in such a case.
@@ -594,13 +788,6 @@ run_loop(int print_fd,			// I - Print file descriptor
     print_fd = 0;
   }
 
-  //
-  // Figure out the maximum file descriptor value to use with select()...
-  //
-
-  nfds = (print_fd > device_fd ? print_fd : device_fd) + 1;
-
-
   //
   // Side channel is OK...
   //
@@ -608,32 +795,45 @@ run_loop(int print_fd,			// I - Print file descriptor
   sc_ok = 1;
 
   //
-  // Now loop until we are out of data from print_fd...
+  // Now loop until we are out of data from print_fd and the buffer is
+  // empty...
   //
 
-  for (print_bytes = 0, print_ptr = print_buffer, offline = -1,
-	 paperout = -1, total_bytes = 0;;)
+  for (print_eof = 0, offline = -1, paperout = -1, total_bytes = 0;
+       !print_eof || buf->used > 0;)
   {
     //
-    // Use select() to determine whether we have data to copy around...
+    // Use poll() to determine whether we have data to copy around...
     //
 
-    FD_ZERO(&input);
-    if (!print_bytes)
-      FD_SET(print_fd, &input);
-    if (use_bc)
-      FD_SET(device_fd, &input);
-    if (!print_bytes && sc_ok)
-      FD_SET(CUPS_SC_FD, &input);
+    nfds       = 0;
+    print_pfd  = NULL;
+    device_pfd = NULL;
+    sc_pfd     = NULL;
+
+    if (!print_eof && buf->used < buf->size)
+    {
+      print_pfd         = pfds + nfds ++;
+      print_pfd->fd     = print_fd;
+      print_pfd->events = POLLIN;
+    }
 
-    FD_ZERO(&output);
-    if (print_bytes)
-      FD_SET(device_fd, &output);
+    if (use_bc || buf->used > 0)
+    {
+      device_pfd         = pfds + nfds ++;
+      device_pfd->fd     = device_fd;
+      device_pfd->events = (use_bc ? POLLIN : 0) |
+			   (buf->used > 0 ? POLLOUT : 0);
+    }
 
-    timeout.tv_sec  = 5;
-    timeout.tv_usec = 0;
+    if (sc_ok)
+    {
+      sc_pfd         = pfds + nfds ++;
+      sc_pfd->fd     = CUPS_SC_FD;
+      sc_pfd->events = POLLIN;
+    }
 
-    if (select(nfds, &input, &output, NULL, &timeout) < 0)
+    if (poll(pfds, (nfds_t)nfds, 5000) < 0)
     {
       //
       // Pause printing to clear any pending errors...
@@ -659,10 +859,12 @@ run_loop(int print_fd,			// I - Print file descriptor
     // Check if we have a side-channel request ready...
     //
 
-    if (sc_ok && FD_ISSET(CUPS_SC_FD, &input))
+    if (sc_pfd && (sc_pfd->revents & POLLNVAL))
+      sc_ok = 0;
+    else if (sc_pfd && (sc_pfd->revents & (POLLIN | POLLHUP | POLLERR)))
     {
       //
-      // Do the side-channel request, then start back over in the select
+      // Do the side-channel request, then start back over in the poll
       // loop since it may have read from print_fd...
       //
       // If the side channel processing errors, go straight on to avoid
@@ -670,7 +872,7 @@ run_loop(int print_fd,			// I - Print file descriptor
       // channel.
       //
 
-      if (side_cb(print_fd, device_fd, use_bc))
+      if (side_cb(print_fd, device_fd, use_bc, buf))
 	sc_ok = 0;
       continue;
     }
@@ -679,7 +881,7 @@ run_loop(int print_fd,			// I - Print file descriptor
     // Check if we have back-channel data ready...
     //
 
-    if (FD_ISSET(device_fd, &input))
+    if (device_pfd && use_bc && (device_pfd->revents & (POLLIN | POLLHUP)))
     {
       if ((bc_bytes = read(device_fd, bc_buffer, sizeof(bc_buffer))) > 0)
       {
@@ -700,10 +902,9 @@ run_loop(int print_fd,			// I - Print file descriptor
     // Check if we have print data ready...
     //
 
-    if (FD_ISSET(print_fd, &input))
+    if (print_pfd && (print_pfd->revents & (POLLIN | POLLHUP | POLLERR)))
     {
-      if ((print_bytes = read(print_fd, print_buffer,
-                              sizeof(print_buffer))) < 0)
+      if ((print_bytes = buffer_read(buf, print_fd)) < 0)
       {
 	//
         // Read error - bail if we don't see EAGAIN or EINTR...
@@ -714,22 +915,15 @@ run_loop(int print_fd,			// I - Print file descriptor
 	  perror("ERROR: Unable to read print data");
 	  return (-1);
 	}
-
-        print_bytes = 0;
       }
       else if (print_bytes == 0)
       {
 	//
-        // End of file, break out of the loop...
+        // End of file, send out what is left in the buffer...
 	//
 
-        break;
+        print_eof = 1;
       }
-
-      print_ptr = print_buffer;
-
-      fprintf(stderr, "DEBUG: Read %d bytes of print data.\n",
-              (int)print_bytes);
     }
 
     //
@@ -737,9 +931,10 @@ run_loop(int print_fd,			// I - Print file descriptor
     // send...
     //
 
-    if (print_bytes && FD_ISSET(device_fd, &output))
+    if (buf->used > 0 && device_pfd &&
+	(device_pfd->revents & (POLLOUT | POLLERR)))
     {
-      if ((bytes = write(device_fd, print_ptr, print_bytes)) < 0)
+      if ((bytes = buffer_write(buf, device_fd)) < 0)
       {
 	//
         // Write error - bail if we don't see an error we can retry...
@@ -781,10 +976,6 @@ run_loop(int print_fd,			// I - Print file descriptor
 	  offline = 0;
 	}
 
-        fprintf(stderr, "DEBUG: Wrote %d bytes of print data...\n", (int)bytes);
-
-        print_bytes -= bytes;
-	print_ptr   += bytes;
 	total_bytes += bytes;
       }
     }
@@ -803,9 +994,10 @@ run_loop(int print_fd,			// I - Print file descriptor
 //
 
 static int				// O - 0 on success, -1 on error
-side_cb(int         print_fd,		// I - Print file
-        int         device_fd,		// I - Device file
-	int         use_bc)		// I - Using back-channel?
+side_cb(int            print_fd,	// I - Print file
+        int            device_fd,	// I - Device file
+	int            use_bc,		// I - Using back-channel?
+	print_buffer_t *buf)		// I - Print buffer
 {
   cups_sc_command_t	command;	// Request command
   cups_sc_status_t	status;		// Request/response status
@@ -821,7 +1013,7 @@ side_cb(int         print_fd,		// I - Print file
   switch (command)
   {
     case CUPS_SC_CMD_DRAIN_OUTPUT :
-        if (drain_output(print_fd, device_fd))
+        if (drain_output(print_fd, device_fd, buf))
 	  status = CUPS_SC_STATUS_IO_ERROR;
 	else if (tcdrain(device_fd))
 	  status = CUPS_SC_STATUS_IO_ERROR;
@@ -9,9 +9,13 @@
 //
 // Contents:
 //
-//   main()         - Send a file to the printer or server.
-//   list_devices() - List all serial devices.
-//   side_cb()      - Handle side-channel requests...
+//   main()                - Send a file to the printer or server.
+//   adaptive_write_size() - Get the number of bytes to write when pacing
+//                           writes by the output queue fill level.
+//   drain_output()        - Drain pending print data to the device.
+//   dsr_ready()           - Check whether the device sets DSR.
+//   list_devices()        - List all serial devices.
+//   side_cb()             - Handle side-channel requests...
 //
 
 //
@@ -59,9 +63,14 @@
 // Local functions...
 //
 
-static int	drain_output(int print_fd, int device_fd);
+static ssize_t	adaptive_write_size(int device_fd, int baud, ssize_t wanted,
+				    long *delay);
+static int	drain_output(int print_fd, int device_fd, const char *pending,
+			     ssize_t pending_bytes);
+static int	dsr_ready(int device_fd, int *dsr_low);
 static void	list_devices(void);
-static int	side_cb(int print_fd, int device_fd, int use_bc);
+static int	side_cb(int print_fd, int device_fd, int use_bc,
+			const char *pending, ssize_t *pending_bytes);
 
 
 //
@@ -92,11 +101,19 @@ main(int  argc,				// I - Number of command-line arguments (6 or 7)
   int		nfds;			// Maximum file descriptor value + 1
   fd_set	input,			// Input set for reading
 		output;			// Output set for writing
+  struct timeval timeout;		// Timeout for select()
+  long		delay;			// Time to wait before writing (usecs)
   ssize_t	print_bytes,		// Print bytes read
 		bc_bytes,		// Backchannel bytes read
 		total_bytes,		// Total bytes written
+		write_bytes = 0,	// Bytes to write
 		bytes;			// Bytes written
   int		dtrdsr;			// Do dtr/dsr flow control?
+  int		dsr_low = 0;		// Waiting for DSR?
+  int		adaptive;		// Pace writes by output queue level?
+  int		paced_writes = 0;	// Paced writes since last message
+  ssize_t	paced_bytes = 0;	// Paced bytes since last message
+  int		baud;			// Baud rate
   int		print_size;		// Size of output buffer for writes
   char		print_buffer[8192],	// Print data buffer
 		*print_ptr,		// Pointer into print data buffer
@@ -254,6 +271,8 @@ main(int  argc,				// I - Number of command-line arguments (6 or 7)
 
   print_size = 96;			// 9600 baud / 10 bits/char / 10Hz
   dtrdsr     = 0;			// No dtr/dsr flow control
+  adaptive   = 0;			// Drain after every write
+  baud       = 9600;
 
   if (options)
   {
@@ -298,7 +317,8 @@ main(int  argc,				// I - Number of command-line arguments (6 or 7)
         // Set the baud rate...
 	//
 
-        print_size = atoi(value) / 100;
+        baud       = atoi(value);
+        print_size = baud / 100;
 
 #if B19200 == 19200
         cfsetispeed(&opts, atoi(value));
@@ -459,6 +479,19 @@ main(int  argc,				// I - Number of command-line arguments (6 or 7)
 	      break;
 	}
       }
+      else if (!strcasecmp(name, "pacing"))
+      {
+	//
+	// Set write pacing: "drain" waits for every write to be transmitted
+	// before reading more data, "adaptive" keeps the output queue of the
+	// port filled and only drains at the end of the job or on request...
+	//
+
+	if (!strcasecmp(value, "adaptive"))
+	  adaptive = 1;
+	else if (!strcasecmp(value, "drain"))
+	  adaptive = 0;
+      }
     }
   }
 
@@ -500,7 +533,7 @@ main(int  argc,				// I - Number of command-line arguments (6 or 7)
   // of the code here instead...
   //
 
-  if (print_size > sizeof(print_buffer))
+  if (print_size > sizeof(print_buffer) || adaptive)
     print_size = sizeof(print_buffer);
 
   total_bytes = 0;
@@ -521,6 +554,26 @@ main(int  argc,				// I - Number of command-line arguments (6 or 7)
 
     for (print_bytes = 0, print_ptr = print_buffer;;)
     {
+      //
+      // See whether the device can take data now.  If it cannot, because
+      // DSR is low or the output queue is still full, wait in select()
+      // for the given time, so that side-channel requests and back-channel
+      // data still get handled...
+      //
+
+      delay = 0;
+
+      if (print_bytes)
+      {
+	if (dtrdsr && !dsr_ready(device_fd, &dsr_low))
+	  delay = adaptive ? 10000 : 100000;
+	else if (adaptive)
+	  write_bytes = adaptive_write_size(device_fd, baud, print_bytes,
+					    &delay);
+	else
+	  write_bytes = print_bytes;
+      }
+
       //
       // Use select() to determine whether we have data to copy around...
       //
@@ -529,14 +582,17 @@ main(int  argc,				// I - Number of command-line arguments (6 or 7)
       if (!print_bytes)
 	FD_SET(print_fd, &input);
       FD_SET(device_fd, &input);
-      if (!print_bytes && !side_eof)
+      if ((!print_bytes || delay) && !side_eof)
         FD_SET(CUPS_SC_FD, &input);
 
       FD_ZERO(&output);
-      if (print_bytes)
+      if (print_bytes && !delay)
 	FD_SET(device_fd, &output);
 
-      if (select(nfds, &input, &output, NULL, NULL) < 0)
+      timeout.tv_sec  = delay / 1000000;
+      timeout.tv_usec = delay % 1000000;
+
+      if (select(nfds, &input, &output, NULL, delay ? &timeout : NULL) < 0)
 	continue;			// Ignore errors here
 
       //
@@ -547,10 +603,11 @@ main(int  argc,				// I - Number of command-line arguments (6 or 7)
       {
 	//
 	// Do the side-channel request, then start back over in the select
-	// loop since it may have read from print_fd...
+	// loop since it may have read from print_fd and sent the print data
+	// we still have...
 	//
 
-        if (side_cb(print_fd, device_fd, 1))
+        if (side_cb(print_fd, device_fd, 1, print_ptr, &print_bytes))
 	  side_eof = 1;
 	continue;
       }
@@ -600,9 +657,13 @@ main(int  argc,				// I - Number of command-line arguments (6 or 7)
 	else if (print_bytes == 0)
 	{
 	  //
-          // End of file, break out of the loop...
+          // End of file, wait until everything is sent and break out of
+	  // the loop...
 	  //
 
+	  if (adaptive)
+	    tcdrain(device_fd);
+
           break;
 	}
 
@@ -616,53 +677,21 @@ main(int  argc,				// I - Number of command-line arguments (6 or 7)
 
       if (print_bytes && FD_ISSET(device_fd, &output))
       {
-	if (dtrdsr)
+	if (!adaptive)
 	{
 	  //
-	  // Check the port and sleep until DSR is set...
+	  // On every transmit need to wait a little
+	  // even though the DSR is OK for some unknown reasons.
 	  //
 
-	  int status;
-
-
-	  if (!ioctl(device_fd, TIOCMGET, &status))
-            if (!(status & TIOCM_DSR))
-	    {
-	      //
-	      // Wait for DSR to go high...
-	      //
-
-	      fputs("DEBUG: DSR is low; waiting for device.\n", stderr);
-
-              do
-	      {
-		//
-	        // Poll every 100ms...
-		//
-
-		usleep(100000);
-
-		if (ioctl(device_fd, TIOCMGET, &status))
-		  break;
-	      }
-	      while (!(status & TIOCM_DSR));
-
-	      fputs("DEBUG: DSR is high; writing to device.\n", stderr);
-            }
-	}
-
-	//
-	// On every transmit need to wait a little
-	// even though the DSR is OK for some unknown reasons.
-	//
-
-	if (print_sleep == 0)
-	{
+	  if (print_sleep == 0)
+	  {
 		usleep(10000);
 		print_sleep = 1;
+	  }
 	}
 
-	if ((bytes = write(device_fd, print_ptr, print_bytes)) < 0)
+	if ((bytes = write(device_fd, print_ptr, write_bytes)) < 0)
 	{
 	  //
           // Write error - bail if we don't see an error we can retry...
@@ -684,12 +713,32 @@ main(int  argc,				// I - Number of command-line arguments (6 or 7)
 	}
 	else
 	{
-          tcdrain(device_fd);
-          fprintf(stderr, "DEBUG: Wrote %d bytes.\n", (int)bytes);
-
           print_bytes -= bytes;
 	  print_ptr   += bytes;
 	  total_bytes += bytes;
+
+	  if (adaptive)
+	  {
+	    //
+	    // Paced writes are small, so only log once the buffer is sent...
+	    //
+
+	    paced_bytes += bytes;
+	    paced_writes ++;
+
+	    if (!print_bytes)
+	    {
+	      fprintf(stderr, "DEBUG: Wrote %d bytes in %d writes.\n",
+		      (int)paced_bytes, paced_writes);
+	      paced_bytes  = 0;
+	      paced_writes = 0;
+	    }
+	  }
+	  else
+	  {
+            tcdrain(device_fd);
+            fprintf(stderr, "DEBUG: Wrote %d bytes.\n", (int)bytes);
+	  }
 	}
       }
     }
@@ -710,13 +759,65 @@ main(int  argc,				// I - Number of command-line arguments (6 or 7)
 }
 
 
+//
+// 'adaptive_write_size()' - Get the number of bytes to write when pacing
+//                           writes by the output queue fill level.
+//
+// The output queue of the port is kept filled with about a quarter of a
+// second of data at the current baud rate.  If more than half of that is
+// still queued, nothing gets written and "delay" is set to the time until
+// only half of it is left, so that the device never starves but we also
+// do not need to drain after every write.
+//
+
+static ssize_t				// O - Number of bytes to write, 0 to
+					//     wait
+adaptive_write_size(int     device_fd,	// I - Device file
+		    int     baud,	// I - Baud rate
+		    ssize_t wanted,	// I - Number of bytes pending
+		    long    *delay)	// O - Time to wait (usecs)
+{
+  int		bps,			// Bytes per second
+		target,			// Target fill level of output queue
+		queued = 0;		// Bytes in output queue
+
+
+  if ((bps = baud / 10) < 10)		// 10 bits/char
+    bps = 10;
+
+  if ((target = bps / 4) < 64)
+    target = 64;
+
+  *delay = 0;
+
+#ifdef TIOCOUTQ
+  if (ioctl(device_fd, TIOCOUTQ, &queued))
+    queued = 0;
+  else if (queued > target / 2)
+  {
+    if ((*delay = (long)((long long)(queued - target / 2) * 1000000 /
+			 bps)) < 1000)
+      *delay = 1000;
+    return (0);
+  }
+#endif // TIOCOUTQ
+
+  if (wanted > target - queued)
+    return (target - queued);
+  else
+    return (wanted);
+}
+
+
 //
 // 'drain_output()' - Drain pending print data to the device.
 //
 
 static int				// O - 0 on success, -1 on error
-drain_output(int print_fd,		// I - Print file descriptor
-             int device_fd)		// I - Device file descriptor
+drain_output(int        print_fd,	// I - Print file descriptor
+             int        device_fd,	// I - Device file descriptor
+	     const char *pending,	// I - Print data read but not sent
+	     ssize_t    pending_bytes)	// I - Number of bytes pending
 {
   int		nfds;			// Maximum file descriptor value + 1
   fd_set	input;			// Input set for reading
@@ -727,6 +828,28 @@ drain_output(int print_fd,		// I - Print file descriptor
   struct timeval timeout;		// Timeout for read...
 
 
+ //
+ // Send the data the main loop still has first...
+ //
+
+  while (pending_bytes > 0)
+  {
+    if ((bytes = write(device_fd, pending, pending_bytes)) < 0)
+    {
+      if (errno != ENOSPC && errno != ENXIO && errno != EAGAIN &&
+	  errno != EINTR && errno != ENOTTY)
+      {
+	perror("ERROR: Unable to write print data");
+	return (-1);
+      }
+    }
+    else
+    {
+      pending       += bytes;
+      pending_bytes -= bytes;
+    }
+  }
+
  //
  // Figure out the maximum file descriptor value to use with select()...
  //
@@ -809,6 +932,41 @@ drain_output(int print_fd,		// I - Print file descriptor
 }
 
 
+//
+// 'dsr_ready()' - Check whether the device sets DSR.
+//
+// Only tells the state of the line, the caller polls it from its select()
+// loop, so that waiting for the device does not block the side channel.
+//
+
+static int				// O - 1 if DSR is high, 0 if low
+dsr_ready(int device_fd,		// I - Device file
+	  int *dsr_low)			// IO - DSR was low last time?
+{
+  int status;				// Modem line status
+
+
+  if (ioctl(device_fd, TIOCMGET, &status) || (status & TIOCM_DSR))
+  {
+    if (*dsr_low)
+    {
+      fputs("DEBUG: DSR is high; writing to device.\n", stderr);
+      *dsr_low = 0;
+    }
+
+    return (1);
+  }
+
+  if (!*dsr_low)
+  {
+    fputs("DEBUG: DSR is low; waiting for device.\n", stderr);
+    *dsr_low = 1;
+  }
+
+  return (0);
+}
+
+
 //
 // 'list_devices()' - List all serial devices.
 //
@@ -1200,9 +1358,11 @@ list_devices(void)
 //
 
 static int				// O - 0 on success, -1 on error
-side_cb(int print_fd,			// I - Print file
-        int device_fd,			// I - Device file
-	int use_bc)			// I - Using back-channel?
+side_cb(int        print_fd,		// I - Print file
+        int        device_fd,		// I - Device file
+	int        use_bc,		// I - Using back-channel?
+	const char *pending,		// I - Print data read but not sent
+	ssize_t    *pending_bytes)	// IO - Number of bytes pending
 {
   cups_sc_command_t	command;	// Request command
   cups_sc_status_t	status;		// Request/response status
@@ -1218,14 +1378,15 @@ side_cb(int print_fd,			// I - Print file
   switch (command)
   {
     case CUPS_SC_CMD_DRAIN_OUTPUT :
-        if (drain_output(print_fd, device_fd))
+        if (drain_output(print_fd, device_fd, pending, *pending_bytes))
 	  status = CUPS_SC_STATUS_IO_ERROR;
 	else if (tcdrain(device_fd))
 	  status = CUPS_SC_STATUS_IO_ERROR;
 	else
 	  status = CUPS_SC_STATUS_OK;
 
-	datalen = 0;
+	*pending_bytes = 0;
+	datalen        = 0;
         break;
 
     case CUPS_SC_CMD_GET_BIDI :
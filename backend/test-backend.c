@@ -0,0 +1,487 @@
+//
+// Loopback test and throughput benchmark for the serial and parallel
+// backends of cups-filters.
+//
+// The backend is run on a synthetic print file against a stand-in device:
+// a pseudo-terminal for the serial backend and a FIFO for the parallel
+// backend.  The bytes arriving at the device are checked against the
+// print file and the throughput is reported as one line of CSV.
+//
+// Copyright © 2024 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Contents:
+//
+//   main()          - Run a backend against a stand-in device.
+//   drain_request() - Send a side-channel drain request, report latency.
+//   pattern_byte()  - Get a byte of the synthetic print data.
+//   now()           - Get the current time in seconds.
+//   usage()         - Show program usage.
+//
+
+//
+// Include necessary headers.
+//
+
+#include <config.h>
+#include <cups/cups.h>
+#include <cups/sidechannel.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+
+//
+// Local functions...
+//
+
+static pid_t	drain_request(int *latency_fd);
+static double	now(void);
+static unsigned char pattern_byte(long pos);
+static void	usage(void);
+
+
+//
+// 'main()' - Run a backend against a stand-in device.
+//
+// Usage:
+//
+//    test-backend [options] /path/to/serial|/path/to/parallel
+//
+// Exit status is 0 if all data arrived unchanged, 1 on a mismatch or
+// backend failure, and 77 (skip) if no stand-in device could be created.
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line arguments
+     char *argv[])			// I - Command-line arguments
+{
+  int		i;			// Looping var
+  const char	*backend = NULL,	// Backend executable
+		*name,			// Base name of backend
+		*baud = "115200",	// Baud rate
+		*flow = "none",		// Flow control
+		*pacing = "drain",	// Serial write pacing
+		*buffer = NULL;		// Parallel print buffer size
+  long		size = 1048576;		// Size of print file
+  int		copies = 1,		// Number of copies
+		drain = 0,		// Send a drain request?
+		verbose = 0;		// Show backend messages?
+  int		is_serial;		// Testing the serial backend?
+  char		tempdir[1024],		// Temporary directory
+		filename[1024],		// Print file
+		fifoname[1024],		// FIFO for parallel backend
+		uri[1024],		// Device URI
+		copies_str[16],		// Number of copies as string
+		buf[65536];		// Device data buffer
+  const char	*devname;		// Stand-in device
+  int		fd,			// Print file
+		devfd,			// Device data (read end)
+		holdfd,			// Keeps the device open
+		sv[2],			// Side channel socket pair
+		latency_fd = -1;	// Pipe with drain latency
+  pid_t		pid,			// Backend process
+		drain_pid = 0;		// Drain request process
+  int		status = 0,		// Backend exit status
+		exited = 0;		// Backend exited?
+  long		pos,			// Position in print data
+		received = 0,		// Bytes received
+		errors = 0,		// Mismatching bytes
+		expected;		// Bytes expected
+  ssize_t	bytes;			// Bytes read
+  struct pollfd	pfd;			// Device to poll
+  double	start,			// Start time
+		first = 0.0,		// Time of first byte
+		last = 0.0,		// Time of last byte
+		elapsed,		// Transfer time
+		latency = -1.0;		// Drain request latency
+
+
+  //
+  // Parse command-line...
+  //
+
+  for (i = 1; i < argc; i ++)
+  {
+    if (!strcmp(argv[i], "-b") && i + 1 < argc)
+      baud = argv[++ i];
+    else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+      flow = argv[++ i];
+    else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+      pacing = argv[++ i];
+    else if (!strcmp(argv[i], "-B") && i + 1 < argc)
+      buffer = argv[++ i];
+    else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+      size = atol(argv[++ i]);
+    else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+      copies = atoi(argv[++ i]);
+    else if (!strcmp(argv[i], "-d"))
+      drain = 1;
+    else if (!strcmp(argv[i], "-v"))
+      verbose = 1;
+    else if (argv[i][0] != '-' && !backend)
+      backend = argv[i];
+    else
+      usage();
+  }
+
+  if (!backend || size <= 0 || copies < 1)
+    usage();
+
+  if ((name = strrchr(backend, '/')) != NULL)
+    name ++;
+  else
+    name = backend;
+
+  is_serial = strstr(name, "serial") != NULL;
+  expected  = size * copies;
+
+  //
+  // Create the print file...
+  //
+
+  snprintf(tempdir, sizeof(tempdir), "%s/test-backend-XXXXXX",
+	   getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+  if (!mkdtemp(tempdir))
+  {
+    perror("test-backend: Unable to create temporary directory");
+    return (77);
+  }
+
+  snprintf(filename, sizeof(filename), "%s/print.dat", tempdir);
+  if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+  {
+    perror("test-backend: Unable to create print file");
+    rmdir(tempdir);
+    return (77);
+  }
+
+  for (pos = 0; pos < size; pos += bytes)
+  {
+    for (bytes = 0; bytes < sizeof(buf) && pos + bytes < size; bytes ++)
+      buf[bytes] = pattern_byte(pos + bytes);
+
+    if (write(fd, buf, (size_t)bytes) != bytes)
+    {
+      perror("test-backend: Unable to write print file");
+      close(fd);
+      unlink(filename);
+      rmdir(tempdir);
+      return (77);
+    }
+  }
+
+  close(fd);
+
+  //
+  // Create the stand-in device: A pseudo-terminal for the serial backend,
+  // a FIFO for the parallel backend.  We keep the device open ourselves,
+  // so that the backend closing it does not end the data stream before
+  // we have read everything...
+  //
+
+  fifoname[0] = '\0';
+
+  if (is_serial)
+  {
+    if ((devfd = posix_openpt(O_RDWR | O_NOCTTY)) < 0 ||
+	grantpt(devfd) || unlockpt(devfd) ||
+	(devname = ptsname(devfd)) == NULL ||
+	(holdfd = open(devname, O_RDWR | O_NOCTTY)) < 0)
+    {
+      perror("test-backend: Unable to create pseudo-terminal");
+      unlink(filename);
+      rmdir(tempdir);
+      return (77);
+    }
+
+    snprintf(uri, sizeof(uri), "serial:%s?baud=%s+flow=%s+pacing=%s",
+	     devname, baud, flow, pacing);
+  }
+  else
+  {
+    snprintf(fifoname, sizeof(fifoname), "%s/lp0", tempdir);
+    if (mkfifo(fifoname, 0600) ||
+	(devfd = open(fifoname, O_RDONLY | O_NONBLOCK)) < 0 ||
+	(holdfd = open(fifoname, O_WRONLY)) < 0)
+    {
+      perror("test-backend: Unable to create FIFO");
+      unlink(fifoname);
+      unlink(filename);
+      rmdir(tempdir);
+      return (77);
+    }
+
+    devname = fifoname;
+
+    if (buffer)
+      snprintf(uri, sizeof(uri), "parallel:%s?buffer=%s", devname, buffer);
+    else
+      snprintf(uri, sizeof(uri), "parallel:%s", devname);
+  }
+
+  fcntl(devfd, F_SETFL, fcntl(devfd, F_GETFL) | O_NONBLOCK);
+
+  //
+  // Set up the side channel, the backend and we both use CUPS_SC_FD...
+  //
+
+  if (socketpair(AF_LOCAL, SOCK_STREAM, 0, sv))
+  {
+    perror("test-backend: Unable to create side channel");
+    return (77);
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  snprintf(copies_str, sizeof(copies_str), "%d", copies);
+
+  start = now();
+
+  if ((pid = fork()) == 0)
+  {
+    //
+    // Child comes here...
+    //
+
+    close(devfd);
+    close(holdfd);
+    close(sv[0]);
+    if (sv[1] != CUPS_SC_FD)
+    {
+      dup2(sv[1], CUPS_SC_FD);
+      close(sv[1]);
+    }
+
+    if (!verbose)
+    {
+      if ((fd = open("/dev/null", O_WRONLY)) >= 0)
+      {
+        dup2(fd, 2);
+	close(fd);
+      }
+    }
+
+    setenv("DEVICE_URI", uri, 1);
+
+    execl(backend, uri, "1", "test", "test-backend", copies_str, "",
+	  filename, (char *)NULL);
+    perror("test-backend: Unable to run backend");
+    _exit(1);
+  }
+  else if (pid < 0)
+  {
+    perror("test-backend: Unable to fork");
+    return (1);
+  }
+
+  close(sv[1]);
+  if (devfd == CUPS_SC_FD)
+    devfd = dup(devfd);
+  if (holdfd == CUPS_SC_FD)
+    holdfd = dup(holdfd);
+  if (sv[0] != CUPS_SC_FD)
+  {
+    dup2(sv[0], CUPS_SC_FD);
+    close(sv[0]);
+  }
+
+  //
+  // Read and check the data arriving at the device...
+  //
+
+  pfd.fd     = devfd;
+  pfd.events = POLLIN;
+
+  for (pos = 0;;)
+  {
+    if (!exited && waitpid(pid, &status, WNOHANG) == pid)
+      exited = 1;
+
+    if (poll(&pfd, 1, exited ? 100 : 1000) <= 0)
+    {
+      if (exited)
+        break;
+      continue;
+    }
+
+    if ((bytes = read(devfd, buf, sizeof(buf))) <= 0)
+    {
+      if (bytes < 0 && (errno == EAGAIN || errno == EINTR))
+        continue;
+      break;
+    }
+
+    if (!received)
+      first = now();
+    last = now();
+
+    for (i = 0; i < bytes; i ++, pos ++)
+      if ((unsigned char)buf[i] != pattern_byte(pos % size))
+        errors ++;
+
+    received += bytes;
+
+    if (drain && !drain_pid && received >= expected / 2)
+      drain_pid = drain_request(&latency_fd);
+  }
+
+  if (!exited)
+    waitpid(pid, &status, 0);
+
+  if (drain_pid > 0)
+  {
+    if (read(latency_fd, &latency, sizeof(latency)) != sizeof(latency))
+      latency = -1.0;
+    close(latency_fd);
+    waitpid(drain_pid, NULL, 0);
+  }
+
+  close(devfd);
+  close(holdfd);
+  if (fifoname[0])
+    unlink(fifoname);
+  unlink(filename);
+  rmdir(tempdir);
+
+  //
+  // Report results...
+  //
+
+  elapsed = (received ? last : now()) - start;
+
+  printf("%s,%s,%s,%s,%s,%ld,%ld,%ld,%.3f,%.3f,%.1f,%.3f,%d\n",
+         name, is_serial ? baud : "", is_serial ? flow : "",
+	 is_serial ? pacing : "", buffer && !is_serial ? buffer : "",
+	 expected, received, errors, received ? first - start : 0.0,
+	 elapsed, elapsed > 0.0 ? received / 1024.0 / elapsed : 0.0,
+	 latency, WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) || received != expected ||
+      errors)
+    return (1);
+
+  return (0);
+}
+
+
+//
+// 'drain_request()' - Send a side-channel drain request, report latency.
+//
+// The request is done by a child process, as the backend only answers it
+// once all data is written to the device, and so we have to go on reading
+// the device in the meantime.  The latency in seconds is sent back as a
+// double through a pipe.
+//
+
+static pid_t				// O - Process ID
+drain_request(int *latency_fd)		// O - Pipe to read latency from
+{
+  int		fds[2];			// Pipe
+  pid_t		pid;			// Process ID
+  double	start,			// Time of request
+		latency;		// Request latency
+  char		data[1];		// Response data
+  int		datalen;		// Response data length
+
+
+  if (pipe(fds))
+    return (-1);
+
+  if ((pid = fork()) == 0)
+  {
+    close(fds[0]);
+
+    start   = now();
+    datalen = 0;
+
+    if (cupsSideChannelDoRequest(CUPS_SC_CMD_DRAIN_OUTPUT, data, &datalen,
+				 60.0) == CUPS_SC_STATUS_OK)
+      latency = now() - start;
+    else
+      latency = -1.0;
+
+    if (write(fds[1], &latency, sizeof(latency)) != sizeof(latency))
+      _exit(1);
+
+    _exit(0);
+  }
+
+  close(fds[1]);
+
+  if (pid < 0)
+  {
+    close(fds[0]);
+    return (-1);
+  }
+
+  *latency_fd = fds[0];
+
+  return (pid);
+}
+
+
+//
+// 'now()' - Get the current time in seconds.
+//
+
+static double				// O - Time in seconds
+now(void)
+{
+  struct timespec ts;			// Current time
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (ts.tv_sec + ts.tv_nsec / 1000000000.0);
+}
+
+
+//
+// 'pattern_byte()' - Get a byte of the synthetic print data.
+//
+// The pattern does not repeat within 256 bytes and contains XON/XOFF and
+// all other control characters, so that any translation or loss of data
+// on the way to the device gets noticed.
+//
+
+static unsigned char			// O - Data byte
+pattern_byte(long pos)			// I - Position in print file
+{
+  return ((unsigned char)((pos * 7 + pos / 251) & 255));
+}
+
+
+//
+// 'usage()' - Show program usage.
+//
+
+static void
+usage(void)
+{
+  puts("Usage: test-backend [options] /path/to/serial|/path/to/parallel");
+  puts("Options:");
+  puts("  -b baud     Baud rate for the serial backend (default 115200)");
+  puts("  -f flow     Flow control: none, soft, rtscts, or dtrdsr");
+  puts("  -p pacing   Serial write pacing: drain or adaptive");
+  puts("  -B kbytes   Print buffer size for the parallel backend");
+  puts("  -s bytes    Size of the print file (default 1048576)");
+  puts("  -c copies   Number of copies");
+  puts("  -d          Send a side-channel drain request in mid-job");
+  puts("  -v          Show the messages of the backend");
+  puts("");
+  puts("Output (CSV): backend,baud,flow,pacing,buffer,expected,received,"
+       "errors,first-byte-sec,total-sec,KB/sec,drain-sec,exit-status");
+
+  exit(1);
+}
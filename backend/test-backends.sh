@@ -0,0 +1,55 @@
+#!/bin/sh
+#
+# Loopback tests for the serial and parallel backends: Runs test-backend
+# with a pseudo-terminal (serial) or a FIFO (parallel) as stand-in device
+# over several baud rates, flow control, pacing, and buffer settings, and
+# prints the throughput of each run as CSV.
+#
+# Copyright © 2024 by OpenPrinting.
+#
+# Licensed under Apache License v2.0.  See the file "LICENSE" for more
+# information.
+#
+# Usage: test-backends.sh [print-file-size]
+#
+
+size="${1:-262144}"
+builddir="${builddir:-.}"
+testbackend="$builddir/test-backend"
+status=0
+
+if test ! -x "$testbackend" -o ! -x "$builddir/serial" -o ! -x "$builddir/parallel"; then
+	echo "test-backend, serial, or parallel not built, skipping."
+	exit 77
+fi
+
+run()
+{
+	"$testbackend" -s "$size" "$@"
+	result=$?
+	if test $result = 77; then
+		echo "Unable to create stand-in device, skipping."
+		exit 77
+	elif test $result != 0; then
+		echo "FAILED: $*"
+		status=1
+	fi
+}
+
+echo "backend,baud,flow,pacing,buffer,expected,received,errors,first-byte-sec,total-sec,KB/sec,drain-sec,exit-status"
+
+for baud in 9600 115200; do
+	for flow in none soft rtscts dtrdsr; do
+		for pacing in drain adaptive; do
+			run -b $baud -f $flow -p $pacing "$builddir/serial"
+		done
+	done
+done
+run -p adaptive -d -c 2 "$builddir/serial"
+
+for buffer in 8 64 256 4096; do
+	run -B $buffer "$builddir/parallel"
+done
+run -d -c 2 "$builddir/parallel"
+
+exit $status
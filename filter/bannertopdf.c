@@ -13,6 +13,7 @@
 
 #include <cupsfilters/filter.h>
 #include <ppd/ppd-filter.h>
+#include "filter-trace.h"
 #include <config.h>
 #include <signal.h>
 
@@ -69,8 +70,8 @@ main(int  argc,	   // I - Number of command-line arguments
     datadir = CUPS_DATADIR;
   snprintf(buf, sizeof(buf), "%s/data", datadir);
 
-  ret = ppdFilterCUPSWrapper(argc, argv, cfFilterBannerToPDF, buf,
-			     &JobCanceled);
+  ret = trace_cups_wrapper(argc, argv, "bannertopdf", cfFilterBannerToPDF, buf,
+			   &JobCanceled);
 
   if (ret)
     fprintf(stderr, "ERROR: bannertopdf filter function failed.\n");
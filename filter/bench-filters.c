@@ -0,0 +1,1139 @@
+//
+// Helper for the end-to-end conversion benchmark of cups-filters
+// (bench-filters.sh).
+//
+// Usage:
+//
+//   bench-filters corpus <directory>
+//
+//     Creates the input files of the benchmark: text, a multi-page
+//     vector PDF, an image-heavy PDF, PNG, JPEG, TIFF, and PWG Raster.
+//     They are generated by this program, without any external tools or
+//     libraries, so that they are the same on every system and for every
+//     release to compare.
+//
+//   bench-filters run [-r <repeat>] -o <output-file> <command> [<args>]
+//
+//     Runs the command with its standard output going to the output file
+//     and prints a CSV fragment
+//     "<exit-status>,<wall-sec>,<user-sec>,<system-sec>,<peak-rss-kb>,
+//     <output-bytes>". With a repeat count the times are the medians of
+//     all runs and the peak RSS the maximum. The CPU times include all
+//     processes of the command (a shell running a filter pipeline waits
+//     for them), the peak RSS is the one of the largest process.
+//
+// Copyright © 2024 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+//
+// Include necessary headers...
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+
+//
+// Constants...
+//
+
+#define TEXT_LINES	3000		// Lines of text (about 50 pages)
+#define VECTOR_PAGES	20		// Pages of the vector PDF
+#define VECTOR_SHAPES	400		// Shapes per page of the vector PDF
+#define IMAGE_PAGES	4		// Pages of the image PDF
+#define IMAGE_WIDTH	1024		// Size of the images
+#define IMAGE_HEIGHT	768
+#define PWG_PAGES	3		// Pages of PWG Raster
+#define PWG_RES		300		// Resolution of PWG Raster
+#define PWG_WIDTH	2480		// A4 at 300 DPI
+#define PWG_HEIGHT	3508
+#define MAX_RUNS	100		// Maximum repeat count
+
+
+//
+// Types...
+//
+
+typedef struct bits_s			// Bit writer for JPEG entropy data
+{
+  FILE		*fp;			// Output file
+  unsigned	buffer;			// Pending bits
+  int		count;			// Number of pending bits
+} bits_t;
+
+
+//
+// Local globals...
+//
+
+static unsigned		Seed = 1;	// Pseudo-random number state
+
+// Standard DC Huffman table (ITU T.81 table K.3)
+static const unsigned char DCBits[16] =
+{ 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const unsigned short DCCodes[12] =
+{ 0x000, 0x002, 0x003, 0x004, 0x005, 0x006, 0x00e, 0x01e, 0x03e, 0x07e,
+  0x0fe, 0x1fe };
+static const unsigned char DCLengths[12] =
+{ 2, 3, 3, 3, 3, 3, 4, 5, 6, 7, 8, 9 };
+
+
+//
+// Local functions...
+//
+
+static int	corpus(const char *dir);
+static int	compare_doubles(const void *a, const void *b);
+static unsigned	crc32_update(unsigned crc, const unsigned char *data,
+			     size_t len);
+static double	get_time(void);
+static void	image_pixel(int x, int y, unsigned char rgb[3]);
+static unsigned	lcg(void);
+static FILE	*open_file(const char *dir, const char *name);
+static void	put_be16(FILE *fp, unsigned v);
+static void	put_be32(FILE *fp, unsigned v);
+static void	put_bits(bits_t *bits, unsigned code, int len);
+static void	put_le16(FILE *fp, unsigned v);
+static void	put_le32(FILE *fp, unsigned v);
+static int	run(int argc, char *argv[]);
+static int	usage(void);
+static int	write_image_pdf(const char *dir);
+static int	write_jpeg(const char *dir);
+static void	write_pdf_object(FILE *fp, long *offsets, int num,
+				 const char *format, ...)
+		__attribute__((format(printf, 4, 5)));
+static void	write_pdf_trailer(FILE *fp, long *offsets, int num_objs);
+static int	write_png(const char *dir);
+static void	write_png_chunk(FILE *fp, const char *type,
+				const unsigned char *data, size_t len);
+static int	write_pwg(const char *dir);
+static int	write_text(const char *dir);
+static int	write_tiff(const char *dir);
+static int	write_vector_pdf(const char *dir);
+
+
+//
+// 'main()' - Main entry.
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line args
+     char *argv[])			// I - Command-line arguments
+{
+  if (argc == 3 && !strcmp(argv[1], "corpus"))
+    return (corpus(argv[2]));
+  else if (argc > 2 && !strcmp(argv[1], "run"))
+    return (run(argc - 2, argv + 2));
+  else
+    return (usage());
+}
+
+
+//
+// 'compare_doubles()' - Compare two doubles for qsort().
+//
+
+static int				// O - Result of comparison
+compare_doubles(const void *a,		// I - First value
+		const void *b)		// I - Second value
+{
+  double	da = *(const double *)a,
+		db = *(const double *)b;
+
+  return (da < db ? -1 : da > db ? 1 : 0);
+}
+
+
+//
+// 'corpus()' - Create the input files.
+//
+
+static int				// O - Exit status
+corpus(const char *dir)			// I - Directory
+{
+  if (mkdir(dir, 0755) && errno != EEXIST)
+  {
+    fprintf(stderr, "bench-filters: Unable to create \"%s\": %s\n", dir,
+	    strerror(errno));
+    return (1);
+  }
+
+  if (write_text(dir) || write_vector_pdf(dir) || write_image_pdf(dir) ||
+      write_png(dir) || write_jpeg(dir) || write_tiff(dir) || write_pwg(dir))
+    return (1);
+
+  return (0);
+}
+
+
+//
+// 'crc32_update()' - Update a CRC-32 as used by PNG.
+//
+
+static unsigned				// O - New CRC
+crc32_update(unsigned            crc,	// I - CRC so far
+	     const unsigned char *data,	// I - Data
+	     size_t              len)	// I - Length of data
+{
+  int	i;
+
+
+  crc = ~crc;
+  while (len -- > 0)
+  {
+    crc ^= *data++;
+    for (i = 0; i < 8; i ++)
+      crc = (crc >> 1) ^ (0xedb88320U & (0U - (crc & 1)));
+  }
+
+  return (~crc);
+}
+
+
+//
+// 'get_time()' - Get the current time in seconds.
+//
+
+static double				// O - Time
+get_time(void)
+{
+  struct timespec	ts;		// Current time
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+
+//
+// 'image_pixel()' - Color of a pixel of the test images: gradients with
+//                   some noise, so that they neither compress to nothing
+//                   nor are plain noise.
+//
+
+static void
+image_pixel(int           x,		// I - Column
+	    int           y,		// I - Row
+	    unsigned char rgb[3])	// O - Color
+{
+  int	noise = (int)(lcg() & 15) - 8;	// Noise
+  int	r, g, b;
+
+
+  r = 255 * x / IMAGE_WIDTH + noise;
+  g = 255 * y / IMAGE_HEIGHT + noise;
+  b = ((x / 64 + y / 64) & 1) ? 200 + noise : 40 + noise;
+
+  rgb[0] = (unsigned char)(r < 0 ? 0 : r > 255 ? 255 : r);
+  rgb[1] = (unsigned char)(g < 0 ? 0 : g > 255 ? 255 : g);
+  rgb[2] = (unsigned char)(b < 0 ? 0 : b > 255 ? 255 : b);
+}
+
+
+//
+// 'lcg()' - Deterministic pseudo-random numbers.
+//
+
+static unsigned				// O - Number from 0 to 32767
+lcg(void)
+{
+  Seed = Seed * 1103515245U + 12345U;
+
+  return ((Seed >> 16) & 0x7fff);
+}
+
+
+//
+// 'open_file()' - Create a corpus file.
+//
+
+static FILE *				// O - File or NULL
+open_file(const char *dir,		// I - Directory
+	  const char *name)		// I - File name
+{
+  char	filename[1024];			// Full file name
+  FILE	*fp;				// File
+
+
+  snprintf(filename, sizeof(filename), "%s/%s", dir, name);
+  if ((fp = fopen(filename, "wb")) == NULL)
+    fprintf(stderr, "bench-filters: Unable to create \"%s\": %s\n", filename,
+	    strerror(errno));
+
+  // Same content for every file, independent of the order of creation
+  Seed = 1;
+
+  return (fp);
+}
+
+
+//
+// 'put_be16()' - Write a 16-bit big-endian number.
+//
+
+static void
+put_be16(FILE     *fp,			// I - File
+	 unsigned v)			// I - Value
+{
+  putc((int)(v >> 8) & 255, fp);
+  putc((int)v & 255, fp);
+}
+
+
+//
+// 'put_be32()' - Write a 32-bit big-endian number.
+//
+
+static void
+put_be32(FILE     *fp,			// I - File
+	 unsigned v)			// I - Value
+{
+  put_be16(fp, v >> 16);
+  put_be16(fp, v & 65535);
+}
+
+
+//
+// 'put_bits()' - Write bits of JPEG entropy coded data.
+//
+
+static void
+put_bits(bits_t   *bits,		// I - Bit writer
+	 unsigned code,			// I - Bits
+	 int      len)			// I - Number of bits
+{
+  int	byte;				// Byte to write
+
+
+  bits->buffer = (bits->buffer << len) | (code & ((1U << len) - 1));
+  bits->count  += len;
+
+  while (bits->count >= 8)
+  {
+    byte = (int)(bits->buffer >> (bits->count - 8)) & 255;
+    putc(byte, bits->fp);
+    if (byte == 255)
+      putc(0, bits->fp);		// Byte stuffing
+    bits->count -= 8;
+  }
+}
+
+
+//
+// 'put_le16()' - Write a 16-bit little-endian number.
+//
+
+static void
+put_le16(FILE     *fp,			// I - File
+	 unsigned v)			// I - Value
+{
+  putc((int)v & 255, fp);
+  putc((int)(v >> 8) & 255, fp);
+}
+
+
+//
+// 'put_le32()' - Write a 32-bit little-endian number.
+//
+
+static void
+put_le32(FILE     *fp,			// I - File
+	 unsigned v)			// I - Value
+{
+  put_le16(fp, v & 65535);
+  put_le16(fp, v >> 16);
+}
+
+
+//
+// 'run()' - Run and measure a command.
+//
+
+static int				// O - Exit status
+run(int  argc,				// I - Number of arguments
+    char *argv[])			// I - Arguments
+{
+  int		i,
+		repeat = 1,		// Number of runs
+		runs,			// Runs done
+		fd,			// Output file
+		status,			// Exit status of command
+		result = 0;		// Exit status to report
+  const char	*output = NULL;		// Output file name
+  double	start,			// Start time
+		wall[MAX_RUNS],		// Wall clock times
+		user[MAX_RUNS],		// User CPU times
+		sys[MAX_RUNS];		// System CPU times
+  long		maxrss = 0;		// Peak RSS
+  pid_t		pid;			// Process ID
+  struct rusage	ru;			// Resources used
+  struct stat	info;			// Output file information
+
+
+  for (i = 0; i < argc && argv[i][0] == '-'; i ++)
+  {
+    if (!strcmp(argv[i], "-r") && i + 1 < argc)
+    {
+      repeat = atoi(argv[++ i]);
+      if (repeat < 1 || repeat > MAX_RUNS)
+	return (usage());
+    }
+    else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+      output = argv[++ i];
+    else if (!strcmp(argv[i], "--"))
+    {
+      i ++;
+      break;
+    }
+    else
+      return (usage());
+  }
+
+  if (!output || i >= argc)
+    return (usage());
+
+  argv += i;
+
+  for (runs = 0; runs < repeat; runs ++)
+  {
+    if ((fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+      fprintf(stderr, "bench-filters: Unable to create \"%s\": %s\n", output,
+	      strerror(errno));
+      return (1);
+    }
+
+    start = get_time();
+
+    if ((pid = fork()) == 0)
+    {
+      dup2(fd, 1);
+      close(fd);
+      execvp(argv[0], argv);
+      fprintf(stderr, "bench-filters: Unable to run \"%s\": %s\n", argv[0],
+	      strerror(errno));
+      _exit(127);
+    }
+    else if (pid < 0)
+    {
+      fprintf(stderr, "bench-filters: Unable to fork: %s\n", strerror(errno));
+      return (1);
+    }
+
+    close(fd);
+
+    while (wait4(pid, &status, 0, &ru) < 0)
+      if (errno != EINTR)
+      {
+	fprintf(stderr, "bench-filters: Unable to wait: %s\n",
+		strerror(errno));
+	return (1);
+      }
+
+    wall[runs] = get_time() - start;
+    user[runs] = (double)ru.ru_utime.tv_sec +
+		 (double)ru.ru_utime.tv_usec / 1000000.0;
+    sys[runs]  = (double)ru.ru_stime.tv_sec +
+		 (double)ru.ru_stime.tv_usec / 1000000.0;
+    if (ru.ru_maxrss > maxrss)
+      maxrss = ru.ru_maxrss;
+
+    if (WIFEXITED(status) && WEXITSTATUS(status))
+      result = WEXITSTATUS(status);
+    else if (WIFSIGNALED(status))
+      result = 128 + WTERMSIG(status);
+  }
+
+  qsort(wall, (size_t)runs, sizeof(double), compare_doubles);
+  qsort(user, (size_t)runs, sizeof(double), compare_doubles);
+  qsort(sys, (size_t)runs, sizeof(double), compare_doubles);
+
+  if (stat(output, &info))
+    info.st_size = 0;
+
+  printf("%d,%.3f,%.3f,%.3f,%ld,%lld\n", result, wall[runs / 2],
+	 user[runs / 2], sys[runs / 2], maxrss, (long long)info.st_size);
+
+  return (0);
+}
+
+
+//
+// 'usage()' - Show program usage.
+//
+
+static int				// O - Exit status
+usage(void)
+{
+  puts("Usage: bench-filters corpus <directory>");
+  puts("       bench-filters run [-r <repeat>] -o <output-file> [--] "
+       "<command> [<args>]");
+
+  return (1);
+}
+
+
+//
+// 'write_image_pdf()' - Write a PDF with a full-page image per page.
+//
+
+static int				// O - 0 on success, 1 on error
+write_image_pdf(const char *dir)	// I - Directory
+{
+  FILE		*fp;			// PDF file
+  long		offsets[3 + 3 * IMAGE_PAGES];
+					// Object offsets
+  int		page,			// Current page
+		x, y,			// Pixel position
+		num_objs = 2 + 3 * IMAGE_PAGES;
+					// Number of objects
+  unsigned char	rgb[3];			// Pixel color
+  char		kids[16 * IMAGE_PAGES],	// Page objects
+		*kptr;			// Position in kids
+  static const char content[] = "q 576 0 0 432 18 180 cm /Im Do Q\n";
+
+
+  if ((fp = open_file(dir, "image.pdf")) == NULL)
+    return (1);
+
+  fputs("%PDF-1.4\n%\342\343\317\323\n", fp);
+
+  for (page = 0, kptr = kids; page < IMAGE_PAGES; page ++)
+  {
+    snprintf(kptr, sizeof(kids) - (size_t)(kptr - kids), "%d 0 R ",
+	     3 + 3 * page);
+    kptr += strlen(kptr);
+  }
+
+  write_pdf_object(fp, offsets, 1, "<< /Type /Catalog /Pages 2 0 R >>");
+  write_pdf_object(fp, offsets, 2,
+		   "<< /Type /Pages /Kids [%s] /Count %d >>", kids,
+		   IMAGE_PAGES);
+
+  for (page = 0; page < IMAGE_PAGES; page ++)
+  {
+    write_pdf_object(fp, offsets, 3 + 3 * page,
+		     "<< /Type /Page /Parent 2 0 R "
+		     "/MediaBox [0 0 612 792] /Contents %d 0 R "
+		     "/Resources << /XObject << /Im %d 0 R >> >> >>",
+		     4 + 3 * page, 5 + 3 * page);
+    write_pdf_object(fp, offsets, 4 + 3 * page,
+		     "<< /Length %d >>\nstream\n%sendstream",
+		     (int)strlen(content), content);
+
+    offsets[5 + 3 * page] = ftell(fp);
+    fprintf(fp, "%d 0 obj\n<< /Type /XObject /Subtype /Image /Width %d "
+	    "/Height %d /ColorSpace /DeviceRGB /BitsPerComponent 8 "
+	    "/Length %d >>\nstream\n", 5 + 3 * page, IMAGE_WIDTH,
+	    IMAGE_HEIGHT, IMAGE_WIDTH * IMAGE_HEIGHT * 3);
+    for (y = 0; y < IMAGE_HEIGHT; y ++)
+      for (x = 0; x < IMAGE_WIDTH; x ++)
+      {
+	image_pixel((x + page * 97) % IMAGE_WIDTH, y, rgb);
+	fwrite(rgb, 1, 3, fp);
+      }
+    fputs("\nendstream\nendobj\n", fp);
+  }
+
+  write_pdf_trailer(fp, offsets, num_objs);
+
+  return (fclose(fp) != 0);
+}
+
+
+//
+// 'write_jpeg()' - Write a baseline JPEG image.
+//
+// The image is a mosaic of 8x8 blocks of flat color, so only the DC
+// coefficients need to be coded and the encoder stays small.
+//
+
+static int				// O - 0 on success, 1 on error
+write_jpeg(const char *dir)		// I - Directory
+{
+  FILE		*fp;			// JPEG file
+  bits_t	bits;			// Bit writer
+  int		i, c,
+		bx, by,			// Block position
+		pred[3] = { 0, 0, 0 },	// DC predictors
+		dc,			// DC coefficient
+		diff,			// Difference to code
+		cat;			// Category of difference
+  unsigned char	rgb[3];			// Block color
+  double	ycc[3];			// Block color as YCbCr
+
+
+  if ((fp = open_file(dir, "image.jpg")) == NULL)
+    return (1);
+
+  // SOI, APP0 (JFIF)
+  put_be16(fp, 0xffd8);
+  put_be16(fp, 0xffe0);
+  put_be16(fp, 16);
+  fwrite("JFIF\0\001\001\001", 1, 8, fp);
+  put_be16(fp, 150);
+  put_be16(fp, 150);
+  put_be16(fp, 0);
+
+  // DQT, DC quantizer 8 so that the coefficient is the sample - 128
+  put_be16(fp, 0xffdb);
+  put_be16(fp, 67);
+  putc(0, fp);
+  for (i = 0; i < 64; i ++)
+    putc(i ? 16 : 8, fp);
+
+  // SOF0, 3 components without subsampling, all using table 0
+  put_be16(fp, 0xffc0);
+  put_be16(fp, 17);
+  putc(8, fp);
+  put_be16(fp, IMAGE_HEIGHT);
+  put_be16(fp, IMAGE_WIDTH);
+  putc(3, fp);
+  for (c = 1; c <= 3; c ++)
+  {
+    putc(c, fp);
+    putc(0x11, fp);
+    putc(0, fp);
+  }
+
+  // DHT, standard DC table and an AC table only coding EOB as "0"
+  put_be16(fp, 0xffc4);
+  put_be16(fp, 2 + 17 + 12 + 17 + 1);
+  putc(0x00, fp);
+  fwrite(DCBits, 1, 16, fp);
+  for (i = 0; i < 12; i ++)
+    putc(i, fp);
+  putc(0x10, fp);
+  putc(1, fp);
+  for (i = 1; i < 16; i ++)
+    putc(0, fp);
+  putc(0x00, fp);
+
+  // SOS
+  put_be16(fp, 0xffda);
+  put_be16(fp, 12);
+  putc(3, fp);
+  for (c = 1; c <= 3; c ++)
+  {
+    putc(c, fp);
+    putc(0x00, fp);
+  }
+  putc(0, fp);
+  putc(63, fp);
+  putc(0, fp);
+
+  // Entropy coded data, one MCU per 8x8 block
+  bits.fp     = fp;
+  bits.buffer = 0;
+  bits.count  = 0;
+
+  for (by = 0; by < IMAGE_HEIGHT / 8; by ++)
+    for (bx = 0; bx < IMAGE_WIDTH / 8; bx ++)
+    {
+      image_pixel(bx * 8, by * 8, rgb);
+
+      ycc[0] = 0.299 * rgb[0] + 0.587 * rgb[1] + 0.114 * rgb[2];
+      ycc[1] = -0.1687 * rgb[0] - 0.3313 * rgb[1] + 0.5 * rgb[2] + 128.0;
+      ycc[2] = 0.5 * rgb[0] - 0.4187 * rgb[1] - 0.0813 * rgb[2] + 128.0;
+
+      for (c = 0; c < 3; c ++)
+      {
+	dc   = (int)(ycc[c] + 0.5) - 128;
+	diff = dc - pred[c];
+	pred[c] = dc;
+
+	for (cat = 0, i = diff < 0 ? -diff : diff; i; i >>= 1)
+	  cat ++;
+
+	put_bits(&bits, DCCodes[cat], DCLengths[cat]);
+	if (cat)
+	  put_bits(&bits, (unsigned)(diff < 0 ? diff + (1 << cat) - 1 : diff),
+		   cat);
+	put_bits(&bits, 0, 1);		// EOB
+      }
+    }
+
+  if (bits.count)
+    put_bits(&bits, 0x7f, 8 - bits.count);
+
+  // EOI
+  put_be16(fp, 0xffd9);
+
+  return (fclose(fp) != 0);
+}
+
+
+//
+// 'write_pdf_object()' - Write a PDF object and record its offset.
+//
+
+static void
+write_pdf_object(FILE       *fp,	// I - PDF file
+		 long       *offsets,	// I - Object offsets
+		 int        num,	// I - Object number
+		 const char *format,	// I - Object contents
+		 ...)			// I - Arguments
+{
+  va_list	ap;			// Arguments
+
+
+  offsets[num] = ftell(fp);
+
+  fprintf(fp, "%d 0 obj\n", num);
+  va_start(ap, format);
+  vfprintf(fp, format, ap);
+  va_end(ap);
+  fputs("\nendobj\n", fp);
+}
+
+
+//
+// 'write_pdf_trailer()' - Write cross-reference table and trailer.
+//
+
+static void
+write_pdf_trailer(FILE *fp,		// I - PDF file
+		  long *offsets,	// I - Object offsets
+		  int  num_objs)	// I - Number of objects
+{
+  int	i;
+  long	xref = ftell(fp);		// Offset of xref table
+
+
+  fprintf(fp, "xref\n0 %d\n0000000000 65535 f \n", num_objs + 1);
+  for (i = 1; i <= num_objs; i ++)
+    fprintf(fp, "%010ld 00000 n \n", offsets[i]);
+  fprintf(fp, "trailer\n<< /Size %d /Root 1 0 R >>\nstartxref\n%ld\n%%%%EOF\n",
+	  num_objs + 1, xref);
+}
+
+
+//
+// 'write_png()' - Write a PNG image, with uncompressed deflate blocks.
+//
+
+static int				// O - 0 on success, 1 on error
+write_png(const char *dir)		// I - Directory
+{
+  FILE		*fp;			// PNG file
+  unsigned char	*data,			// IDAT data
+		*ptr,			// Position in data
+		*raw,			// Raw scanlines
+		*rptr,			// Position in raw
+		header[13];		// IHDR data
+  size_t	rawlen = (size_t)(IMAGE_WIDTH * 3 + 1) * IMAGE_HEIGHT,
+					// Length of raw data
+		blocklen,		// Length of deflate block
+		done;			// Raw bytes done
+  unsigned	a = 1, b = 0;		// Adler-32
+  int		x, y;
+
+
+  if ((fp = open_file(dir, "image.png")) == NULL)
+    return (1);
+
+  raw = malloc(rawlen);
+  for (y = 0, rptr = raw; y < IMAGE_HEIGHT; y ++)
+  {
+    *rptr++ = 0;			// Filter type "None"
+    for (x = 0; x < IMAGE_WIDTH; x ++, rptr += 3)
+      image_pixel(x, y, rptr);
+  }
+
+  for (done = 0; done < rawlen; done ++)
+  {
+    a = (a + raw[done]) % 65521;
+    b = (b + a) % 65521;
+  }
+
+  // zlib stream with stored blocks of at most 65535 bytes
+  data = malloc(rawlen + 6 + 5 * (rawlen / 65535 + 1));
+  ptr  = data;
+  *ptr++ = 0x78;
+  *ptr++ = 0x01;
+  for (done = 0; done < rawlen; done += blocklen)
+  {
+    blocklen = rawlen - done > 65535 ? 65535 : rawlen - done;
+    *ptr++ = done + blocklen >= rawlen ? 1 : 0;
+    *ptr++ = (unsigned char)(blocklen & 255);
+    *ptr++ = (unsigned char)(blocklen >> 8);
+    *ptr++ = (unsigned char)(~blocklen & 255);
+    *ptr++ = (unsigned char)((~blocklen >> 8) & 255);
+    memcpy(ptr, raw + done, blocklen);
+    ptr += blocklen;
+  }
+  *ptr++ = (unsigned char)(b >> 8);
+  *ptr++ = (unsigned char)(b & 255);
+  *ptr++ = (unsigned char)(a >> 8);
+  *ptr++ = (unsigned char)(a & 255);
+
+  fwrite("\211PNG\r\n\032\n", 1, 8, fp);
+
+  header[0]  = (unsigned char)(IMAGE_WIDTH >> 24);
+  header[1]  = (unsigned char)(IMAGE_WIDTH >> 16);
+  header[2]  = (unsigned char)(IMAGE_WIDTH >> 8);
+  header[3]  = (unsigned char)IMAGE_WIDTH;
+  header[4]  = (unsigned char)(IMAGE_HEIGHT >> 24);
+  header[5]  = (unsigned char)(IMAGE_HEIGHT >> 16);
+  header[6]  = (unsigned char)(IMAGE_HEIGHT >> 8);
+  header[7]  = (unsigned char)IMAGE_HEIGHT;
+  header[8]  = 8;			// Bit depth
+  header[9]  = 2;			// RGB
+  header[10] = 0;			// Deflate
+  header[11] = 0;			// Adaptive filtering
+  header[12] = 0;			// No interlace
+
+  write_png_chunk(fp, "IHDR", header, sizeof(header));
+  write_png_chunk(fp, "IDAT", data, (size_t)(ptr - data));
+  write_png_chunk(fp, "IEND", NULL, 0);
+
+  free(raw);
+  free(data);
+
+  return (fclose(fp) != 0);
+}
+
+
+//
+// 'write_png_chunk()' - Write a PNG chunk.
+//
+
+static void
+write_png_chunk(FILE                *fp,	// I - PNG file
+		const char          *type,	// I - Chunk type
+		const unsigned char *data,	// I - Chunk data
+		size_t              len)	// I - Length of data
+{
+  unsigned	crc;			// CRC of type and data
+
+
+  put_be32(fp, (unsigned)len);
+  fwrite(type, 1, 4, fp);
+  if (len)
+    fwrite(data, 1, len, fp);
+
+  crc = crc32_update(0, (const unsigned char *)type, 4);
+  if (len)
+    crc = crc32_update(crc, data, len);
+  put_be32(fp, crc);
+}
+
+
+//
+// 'write_pwg()' - Write PWG Raster, A4 sRGB 8-bit with PackBits-like
+//                 compressed lines.
+//
+
+static int				// O - 0 on success, 1 on error
+write_pwg(const char *dir)		// I - Directory
+{
+  FILE		*fp;			// PWG file
+  unsigned char	header[1796],		// Page header
+		*line,			// Current line
+		*ptr;			// Position in line
+  int		page,			// Current page
+		i,
+		x, y,			// Pixel position
+		count;			// Pixels in run
+
+
+#define PWG_SET(offset,value) \
+  header[offset]     = (unsigned char)((unsigned)(value) >> 24), \
+  header[offset + 1] = (unsigned char)((unsigned)(value) >> 16), \
+  header[offset + 2] = (unsigned char)((unsigned)(value) >> 8), \
+  header[offset + 3] = (unsigned char)(value)
+
+  if ((fp = open_file(dir, "raster.pwg")) == NULL)
+    return (1);
+
+  memset(header, 0, sizeof(header));
+  strcpy((char *)header + 0, "PwgRaster");		// MediaClass
+  PWG_SET(276, PWG_RES);				// HWResolution
+  PWG_SET(280, PWG_RES);
+  PWG_SET(340, 1);					// NumCopies
+  PWG_SET(352, 595);					// PageSize
+  PWG_SET(356, 842);
+  PWG_SET(372, PWG_WIDTH);				// cupsWidth
+  PWG_SET(376, PWG_HEIGHT);				// cupsHeight
+  PWG_SET(384, 8);					// cupsBitsPerColor
+  PWG_SET(388, 24);					// cupsBitsPerPixel
+  PWG_SET(392, PWG_WIDTH * 3);				// cupsBytesPerLine
+  PWG_SET(400, 19);					// cupsColorSpace sRGB
+  PWG_SET(420, 3);					// cupsNumColors
+  PWG_SET(452, PWG_PAGES);				// TotalPageCount
+  PWG_SET(456, 1);					// CrossFeedTransform
+  PWG_SET(460, 1);					// FeedTransform
+  PWG_SET(484, 0xffffff);				// AlternatePrimary
+  strcpy((char *)header + 1732, "iso_a4_210x297mm");	// cupsPageSizeName
+
+  fwrite("RaS2", 1, 4, fp);
+
+  line = malloc((size_t)PWG_WIDTH * 4 + 2);
+
+  for (page = 0; page < PWG_PAGES; page ++)
+  {
+    fwrite(header, 1, sizeof(header), fp);
+
+    for (y = 0; y < PWG_HEIGHT; y ++)
+    {
+      ptr    = line;
+      *ptr++ = 0;			// Line repeat count
+
+      if (y < 300 || y >= PWG_HEIGHT - 300)
+      {
+	*ptr++ = 128;			// White to the end of line
+	fwrite(line, 1, (size_t)(ptr - line), fp);
+	continue;
+      }
+
+      //
+      // Runs of flat color bars with a band of gradient (literal runs)
+      // in the middle of the page...
+      //
+
+      for (x = 0; x < PWG_WIDTH; x += count)
+      {
+	if (y > PWG_HEIGHT / 3 + page * 100 && y < PWG_HEIGHT / 2 + page * 100 &&
+	    x >= 300 && x < PWG_WIDTH - 300)
+	{
+	  count = PWG_WIDTH - 300 - x;
+	  if (count > 128)
+	    count = 128;
+	  *ptr++ = (unsigned char)(257 - count);
+	  for (i = 0; i < count; i ++)
+	  {
+	    *ptr++ = (unsigned char)((x + i) * 255 / PWG_WIDTH);
+	    *ptr++ = (unsigned char)(y * 255 / PWG_HEIGHT);
+	    *ptr++ = (unsigned char)(lcg() & 255);
+	  }
+	}
+	else
+	{
+	  count = 100 - x % 100;
+	  if (x < 300 && x + count > 300)
+	    count = 300 - x;
+	  if (x + count > PWG_WIDTH)
+	    count = PWG_WIDTH - x;
+	  *ptr++ = (unsigned char)(count - 1);
+	  *ptr++ = (unsigned char)((x / 100) * 37);
+	  *ptr++ = (unsigned char)((y / 100) * 53);
+	  *ptr++ = (unsigned char)(((x + y) / 100) * 71);
+	}
+      }
+
+      fwrite(line, 1, (size_t)(ptr - line), fp);
+    }
+  }
+
+  free(line);
+
+  return (fclose(fp) != 0);
+}
+
+
+//
+// 'write_text()' - Write plain text.
+//
+
+static int				// O - 0 on success, 1 on error
+write_text(const char *dir)		// I - Directory
+{
+  FILE		*fp;			// Text file
+  int		line,			// Current line
+		word,			// Current word
+		i;
+  static const char * const words[] =	// Words to use
+  {
+    "printer", "filter", "page", "raster", "queue", "job", "color", "font",
+    "margin", "duplex", "paper", "toner", "driver", "option", "PDF", "PPD"
+  };
+
+
+  if ((fp = open_file(dir, "text.txt")) == NULL)
+    return (1);
+
+  for (line = 1; line <= TEXT_LINES; line ++)
+  {
+    fprintf(fp, "%5d ", line);
+    for (word = 0, i = (int)(lcg() % 12); word < i; word ++)
+      fprintf(fp, "%s ", words[lcg() % (sizeof(words) / sizeof(words[0]))]);
+    putc('\n', fp);
+    if (line % 60 == 0)
+      putc('\f', fp);
+  }
+
+  return (fclose(fp) != 0);
+}
+
+
+//
+// 'write_tiff()' - Write an uncompressed baseline RGB TIFF image.
+//
+
+static int				// O - 0 on success, 1 on error
+write_tiff(const char *dir)		// I - Directory
+{
+  FILE		*fp;			// TIFF file
+  int		x, y;
+  unsigned char	rgb[3];			// Pixel color
+  unsigned	ifd = 8,		// Offset of IFD
+		num_tags = 12,		// Number of tags
+		extra,			// Offset of data after IFD
+		image;			// Offset of image data
+
+
+  if ((fp = open_file(dir, "image.tiff")) == NULL)
+    return (1);
+
+  extra = ifd + 2 + num_tags * 12 + 4;
+  image = extra + 6 + 16;		// BitsPerSample, 2 resolutions
+
+  fwrite("II*\0", 1, 4, fp);
+  put_le32(fp, ifd);
+
+#define TIFF_TAG(tag,type,count,value) \
+  put_le16(fp, tag), put_le16(fp, type), put_le32(fp, count), \
+  (type == 3 && count == 1 ? (put_le16(fp, value), put_le16(fp, 0)) : \
+   put_le32(fp, value))
+
+  put_le16(fp, num_tags);
+  TIFF_TAG(256, 3, 1, IMAGE_WIDTH);			// ImageWidth
+  TIFF_TAG(257, 3, 1, IMAGE_HEIGHT);			// ImageLength
+  TIFF_TAG(258, 3, 3, extra);				// BitsPerSample
+  TIFF_TAG(259, 3, 1, 1);				// Compression
+  TIFF_TAG(262, 3, 1, 2);				// Photometric RGB
+  TIFF_TAG(273, 4, 1, image);				// StripOffsets
+  TIFF_TAG(277, 3, 1, 3);				// SamplesPerPixel
+  TIFF_TAG(278, 3, 1, IMAGE_HEIGHT);			// RowsPerStrip
+  TIFF_TAG(279, 4, 1, IMAGE_WIDTH * IMAGE_HEIGHT * 3);	// StripByteCounts
+  TIFF_TAG(282, 5, 1, extra + 6);			// XResolution
+  TIFF_TAG(283, 5, 1, extra + 14);			// YResolution
+  TIFF_TAG(296, 3, 1, 2);				// ResolutionUnit inch
+  put_le32(fp, 0);					// No next IFD
+
+  put_le16(fp, 8);
+  put_le16(fp, 8);
+  put_le16(fp, 8);
+  put_le32(fp, 150);
+  put_le32(fp, 1);
+  put_le32(fp, 150);
+  put_le32(fp, 1);
+
+  for (y = 0; y < IMAGE_HEIGHT; y ++)
+    for (x = 0; x < IMAGE_WIDTH; x ++)
+    {
+      image_pixel(x, y, rgb);
+      fwrite(rgb, 1, 3, fp);
+    }
+
+  return (fclose(fp) != 0);
+}
+
+
+//
+// 'write_vector_pdf()' - Write a PDF with vector graphics on each page.
+//
+
+static int				// O - 0 on success, 1 on error
+write_vector_pdf(const char *dir)	// I - Directory
+{
+  FILE		*fp;			// PDF file
+  long		offsets[3 + 2 * VECTOR_PAGES];
+					// Object offsets
+  int		page,			// Current page
+		shape,			// Current shape
+		num_objs = 2 + 2 * VECTOR_PAGES;
+					// Number of objects
+  char		*content,		// Content stream
+		*ptr,			// Position in content
+		*end,			// End of content buffer
+		kids[16 * VECTOR_PAGES],// Page objects
+		*kptr;			// Position in kids
+  size_t	size = VECTOR_SHAPES * 160 + 64;
+					// Size of content buffer
+
+
+  if ((fp = open_file(dir, "vector.pdf")) == NULL)
+    return (1);
+
+  fputs("%PDF-1.4\n%\342\343\317\323\n", fp);
+
+  for (page = 0, kptr = kids; page < VECTOR_PAGES; page ++)
+  {
+    snprintf(kptr, sizeof(kids) - (size_t)(kptr - kids), "%d 0 R ",
+	     3 + 2 * page);
+    kptr += strlen(kptr);
+  }
+
+  write_pdf_object(fp, offsets, 1, "<< /Type /Catalog /Pages 2 0 R >>");
+  write_pdf_object(fp, offsets, 2,
+		   "<< /Type /Pages /Kids [%s] /Count %d >>", kids,
+		   VECTOR_PAGES);
+
+  content = malloc(size);
+  end     = content + size;
+
+  for (page = 0; page < VECTOR_PAGES; page ++)
+  {
+    //
+    // Filled and stroked rectangles, curves, and lines in many colors...
+    //
+
+    for (shape = 0, ptr = content; shape < VECTOR_SHAPES; shape ++)
+    {
+      int x = 20 + (int)(lcg() % 540), y = 20 + (int)(lcg() % 720),
+	  w = 5 + (int)(lcg() % 80), h = 5 + (int)(lcg() % 80);
+
+      switch (shape % 3)
+      {
+	case 0 :
+	    snprintf(ptr, (size_t)(end - ptr),
+		     "%.2f %.2f %.2f rg %d %d %d %d re f\n",
+		     (lcg() % 100) / 100.0, (lcg() % 100) / 100.0,
+		     (lcg() % 100) / 100.0, x, y, w, h);
+	    break;
+	case 1 :
+	    snprintf(ptr, (size_t)(end - ptr),
+		     "%.2f %.2f %.2f RG %.1f w %d %d m %d %d %d %d %d %d c S\n",
+		     (lcg() % 100) / 100.0, (lcg() % 100) / 100.0,
+		     (lcg() % 100) / 100.0, 0.5 + (lcg() % 30) / 10.0, x, y,
+		     x + w, y + h, x - w, y + 2 * h, x + w / 2, y + 3 * h);
+	    break;
+	default :
+	    snprintf(ptr, (size_t)(end - ptr),
+		     "%.2f g %d %d m %d %d l %d %d l h B\n",
+		     (lcg() % 100) / 100.0, x, y, x + w, y, x + w / 2, y + h);
+	    break;
+      }
+      ptr += strlen(ptr);
+    }
+
+    write_pdf_object(fp, offsets, 3 + 2 * page,
+		     "<< /Type /Page /Parent 2 0 R "
+		     "/MediaBox [0 0 612 792] /Contents %d 0 R >>",
+		     4 + 2 * page);
+    write_pdf_object(fp, offsets, 4 + 2 * page,
+		     "<< /Length %d >>\nstream\n%sendstream",
+		     (int)(ptr - content), content);
+  }
+
+  free(content);
+
+  write_pdf_trailer(fp, offsets, num_objs);
+
+  return (fclose(fp) != 0);
+}
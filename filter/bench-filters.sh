@@ -0,0 +1,153 @@
+#!/bin/sh
+#
+# End-to-end conversion benchmark: Creates a fixed corpus of input files
+# (text, vector PDF, image PDF, PNG, JPEG, TIFF, PWG Raster) and runs each
+# of them through the filter chain CUPS would choose from the .convs files
+# for each sample PPD, once with the individual filters and once with the
+# "universal" filter. Prints wall clock and CPU time, peak memory, and
+# output size of each chain as CSV.
+#
+# Copyright © 2024 by OpenPrinting.
+#
+# Licensed under Apache License v2.0.  See the file "LICENSE" for more
+# information.
+#
+# Usage: bench-filters.sh [-r repeat] [ppd-file ...]
+#
+# The filters are taken from $builddir, the .convs files and the default
+# PPD files from $srcdir.
+#
+
+repeat=3
+if test "x$1" = x-r; then
+	repeat="$2"
+	shift 2
+fi
+
+srcdir="${srcdir:-.}"
+builddir="${builddir:-.}"
+bench="$builddir/bench-filters"
+
+if test ! -x "$bench"; then
+	echo "bench-filters not built, skipping." 1>&2
+	exit 77
+fi
+
+if test $# = 0; then
+	set -- "$srcdir"/ppdfiles/*.ppd
+fi
+
+workdir="${TMPDIR:-/tmp}/bench-filters.$$"
+trap 'rm -rf "$workdir"' 0 1 2 15
+mkdir "$workdir" || exit 1
+
+"$bench" corpus "$workdir/corpus" || exit 1
+
+# The .convs files of each setup
+convs_individual="$srcdir/mime/cupsfilters.convs $srcdir/mime/cupsfilters-individual.convs.in $srcdir/mime/cupsfilters-ghostscript.convs $srcdir/mime/cupsfilters-poppler.convs $srcdir/mime/cupsfilters-mupdf.convs"
+convs_universal="$srcdir/mime/cupsfilters.convs $srcdir/mime/cupsfilters-universal.convs $srcdir/mime/cupsfilters-universal-postscript.convs"
+
+#
+# Find the cheapest chain of filters from one MIME type to another, like
+# cupsd does, and print the filter names, or nothing if there is none.
+#
+
+find_chain()
+{
+	from="$1"
+	to="$2"
+	shift 2
+	cat "$@" | awk -v from="$from" -v to="$to" '
+		/^[ \t]*#/ || NF < 4 { next }
+		{
+			sub(/^@[A-Za-z0-9_]*@/, "")
+			n ++
+			src[n] = $1; dst[n] = $2; cost[n] = $3; prog[n] = $4
+		}
+		END {
+			dist[from] = 0
+			for (pass = 0; pass < n; pass ++) {
+				changed = 0
+				for (i = 1; i <= n; i ++)
+					if ((src[i] in dist) &&
+					    (!(dst[i] in dist) ||
+					     dist[src[i]] + cost[i] < dist[dst[i]])) {
+						dist[dst[i]] = dist[src[i]] + cost[i]
+						via[dst[i]] = i
+						changed = 1
+					}
+				if (!changed)
+					break
+			}
+			if (!(to in dist))
+				exit
+			chain = ""
+			for (t = to; t != from; t = src[via[t]])
+				if (prog[via[t]] != "-")
+					chain = prog[via[t]] " " chain
+			print chain
+		}'
+}
+
+echo "ppd,setup,input,input-type,filters,exit-status,wall-sec,user-sec,sys-sec,peak-rss-kb,output-bytes"
+
+for ppd in "$@"; do
+	ppdname="`basename "$ppd" .ppd`"
+
+	# Use the PPD's cupsFilter line with the lowest cost
+	filterline="`sed -n 's/^\*cupsFilter:[ \t]*"\(.*\)"/\1/p' "$ppd" | sort -n -k 2 | head -1`"
+	if test "x$filterline" = x; then
+		echo "$ppdname: No cupsFilter line, skipping." 1>&2
+		continue
+	fi
+	set -- $filterline
+	ppdtype="$1"
+	ppdfilter="$3"
+
+	for setup in individual universal; do
+		eval convs="\$convs_$setup"
+
+		for input in text.txt:text/plain vector.pdf:application/pdf \
+			     image.pdf:application/pdf image.png:image/png \
+			     image.jpg:image/jpeg image.tiff:image/tiff \
+			     raster.pwg:image/pwg-raster; do
+			file="${input%%:*}"
+			type="${input#*:}"
+
+			chain="`find_chain "$type" "$ppdtype" $convs`"
+			if test "x$ppdfilter" != x-; then
+				chain="$chain$ppdfilter"
+			fi
+			if test "x$chain" = x; then
+				echo "$ppdname,$setup,$file: No filter chain from $type to $ppdtype, skipping." 1>&2
+				continue
+			fi
+
+			pipeline=""
+			missing=""
+			for filter in $chain; do
+				if test ! -x "$builddir/$filter"; then
+					missing="$filter"
+					break
+				fi
+				if test "x$pipeline" = x; then
+					pipeline="'$builddir/$filter' 1 bench bench 1 '' '$workdir/corpus/$file'"
+				else
+					pipeline="$pipeline | '$builddir/$filter' 1 bench bench 1 ''"
+				fi
+			done
+			if test "x$missing" != x; then
+				echo "$ppdname,$setup,$file: $missing not built, skipping." 1>&2
+				continue
+			fi
+
+			result="`PPD="$ppd" CONTENT_TYPE="$type" FINAL_CONTENT_TYPE="$ppdtype" "$bench" run -r "$repeat" -o "$workdir/output" sh -c "$pipeline" 2>"$workdir/log"`"
+			if test "x${result%%,*}" != x0; then
+				echo "$ppdname,$setup,$file: $chain failed:" 1>&2
+				grep -v "^DEBUG" "$workdir/log" | tail -5 1>&2
+			fi
+
+			echo "$ppdname,$setup,$file,$type,`echo $chain`,$result"
+		done
+	done
+done
@@ -0,0 +1,622 @@
+//
+// Shared, memory-mapped store of the color separations and dither
+// lookup tables of a PPD file, for rastertopclx and rastertoescpx.
+//
+// Building the RGB and CMYK separations and the dither LUTs from the
+// cupsRGB*, cupsCMYK*, and cupsInk* attributes of the PPD file takes
+// time and memory in every filter process, for every page. So the
+// first process compiles them into a file in CUPS' cache directory,
+// keyed by PPD file name and the ColorModel, MediaType, and Resolution
+// selector, and all later processes map this file read-only. The data
+// pages are then shared between all jobs on the printer. The file is
+// rebuilt when the PPD file changes.
+//
+// Copyright © 2024 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Contents:
+//
+//   color_store_close() - Free the color data of a page.
+//   color_store_lut()   - Get the dither LUT of an ink.
+//   color_store_open()  - Get the color data for a page setup.
+//   color_store_owns()  - Check whether data belongs to the store.
+//   check_store()       - Check a mapped store file.
+//   map_store()         - Map a store file.
+//   save_store()        - Save color data into a store file.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "color-store.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+//
+// Constants...
+//
+
+#define COLOR_STORE_MAGIC	"CFCOLOR"
+#define COLOR_STORE_VERSION	1
+#define COLOR_STORE_ALIGN(n)	(((n) + 7) & ~(size_t)7)
+#define COLOR_STORE_LUTSIZE	((CF_MAX_LUT + 1) * sizeof(cf_lut_t))
+
+
+//
+// Types...
+//
+
+typedef struct color_store_header_s	// Header of a store file
+{
+  char		magic[8];		// COLOR_STORE_MAGIC
+  unsigned	version,		// COLOR_STORE_VERSION
+		rgb_size,		// sizeof(cf_rgb_t)
+		cmyk_size,		// sizeof(cf_cmyk_t)
+		lut_size,		// sizeof(cf_lut_t)
+		length,			// Length of the file
+		key_length;		// Length of key following the header
+  long long	ppd_mtime,		// Modification time of PPD file
+		ppd_size;		// Size of PPD file
+  unsigned	rgb,			// Offset of cf_rgb_t or 0
+		rgb_colors,		// Offset of RGB cube samples
+		cmyk,			// Offset of cf_cmyk_t or 0
+		cmyk_channels,		// Offset of CMYK channel tables
+		luts[COLOR_STORE_LUTS];	// Offsets of dither LUTs or 0
+} color_store_header_t;
+
+
+//
+// Local globals...
+//
+
+static const char * const LutNames[COLOR_STORE_LUTS] =
+{					// Inks with dither LUTs
+  "Black",
+  "LightBlack",
+  "Cyan",
+  "LightCyan",
+  "Magenta",
+  "LightMagenta",
+  "Yellow"
+};
+
+
+//
+// Local functions...
+//
+
+static int	check_store(const unsigned char *map, size_t length,
+			    const char *key, size_t keylen,
+			    struct stat *ppdinfo);
+static int	map_store(color_store_t *cs, const char *filename,
+			  const char *key, size_t keylen,
+			  struct stat *ppdinfo);
+static void	save_store(color_store_t *cs, const char *filename,
+			   const char *key, size_t keylen,
+			   struct stat *ppdinfo, cf_logfunc_t logfunc,
+			   void *ld);
+
+
+//
+// 'color_store_close()' - Free the color data of a page.
+//
+
+void
+color_store_close(color_store_t *cs)	// I - Color store
+{
+  int	i;				// Looping var
+
+
+  if (cs->map)
+  {
+    //
+    // Only the structures and the RGB cube's pointer tables are private,
+    // the tables themselves are in the mapping...
+    //
+
+    if (cs->rgb)
+    {
+      free(cs->rgb->colors[0][0]);
+      free(cs->rgb->colors[0]);
+      free(cs->rgb->colors);
+      free(cs->rgb);
+    }
+
+    free(cs->cmyk);
+
+    munmap(cs->map, cs->maplen);
+  }
+  else
+  {
+    if (cs->rgb)
+      cfRGBDelete(cs->rgb);
+    if (cs->cmyk)
+      cfCMYKDelete(cs->cmyk);
+    for (i = 0; i < COLOR_STORE_LUTS; i ++)
+      if (cs->luts[i])
+	cfLutDelete(cs->luts[i]);
+  }
+
+  memset(cs, 0, sizeof(color_store_t));
+}
+
+
+//
+// 'color_store_lut()' - Get the dither LUT of an ink.
+//
+
+cf_lut_t *				// O - LUT or NULL if not in PPD
+color_store_lut(color_store_t *cs,	// I - Color store
+		const char    *name)	// I - Ink name ("Cyan", etc.)
+{
+  int	i;				// Looping var
+
+
+  for (i = 0; i < COLOR_STORE_LUTS; i ++)
+    if (!strcmp(LutNames[i], name))
+      return (cs->luts[i]);
+
+  return (NULL);
+}
+
+
+//
+// 'color_store_open()' - Get the color data for a page setup.
+//
+// The data is mapped from the store file if it is up to date, otherwise
+// loaded from the PPD file and saved for the next process.
+//
+
+void
+color_store_open(color_store_t *cs,	// O - Color store
+		 ppd_file_t    *ppd,	// I - PPD file
+		 const char    *colormodel,
+					// I - Color model
+		 const char    *media,	// I - Media type
+		 const char    *resolution,
+					// I - Resolution
+		 cf_logfunc_t  logfunc,	// I - Log function
+		 void          *ld)	// I - Log function data
+{
+  int			i;		// Looping var
+  const char		*ppdfile,	// PPD file name
+			*cachedir;	// CUPS cache directory
+  char			key[1024],	// Key of store file
+			filename[1024];	// Store file name
+  size_t		keylen;		// Length of key
+  unsigned long long	hash;		// Hash of key
+  struct stat		ppdinfo;	// PPD file information
+
+
+  memset(cs, 0, sizeof(color_store_t));
+
+  if (!ppd)
+    return;
+
+  //
+  // The store needs the PPD file name and a place to put the file...
+  //
+
+  ppdfile  = getenv("PPD");
+  cachedir = getenv("CUPS_CACHEDIR");
+
+  if (ppdfile && cachedir && *cachedir && !stat(ppdfile, &ppdinfo))
+  {
+    //
+    // Key is the PPD file name and the selector, the file name is made
+    // from its FNV-1a hash...
+    //
+
+    keylen = (size_t)snprintf(key, sizeof(key), "%s%c%s%c%s%c%s", ppdfile,
+			      0, colormodel, 0, media, 0, resolution) + 1;
+
+    for (i = 0, hash = 14695981039346656037ULL; i < (int)keylen; i ++)
+      hash = (hash ^ (unsigned char)key[i]) * 1099511628211ULL;
+
+    snprintf(filename, sizeof(filename), "%s/cupsfilters-color-%016llx",
+	     cachedir, hash);
+
+    if (keylen < sizeof(key) &&
+	map_store(cs, filename, key, keylen, &ppdinfo))
+    {
+      if (logfunc)
+	logfunc(ld, CF_LOGLEVEL_DEBUG, "Mapped color data from \"%s\".",
+		filename);
+      return;
+    }
+  }
+  else
+    keylen = 0;
+
+  //
+  // Load from the PPD file...
+  //
+
+  cs->rgb  = ppdRGBLoad(ppd, colormodel, media, resolution, logfunc, ld);
+  cs->cmyk = ppdCMYKLoad(ppd, colormodel, media, resolution, logfunc, ld);
+
+  for (i = 0; i < COLOR_STORE_LUTS; i ++)
+    cs->luts[i] = ppdLutLoad(ppd, colormodel, media, resolution, LutNames[i],
+			     logfunc, ld);
+
+  if (keylen > 0 && keylen < sizeof(key))
+    save_store(cs, filename, key, keylen, &ppdinfo, logfunc, ld);
+}
+
+
+//
+// 'color_store_owns()' - Check whether data belongs to the store.
+//
+
+int					// O - 1 if owned by store, 0 otherwise
+color_store_owns(color_store_t *cs,	// I - Color store
+		 const void    *ptr)	// I - Separation or LUT
+{
+  int	i;				// Looping var
+
+
+  if (!ptr)
+    return (0);
+
+  if (ptr == cs->rgb || ptr == cs->cmyk)
+    return (1);
+
+  for (i = 0; i < COLOR_STORE_LUTS; i ++)
+    if (ptr == cs->luts[i])
+      return (1);
+
+  return (0);
+}
+
+
+//
+// 'check_store()' - Check a mapped store file.
+//
+
+static int				// O - 1 if valid, 0 if stale or broken
+check_store(
+    const unsigned char *map,		// I - Mapped file
+    size_t              length,		// I - Length of file
+    const char          *key,		// I - Key
+    size_t              keylen,		// I - Length of key
+    struct stat         *ppdinfo)	// I - PPD file information
+{
+  int				i;	// Looping var
+  const color_store_header_t	*header;// File header
+  const cf_rgb_t		*rgb;	// RGB separation
+  const cf_cmyk_t		*cmyk;	// CMYK separation
+  size_t			bytes;	// Bytes of table
+
+
+  header = (const color_store_header_t *)map;
+
+  if (length < sizeof(color_store_header_t) + keylen ||
+      memcmp(header->magic, COLOR_STORE_MAGIC, sizeof(header->magic)) ||
+      header->version != COLOR_STORE_VERSION ||
+      header->rgb_size != sizeof(cf_rgb_t) ||
+      header->cmyk_size != sizeof(cf_cmyk_t) ||
+      header->lut_size != sizeof(cf_lut_t) ||
+      header->length != length ||
+      header->key_length != keylen ||
+      memcmp(map + sizeof(color_store_header_t), key, keylen) ||
+      header->ppd_mtime != (long long)ppdinfo->st_mtime ||
+      header->ppd_size != (long long)ppdinfo->st_size)
+    return (0);
+
+  //
+  // Check all tables against the size of the file before using them...
+  //
+
+  if (header->rgb)
+  {
+    if (header->rgb > length - sizeof(cf_rgb_t))
+      return (0);
+
+    rgb = (const cf_rgb_t *)(map + header->rgb);
+    if (rgb->cube_size < 2 || rgb->cube_size > 256 ||
+	rgb->num_channels < 1 || rgb->num_channels > CF_MAX_RGB)
+      return (0);
+
+    bytes = (size_t)rgb->cube_size * (size_t)rgb->cube_size *
+	    (size_t)rgb->cube_size * (size_t)rgb->num_channels;
+    if (header->rgb_colors > length || bytes > length - header->rgb_colors)
+      return (0);
+
+    for (i = 0; i < 256; i ++)
+      if (rgb->cube_index[i] < 0 || rgb->cube_index[i] >= rgb->cube_size)
+	return (0);
+  }
+
+  if (header->cmyk)
+  {
+    if (header->cmyk > length - sizeof(cf_cmyk_t))
+      return (0);
+
+    cmyk  = (const cf_cmyk_t *)(map + header->cmyk);
+    if (cmyk->num_channels < 1 || cmyk->num_channels > CF_MAX_CHAN)
+      return (0);
+
+    bytes = (size_t)cmyk->num_channels * 256 * sizeof(short);
+    if (header->cmyk_channels > length ||
+	bytes > length - header->cmyk_channels)
+      return (0);
+  }
+
+  for (i = 0; i < COLOR_STORE_LUTS; i ++)
+    if (header->luts[i] && header->luts[i] > length - COLOR_STORE_LUTSIZE)
+      return (0);
+
+  return (1);
+}
+
+
+//
+// 'map_store()' - Map a store file.
+//
+
+static int				// O - 1 on success, 0 on failure
+map_store(color_store_t *cs,		// I - Color store
+	  const char    *filename,	// I - Store file
+	  const char    *key,		// I - Key
+	  size_t        keylen,		// I - Length of key
+	  struct stat   *ppdinfo)	// I - PPD file information
+{
+  int			fd,		// Store file
+			i,		// Looping var
+			r, g, b,	// Cube position
+			size;		// Cube size
+  struct stat		info;		// Store file information
+  unsigned char		*map,		// Mapped file
+			****colors,	// Pointer tables of RGB cube
+			***rows,	// Red/green pointers
+			**columns,	// Blue pointers
+			*samples;	// Cube samples
+  color_store_header_t	*header;	// File header
+
+
+  if ((fd = open(filename, O_RDONLY)) < 0)
+    return (0);
+
+  //
+  // Only use files of our own user...
+  //
+
+  if (fstat(fd, &info) || info.st_uid != geteuid() ||
+      info.st_size < (off_t)sizeof(color_store_header_t))
+  {
+    close(fd);
+    return (0);
+  }
+
+  map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED)
+    return (0);
+
+  if (!check_store(map, (size_t)info.st_size, key, keylen, ppdinfo))
+  {
+    munmap(map, (size_t)info.st_size);
+    return (0);
+  }
+
+  header     = (color_store_header_t *)map;
+  cs->map    = map;
+  cs->maplen = (size_t)info.st_size;
+
+  //
+  // The structures are copied, their tables stay in the mapping.  The RGB
+  // cube is addressed through pointer tables, which are rebuilt here...
+  //
+
+  if (header->rgb)
+  {
+    cs->rgb = malloc(sizeof(cf_rgb_t));
+    memcpy(cs->rgb, map + header->rgb, sizeof(cf_rgb_t));
+
+    size    = cs->rgb->cube_size;
+    colors  = calloc((size_t)size, sizeof(unsigned char ***));
+    rows    = calloc((size_t)(size * size), sizeof(unsigned char **));
+    columns = calloc((size_t)(size * size * size), sizeof(unsigned char *));
+    samples = map + header->rgb_colors;
+
+    for (r = 0; r < size; r ++)
+    {
+      colors[r] = rows + r * size;
+
+      for (g = 0; g < size; g ++)
+      {
+	colors[r][g] = columns + (r * size + g) * size;
+
+	for (b = 0; b < size; b ++, samples += cs->rgb->num_channels)
+	  colors[r][g][b] = samples;
+      }
+    }
+
+    cs->rgb->colors = colors;
+  }
+
+  if (header->cmyk)
+  {
+    cs->cmyk = malloc(sizeof(cf_cmyk_t));
+    memcpy(cs->cmyk, map + header->cmyk, sizeof(cf_cmyk_t));
+
+    memset(cs->cmyk->channels, 0, sizeof(cs->cmyk->channels));
+    for (i = 0; i < cs->cmyk->num_channels; i ++)
+      cs->cmyk->channels[i] = (short *)(map + header->cmyk_channels) +
+			      256 * i;
+  }
+
+  for (i = 0; i < COLOR_STORE_LUTS; i ++)
+    if (header->luts[i])
+      cs->luts[i] = (cf_lut_t *)(map + header->luts[i]);
+
+  return (1);
+}
+
+
+//
+// 'save_store()' - Save color data into a store file.
+//
+// The file is written under a temporary name and then renamed, so other
+// processes either see the old or the complete new file.
+//
+
+static void
+save_store(color_store_t *cs,		// I - Color store
+	   const char    *filename,	// I - Store file
+	   const char    *key,		// I - Key
+	   size_t        keylen,	// I - Length of key
+	   struct stat   *ppdinfo,	// I - PPD file information
+	   cf_logfunc_t  logfunc,	// I - Log function
+	   void          *ld)		// I - Log function data
+{
+  int			fd,		// Temporary file
+			i,		// Looping var
+			r, g, b,	// Cube position
+			size = 0;	// Cube size
+  size_t		length,		// Length of file
+			bytes,		// Bytes written
+			samples = 0;	// Bytes of RGB cube samples
+  unsigned char		*buffer,	// File contents
+			*ptr;		// Position in buffer
+  color_store_header_t	*header;	// File header
+  char			tempfile[1024];	// Temporary file name
+  ssize_t		written;	// Bytes written by write()
+
+
+  //
+  // Lay out the file...
+  //
+
+  length = COLOR_STORE_ALIGN(sizeof(color_store_header_t) + keylen);
+
+  if (cs->rgb)
+  {
+    size    = cs->rgb->cube_size;
+    samples = (size_t)(size * size * size) * (size_t)cs->rgb->num_channels;
+    length += COLOR_STORE_ALIGN(sizeof(cf_rgb_t)) +
+	      COLOR_STORE_ALIGN(samples);
+  }
+
+  if (cs->cmyk)
+    length += COLOR_STORE_ALIGN(sizeof(cf_cmyk_t)) +
+	      COLOR_STORE_ALIGN((size_t)cs->cmyk->num_channels * 256 *
+				sizeof(short));
+
+  for (i = 0; i < COLOR_STORE_LUTS; i ++)
+    if (cs->luts[i])
+      length += COLOR_STORE_ALIGN(COLOR_STORE_LUTSIZE);
+
+  if (length > 0x7fffffff || (buffer = calloc(1, length)) == NULL)
+    return;
+
+  header = (color_store_header_t *)buffer;
+
+  memcpy(header->magic, COLOR_STORE_MAGIC, sizeof(header->magic));
+  header->version    = COLOR_STORE_VERSION;
+  header->rgb_size   = sizeof(cf_rgb_t);
+  header->cmyk_size  = sizeof(cf_cmyk_t);
+  header->lut_size   = sizeof(cf_lut_t);
+  header->length     = (unsigned)length;
+  header->key_length = (unsigned)keylen;
+  header->ppd_mtime  = (long long)ppdinfo->st_mtime;
+  header->ppd_size   = (long long)ppdinfo->st_size;
+
+  memcpy(buffer + sizeof(color_store_header_t), key, keylen);
+  ptr = buffer + COLOR_STORE_ALIGN(sizeof(color_store_header_t) + keylen);
+
+  //
+  // Copy the tables, the pointers of the structures are meaningless in
+  // the file and get replaced when mapping...
+  //
+
+  if (cs->rgb)
+  {
+    header->rgb = (unsigned)(ptr - buffer);
+    memcpy(ptr, cs->rgb, sizeof(cf_rgb_t));
+    ((cf_rgb_t *)ptr)->colors = NULL;
+    ptr += COLOR_STORE_ALIGN(sizeof(cf_rgb_t));
+
+    header->rgb_colors = (unsigned)(ptr - buffer);
+    for (r = 0; r < size; r ++)
+      for (g = 0; g < size; g ++)
+	for (b = 0; b < size; b ++, ptr += cs->rgb->num_channels)
+	  memcpy(ptr, cs->rgb->colors[r][g][b],
+		 (size_t)cs->rgb->num_channels);
+    ptr = buffer + header->rgb_colors + COLOR_STORE_ALIGN(samples);
+  }
+
+  if (cs->cmyk)
+  {
+    header->cmyk = (unsigned)(ptr - buffer);
+    memcpy(ptr, cs->cmyk, sizeof(cf_cmyk_t));
+    memset(((cf_cmyk_t *)ptr)->channels, 0, sizeof(cs->cmyk->channels));
+    ptr += COLOR_STORE_ALIGN(sizeof(cf_cmyk_t));
+
+    header->cmyk_channels = (unsigned)(ptr - buffer);
+    for (i = 0; i < cs->cmyk->num_channels; i ++, ptr += 256 * sizeof(short))
+      memcpy(ptr, cs->cmyk->channels[i], 256 * sizeof(short));
+    ptr = buffer + COLOR_STORE_ALIGN((size_t)(ptr - buffer));
+  }
+
+  for (i = 0; i < COLOR_STORE_LUTS; i ++)
+    if (cs->luts[i])
+    {
+      header->luts[i] = (unsigned)(ptr - buffer);
+      memcpy(ptr, cs->luts[i], COLOR_STORE_LUTSIZE);
+      ptr += COLOR_STORE_ALIGN(COLOR_STORE_LUTSIZE);
+    }
+
+  //
+  // Write it...
+  //
+
+  snprintf(tempfile, sizeof(tempfile), "%s.XXXXXX", filename);
+
+  if ((fd = mkstemp(tempfile)) < 0)
+  {
+    if (logfunc)
+      logfunc(ld, CF_LOGLEVEL_DEBUG,
+	      "Unable to create color data store \"%s\": %s", tempfile,
+	      strerror(errno));
+    free(buffer);
+    return;
+  }
+
+  for (bytes = 0; bytes < length; bytes += (size_t)written)
+    if ((written = write(fd, buffer + bytes, length - bytes)) < 0)
+    {
+      if (errno == EINTR)
+      {
+	written = 0;
+	continue;
+      }
+      break;
+    }
+
+  fchmod(fd, 0644);
+
+  if (close(fd) || bytes < length || rename(tempfile, filename))
+  {
+    if (logfunc)
+      logfunc(ld, CF_LOGLEVEL_DEBUG,
+	      "Unable to save color data store \"%s\": %s", filename,
+	      strerror(errno));
+    unlink(tempfile);
+  }
+  else if (logfunc)
+    logfunc(ld, CF_LOGLEVEL_DEBUG, "Saved color data to \"%s\".", filename);
+
+  free(buffer);
+}
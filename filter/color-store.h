@@ -0,0 +1,55 @@
+//
+// Shared, memory-mapped store of the color separations and dither
+// lookup tables of a PPD file, for rastertopclx and rastertoescpx.
+//
+// Copyright © 2024 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _COLOR_STORE_H_
+#  define _COLOR_STORE_H_
+
+//
+// Include necessary headers...
+//
+
+#  include <cupsfilters/driver.h>
+#  include <ppd/ppd.h>
+
+
+//
+// Constants...
+//
+
+#  define COLOR_STORE_LUTS	7	// Number of dither LUT names
+
+
+//
+// Types...
+//
+
+typedef struct color_store_s		// Color data for one page setup
+{
+  cf_rgb_t	*rgb;			// RGB separation or NULL
+  cf_cmyk_t	*cmyk;			// CMYK separation or NULL
+  cf_lut_t	*luts[COLOR_STORE_LUTS];// Dither LUTs or NULL
+  void		*map;			// Mapped store file or NULL
+  size_t	maplen;			// Length of mapping
+} color_store_t;
+
+
+//
+// Functions...
+//
+
+extern void	color_store_close(color_store_t *cs);
+extern cf_lut_t	*color_store_lut(color_store_t *cs, const char *name);
+extern void	color_store_open(color_store_t *cs, ppd_file_t *ppd,
+				 const char *colormodel, const char *media,
+				 const char *resolution, cf_logfunc_t logfunc,
+				 void *ld);
+extern int	color_store_owns(color_store_t *cs, const void *ptr);
+
+#endif // !_COLOR_STORE_H_
@@ -0,0 +1,582 @@
+//
+// Filter pipeline tracing for the legacy CUPS filter wrappers of
+// cups-filters.
+//
+// When FILTER_TRACE is set in the environment of a filter (use "SetEnv"
+// in cupsd.conf), each traced filter function reports when it started
+// and ended, how many bytes it read and wrote, and how many pages it
+// logged, as an "ATTR: filter-trace=..." line. Where a filter runs a
+// chain of filter functions itself, like filterchain, each stage gets
+// wrapped in trace_filter() and so gets its own line. With
+// FILTER_TRACE_JSON set to a file name, the same data gets appended to
+// that file as Chrome trace events (JSON array format, to be loaded into
+// chrome://tracing or Perfetto), one track per filter process, grouped
+// by job ID.
+//
+// Copyright © 2020-2022 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Contents:
+//
+//   trace_cups_wrapper() - ppdFilterCUPSWrapper() with tracing of the
+//                          filter function, if enabled.
+//   trace_enabled()      - Check whether tracing is enabled.
+//   trace_filter()       - Filter function running another one with
+//                          tracing.
+//   trace_close()        - Close a counting pipe, if it is still open.
+//   trace_copy()         - Start a process copying and counting data.
+//   trace_copied()       - Wait for a copying process and get its byte
+//                          count.
+//   trace_escape()       - Quote a string for JSON.
+//   trace_json()         - Append a Chrome trace event to the
+//                          FILTER_TRACE_JSON file.
+//   trace_log()          - Log function counting the pages.
+//   trace_report()       - Report the trace of a filter.
+//   trace_time()         - Current time in seconds since the epoch,
+//                          comparable between processes.
+//
+
+//
+// Include necessary headers...
+//
+
+#include <ppd/ppd-filter.h>
+#include "filter-trace.h"
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+
+//
+// Types...
+//
+
+typedef struct trace_log_s		// Log function data while tracing
+{
+  cf_logfunc_t		logfunc;	// Original log function
+  void			*logdata;	// Its data
+  cf_filter_data_t	*data;		// Job and printer data
+  const char		*name;		// Name of the traced filter
+  int			pages;		// Number of pages logged
+} trace_log_t;
+
+
+//
+// Local functions...
+//
+
+static void		trace_close(int fd, struct stat *fdinfo);
+static pid_t		trace_copy(int fromfd, int tofd, int closefd1,
+				   int closefd2, int *reportfd);
+static long long	trace_copied(pid_t pid, int reportfd);
+static void		trace_escape(const char *s, char *buffer,
+				     size_t bufsize);
+static void		trace_json(trace_log_t *log, const char *name,
+				   int pid, double start, double end,
+				   long long in_bytes, long long out_bytes,
+				   int pages, int status);
+static void		trace_log(void *logdata, cf_loglevel_t level,
+				  const char *message, ...);
+static void		trace_report(trace_log_t *log, const char *name,
+				     int pid, double start, double end,
+				     long long in_bytes, long long out_bytes,
+				     int pages, int status);
+static double		trace_time(void);
+
+
+//
+// 'trace_cups_wrapper()' - ppdFilterCUPSWrapper() with tracing of the
+//                          filter function, if enabled.
+//
+
+int					// O - Exit status
+trace_cups_wrapper(
+    int                  argc,		// I - Number of command-line args
+    char                 *argv[],	// I - Command-line arguments
+    const char           *name,		// I - Name of the filter
+    cf_filter_function_t function,	// I - Filter function
+    void                 *parameters,	// I - Its parameters
+    int                  *JobCanceled)	// I - Set to 1 on SIGTERM
+{
+  trace_filter_t	traced;		// Filter to trace
+
+
+  if (!trace_enabled())
+    return (ppdFilterCUPSWrapper(argc, argv, function, parameters,
+				 JobCanceled));
+
+  traced.name         = name;
+  traced.function     = function;
+  traced.parameters   = parameters;
+  traced.count_input  = 1;
+  traced.count_output = 1;
+
+  return (ppdFilterCUPSWrapper(argc, argv, trace_filter, &traced,
+			       JobCanceled));
+}
+
+
+//
+// 'trace_enabled()' - Check whether tracing is enabled.
+//
+
+int					// O - 1 if enabled, 0 otherwise
+trace_enabled(void)
+{
+  const char	*val;			// Environment variable value
+
+
+  if ((val = getenv("FILTER_TRACE_JSON")) != NULL && *val)
+    return (1);
+
+  if ((val = getenv("FILTER_TRACE")) != NULL && *val &&
+      strcasecmp(val, "0") && strcasecmp(val, "no") &&
+      strcasecmp(val, "off") && strcasecmp(val, "false"))
+    return (1);
+
+  return (0);
+}
+
+
+//
+// 'trace_filter()' - Filter function running another one with tracing.
+//
+// Data read from or written to a regular file is counted from the size
+// of the file. Data on a pipe gets counted only where the trace_filter_t
+// asks for it, on the outer pipes of a filter, by passing it through a
+// process copying and counting it; the byte counts of the other pipes
+// are reported as -1.
+//
+
+int					// O - Exit status of the traced
+					//     filter function
+trace_filter(int              inputfd,	// I - File descriptor input stream
+	     int              outputfd,	// I - File descriptor output stream
+	     int              inputseekable,
+					// I - Is input stream seekable?
+	     cf_filter_data_t *data,	// I - Job and printer data
+	     void             *parameters)
+					// I - Filter to trace
+{
+  trace_filter_t *traced = (trace_filter_t *)parameters;
+					// Filter to trace
+  trace_log_t	log;			// Log function data
+  int		ret,			// Exit status
+		infd = inputfd,		// Input of the traced function
+		outfd = outputfd,	// Output of the traced function
+		inpipe[2],		// Pipe for counting the input
+		outpipe[2],		// Pipe for counting the output
+		inreport = -1,		// Byte count of input
+		outreport = -1;		// Byte count of output
+  pid_t		inpid = -1,		// Input copying process
+		outpid = -1;		// Output copying process
+  struct stat	fileinfo,		// Input file information
+		outfileinfo,		// Output file information
+		ininfo,			// Input pipe information
+		outinfo;		// Output pipe information
+  int		outfile = 0;		// Output to a regular file?
+  long long	in_bytes = -1,		// Bytes read
+		out_bytes = -1;		// Bytes written
+  double	start,			// Start time
+		end;			// End time
+
+
+  start = trace_time();
+
+  //
+  // Count pages logged by the filter function...
+  //
+
+  log.logfunc    = data->logfunc;
+  log.logdata    = data->logdata;
+  log.data       = data;
+  log.name       = traced->name;
+  log.pages      = 0;
+  data->logfunc  = trace_log;
+  data->logdata  = &log;
+
+  //
+  // Put the counting pipes in place...
+  //
+
+  if (!fstat(inputfd, &fileinfo) && S_ISREG(fileinfo.st_mode))
+    in_bytes = (long long)fileinfo.st_size;
+  else if (traced->count_input && !pipe(inpipe))
+  {
+    if ((inpid = trace_copy(inputfd, inpipe[1], inpipe[0], outputfd,
+			    &inreport)) > 0)
+    {
+      close(inputfd);
+      infd = inpipe[0];
+      fstat(infd, &ininfo);
+    }
+    else
+      close(inpipe[0]);
+    close(inpipe[1]);
+  }
+
+  if (!fstat(outputfd, &outfileinfo) && S_ISREG(outfileinfo.st_mode))
+    outfile = 1;
+  else if (traced->count_output && !pipe(outpipe))
+  {
+    if ((outpid = trace_copy(outpipe[0], outputfd, outpipe[1],
+			     infd != inputfd ? infd : -1, &outreport)) > 0)
+    {
+      close(outputfd);
+      outfd = outpipe[1];
+      fstat(outfd, &outinfo);
+    }
+    else
+      close(outpipe[1]);
+    close(outpipe[0]);
+  }
+
+  //
+  // Run the filter function...
+  //
+
+  ret = (traced->function)(infd, outfd, infd == inputfd ? inputseekable : 0,
+			   data, traced->parameters);
+
+  //
+  // Close the pipes if the filter function did not do so, and collect
+  // the byte counts...
+  //
+
+  if (inpid > 0)
+  {
+    trace_close(infd, &ininfo);
+    in_bytes = trace_copied(inpid, inreport);
+  }
+
+  if (outpid > 0)
+  {
+    trace_close(outfd, &outinfo);
+    out_bytes = trace_copied(outpid, outreport);
+  }
+  else if (outfile && !fstat(outputfd, &fileinfo) &&
+	   fileinfo.st_dev == outfileinfo.st_dev &&
+	   fileinfo.st_ino == outfileinfo.st_ino)
+    out_bytes = (long long)(fileinfo.st_size - outfileinfo.st_size);
+
+  end = trace_time();
+
+  data->logfunc = log.logfunc;
+  data->logdata = log.logdata;
+
+  trace_report(&log, traced->name, (int)getpid(), start, end, in_bytes,
+	       out_bytes, log.pages, ret);
+
+  return (ret);
+}
+
+
+//
+// 'trace_close()' - Close a counting pipe, if it is still open.
+//
+
+static void
+trace_close(int         fd,		// I - File descriptor
+	    struct stat *fdinfo)	// I - What it was when we opened it
+{
+  struct stat	info;			// What it is now
+
+
+  // The filter function may have closed it and the number been reused
+  if (!fstat(fd, &info) && info.st_dev == fdinfo->st_dev &&
+      info.st_ino == fdinfo->st_ino)
+    close(fd);
+}
+
+
+//
+// 'trace_copy()' - Start a process copying and counting data.
+//
+
+static pid_t				// O - Process ID or -1 on error
+trace_copy(int fromfd,			// I - Where to read from
+	   int tofd,			// I - Where to write to
+	   int closefd1,		// I - fd not to keep open in the
+					//     copying process or -1
+	   int closefd2,		// I - Another one or -1
+	   int *reportfd)		// O - Where to read the byte count
+{
+  pid_t		pid;			// Process ID
+  int		report[2];		// Pipe for byte count
+  char		buffer[65536],		// Copy buffer
+		*ptr;			// Position in buffer
+  ssize_t	bytes,			// Bytes read
+		written;		// Bytes written
+  long long	total = 0;		// Total bytes copied
+
+
+  if (pipe(report))
+    return (-1);
+
+  if ((pid = fork()) == 0)
+  {
+    //
+    // Copy until end of input, or until the reader goes away...
+    //
+
+    signal(SIGPIPE, SIG_IGN);
+    close(report[0]);
+    if (closefd1 >= 0)
+      close(closefd1);
+    if (closefd2 >= 0)
+      close(closefd2);
+
+    for (;;)
+    {
+      if ((bytes = read(fromfd, buffer, sizeof(buffer))) < 0)
+      {
+	if (errno == EINTR || errno == EAGAIN)
+	  continue;
+	break;
+      }
+      else if (bytes == 0)
+	break;
+
+      total += bytes;
+
+      for (ptr = buffer; bytes > 0; ptr += written, bytes -= written)
+	if ((written = write(tofd, ptr, (size_t)bytes)) < 0)
+	{
+	  if (errno == EINTR || errno == EAGAIN)
+	    written = 0;
+	  else
+	    break;
+	}
+
+      if (bytes > 0)
+	break;
+    }
+
+    if (write(report[1], &total, sizeof(total)) < 0)
+      _exit(1);
+    _exit(0);
+  }
+
+  close(report[1]);
+
+  if (pid < 0)
+  {
+    close(report[0]);
+    return (-1);
+  }
+
+  *reportfd = report[0];
+
+  return (pid);
+}
+
+
+//
+// 'trace_copied()' - Wait for a copying process and get its byte count.
+//
+
+static long long			// O - Bytes copied or -1
+trace_copied(pid_t pid,			// I - Process ID
+	     int   reportfd)		// I - Where to read the byte count
+{
+  long long	total = -1;		// Bytes copied
+
+
+  if (read(reportfd, &total, sizeof(total)) != sizeof(total))
+    total = -1;
+  close(reportfd);
+
+  while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+
+  return (total);
+}
+
+
+//
+// 'trace_escape()' - Quote a string for JSON.
+//
+
+static void
+trace_escape(const char *s,		// I - String
+	     char       *buffer,	// O - Quoted string
+	     size_t     bufsize)	// I - Size of buffer
+{
+  char	*ptr,				// Position in buffer
+	*end = buffer + bufsize - 1;	// End of buffer
+
+
+  for (ptr = buffer; *s && ptr < end; s ++)
+  {
+    if (*s == '"' || *s == '\\')
+    {
+      if (ptr + 2 > end)
+	break;
+      *ptr++ = '\\';
+      *ptr++ = *s;
+    }
+    else if ((*s & 255) < ' ')
+    {
+      if (ptr + 6 > end)
+	break;
+      snprintf(ptr, 7, "\\u%04x", *s & 255);
+      ptr += 6;
+    }
+    else
+      *ptr++ = *s;
+  }
+
+  *ptr = '\0';
+}
+
+
+//
+// 'trace_json()' - Append a Chrome trace event to the FILTER_TRACE_JSON
+//                  file.
+//
+
+static void
+trace_json(trace_log_t *log,		// I - Log function data
+	   const char  *name,		// I - Name of the stage
+	   int         pid,		// I - Process of the stage
+	   double      start,		// I - Start time
+	   double      end,		// I - End time
+	   long long   in_bytes,	// I - Bytes read
+	   long long   out_bytes,	// I - Bytes written
+	   int         pages,		// I - Pages logged
+	   int         status)		// I - Exit status
+{
+  int		fd;			// Trace file
+  struct stat	info;			// Trace file information
+  char		event[2048],		// Trace event
+		qname[512],		// Quoted name
+		qprinter[512];		// Quoted printer name
+  int		len;			// Length of event
+
+
+  if ((fd = open(getenv("FILTER_TRACE_JSON"),
+		 O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) < 0)
+  {
+    if (log->logfunc)
+      log->logfunc(log->logdata, CF_LOGLEVEL_DEBUG,
+		   "Unable to open trace file \"%s\": %s",
+		   getenv("FILTER_TRACE_JSON"), strerror(errno));
+    return;
+  }
+
+  trace_escape(name, qname, sizeof(qname));
+  trace_escape(log->data->printer ? log->data->printer : "", qprinter,
+	       sizeof(qprinter));
+
+  len = snprintf(event, sizeof(event),
+		 "{\"name\":\"%s\",\"cat\":\"filter\",\"ph\":\"X\","
+		 "\"ts\":%.0f,\"dur\":%.0f,\"pid\":%d,\"tid\":%d,"
+		 "\"args\":{\"printer\":\"%s\",\"in_bytes\":%lld,"
+		 "\"out_bytes\":%lld,\"pages\":%d,\"status\":%d}},\n",
+		 qname, start * 1000000.0, (end - start) * 1000000.0,
+		 log->data->job_id, pid, qprinter, in_bytes, out_bytes,
+		 pages, status);
+  if (len >= (int)sizeof(event))
+    len = 0;
+
+  //
+  // Other filters of this or other jobs may write at the same time,
+  // and the first one starts the array...
+  //
+
+  flock(fd, LOCK_EX);
+  if (!fstat(fd, &info) && info.st_size == 0 && write(fd, "[\n", 2) < 0)
+    len = 0;
+  if (len > 0 && write(fd, event, (size_t)len) < 0 && log->logfunc)
+    log->logfunc(log->logdata, CF_LOGLEVEL_DEBUG,
+		 "Unable to write trace file \"%s\": %s",
+		 getenv("FILTER_TRACE_JSON"), strerror(errno));
+  flock(fd, LOCK_UN);
+
+  close(fd);
+}
+
+
+//
+// 'trace_log()' - Log function counting the pages.
+//
+
+static void
+trace_log(void          *logdata,	// I - Original log function data
+	  cf_loglevel_t level,		// I - Log level
+	  const char    *message,	// I - Message format
+	  ...)				// I - Arguments
+{
+  trace_log_t	*log = (trace_log_t *)logdata;
+					// Original log function
+  char		buffer[4096];		// Formatted message
+  va_list	ap;			// Arguments
+
+
+  va_start(ap, message);
+  vsnprintf(buffer, sizeof(buffer), message, ap);
+  va_end(ap);
+
+  if (level == CF_LOGLEVEL_CONTROL && !strncmp(buffer, "PAGE:", 5) &&
+      strncmp(buffer + 5, " total", 6))
+    log->pages ++;
+
+  if (log->logfunc)
+    log->logfunc(log->logdata, level, "%s", buffer);
+}
+
+
+//
+// 'trace_report()' - Report the trace of a filter.
+//
+
+static void
+trace_report(trace_log_t *log,		// I - Log function data
+	     const char  *name,		// I - Name of the stage
+	     int         pid,		// I - Process of the stage
+	     double      start,		// I - Start time
+	     double      end,		// I - End time
+	     long long   in_bytes,	// I - Bytes read or -1
+	     long long   out_bytes,	// I - Bytes written or -1
+	     int         pages,		// I - Pages logged or -1
+	     int         status)	// I - Exit status
+{
+  const char	*val;			// FILTER_TRACE_JSON
+
+
+  if ((val = getenv("FILTER_TRACE_JSON")) != NULL && *val)
+    trace_json(log, name, pid, start, end, in_bytes, out_bytes, pages,
+	       status);
+
+  if (log->logfunc)
+    log->logfunc(log->logdata, CF_LOGLEVEL_CONTROL,
+		 "ATTR: filter-trace=\"%s start=%.6f end=%.6f "
+		 "elapsed-ms=%.3f in-bytes=%lld out-bytes=%lld pages=%d "
+		 "status=%d\"", name, start, end, (end - start) * 1000.0,
+		 in_bytes, out_bytes, pages, status);
+}
+
+
+//
+// 'trace_time()' - Current time in seconds since the epoch, comparable
+//                  between processes.
+//
+
+static double				// O - Time
+trace_time(void)
+{
+  struct timespec	ts;		// Current time
+
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  return ((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
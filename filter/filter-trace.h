@@ -0,0 +1,46 @@
+//
+// Filter pipeline tracing for the legacy CUPS filter wrappers of
+// cups-filters.
+//
+// Copyright © 2020-2022 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _FILTER_TRACE_H_
+#  define _FILTER_TRACE_H_
+
+//
+// Include necessary headers...
+//
+
+#  include <cupsfilters/filter.h>
+
+
+//
+// Types...
+//
+
+typedef struct trace_filter_s		// Filter function to trace
+{
+  const char		*name;		// Name of the stage
+  cf_filter_function_t	function;	// Filter function
+  void			*parameters;	// Its parameters
+  int			count_input,	// Count input read from a pipe?
+			count_output;	// Count output written to a pipe?
+} trace_filter_t;
+
+
+//
+// Functions...
+//
+
+extern int	trace_cups_wrapper(int argc, char *argv[], const char *name,
+				   cf_filter_function_t function,
+				   void *parameters, int *JobCanceled);
+extern int	trace_enabled(void);
+extern int	trace_filter(int inputfd, int outputfd, int inputseekable,
+			     cf_filter_data_t *data, void *parameters);
+
+#endif // !_FILTER_TRACE_H_
@@ -0,0 +1,476 @@
+//
+// Client of the resident filterchain worker for cups-filters.
+//
+// The symbolic links named "<filter>+<filter>+..." point to this small
+// program, which does not link any of the printing libraries. If the
+// FILTERCHAIN_WORKER environment variable names the socket of a running
+// "filterchain --worker", it hands over its standard file descriptors,
+// arguments, and environment, waits for the exit status, and forwards a
+// cancellation (SIGTERM). Otherwise, or if the worker cannot take the
+// job, it loads the filterchain module and runs the chain itself, with
+// the same code the worker uses.
+//
+// Copyright © 2020-2022 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Contents:
+//
+//   main()           - Main entry.
+//   cancel_job()     - Flag the job as canceled.
+//   read_all()       - Read exactly the given number of bytes.
+//   run_in_process() - Run the filter chain with the filterchain module.
+//   run_in_worker()  - Let the resident worker run the filter chain.
+//   set_signal()     - Set a signal handler.
+//   write_all()      - Write a buffer completely.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "filterchain.h"
+#include <config.h>
+#include <dlfcn.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef HAVE_GETAUXVAL
+#  include <sys/auxv.h>
+#endif // HAVE_GETAUXVAL
+
+
+//
+// Local globals...
+//
+
+static int		JobCanceled = 0; // Set to 1 on SIGTERM
+
+
+//
+// Local functions...
+//
+
+static void		cancel_job(int sig);
+static int		read_all(int fd, void *buf, size_t len);
+static int		run_in_process(const char *chain_name, int argc,
+				       char *argv[]);
+static int		run_in_worker(const char *sockname,
+				      const char *chain_name, int argc,
+				      char *argv[]);
+static void		set_signal(int sig, void (*handler)(int));
+static int		write_all(int fd, const void *buf, size_t len);
+
+
+//
+// 'main()' - Main entry.
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line args
+     char *argv[])			// I - Command-line arguments
+{
+  int           ret;
+  char		*p;
+  const char	*exec_name = NULL,
+		*chain_name;
+
+
+  //
+  // Register a signal handler to cleanly cancel a job.
+  //
+
+  set_signal(SIGTERM, cancel_job);
+
+  //
+  // Get the chain from the name of the link executed,
+  // "<filter>+<filter>+...". CUPS puts the queue name into argv[0], so
+  // without the system telling us the path there is no way to know.
+  //
+
+#ifdef HAVE_GETAUXVAL
+  exec_name = (const char *)getauxval(AT_EXECFN);
+#endif // HAVE_GETAUXVAL
+
+  if (!exec_name)
+  {
+    fputs("ERROR: Unable to get the filter chain to run, the system does "
+	  "not tell the name of the executed link.\n", stderr);
+    return (1);
+  }
+
+  if ((chain_name = strrchr(exec_name, '/')) != NULL)
+    chain_name ++;
+  else
+    chain_name = exec_name;
+
+  if (!strchr(chain_name, '+'))
+  {
+    fprintf(stderr,
+	    "ERROR: filterchain-client must be called via a link named "
+	    "\"<filter>+<filter>+...\", not \"%s\".\n", chain_name);
+    return (1);
+  }
+
+  //
+  // Let the resident worker do the job if there is one...
+  //
+
+  if ((p = getenv("FILTERCHAIN_WORKER")) != NULL && *p &&
+      (ret = run_in_worker(p, chain_name, argc, argv)) >= 0)
+    return (ret);
+
+  if (JobCanceled)
+    return (1);
+
+  //
+  // Otherwise run the chain in this process...
+  //
+
+  return (run_in_process(chain_name, argc, argv));
+}
+
+
+//
+// 'cancel_job()' - Flag the job as canceled.
+//
+
+static void
+cancel_job(int sig)			// I - Signal number (unused)
+{
+  (void)sig;
+
+  JobCanceled = 1;
+}
+
+
+//
+// 'read_all()' - Read exactly the given number of bytes.
+//
+
+static int				// O - 0 on success, -1 on error/EOF
+read_all(int    fd,			// I - File descriptor
+	 void   *buf,			// I - Buffer
+	 size_t len)			// I - Number of bytes to read
+{
+  char		*ptr = (char *)buf;	// Current position
+  ssize_t	bytes;			// Bytes read
+
+
+  while (len > 0)
+  {
+    if ((bytes = read(fd, ptr, len)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+	continue;
+      return (-1);
+    }
+    else if (bytes == 0)
+      return (-1);
+
+    ptr += bytes;
+    len -= (size_t)bytes;
+  }
+
+  return (0);
+}
+
+
+//
+// 'run_in_process()' - Run the filter chain with the filterchain module.
+//
+// The module has the printing libraries linked, it only gets loaded
+// when there is no worker, so that handing the job to the worker stays
+// cheap.
+//
+
+static int				// O - Exit status
+run_in_process(const char *chain_name,	// I - Chain name
+	       int        argc,		// I - Number of command-line args
+	       char       *argv[])	// I - Command-line arguments
+{
+  void			*module;	// filterchain module
+  filterchain_run_t	run;		// Its entry point
+
+
+  if ((module = dlopen(FILTERCHAIN_MODULE, RTLD_NOW)) == NULL)
+  {
+    fprintf(stderr, "ERROR: Unable to load %s: %s\n", FILTERCHAIN_MODULE,
+	    dlerror());
+    return (1);
+  }
+
+  if ((run = (filterchain_run_t)dlsym(module, FILTERCHAIN_RUN)) == NULL)
+  {
+    fprintf(stderr, "ERROR: Unable to find %s in %s: %s\n", FILTERCHAIN_RUN,
+	    FILTERCHAIN_MODULE, dlerror());
+    dlclose(module);
+    return (1);
+  }
+
+  return ((*run)(chain_name, argc, argv, &JobCanceled));
+}
+
+
+//
+// 'run_in_worker()' - Let the resident worker run the filter chain.
+//
+
+static int				// O - Exit status, -1 if the worker
+					//     could not take the job
+run_in_worker(const char *sockname,	// I - Worker's socket
+	      const char *chain_name,	// I - Chain name
+	      int        argc,		// I - Number of command-line args
+	      char       *argv[])	// I - Command-line arguments
+{
+  int			fd,		// Connection to the worker
+			i,
+			num_fds = 0,	// Number of fds passed
+			fds[WORKER_NUM_FDS],
+					// File descriptors passed
+			status,		// Exit status of the filter chain
+			cancel_sent = 0;// Cancellation forwarded?
+  struct sockaddr_un	addr;		// Worker's address
+  worker_request_t	req;		// Request header
+  char			*strings,	// Chain name, arguments, environment
+			*ptr,
+			**envp;
+  size_t		len;
+  struct msghdr		msg;		// Message with the fds
+  struct iovec		iov;
+  struct cmsghdr	*cmsg;
+  union
+  {
+    struct cmsghdr	align;
+    char		buf[CMSG_SPACE(sizeof(int) * WORKER_NUM_FDS)];
+  }			control;
+  struct pollfd		pfd;
+  extern char		**environ;
+
+
+  if (strlen(sockname) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "DEBUG: Filter worker socket name \"%s\" too long.\n",
+	    sockname);
+    return (-1);
+  }
+
+  //
+  // Our standard fds go to the worker, check them before the socket
+  // takes one of the numbers...
+  //
+
+  memset(&req, 0, sizeof(req));
+  req.magic = WORKER_MAGIC;
+
+  for (i = 0; i < WORKER_NUM_FDS; i ++)
+    if (fcntl(i, F_GETFD) >= 0)
+    {
+      req.fds |= 1U << i;
+      fds[num_fds ++] = i;
+    }
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return (-1);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, sockname, sizeof(addr.sun_path) - 1);
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+  {
+    fprintf(stderr,
+	    "DEBUG: Filter worker at %s not available (%s), running filter "
+	    "chain locally.\n", sockname, strerror(errno));
+    close(fd);
+    return (-1);
+  }
+
+  //
+  // Collect the rest of what the filter chain needs: the chain name,
+  // the arguments, and the environment...
+  //
+
+  req.argc  = (unsigned)argc;
+
+  len = strlen(chain_name) + 1;
+  for (i = 0; i < argc; i ++)
+    len += strlen(argv[i]) + 1;
+  for (envp = environ; *envp; envp ++)
+    len += strlen(*envp) + 1;
+
+  if (len > WORKER_MAX_REQ || (strings = malloc(len)) == NULL)
+  {
+    fputs("DEBUG: Job too big for filter worker, running filter chain "
+	  "locally.\n", stderr);
+    close(fd);
+    return (-1);
+  }
+
+  ptr = strings;
+
+  strcpy(ptr, chain_name);
+  ptr += strlen(ptr) + 1;
+  for (i = 0; i < argc; i ++)
+  {
+    strcpy(ptr, argv[i]);
+    ptr += strlen(ptr) + 1;
+  }
+  for (envp = environ; *envp; envp ++)
+  {
+    strcpy(ptr, *envp);
+    ptr += strlen(ptr) + 1;
+  }
+
+  req.length = (unsigned)len;
+
+  //
+  // Send the header together with the fds, then the strings. Nothing
+  // runs before the worker has the complete request, so on failure the
+  // job can still be done locally.
+  //
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  iov.iov_base   = &req;
+  iov.iov_len    = sizeof(req);
+  msg.msg_iov    = &iov;
+  msg.msg_iovlen = 1;
+
+  if (num_fds > 0)
+  {
+    msg.msg_control    = control.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)num_fds);
+
+    cmsg             = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(int) * (size_t)num_fds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * (size_t)num_fds);
+  }
+
+  while ((i = (int)sendmsg(fd, &msg, 0)) < 0 && errno == EINTR);
+
+  if (i != (int)sizeof(req) || write_all(fd, strings, len))
+  {
+    fprintf(stderr,
+	    "DEBUG: Unable to send job to filter worker (%s), running filter "
+	    "chain locally.\n", strerror(errno));
+    free(strings);
+    close(fd);
+    return (-1);
+  }
+
+  free(strings);
+
+  fprintf(stderr, "DEBUG: Filter chain %s handed to worker at %s.\n",
+	  chain_name, sockname);
+
+  //
+  // Wait for the exit status, forwarding a cancellation. SIGTERM
+  // interrupts poll(), the timeout covers a signal arriving just
+  // before it.
+  //
+
+  for (;;)
+  {
+    if (JobCanceled && !cancel_sent)
+    {
+      if (!write_all(fd, "C", 1))
+	fputs("DEBUG: Job canceled, told filter worker.\n", stderr);
+      cancel_sent = 1;
+    }
+
+    pfd.fd      = fd;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, 1000) <= 0)
+      continue;
+
+    if (read_all(fd, &status, sizeof(status)))
+    {
+      fputs("ERROR: Filter worker went away while processing the job.\n",
+	    stderr);
+      status = 1;
+    }
+    else if (status < 0)
+    {
+      fprintf(stderr, "ERROR: Filter chain in worker crashed on signal %d.\n",
+	      -status);
+      status = 1;
+    }
+
+    break;
+  }
+
+  close(fd);
+
+  return (status);
+}
+
+
+//
+// 'set_signal()' - Set a signal handler.
+//
+
+static void
+set_signal(int  sig,			// I - Signal number
+	   void (*handler)(int))	// I - Handler, SIG_DFL, or SIG_IGN
+{
+#if defined(HAVE_SIGACTION) && !defined(HAVE_SIGSET)
+  struct sigaction action;		// Actions for POSIX signals
+#endif // HAVE_SIGACTION && !HAVE_SIGSET
+
+
+#ifdef HAVE_SIGSET // Use System V signals over POSIX to avoid bugs
+  sigset(sig, handler);
+#elif defined(HAVE_SIGACTION)
+  memset(&action, 0, sizeof(action));
+
+  sigemptyset(&action.sa_mask);
+  action.sa_handler = handler;
+  sigaction(sig, &action, NULL);
+#else
+  signal(sig, handler);
+#endif // HAVE_SIGSET
+}
+
+
+//
+// 'write_all()' - Write a buffer completely.
+//
+
+static int				// O - 0 on success, -1 on error
+write_all(int        fd,		// I - File descriptor
+	  const void *buf,		// I - Buffer
+	  size_t     len)		// I - Number of bytes
+{
+  const char	*ptr = (const char *)buf;// Current position
+  ssize_t	bytes;			// Bytes written
+
+
+  while (len > 0)
+  {
+    if ((bytes = write(fd, ptr, len)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+	continue;
+      return (-1);
+    }
+
+    ptr += bytes;
+    len -= (size_t)bytes;
+  }
+
+  return (0);
+}
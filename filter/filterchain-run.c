@@ -0,0 +1,401 @@
+//
+// Filter chain functions of filterchain for cups-filters.
+//
+// Resolves chain names like "pdftopdf+gstoraster" into the parameters of
+// cfFilterChain() and runs a chain as CUPS filter. The resident worker
+// (filterchain.c) uses these functions in the forks running the jobs,
+// filterchain-client loads them as module when there is no worker.
+//
+// Copyright © 2020-2022 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Contents:
+//
+//   create_chain()    - Create the cfFilterChain() parameters for a chain.
+//   delete_chain()    - Free a chain created by create_chain().
+//   filterchain_run() - Run a chain given by its name, the module's
+//                       entry point.
+//   run_chain()       - Run the filter chain in this process.
+//   set_parameters()  - Set the filter function parameters from the
+//                       environment.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "filterchain-run.h"
+#include <ppd/ppd-filter.h>
+#include "filter-trace.h"
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+//
+// Types...
+//
+
+typedef enum chain_param_e		// Parameters a filter function needs
+{
+  CHAIN_PARAM_NONE,			// None
+  CHAIN_PARAM_OUTFORMAT,		// Fixed output format
+  CHAIN_PARAM_OUTFORMAT_FINAL,		// Raster format from FINAL_CONTENT_TYPE
+  CHAIN_PARAM_BANNER,			// Banner template directory
+  CHAIN_PARAM_TEXTTOPDF			// cf_filter_texttopdf_parameter_t
+} chain_param_t;
+
+typedef struct chain_filter_s		// Filter which can be chained
+{
+  const char		*name;		// Name of the legacy wrapper
+  cf_filter_function_t	function;	// Filter function it calls
+  chain_param_t		param;		// Parameters it needs
+  cf_filter_out_format_t outformat;	// Output format (CHAIN_PARAM_OUTFORMAT)
+} chain_filter_t;
+
+typedef struct chain_stage_s		// Stage in the chain
+{
+  cf_filter_filter_in_chain_t filter;	// Entry for cfFilterChain(), first
+  trace_filter_t	trace;		// Traced filter function
+} chain_stage_t;
+
+
+//
+// Local globals...
+//
+
+// Same filter functions and parameters as the individual wrappers use
+static chain_filter_t	Filters[] =
+{
+  { "bannertopdf",   cfFilterBannerToPDF,   CHAIN_PARAM_BANNER,        0 },
+  { "gstopdf",       cfFilterGhostscript,   CHAIN_PARAM_OUTFORMAT,
+    CF_FILTER_OUT_FORMAT_PDF },
+  { "gstopxl",       cfFilterGhostscript,   CHAIN_PARAM_OUTFORMAT,
+    CF_FILTER_OUT_FORMAT_PXL },
+  { "gstoraster",    cfFilterGhostscript,   CHAIN_PARAM_NONE,          0 },
+  { "imagetopdf",    ppdFilterImageToPDF,   CHAIN_PARAM_NONE,          0 },
+  { "imagetops",     ppdFilterImageToPS,    CHAIN_PARAM_NONE,          0 },
+  { "imagetoraster", cfFilterImageToRaster, CHAIN_PARAM_NONE,          0 },
+  { "mupdftopwg",    cfFilterMuPDFToPWG,    CHAIN_PARAM_NONE,          0 },
+  { "pclmtoraster",  cfFilterPCLmToRaster,  CHAIN_PARAM_OUTFORMAT_FINAL, 0 },
+  { "pdftopdf",      ppdFilterPDFToPDF,     CHAIN_PARAM_NONE,          0 },
+  { "pdftops",       ppdFilterPDFToPS,      CHAIN_PARAM_NONE,          0 },
+  { "pdftoraster",   cfFilterPDFToRaster,   CHAIN_PARAM_NONE,          0 },
+  { "pstops",        ppdFilterPSToPS,       CHAIN_PARAM_NONE,          0 },
+  { "pwgtopclm",     cfFilterPWGToPDF,      CHAIN_PARAM_OUTFORMAT,
+    CF_FILTER_OUT_FORMAT_PCLM },
+  { "pwgtopdf",      cfFilterPWGToPDF,      CHAIN_PARAM_OUTFORMAT,
+    CF_FILTER_OUT_FORMAT_PDF },
+  { "pwgtoraster",   cfFilterPWGToRaster,   CHAIN_PARAM_NONE,          0 },
+  { "rastertops",    ppdFilterRasterToPS,   CHAIN_PARAM_NONE,          0 },
+  { "rastertopwg",   cfFilterRasterToPWG,   CHAIN_PARAM_NONE,          0 },
+  { "texttopdf",     cfFilterTextToPDF,     CHAIN_PARAM_TEXTTOPDF,     0 },
+  { "texttotext",    cfFilterTextToText,    CHAIN_PARAM_NONE,          0 }
+};
+
+// Parameters of the filter functions, set from the environment
+static char		BannerDir[1024];
+static cf_filter_out_format_t FinalOutFormat;
+static cf_filter_texttopdf_parameter_t TextToPDFParams;
+
+
+//
+// Local functions...
+//
+
+static void		set_parameters(void);
+
+
+//
+// 'create_chain()' - Create the cfFilterChain() parameters for a chain
+//                    named "<filter>+<filter>+...".
+//
+
+cups_array_t *				// O - Filters in chain or NULL
+create_chain(char *chain_name)		// I - Chain name, gets modified
+{
+  int		i,
+		trace;			// Trace the stages?
+  char		*name;
+  cups_array_t	*chain;
+  chain_stage_t	*stage;
+
+
+  chain = cupsArrayNew(NULL, NULL);
+  trace = trace_enabled();
+
+  for (name = strtok(chain_name, "+"); name; name = strtok(NULL, "+"))
+  {
+    for (i = 0; i < (int)(sizeof(Filters) / sizeof(Filters[0])); i ++)
+      if (!strcmp(name, Filters[i].name))
+	break;
+
+    if (i >= (int)(sizeof(Filters) / sizeof(Filters[0])))
+    {
+      fprintf(stderr, "ERROR: Unknown filter \"%s\" in filter chain.\n",
+	      name);
+      delete_chain(chain);
+      return (NULL);
+    }
+
+    stage = (chain_stage_t *)calloc(1, sizeof(chain_stage_t));
+    stage->filter.function = Filters[i].function;
+    stage->filter.name     = (char *)Filters[i].name;
+    switch (Filters[i].param)
+    {
+      case CHAIN_PARAM_NONE :
+	  stage->filter.parameters = NULL;
+	  break;
+      case CHAIN_PARAM_OUTFORMAT :
+	  stage->filter.parameters = &(Filters[i].outformat);
+	  break;
+      case CHAIN_PARAM_OUTFORMAT_FINAL :
+	  stage->filter.parameters = &FinalOutFormat;
+	  break;
+      case CHAIN_PARAM_BANNER :
+	  stage->filter.parameters = BannerDir;
+	  break;
+      case CHAIN_PARAM_TEXTTOPDF :
+	  stage->filter.parameters = &TextToPDFParams;
+	  break;
+    }
+
+    if (trace)
+    {
+      stage->trace.name        = Filters[i].name;
+      stage->trace.function    = stage->filter.function;
+      stage->trace.parameters  = stage->filter.parameters;
+      stage->filter.function   = trace_filter;
+      stage->filter.parameters = &(stage->trace);
+    }
+
+    cupsArrayAdd(chain, stage);
+  }
+
+  //
+  // Only count the bytes on the outer pipes of the chain, the pipes
+  // between the stages are not copied...
+  //
+
+  if (trace && cupsArrayCount(chain) > 0)
+  {
+    ((chain_stage_t *)cupsArrayFirst(chain))->trace.count_input = 1;
+    ((chain_stage_t *)cupsArrayLast(chain))->trace.count_output = 1;
+  }
+
+  return (chain);
+}
+
+
+//
+// 'delete_chain()' - Free a chain created by create_chain().
+//
+
+void
+delete_chain(cups_array_t *chain)	// I - Filters in chain
+{
+  chain_stage_t	*stage;			// Current filter
+
+
+  for (stage = (chain_stage_t *)cupsArrayFirst(chain); stage;
+       stage = (chain_stage_t *)cupsArrayNext(chain))
+    free(stage);
+  cupsArrayDelete(chain);
+}
+
+
+//
+// 'filterchain_run()' - Run a chain given by its name, the module's
+//                       entry point.
+//
+
+int					// O - Exit status
+filterchain_run(const char *chain_name,	// I - "<filter>+<filter>+..."
+		int        argc,	// I - Number of command-line args
+		char       *argv[],	// I - Command-line arguments
+		int        *canceled)	// I - Set to 1 on SIGTERM
+{
+  int		ret;			// Exit status
+  char		*name;			// Chain name for create_chain()
+  cups_array_t	*chain;			// Filters in chain
+
+
+  if (!strchr(chain_name, '+'))
+  {
+    fprintf(stderr, "ERROR: Invalid filter chain \"%s\".\n", chain_name);
+    return (1);
+  }
+
+  if ((name = strdup(chain_name)) == NULL)
+    return (1);
+
+  chain = create_chain(name);
+  free(name);
+
+  if (!chain)
+    return (1);
+
+  ret = run_chain(argc, argv, chain, NULL, canceled);
+
+  delete_chain(chain);
+
+  return (ret);
+}
+
+
+//
+// 'run_chain()' - Run the filter chain in this process.
+//
+// This does what ppdFilterCUPSWrapper() does for the individual
+// wrappers, but it can take the PPD file already parsed by the worker,
+// so that only the options of the job get applied to it.
+//
+
+int					// O - Exit status
+run_chain(int          argc,		// I - Number of command-line args
+	  char         *argv[],		// I - Command-line arguments
+	  cups_array_t *chain,		// I - Filters in chain
+	  ppd_file_t   *ppd,		// I - Parsed PPD file or NULL
+	  int          *canceled)	// I - Set to 1 on SIGTERM
+{
+  int			ret,		// Exit status
+			i,		// Stage number
+			inputfd,	// Print file
+			inputseekable;	// Is the print file seekable?
+  const char		*ppdfile;	// PPD file name
+  chain_stage_t		*stage;		// Current filter
+  cf_filter_data_t	data;		// Data for the filter functions
+  ppd_filter_data_ext_t	*ext;		// PPD extension of the data
+
+
+  if (argc < 6 || argc > 7)
+  {
+    fprintf(stderr, "Usage: %s job-id user title copies options [file]\n",
+	    argv[0]);
+    return (1);
+  }
+
+  set_parameters();
+
+  for (i = 1, stage = (chain_stage_t *)cupsArrayFirst(chain); stage;
+       i ++, stage = (chain_stage_t *)cupsArrayNext(chain))
+    fprintf(stderr, "DEBUG: Filter chain stage %d: %s\n", i,
+	    stage->filter.name);
+
+  //
+  // Open the print file...
+  //
+
+  if (argc == 7)
+  {
+    if ((inputfd = open(argv[6], O_RDONLY)) < 0)
+    {
+      if (!*canceled)
+	fprintf(stderr, "ERROR: Unable to open print file \"%s\": %s\n",
+		argv[6], strerror(errno));
+      return (1);
+    }
+    inputseekable = 1;
+  }
+  else
+  {
+    inputfd       = 0;
+    inputseekable = 0;
+  }
+
+  //
+  // Job data as the filter functions expect it from CUPS...
+  //
+
+  memset(&data, 0, sizeof(data));
+  if ((data.printer = getenv("PRINTER")) == NULL)
+    data.printer = argv[0];
+  data.job_id             = atoi(argv[1]);
+  data.job_user           = argv[2];
+  data.job_title          = argv[3];
+  data.copies             = atoi(argv[4]);
+  data.num_options        = cupsParseOptions(argv[5], 0, &data.options);
+  data.content_type       = getenv("CONTENT_TYPE");
+  data.final_content_type = getenv("FINAL_CONTENT_TYPE");
+  data.back_pipe[0]       = 3;
+  data.back_pipe[1]       = 3;
+  data.side_pipe[0]       = 4;
+  data.side_pipe[1]       = 4;
+  data.logfunc            = cfCUPSLogFunc;
+  data.logdata            = NULL;
+  data.iscanceledfunc     = cfCUPSIsCanceledFunc;
+  data.iscanceleddata     = canceled;
+
+  //
+  // Apply the options of the job to the PPD file, parsing it only if
+  // the worker has not done so already...
+  //
+
+  ppdfile = getenv("PPD");
+
+  if (ppd && ppdfile &&
+      (ext = (ppd_filter_data_ext_t *)calloc(1,
+					     sizeof(ppd_filter_data_ext_t))) !=
+      NULL)
+  {
+    ext->ppdfile = strdup(ppdfile);
+    ext->ppd     = ppd;
+    cfFilterDataAddExt(&data, PPD_FILTER_DATA_EXT, ext);
+    ret = ppdFilterLoadPPD(&data);
+  }
+  else
+    ret = ppdFilterLoadPPDFile(&data, ppdfile);
+
+  if (ret)
+    fprintf(stderr, "ERROR: Unable to load PPD file \"%s\".\n",
+	    ppdfile ? ppdfile : "(null)");
+  else if ((ret = cfFilterChain(inputfd, 1, inputseekable, &data,
+				chain)) != 0)
+    fprintf(stderr, "ERROR: filterchain filter failed.\n");
+
+  ppdFilterFreePPDFile(&data);
+  cupsFreeOptions(data.num_options, data.options);
+
+  if (inputfd)
+    close(inputfd);
+
+  return (ret);
+}
+
+
+//
+// 'set_parameters()' - Set the filter function parameters from the
+//                      environment, as the individual wrappers do.
+//
+
+static void
+set_parameters(void)
+{
+  const char	*datadir,		// CUPS_DATADIR
+		*p;
+
+
+  if ((datadir = getenv("CUPS_DATADIR")) == NULL)
+    datadir = CUPS_DATADIR;
+  snprintf(BannerDir, sizeof(BannerDir), "%s/data", datadir);
+
+  TextToPDFParams.data_dir       = (char *)datadir;
+  TextToPDFParams.char_set       = getenv("CHARSET");
+  TextToPDFParams.content_type   = getenv("CONTENT_TYPE");
+  TextToPDFParams.classification = getenv("CLASSIFICATION");
+
+  FinalOutFormat = CF_FILTER_OUT_FORMAT_PWG_RASTER;
+  if ((p = getenv("FINAL_CONTENT_TYPE")) != NULL)
+  {
+    if (strcasestr(p, "urf"))
+      FinalOutFormat = CF_FILTER_OUT_FORMAT_APPLE_RASTER;
+    else if (strcasestr(p, "cups-raster"))
+      FinalOutFormat = CF_FILTER_OUT_FORMAT_CUPS_RASTER;
+  }
+}
@@ -0,0 +1,34 @@
+//
+// Filter chain functions shared by the filterchain worker and the
+// filterchain module for cups-filters.
+//
+// Copyright © 2020-2022 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _FILTERCHAIN_RUN_H_
+#  define _FILTERCHAIN_RUN_H_
+
+//
+// Include necessary headers...
+//
+
+#  include <cupsfilters/filter.h>
+#  include <ppd/ppd.h>
+#  include "filterchain.h"
+
+
+//
+// Prototypes...
+//
+
+extern cups_array_t	*create_chain(char *chain_name);
+extern void		delete_chain(cups_array_t *chain);
+extern int		filterchain_run(const char *chain_name, int argc,
+					char *argv[], int *canceled);
+extern int		run_chain(int argc, char *argv[], cups_array_t *chain,
+				  ppd_file_t *ppd, int *canceled);
+
+#endif // !_FILTERCHAIN_RUN_H_
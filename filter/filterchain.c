@@ -0,0 +1,934 @@
+//
+// Resident worker running filter chains for cups-filters.
+//
+// The symbolic links named "<filter>+<filter>+..." (for example
+// "pdftopdf+gstoraster") point to filterchain-client, which runs several
+// filter functions as one CUPS filter. Started as
+// "filterchain --worker <socket>" this program stays resident and runs
+// the jobs handed over by filterchain-client. The worker keeps the
+// libraries loaded, the chains it has resolved, and the PPD files it has
+// parsed, each job runs in a fork of it which only applies the options
+// of the job.
+//
+// Copyright © 2020-2022 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Contents:
+//
+//   main()         - Main entry.
+//   cancel_job()   - Flag the job as canceled.
+//   child_exited() - Wake up the worker's job supervisor.
+//   set_signal()   - Set a signal handler.
+//   worker()       - Run as resident worker, taking jobs on a Unix socket.
+//   worker_chain() - Get the chain of a job, resolving it the first time
+//                    it is used.
+//   worker_free()  - Free a job received by the worker.
+//   worker_job()   - Run one job in the worker and report its exit status.
+//   worker_ppd()   - Get the parsed PPD file of a job.
+//   worker_read()  - Read more of a request from a filter.
+//   worker_start() - Start a job whose request is complete.
+//   write_all()    - Write a buffer completely.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "filterchain-run.h"
+#include "filter-trace.h"
+#include <config.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+//
+// Constants...
+//
+
+#define WORKER_TIMEOUT	5		// Seconds to wait for a request
+#define WORKER_MAX_CONNS 64		// Requests received at the same time
+#define WORKER_MAX_PPDS	32		// PPD files kept parsed
+
+
+//
+// Types...
+//
+
+typedef struct worker_chain_s		// Chain resolved by the worker
+{
+  char			*name;		// Chain name
+  int			trace;		// Are the stages traced?
+  cups_array_t		*chain;		// Filters in chain
+} worker_chain_t;
+
+typedef struct worker_ppd_s		// PPD file parsed by the worker
+{
+  char			*filename;	// PPD file name
+  time_t		mtime;		// Modification time of the file
+  off_t			size;		// Size of the file
+  ino_t			ino;		// Inode of the file
+  time_t		used;		// Last time a job used it
+  ppd_file_t		*ppd;		// Parsed PPD file
+} worker_ppd_t;
+
+typedef struct worker_job_s		// Job received by the worker
+{
+  unsigned		fdmask;		// Bit mask of the fds 0-4 passed along
+  int			num_fds,	// Number of fds received
+			fds[WORKER_NUM_FDS];
+					// Received fds
+  char			*strings,	// Strings of the request
+			*chain_name,	// Chain name
+			**argv,		// Arguments
+			**envp;		// Environment
+  int			argc;		// Number of arguments
+} worker_job_t;
+
+typedef struct worker_conn_s		// Connection sending a request
+{
+  int			fd;		// Connection to the filter
+  time_t		start;		// Time of connecting
+  worker_request_t	req;		// Request header
+  size_t		bytes;		// Bytes of the request received
+  worker_job_t		job;		// Job received
+} worker_conn_t;
+
+
+//
+// Local globals...
+//
+
+static int		JobCanceled = 0; // Set to 1 on SIGTERM
+static int		ChildPipe[2] = { -1, -1 };
+					// Wakes up the worker on SIGCHLD
+static cups_array_t	*WorkerChains = NULL,
+					// Chains resolved by the worker
+			*WorkerPPDs = NULL;
+					// PPD files parsed by the worker
+static worker_conn_t	WorkerConns[WORKER_MAX_CONNS];
+					// Requests being received
+static int		NumWorkerConns = 0;
+					// Number of requests being received
+
+
+//
+// Local functions...
+//
+
+static void		cancel_job(int sig);
+static void		child_exited(int sig);
+static void		set_signal(int sig, void (*handler)(int));
+static int		worker(const char *sockname);
+static cups_array_t	*worker_chain(worker_job_t *job);
+static void		worker_free(worker_job_t *job);
+static void		worker_job(int fd, worker_job_t *job,
+				   cups_array_t *chain, ppd_file_t *ppd);
+static ppd_file_t	*worker_ppd(worker_job_t *job);
+static int		worker_read(worker_conn_t *conn);
+static void		worker_start(int listenfd, worker_conn_t *conn);
+static int		write_all(int fd, const void *buf, size_t len);
+
+
+//
+// 'main()' - Main entry.
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line args
+     char *argv[])			// I - Command-line arguments
+{
+  if (argc == 3 && !strcmp(argv[1], "--worker"))
+    return (worker(argv[2]));
+
+  //
+  // The filter chains themselves get run by filterchain-client...
+  //
+
+  fputs("Usage: filterchain --worker <socket>\n", stderr);
+
+  return (1);
+}
+
+
+//
+// 'cancel_job()' - Flag the job as canceled.
+//
+
+static void
+cancel_job(int sig)			// I - Signal number (unused)
+{
+  (void)sig;
+
+  JobCanceled = 1;
+}
+
+
+//
+// 'child_exited()' - Wake up the worker's job supervisor.
+//
+
+static void
+child_exited(int sig)			// I - Signal number (unused)
+{
+  int		saved_errno = errno;	// Keep errno of interrupted code
+  ssize_t	bytes;			// A full pipe wakes up anyway
+
+
+  (void)sig;
+
+  bytes = write(ChildPipe[1], "x", 1);
+  (void)bytes;
+
+  errno = saved_errno;
+}
+
+
+//
+// 'set_signal()' - Set a signal handler.
+//
+
+static void
+set_signal(int  sig,			// I - Signal number
+	   void (*handler)(int))	// I - Handler, SIG_DFL, or SIG_IGN
+{
+#if defined(HAVE_SIGACTION) && !defined(HAVE_SIGSET)
+  struct sigaction action;		// Actions for POSIX signals
+#endif // HAVE_SIGACTION && !HAVE_SIGSET
+
+
+#ifdef HAVE_SIGSET // Use System V signals over POSIX to avoid bugs
+  sigset(sig, handler);
+#elif defined(HAVE_SIGACTION)
+  memset(&action, 0, sizeof(action));
+
+  sigemptyset(&action.sa_mask);
+  action.sa_handler = handler;
+  sigaction(sig, &action, NULL);
+#else
+  signal(sig, handler);
+#endif // HAVE_SIGSET
+}
+
+
+//
+// 'worker()' - Run as resident worker, taking jobs on a Unix socket.
+//
+// Each job is run by a fork of this process, which has the libraries
+// loaded and initialized already, instead of by a freshly exec'ed
+// filter. The requests are read here, without blocking, so that a slow
+// client does not hold up the others, and so that the chain and the PPD
+// file of a job get resolved and parsed only the first time they are
+// used and are inherited by the forks after that.
+//
+
+static int				// O - Exit status
+worker(const char *sockname)		// I - Socket to listen on
+{
+  int			fd,		// Listening socket
+			client,		// Connection to a filter
+			i,
+			ret;		// Result of reading a request
+  mode_t		old_umask;	// Umask to restore
+  struct sockaddr_un	addr;		// Socket address
+  struct pollfd		pfds[WORKER_MAX_CONNS + 1];
+					// Listening socket and connections
+  worker_conn_t		*conn;		// Current connection
+  time_t		now;		// Current time
+#ifdef SO_PEERCRED
+  struct ucred		cred;		// Credentials of the filter
+  socklen_t		credlen;
+#endif // SO_PEERCRED
+
+
+  if (strlen(sockname) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "ERROR: Socket name \"%s\" too long.\n", sockname);
+    return (1);
+  }
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+  {
+    fprintf(stderr, "ERROR: Unable to create socket: %s\n", strerror(errno));
+    return (1);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, sockname, sizeof(addr.sun_path) - 1);
+
+  //
+  // Only our own user (the one CUPS runs the filters as) may connect...
+  //
+
+  unlink(sockname);
+  old_umask = umask(077);
+  ret       = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  umask(old_umask);
+
+  if (ret || listen(fd, 64))
+  {
+    fprintf(stderr, "ERROR: Unable to listen on %s: %s\n", sockname,
+	    strerror(errno));
+    close(fd);
+    return (1);
+  }
+
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+
+  fprintf(stderr, "DEBUG: Filter worker listening on %s.\n", sockname);
+
+  WorkerChains = cupsArrayNew(NULL, NULL);
+  WorkerPPDs   = cupsArrayNew(NULL, NULL);
+
+  //
+  // Job supervisors get reaped automatically...
+  //
+
+  set_signal(SIGCHLD, SIG_IGN);
+  set_signal(SIGPIPE, SIG_IGN);
+
+  for (;;)
+  {
+    //
+    // Wait for new connections and for the requests coming in...
+    //
+
+    pfds[0].fd      = NumWorkerConns < WORKER_MAX_CONNS ? fd : -1;
+    pfds[0].events  = POLLIN;
+    pfds[0].revents = 0;
+
+    for (i = 0; i < NumWorkerConns; i ++)
+    {
+      pfds[i + 1].fd      = WorkerConns[i].fd;
+      pfds[i + 1].events  = POLLIN;
+      pfds[i + 1].revents = 0;
+    }
+
+    if (poll(pfds, (nfds_t)NumWorkerConns + 1, 1000) < 0)
+    {
+      if (errno != EINTR)
+      {
+	fprintf(stderr, "ERROR: Unable to poll connections: %s\n",
+		strerror(errno));
+	sleep(1);
+      }
+      continue;
+    }
+
+    now = time(NULL);
+
+    //
+    // Read the requests, starting the complete ones and dropping the
+    // broken and stuck ones. Going backwards, the last connection can
+    // take the place of a dropped one...
+    //
+
+    for (i = NumWorkerConns - 1; i >= 0; i --)
+    {
+      conn = WorkerConns + i;
+
+      if (pfds[i + 1].revents)
+      {
+	if ((ret = worker_read(conn)) > 0)
+	  worker_start(fd, conn);
+      }
+      else if (now - conn->start > WORKER_TIMEOUT)
+      {
+	fputs("ERROR: Timeout reading request to filter worker.\n", stderr);
+	ret = -1;
+      }
+      else
+	ret = 0;
+
+      if (ret)
+      {
+	worker_free(&(conn->job));
+	close(conn->fd);
+
+	NumWorkerConns --;
+	if (i < NumWorkerConns)
+	  *conn = WorkerConns[NumWorkerConns];
+      }
+    }
+
+    //
+    // Accept new connections...
+    //
+
+    if (!pfds[0].revents)
+      continue;
+
+    while (NumWorkerConns < WORKER_MAX_CONNS)
+    {
+      if ((client = accept(fd, NULL, NULL)) < 0)
+      {
+	if (errno == EINTR || errno == ECONNABORTED)
+	  continue;
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK)
+	{
+	  fprintf(stderr, "ERROR: Unable to accept connection: %s\n",
+		  strerror(errno));
+	  sleep(1);
+	}
+	break;
+      }
+
+#ifdef SO_PEERCRED
+      credlen = sizeof(cred);
+      if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) ||
+	  (cred.uid != getuid() && cred.uid != 0))
+      {
+	fputs("ERROR: Rejecting connection from another user.\n", stderr);
+	close(client);
+	continue;
+      }
+#endif // SO_PEERCRED
+
+      fcntl(client, F_SETFL, O_NONBLOCK);
+
+      conn = WorkerConns + NumWorkerConns;
+      NumWorkerConns ++;
+
+      memset(conn, 0, sizeof(worker_conn_t));
+      conn->fd    = client;
+      conn->start = now;
+    }
+  }
+
+  return (0);
+}
+
+
+//
+// 'worker_chain()' - Get the chain of a job, resolving it the first
+//                    time it is used.
+//
+
+static cups_array_t *			// O - Filters in chain or NULL
+worker_chain(worker_job_t *job)		// I - Job
+{
+  worker_chain_t	*wc;		// Resolved chain
+  char			*name;		// Chain name for create_chain()
+  char			**saved_environ;// Environment of the worker
+  int			trace;		// Are the stages traced?
+  extern char		**environ;
+
+
+  //
+  // Whether the stages get traced depends on the environment of the
+  // job...
+  //
+
+  saved_environ = environ;
+  environ       = job->envp;
+  trace         = trace_enabled();
+  environ       = saved_environ;
+
+  for (wc = (worker_chain_t *)cupsArrayFirst(WorkerChains); wc;
+       wc = (worker_chain_t *)cupsArrayNext(WorkerChains))
+    if (wc->trace == trace && !strcmp(wc->name, job->chain_name))
+      return (wc->chain);
+
+  if (!strchr(job->chain_name, '+'))
+  {
+    fprintf(stderr, "ERROR: Invalid filter chain \"%s\".\n",
+	    job->chain_name);
+    return (NULL);
+  }
+
+  if ((name = strdup(job->chain_name)) == NULL)
+    return (NULL);
+
+  environ = job->envp;
+  wc      = (worker_chain_t *)calloc(1, sizeof(worker_chain_t));
+  if (wc && (wc->chain = create_chain(name)) != NULL)
+  {
+    wc->name  = strdup(job->chain_name);
+    wc->trace = trace;
+    cupsArrayAdd(WorkerChains, wc);
+    fprintf(stderr, "DEBUG: Resolved filter chain %s.\n", wc->name);
+  }
+  else
+  {
+    free(wc);
+    wc = NULL;
+  }
+  environ = saved_environ;
+
+  free(name);
+
+  return (wc ? wc->chain : NULL);
+}
+
+
+//
+// 'worker_free()' - Free a job received by the worker.
+//
+
+static void
+worker_free(worker_job_t *job)		// I - Job
+{
+  int	i;				// Looping var
+
+
+  for (i = 0; i < job->num_fds; i ++)
+    close(job->fds[i]);
+
+  free(job->strings);
+  free(job->argv);
+  free(job->envp);
+
+  memset(job, 0, sizeof(worker_job_t));
+}
+
+
+//
+// 'worker_job()' - Run one job in the worker and report its exit status.
+//
+// The filter chain runs in a child process with the filter's fds,
+// arguments and environment, so that it behaves as if exec'ed by CUPS.
+// This process supervises it, sending SIGTERM when the filter gets
+// canceled or goes away.
+//
+
+static void
+worker_job(int          fd,		// I - Connection to the filter
+	   worker_job_t *job,		// I - Job
+	   cups_array_t *chain,		// I - Filters in chain
+	   ppd_file_t   *ppd)		// I - Parsed PPD file or NULL
+{
+  int			i, j,
+			newfd,		// Moved fd
+			status,		// Exit status
+			canceled = 0;	// SIGTERM sent?
+  struct pollfd		pfds[2];
+  char			cmd;
+  pid_t			pid;
+  extern char		**environ;
+
+
+  //
+  // Start the filter chain...
+  //
+
+  if (pipe(ChildPipe))
+  {
+    fprintf(stderr, "ERROR: Unable to create pipe: %s\n", strerror(errno));
+    return;
+  }
+  fcntl(ChildPipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(ChildPipe[1], F_SETFL, O_NONBLOCK);
+  set_signal(SIGCHLD, child_exited);
+
+  if ((pid = fork()) == 0)
+  {
+    //
+    // Child: Put the filter's fds in place and behave like it...
+    //
+
+    set_signal(SIGCHLD, SIG_DFL);
+    set_signal(SIGPIPE, SIG_DFL);
+    set_signal(SIGTERM, cancel_job);
+    close(ChildPipe[0]);
+    close(ChildPipe[1]);
+    close(fd);
+
+    // Move the received fds out of the way first, so that dup2() does
+    // not overwrite one of them
+    for (j = 0; j < job->num_fds; j ++)
+      if (job->fds[j] < WORKER_NUM_FDS)
+      {
+	newfd = fcntl(job->fds[j], F_DUPFD, WORKER_NUM_FDS);
+	close(job->fds[j]);
+	job->fds[j] = newfd;
+      }
+
+    for (i = 0, j = 0; i < WORKER_NUM_FDS; i ++)
+      if ((job->fdmask & (1U << i)) && j < job->num_fds)
+      {
+	dup2(job->fds[j], i);
+	close(job->fds[j]);
+	j ++;
+      }
+      else
+	close(i);
+
+    environ = job->envp;
+
+    exit(run_chain(job->argc, job->argv, chain, ppd, &JobCanceled));
+  }
+  else if (pid < 0)
+  {
+    fprintf(stderr, "ERROR: Unable to fork: %s\n", strerror(errno));
+    status = 1;
+    write_all(fd, &status, sizeof(status));
+    return;
+  }
+
+  for (i = 0; i < job->num_fds; i ++)
+    close(job->fds[i]);
+  job->num_fds = 0;
+
+  //
+  // Forward a cancellation until the chain finishes...
+  //
+
+  while (waitpid(pid, &status, WNOHANG) != pid)
+  {
+    pfds[0].fd      = canceled ? -1 : fd;
+    pfds[0].events  = POLLIN;
+    pfds[0].revents = 0;
+    pfds[1].fd      = ChildPipe[0];
+    pfds[1].events  = POLLIN;
+    pfds[1].revents = 0;
+
+    if (poll(pfds, 2, -1) <= 0)
+      continue;
+
+    if (pfds[1].revents)
+      while (read(ChildPipe[0], &cmd, 1) > 0);
+
+    // Cancel request, or the filter process went away
+    if (pfds[0].revents && (read(fd, &cmd, 1) != 1 || cmd == 'C'))
+    {
+      kill(pid, SIGTERM);
+      canceled = 1;
+    }
+  }
+
+  if (WIFEXITED(status))
+    status = WEXITSTATUS(status);
+  else if (WIFSIGNALED(status))
+    status = -WTERMSIG(status);
+  else
+    status = 1;
+
+  write_all(fd, &status, sizeof(status));
+}
+
+
+//
+// 'worker_ppd()' - Get the parsed PPD file of a job.
+//
+// The PPD files are kept parsed but unmarked, keyed by file name and
+// modification time, so a changed queue gets its PPD file parsed again.
+// The forks running the jobs mark the options of the job in their copy.
+//
+
+static ppd_file_t *			// O - Parsed PPD file or NULL
+worker_ppd(worker_job_t *job)		// I - Job
+{
+  char		**envp;			// Environment of the job
+  const char	*filename = NULL;	// PPD file of the job
+  struct stat	fileinfo;		// PPD file information
+  worker_ppd_t	*wp,			// Parsed PPD file
+		*oldest;		// Least recently used one
+
+
+  for (envp = job->envp; *envp; envp ++)
+    if (!strncmp(*envp, "PPD=", 4))
+    {
+      filename = *envp + 4;
+      break;
+    }
+
+  if (!filename || !*filename || stat(filename, &fileinfo))
+    return (NULL);
+
+  for (wp = (worker_ppd_t *)cupsArrayFirst(WorkerPPDs); wp;
+       wp = (worker_ppd_t *)cupsArrayNext(WorkerPPDs))
+    if (!strcmp(wp->filename, filename))
+      break;
+
+  if (wp && wp->mtime == fileinfo.st_mtime &&
+      wp->size == fileinfo.st_size && wp->ino == fileinfo.st_ino)
+  {
+    wp->used = time(NULL);
+    return (wp->ppd);
+  }
+
+  //
+  // Drop the outdated copy of the PPD file, or the least recently used
+  // PPD file if there are too many...
+  //
+
+  if (!wp && cupsArrayCount(WorkerPPDs) >= WORKER_MAX_PPDS)
+    for (oldest = (worker_ppd_t *)cupsArrayFirst(WorkerPPDs);
+	 oldest; oldest = (worker_ppd_t *)cupsArrayNext(WorkerPPDs))
+      if (!wp || oldest->used < wp->used)
+	wp = oldest;
+
+  if (wp)
+  {
+    cupsArrayRemove(WorkerPPDs, wp);
+    ppdClose(wp->ppd);
+    free(wp->filename);
+    free(wp);
+  }
+
+  //
+  // Parse the PPD file, on error the job reports it...
+  //
+
+  if ((wp = (worker_ppd_t *)calloc(1, sizeof(worker_ppd_t))) == NULL)
+    return (NULL);
+
+  if ((wp->ppd = ppdOpenFile(filename)) == NULL)
+  {
+    free(wp);
+    return (NULL);
+  }
+
+  wp->filename = strdup(filename);
+  wp->mtime    = fileinfo.st_mtime;
+  wp->size     = fileinfo.st_size;
+  wp->ino      = fileinfo.st_ino;
+  wp->used     = time(NULL);
+
+  cupsArrayAdd(WorkerPPDs, wp);
+
+  fprintf(stderr, "DEBUG: Parsed PPD file %s.\n", filename);
+
+  return (wp->ppd);
+}
+
+
+//
+// 'worker_read()' - Read more of a request from a filter.
+//
+// The connection does not block, each call reads what has arrived: the
+// header together with the fds first, then the strings.
+//
+
+static int				// O - 1 if complete, 0 if not yet,
+					//     -1 on error
+worker_read(worker_conn_t *conn)	// I - Connection to the filter
+{
+  int			i, n;
+  worker_job_t		*job = &(conn->job);
+					// Job being received
+  size_t		done;		// Bytes of the strings received
+  char			*ptr,
+			*end;
+  int			envc,
+			newfd;		// Received fd
+  struct msghdr		msg;		// Message with the fds
+  struct iovec		iov;
+  struct cmsghdr	*cmsg;
+  union
+  {
+    struct cmsghdr	align;
+    char		buf[CMSG_SPACE(sizeof(int) * WORKER_NUM_FDS)];
+  }			control;
+  ssize_t		bytes;
+
+
+  if (conn->bytes < sizeof(worker_request_t))
+  {
+    //
+    // Receive header and fds...
+    //
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base       = (char *)&(conn->req) + conn->bytes;
+    iov.iov_len        = sizeof(worker_request_t) - conn->bytes;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    while ((bytes = recvmsg(conn->fd, &msg, 0)) < 0 && errno == EINTR);
+
+    if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return (0);
+
+    if (bytes > 0)
+      for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+	{
+	  n = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+	  for (i = 0; i < n; i ++)
+	  {
+	    memcpy(&newfd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+	    if (job->num_fds < WORKER_NUM_FDS)
+	      job->fds[job->num_fds ++] = newfd;
+	    else
+	      close(newfd);
+	  }
+	}
+
+    if (bytes <= 0)
+    {
+      fputs("ERROR: Incomplete request to filter worker.\n", stderr);
+      return (-1);
+    }
+
+    conn->bytes += (size_t)bytes;
+    if (conn->bytes < sizeof(worker_request_t))
+      return (0);
+
+    if (conn->req.magic != WORKER_MAGIC || conn->req.length == 0 ||
+	conn->req.length > WORKER_MAX_REQ || conn->req.argc == 0)
+    {
+      fputs("ERROR: Invalid request to filter worker.\n", stderr);
+      return (-1);
+    }
+
+    job->fdmask = conn->req.fds;
+    if ((job->strings = malloc(conn->req.length + 1)) == NULL)
+      return (-1);
+  }
+
+  //
+  // Receive the strings...
+  //
+
+  done = conn->bytes - sizeof(worker_request_t);
+
+  while ((bytes = read(conn->fd, job->strings + done,
+		       conn->req.length - done)) < 0 && errno == EINTR);
+
+  if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return (0);
+
+  if (bytes <= 0)
+  {
+    fputs("ERROR: Incomplete request to filter worker.\n", stderr);
+    return (-1);
+  }
+
+  conn->bytes += (size_t)bytes;
+  if ((done += (size_t)bytes) < conn->req.length)
+    return (0);
+
+  job->strings[conn->req.length] = '\0';
+  end = job->strings + conn->req.length;
+
+  //
+  // Split up the strings...
+  //
+
+  job->chain_name = job->strings;
+  ptr             = job->strings + strlen(job->strings) + 1;
+
+  job->argc = (int)conn->req.argc;
+  job->argv = calloc((size_t)job->argc + 1, sizeof(char *));
+  for (i = 0; i < job->argc; i ++)
+  {
+    if (ptr >= end)
+    {
+      fputs("ERROR: Incomplete request to filter worker.\n", stderr);
+      return (-1);
+    }
+    job->argv[i] = ptr;
+    ptr += strlen(ptr) + 1;
+  }
+
+  for (envc = 0, i = (int)(ptr - job->strings); i < (int)conn->req.length;
+       i += (int)strlen(job->strings + i) + 1)
+    envc ++;
+  job->envp = calloc((size_t)envc + 1, sizeof(char *));
+  for (i = 0; i < envc; i ++)
+  {
+    job->envp[i] = ptr;
+    ptr += strlen(ptr) + 1;
+  }
+
+  return (1);
+}
+
+
+//
+// 'worker_start()' - Start a job whose request is complete.
+//
+
+static void
+worker_start(int           listenfd,	// I - Listening socket
+	     worker_conn_t *conn)	// I - Connection with the request
+{
+  int		i,
+		status;			// Exit status for a failed job
+  pid_t		pid;			// Job supervisor
+  cups_array_t	*chain;			// Filters of the job
+  ppd_file_t	*ppd;			// PPD file of the job
+
+
+  if ((chain = worker_chain(&(conn->job))) == NULL)
+  {
+    status = 1;
+    write_all(conn->fd, &status, sizeof(status));
+    return;
+  }
+
+  ppd = worker_ppd(&(conn->job));
+
+  if ((pid = fork()) == 0)
+  {
+    //
+    // Child: Let go of the other connections, so that the worker
+    // dropping one gets noticed by its filter...
+    //
+
+    close(listenfd);
+
+    for (i = 0; i < NumWorkerConns; i ++)
+      if (WorkerConns + i != conn)
+      {
+	worker_free(&(WorkerConns[i].job));
+	close(WorkerConns[i].fd);
+      }
+
+    fcntl(conn->fd, F_SETFL, 0);
+
+    worker_job(conn->fd, &(conn->job), chain, ppd);
+    exit(0);
+  }
+  else if (pid < 0)
+  {
+    fprintf(stderr, "ERROR: Unable to fork: %s\n", strerror(errno));
+    status = 1;
+    write_all(conn->fd, &status, sizeof(status));
+  }
+}
+
+
+//
+// 'write_all()' - Write a buffer completely.
+//
+
+static int				// O - 0 on success, -1 on error
+write_all(int        fd,		// I - File descriptor
+	  const void *buf,		// I - Buffer
+	  size_t     len)		// I - Number of bytes
+{
+  const char	*ptr = (const char *)buf;// Current position
+  ssize_t	bytes;			// Bytes written
+
+
+  while (len > 0)
+  {
+    if ((bytes = write(fd, ptr, len)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+	continue;
+      return (-1);
+    }
+
+    ptr += bytes;
+    len -= (size_t)bytes;
+  }
+
+  return (0);
+}
@@ -0,0 +1,52 @@
+//
+// Protocol between filterchain-client, the resident filterchain worker,
+// and the filterchain module for cups-filters.
+//
+// Copyright © 2020-2022 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _FILTERCHAIN_H_
+#  define _FILTERCHAIN_H_
+
+
+//
+// Constants...
+//
+
+#  define WORKER_MAGIC	0x46434857	// "FCHW", request to worker
+#  define WORKER_NUM_FDS 5		// stdin, stdout, stderr, back and
+					// side channel
+#  define WORKER_MAX_REQ 1048576	// Maximum size of a request
+
+#  define FILTERCHAIN_RUN "filterchain_run"
+					// Entry point of the module
+
+
+//
+// Types...
+//
+
+// The header gets sent together with the fds (SCM_RIGHTS), followed by
+// "length" bytes of nul-terminated strings: the chain name, "argc"
+// arguments, and the environment. The worker answers with the exit
+// status of the chain as an int, negative for the signal that killed
+// it. A "C" sent while the job runs cancels it.
+
+typedef struct worker_request_s		// Header of a request to the worker
+{
+  unsigned		magic;		// WORKER_MAGIC
+  unsigned		fds;		// Bit mask of the fds 0-4 passed along
+  unsigned		argc;		// Number of arguments
+  unsigned		length;		// Length of the strings following
+} worker_request_t;
+
+// Without worker filterchain-client loads the filterchain module and
+// runs the chain in its own process through this entry point.
+
+typedef int (*filterchain_run_t)(const char *chain_name, int argc,
+				 char *argv[], int *canceled);
+
+#endif // !_FILTERCHAIN_H_
@@ -106,6 +106,15 @@ dstr_t *jclappend;
 // in production.
 int debug = 0;
 
+// Set render_monitor to 1 to let foomatic-rip watch the renderer while it
+// is running: Its stderr gets parsed for page progress, the bytes it sends
+// to the printer get counted, and "PAGE:", "ATTR: job-media-progress" and
+// throughput "DEBUG:" lines are issued while the job is rendered. If
+// renderer_timeout is set to a positive number of seconds, a renderer
+// which neither outputs data nor messages for that long gets killed.
+int render_monitor = 0;
+int renderer_timeout = 0;
+
 // Path to the GhostScript which foomatic-rip shall use
 char gspath[PATH_MAX] = "gs";
 
@@ -158,6 +167,10 @@ config_set_option(const char *key,
     strlcpy(gspath, value, PATH_MAX);
   else if (strcmp(key, "echo") == 0)
     strlcpy(echopath, value, PATH_MAX);
+  else if (strcmp(key, "render_monitor") == 0)
+    render_monitor = atoi(value);
+  else if (strcmp(key, "renderer_timeout") == 0)
+    renderer_timeout = atoi(value);
 }
 
 
@@ -68,6 +68,8 @@ extern char **jclprepend;
 extern int jobhasjcl;
 extern char cupsfilterpath[PATH_MAX];
 extern int debug;
+extern int render_monitor;
+extern int renderer_timeout;
 extern int do_docs;
 extern char printer_model[];
 extern int dontparse;
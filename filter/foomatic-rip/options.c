@@ -26,6 +26,70 @@ typedef struct icc_mapping_entry_s
   char *filename;
 } icc_mapping_entry_t;
 
+// Hash index entry for find_option(), each option has one for its name
+// and one for its "no<Option>" boolean form
+typedef struct option_index_s
+{
+  char key [130];
+  option_t *opt;
+  struct option_index_s *next;
+} option_index_t;
+
+// Value IDs in the optionset value tables, other IDs are strings in
+// value_pool
+#define VALUE_NONE 0          // No value in this optionset
+#define VALUE_NULL 1          // Value set, but not valid or from a composite
+
+// Optionset, with a table of the value IDs for all options (by column)
+typedef struct optionset_s
+{
+  char *name;
+  unsigned hash;
+  int *values;
+  option_t **fromoptions;     // Composite which set the value, if any
+  unsigned generation;        // Incremented on every change of values
+  int copy_of;                // Optionset this is an unchanged copy of
+  unsigned copy_generation;   // Our generation right after the copy
+  unsigned source_generation; // Generation of copy_of when copied
+  struct cmdline_cache_s *cmdline; // Last build_commandline() result
+} optionset_t;
+
+// Renderer command line, split into its literal text and the first spot
+// marker ("%A", "%B", ...) of each spot, with the option snippets to
+// insert before it
+typedef struct cmdline_slot_s
+{
+  char spot;
+  size_t pos;                 // Offset of the marker in source
+  dstr_t *frags;              // Snippets, in the order of the options
+} cmdline_slot_t;
+
+typedef struct cmdline_template_s
+{
+  char *source;               // Command line this was compiled from
+  int nslots;
+  cmdline_slot_t slots [256]; // In the order of the markers
+  int spots [256];            // Slot index + 1 of each spot, or 0
+} cmdline_template_t;
+
+// Output of build_commandline() for an optionset, valid as long as the
+// values of the optionset do not change
+typedef struct cmdline_cache_s
+{
+  int valid;
+  unsigned generation;        // Generation of the optionset
+  unsigned header_generation; // Generation of "header" for "currentpage"
+  size_t options;             // Number of options
+  int pdfcmdline;             // Template of cmdline, -1 for none
+  char *template;             // Command line the result was built from
+  int jcl;                    // JCL options found
+  dstr_t *cmdline;
+  dstr_t *prolog;
+  dstr_t *setup;
+  dstr_t *pagesetup;
+  dstr_t *jclprepend;
+} cmdline_cache_t;
+
 // Values from foomatic keywords in the ppd file
 extern char printer_model [256];
 char printer_id [256];
@@ -62,6 +126,9 @@ dstr_t *prologprepend;
 dstr_t *setupprepend;
 dstr_t *pagesetupprepend;
 
+// Compiled templates of cmd and cmd_pdf
+static cmdline_template_t cmdline_templates [2];
+
 
 list_t *qualifier_data = NULL;
 char **qualifier = NULL;
@@ -69,8 +136,29 @@ char **qualifier = NULL;
 option_t *optionlist = NULL;
 option_t *optionlist_sorted_by_order = NULL;
 
+// Last option of optionlist, and the hash index of its names (the chains
+// are in the order of optionlist, so the first match is the same as the
+// first match when scanning optionlist)
+static option_t *optionlist_tail = NULL;
+static option_index_t **option_index = NULL;
+static size_t option_index_size = 0;
+static size_t option_index_count = 0;
+
+static void free_option_index();
+
 int optionset_alloc, optionset_count;
-char **optionsets;
+static optionset_t *optionsets;
+
+// Number of options and allocated columns in the value tables
+static int option_columns = 0;
+static int option_columns_alloc = 0;
+
+// Interned value strings (index is the value ID) and their hash index
+static char **value_pool = NULL;
+static int value_pool_count = 0;
+static int value_pool_alloc = 0;
+static int *value_pool_index = NULL;
+static int value_pool_index_size = 0;
 
 
 char *
@@ -249,7 +337,7 @@ options_init()
 {
   optionset_alloc = 8;
   optionset_count = 0;
-  optionsets = calloc(optionset_alloc, sizeof(char *));
+  optionsets = calloc(optionset_alloc, sizeof(optionset_t));
 
   prologprepend = create_dstr();
   setupprepend = create_dstr();
@@ -280,12 +368,92 @@ free_param(param_t *param)
 //  Values
 //
 
+static unsigned
+value_hash(const char *value)
+{
+  unsigned hash = 2166136261U;
+
+  // FNV-1a
+  for (; *value; value ++)
+    hash = (hash ^ (unsigned char)*value) * 16777619U;
+  return (hash);
+}
+
+
+// Returns the ID of a value string, adding it to value_pool if new
+static int
+value_intern(const char *value)
+{
+  int i, id, size;
+  unsigned slot;
+  int *index;
+
+  if (!value)
+    return (VALUE_NULL);
+
+  if (value_pool_count == 0)
+    value_pool_count = 2;     // VALUE_NONE and VALUE_NULL
+
+  if (2 * value_pool_count >= value_pool_index_size)
+  {
+    // Grow the open-addressing index and re-add all strings
+    size = value_pool_index_size ? 2 * value_pool_index_size : 256;
+    index = calloc(size, sizeof(int));
+    if (!index)
+      rip_die(EXIT_PRNERR, "Memory allocation failed for option values");
+    for (i = 2; i < value_pool_count; i ++)
+    {
+      for (slot = value_hash(value_pool[i]) & (size - 1); index[slot];
+	   slot = (slot + 1) & (size - 1));
+      index[slot] = i;
+    }
+    free(value_pool_index);
+    value_pool_index = index;
+    value_pool_index_size = size;
+  }
+
+  for (slot = value_hash(value) & (value_pool_index_size - 1);
+       (id = value_pool_index[slot]) != 0;
+       slot = (slot + 1) & (value_pool_index_size - 1))
+    if (!strcmp(value_pool[id], value))
+      return (id);
+
+  if (value_pool_count >= value_pool_alloc)
+  {
+    value_pool_alloc = value_pool_alloc ? 2 * value_pool_alloc : 256;
+    value_pool = realloc(value_pool, value_pool_alloc * sizeof(char *));
+    if (!value_pool)
+      rip_die(EXIT_PRNERR, "Memory allocation failed for option values");
+  }
+
+  id = value_pool_count ++;
+  value_pool[id] = strdup(value);
+  value_pool_index[slot] = id;
+  return (id);
+}
+
+
+static const char *
+value_string(int id)
+{
+  return (id >= 2 ? value_pool[id] : NULL);
+}
+
+
 static void
-free_value(value_t *val)
+free_values()
 {
-  if (val->value)
-    free(val->value);
-  free(val);
+  int i;
+
+  for (i = 2; i < value_pool_count; i ++)
+    free(value_pool[i]);
+  free(value_pool);
+  free(value_pool_index);
+  value_pool = NULL;
+  value_pool_index = NULL;
+  value_pool_count = 0;
+  value_pool_alloc = 0;
+  value_pool_index_size = 0;
 }
 
 
@@ -297,21 +465,16 @@ static void free_option(option_t *opt)
 {
   choice_t *choice;
   param_t *param;
-  value_t *value;
 
   free(opt->custom_command);
   free(opt->proto);
+  free(opt->command);
 
-  while (opt->valuelist)
-  {
-    value = opt->valuelist;
-    opt->valuelist = opt->valuelist->next;
-    free_value(value);
-  }
   while (opt->choicelist)
   {
     choice = opt->choicelist;
     opt->choicelist = opt->choicelist->next;
+    free(choice->command);
     free(choice);
   }
   while (opt->paramlist)
@@ -327,20 +490,44 @@ static void free_option(option_t *opt)
 }
 
 
+static void
+free_cmdline_cache(cmdline_cache_t *cache)
+{
+  if (!cache)
+    return;
+
+  free_dstr(cache->cmdline);
+  free_dstr(cache->prolog);
+  free_dstr(cache->setup);
+  free_dstr(cache->pagesetup);
+  free_dstr(cache->jclprepend);
+  free(cache->template);
+  free(cache);
+}
+
+
 void
 options_free()
 {
   option_t *opt;
-  int i;
+  int i, j;
   listitem_t *item;
   icc_mapping_entry_t *entry;
 
   for (i = 0; i < optionset_count; i++)
-    free(optionsets[i]);
+  {
+    free(optionsets[i].name);
+    free(optionsets[i].values);
+    free(optionsets[i].fromoptions);
+    free_cmdline_cache(optionsets[i].cmdline);
+  }
   free(optionsets);
   optionsets = NULL;
   optionset_alloc = 0;
   optionset_count = 0;
+  option_columns = 0;
+  option_columns_alloc = 0;
+  free_values();
 
   if (qualifier_data)
   {
@@ -364,6 +551,8 @@ options_free()
     optionlist = optionlist->next;
     free_option(opt);
   }
+  optionlist_tail = NULL;
+  free_option_index();
 
   if (postpipe)
     free_dstr(postpipe);
@@ -371,6 +560,15 @@ options_free()
   free_dstr(prologprepend);
   free_dstr(setupprepend);
   free_dstr(pagesetupprepend);
+
+  for (i = 0; i < 2; i ++)
+  {
+    free(cmdline_templates[i].source);
+    for (j = 0; j < 256; j ++)
+      if (cmdline_templates[i].slots[j].frags)
+	free_dstr(cmdline_templates[i].slots[j].frags);
+  }
+  memset(cmdline_templates, 0, sizeof(cmdline_templates));
 }
 
 
@@ -386,30 +584,134 @@ option_count()
 }
 
 
+static unsigned
+option_hash(const char *name)
+{
+  unsigned hash = 2166136261U;
+
+  // FNV-1a, case-insensitive
+  for (; *name; name ++)
+    hash = (hash ^ (unsigned char)tolower((unsigned char)*name)) * 16777619U;
+  return (hash);
+}
+
+
+static void
+add_option_index(const char *prefix, option_t *opt)
+{
+  option_index_t *entry, **ptr;
+
+  entry = calloc(1, sizeof(option_index_t));
+  snprintf(entry->key, sizeof(entry->key), "%s%s", prefix, opt->name);
+  entry->opt = opt;
+
+  // Append, to keep the chain in the order of optionlist
+  for (ptr = &option_index[option_hash(entry->key) &
+			   (option_index_size - 1)];
+       *ptr; ptr = &(*ptr)->next);
+  *ptr = entry;
+  option_index_count ++;
+}
+
+
+static void
+free_option_index()
+{
+  option_index_t *entry, *next;
+  size_t i;
+
+  for (i = 0; i < option_index_size; i ++)
+    for (entry = option_index[i]; entry; entry = next)
+    {
+      next = entry->next;
+      free(entry);
+    }
+  free(option_index);
+  option_index = NULL;
+  option_index_size = 0;
+  option_index_count = 0;
+}
+
+
+static void
+index_option(option_t *opt)
+{
+  size_t size;
+
+  if (option_index_count + 2 > option_index_size)
+  {
+    // Grow the table and re-index all options, opt is already in
+    // optionlist
+    size = option_index_size ? 2 * option_index_size : 256;
+    free_option_index();
+    option_index = calloc(size, sizeof(option_index_t *));
+    option_index_size = size;
+    for (opt = optionlist; opt; opt = opt->next)
+    {
+      add_option_index("", opt);
+      add_option_index("no", opt);
+    }
+  }
+  else
+  {
+    add_option_index("", opt);
+    add_option_index("no", opt);
+  }
+}
+
+
 option_t *
 find_option(const char *name)
 {
-  option_t *opt;
+  option_index_t *entry;
 
   // PageRegion and PageSize are the same options, just store one of them
   if (!strcasecmp(name, "PageRegion"))
     return (find_option("PageSize"));
 
-  for (opt = optionlist; opt; opt = opt->next)
+  if (!option_index)
+    return (NULL);
+
+  for (entry = option_index[option_hash(name) & (option_index_size - 1)];
+       entry; entry = entry->next)
+    if (!strcasecmp(entry->key, name))
+      return (entry->opt);
+  return (NULL);
+}
+
+
+// Gives a new option its column in the optionsets' value tables
+static void
+add_option_column(option_t *opt)
+{
+  int i, alloc;
+
+  opt->column = option_columns ++;
+  if (option_columns <= option_columns_alloc)
+    return;
+
+  alloc = option_columns_alloc ? 2 * option_columns_alloc : 64;
+  for (i = 0; i < optionset_count; i ++)
   {
-    if ((!strcasecmp(opt->name, name)) ||
-	((!strcasecmp(opt->name, &name[2])) &&
-	 (!prefixcasecmp(name, "no"))))
-      return (opt);
+    optionsets[i].values = realloc(optionsets[i].values,
+				   alloc * sizeof(int));
+    optionsets[i].fromoptions = realloc(optionsets[i].fromoptions,
+					alloc * sizeof(option_t *));
+    if (!optionsets[i].values || !optionsets[i].fromoptions)
+      rip_die(EXIT_PRNERR, "Memory allocation failed for option values");
+    memset(optionsets[i].values + option_columns_alloc, 0,
+	   (alloc - option_columns_alloc) * sizeof(int));
+    memset(optionsets[i].fromoptions + option_columns_alloc, 0,
+	   (alloc - option_columns_alloc) * sizeof(option_t *));
   }
-  return (NULL);
+  option_columns_alloc = alloc;
 }
 
 
 option_t *
 assure_option(const char *name)
 {
-  option_t *opt, *last;
+  option_t *opt;
 
   if ((opt = find_option(name)))
     return (opt);
@@ -432,14 +734,15 @@ assure_option(const char *name)
 
   opt->type = TYPE_NONE;
 
+  add_option_column(opt);
+
   // append opt to optionlist
-  if (optionlist)
-  {
-    for (last = optionlist; last->next; last = last->next);
-    last->next = opt;
-  }
+  if (optionlist_tail)
+    optionlist_tail->next = opt;
   else
     optionlist = opt;
+  optionlist_tail = opt;
+  index_option(opt);
 
   // prepend opt to optionlist_sorted_by_order
   // (0 is always at the beginning)
@@ -507,46 +810,30 @@ option_get_section(option_t *opt)
 }
 
 
-static value_t *
-option_find_value(option_t *opt,
-		  int optionset)
+// Returns the value ID of 'opt' in 'optionset'
+static int
+option_get_value_id(option_t *opt,
+		    int optionset)
 {
-  value_t *val;
-
-  if (!opt)
-    return (NULL);
-
-  for (val = opt->valuelist; val; val = val->next)
-  {
-    if (val->optionset == optionset)
-      return (val);
-  }
-  return (NULL);
+  if (!opt || optionset < 0 || optionset >= optionset_count)
+    return (VALUE_NONE);
+  return (optionsets[optionset].values[opt->column]);
 }
 
 
-static value_t *
-option_assure_value(option_t *opt,
-		    int optionset)
+// Sets the value ID of 'opt' in 'optionset'
+static void
+option_set_value_id(option_t *opt,
+		    int optionset,
+		    int id)
 {
-  value_t *val, *last;
+  optionset_t *set = &optionsets[optionset];
 
-  val = option_find_value(opt, optionset);
-  if (!val)
+  if (set->values[opt->column] != id)
   {
-    val = calloc(1, sizeof(value_t));
-    val->optionset = optionset;
-
-    // append to opt->valuelist
-    if (opt->valuelist)
-    {
-      for (last = opt->valuelist; last->next; last = last->next);
-      last->next = val;
-    }
-    else
-      opt->valuelist = val;
+    set->values[opt->column] = id;
+    set->generation ++;
   }
-  return (val);
 }
 
 
@@ -949,8 +1236,7 @@ get_valid_value_string(option_t *opt,
 const char *
 option_get_value(option_t *opt, int optionset)
 {
-  value_t *val = option_find_value(opt, optionset);
-  return (val ? val->value : NULL);
+  return (value_string(option_get_value_id(opt, optionset)));
 }
 
 
@@ -1124,27 +1410,16 @@ option_is_custom_value(option_t *opt,
 }
 
 
-int
-option_get_command(dstr_t *cmd,
-		   option_t *opt,
-		   int optionset,
-		   int section)
+// Builds the command of a non-composite option for the given value
+static int
+option_expand_command(dstr_t *cmd,
+		      option_t *opt,
+		      const char *valstr)
 {
-  const char *valstr;
   choice_t *choice = NULL;
 
   dstrclear(cmd);
 
-  if (option_is_composite(opt))
-    return (composite_get_command(cmd, opt, optionset, section));
-
-  if (section >= 0 && !option_is_in_section(opt, section))
-    return (1); // empty command for this section
-
-  valstr = option_get_value(opt, optionset);
-  if (!valstr)
-    return (0);
-
   // If the value is set to a predefined choice
   choice = option_find_choice(opt, valstr);
   if (choice && (*choice->command ||
@@ -1180,6 +1455,56 @@ option_get_command(dstr_t *cmd,
 }
 
 
+int
+option_get_command(dstr_t *cmd,
+		   option_t *opt,
+		   int optionset,
+		   int section)
+{
+  int val;
+
+  dstrclear(cmd);
+
+  if (option_is_composite(opt))
+    return (composite_get_command(cmd, opt, optionset, section));
+
+  if (section >= 0 && !option_is_in_section(opt, section))
+    return (1); // empty command for this section
+
+  if ((val = option_get_value_id(opt, optionset)) <= VALUE_NULL)
+    return (0);
+
+  // The command only depends on the value, so keep the one of the last
+  // value, which usually is the same for all optionsets and pages
+  if (val != opt->command_value)
+  {
+    opt->command_result = option_expand_command(cmd, opt, value_string(val));
+    free(opt->command);
+    opt->command = strdup(cmd->data);
+    opt->command_value = val;
+  }
+  else
+    dstrcpy(cmd, opt->command);
+
+  return (opt->command_result);
+}
+
+
+// Sets a value of an option from a composite option
+static void
+composite_set_value(option_t *opt,
+		    int optionset,
+		    option_t *dep,
+		    const char *value)
+{
+  char *valid = get_valid_value_string(dep, value);
+
+  option_set_value_id(dep, optionset, value_intern(valid));
+  optionsets[optionset].fromoptions[dep->column] = opt;
+  free(valid);
+}
+
+
 void
 composite_set_values(option_t *opt,
 		     int optionset,
@@ -1187,7 +1512,6 @@ composite_set_values(option_t *opt,
 {
   char *copy, *cur, *p;
   option_t *dep;
-  value_t *val;
 
   copy = strdup(values);
   for (cur = strtok(copy, " \t"); cur; cur = strtok(NULL, " \t"))
@@ -1196,11 +1520,7 @@ composite_set_values(option_t *opt,
     {
       *p++ = '\0';
       if ((dep = find_option(cur)))
-      {
-	val = option_assure_value(dep, optionset);
-	val->fromoption = opt;
-	val->value = get_valid_value_string(dep, p);
-      }
+	composite_set_value(opt, optionset, dep, p);
       else
 	_log("Could not find option \"%s\" (set from composite \"%s\")",
 	     cur, opt->name);
@@ -1208,20 +1528,12 @@ composite_set_values(option_t *opt,
     else if (startswith(cur, "no") || startswith(cur, "No"))
     {
       if ((dep = find_option(&cur[2])))
-      {
-	val = option_assure_value(dep, optionset);
-	val->fromoption = opt;
-	val->value = get_valid_value_string(dep, "0");
-      }
+	composite_set_value(opt, optionset, dep, "0");
     }
     else
     {
       if ((dep = find_option(cur)))
-      {
-	val = option_assure_value(dep, optionset);
-	val->fromoption = opt;
-	val->value = get_valid_value_string(dep, "1");
-      }
+	composite_set_value(opt, optionset, dep, "1");
     }
   }
   free(copy);
@@ -1233,21 +1545,23 @@ option_set_value(option_t *opt,
 		 int optionset,
 		 const char *value)
 {
-  value_t *val = option_assure_value(opt, optionset);
   char *newvalue;
   choice_t *choice;
   option_t *fromopt;
 
+  // The value exists from now on, even if the new one is not valid
+  if (option_get_value_id(opt, optionset) == VALUE_NONE)
+    option_set_value_id(opt, optionset, VALUE_NULL);
+
   newvalue = get_valid_value_string(opt, value);
   if (!newvalue)
     return (0);
 
-  free(val->value);
-  val->value = NULL;
-
   if (startswith(newvalue, "From") && (fromopt = find_option(&newvalue[4])) &&
       option_is_composite(fromopt))
   {
+    option_set_value_id(opt, optionset, VALUE_NULL);
+
     // TODO only set the changed option, not all of them
     choice = option_find_choice(fromopt, 
 				option_get_value(fromopt, optionset));
@@ -1255,7 +1569,10 @@ option_set_value(option_t *opt,
     free(newvalue);
   }
   else
-    val->value = newvalue;
+  {
+    option_set_value_id(opt, optionset, value_intern(newvalue));
+    free(newvalue);
+  }
 
   if (option_is_composite(opt))
   {
@@ -1378,6 +1695,7 @@ option_assure_choice(option_t *opt,
   if (!choice)
   {
     choice = calloc(1, sizeof(choice_t));
+    choice->command = strdup("");
     if (last)
       last->next = choice;
     else
@@ -1393,11 +1711,11 @@ unhtmlify(char *dest,
 	  size_t size,
 	  const char *src)
 {
-  jobparams_t *job = get_current_job();
+  jobparams_t *job = NULL;
   char *pdest = dest;
   const char *psrc = src, *p = NULL;
   const char *repl;
-  struct tm *t = localtime(&job->time);
+  struct tm *t = NULL;
   char tmpstr[16];
   size_t s, l, n;
 
@@ -1406,6 +1724,12 @@ unhtmlify(char *dest,
     if (*psrc == '&')
     {
       psrc++;
+      // Only look up the job and its time if there are entities at all
+      if (!job)
+      {
+	job = get_current_job();
+	t = localtime(&job->time);
+      }
       repl = NULL;
       p = NULL;
       l = 0;
@@ -1592,6 +1916,7 @@ option_set_choice(option_t *opt,
 		  const char *code)
 {
   choice_t *choice;
+  char *tmp;
 
   if (opt->type == TYPE_BOOL)
   {
@@ -1614,7 +1939,13 @@ option_set_choice(option_t *opt,
   }
 
   if (!startswith(code, "%% FoomaticRIPOptionSetting"))
-    unhtmlify(choice->command, 65536, code);
+  {
+    tmp = malloc(65536);
+    unhtmlify(tmp, 65536, code);
+    free(choice->command);
+    choice->command = strdup(tmp);
+    free(tmp);
+  }
 }
 
 //
@@ -1770,7 +2101,7 @@ optionset_name(int idx)
     _log("Optionset with index %d does not exist\n", idx);
     return (NULL);
   }
-  return (optionsets[idx]);
+  return (optionsets[idx].name);
 }
 
 
@@ -1778,26 +2109,34 @@ int
 optionset(const char *name)
 {
   int i;
-  char **tmp;
+  unsigned hash = value_hash(name);
+  optionset_t *tmp;
 
   for (i = 0; i < optionset_count; i ++)
   {
-    if (!strcmp(optionsets[i], name))
+    if (optionsets[i].hash == hash && !strcmp(optionsets[i].name, name))
       return (i);
   }
 
   if (optionset_count == optionset_alloc)
   {
     optionset_alloc *= 2;
-    tmp = realloc(optionsets, optionset_alloc * sizeof(char *));
+    tmp = realloc(optionsets, optionset_alloc * sizeof(optionset_t));
     if (!tmp)
       rip_die(EXIT_PRNERR, "Memory allocation failed for optionsets");
     optionsets = tmp;
-    for (i = optionset_count; i < optionset_alloc; i++)
-      optionsets[i] = NULL;
-  }
-
-  optionsets[optionset_count] = strdup(name);
+    memset(optionsets + optionset_count, 0,
+	   (optionset_alloc - optionset_count) * sizeof(optionset_t));
+  }
+
+  tmp = &optionsets[optionset_count];
+  tmp->name = strdup(name);
+  tmp->hash = hash;
+  tmp->values = calloc(option_columns_alloc + 1, sizeof(int));
+  tmp->fromoptions = calloc(option_columns_alloc + 1, sizeof(option_t *));
+  tmp->copy_of = -1;
+  if (!tmp->name || !tmp->values || !tmp->fromoptions)
+    rip_die(EXIT_PRNERR, "Memory allocation failed for optionsets");
   optionset_count++;
   return (optionset_count - 1);
 }
@@ -1807,52 +2146,60 @@ void
 optionset_copy_values(int src_optset,
 		      int dest_optset)
 {
-  option_t *opt;
-  value_t *val;
+  optionset_t *src = &optionsets[src_optset],
+	      *dest = &optionsets[dest_optset];
+  int i;
 
-  for (opt = optionlist; opt; opt = opt->next)
+  // All values in 'src' are already validated and include the values set
+  // by its composite options, so they are copied as they are.  Options
+  // without a value in 'src' keep their value in 'dest', so copying for
+  // example the user's values into the header set only overrides the
+  // defaults the user changed
+  if (src_optset == dest_optset)
+    return;
+
+  for (i = 0; i < option_columns; i ++)
   {
-    for (val = opt->valuelist; val; val = val->next)
-    {
-      if (val->optionset == src_optset)
-      {
-	option_set_value(opt, dest_optset, val->value);
-	break;
-      }
-    }
+    if (src->values[i] == VALUE_NONE)
+      continue;
+    dest->values[i] = src->values[i];
+    dest->fromoptions[i] = src->fromoptions[i];
   }
+  dest->generation ++;
+
+  // Only a row equal to 'src' lets optionset_equal() skip the comparison
+  if (memcmp(dest->values, src->values, option_columns * sizeof(int)))
+  {
+    dest->copy_of = -1;
+    return;
+  }
+  dest->copy_of = src_optset;
+  dest->copy_generation = dest->generation;
+  dest->source_generation = src->generation;
 }
 
 
 void
 optionset_delete_values(int optionset)
 {
-  option_t *opt;
-  value_t *val, *prev_val;
+  optionset_t *set = &optionsets[optionset];
 
-  for (opt = optionlist; opt; opt = opt->next)
-  {
-    val = opt->valuelist;
-    prev_val = NULL;
-    while (val)
-    {
-      if (val->optionset == optionset)
-      {
-	if (prev_val)
-	  prev_val->next = val->next;
-	else
-	  opt->valuelist = val->next;
-	free_value(val);
-	val = prev_val ? prev_val->next : opt->valuelist;
-	break;
-      }
-      else
-      {
-	prev_val = val;
-	val = val->next;
-      }
-    }
-  }
+  memset(set->values, 0, option_columns * sizeof(int));
+  memset(set->fromoptions, 0, option_columns * sizeof(option_t *));
+  set->generation ++;
+  set->copy_of = -1;
+}
+
+
+// Is 'set' unchanged since it got copied from 'source', which did not
+// change either?
+static int
+optionset_is_copy(optionset_t *set,
+		  int source)
+{
+  return (set->copy_of == source &&
+	  set->generation == set->copy_generation &&
+	  optionsets[source].generation == set->source_generation);
 }
 
 
@@ -1862,25 +2209,26 @@ optionset_equal(int optset1,
 		int exceptPS)
 {
   option_t *opt;
-  const char *val1, *val2;
+  optionset_t *set1 = &optionsets[optset1],
+	      *set2 = &optionsets[optset2];
+  int val1, val2;
+
+  if (optset1 == optset2 ||
+      optionset_is_copy(set1, optset2) || optionset_is_copy(set2, optset1) ||
+      !memcmp(set1->values, set2->values, option_columns * sizeof(int)))
+    return (1);
 
   for (opt = optionlist; opt; opt = opt->next)
   {
     if (exceptPS && opt->style == 'G')
       continue;
 
-    val1 = option_get_value(opt, optset1);
-    val2 = option_get_value(opt, optset2);
-
-    if (val1 && val2) // both entries exist
-    {
-      if (strcmp(val1, val2) != 0)
-	return (0); // but aren't equal
-    }
-    else if (val1 || val2) // one entry exists --> can't be equal
+    // Equal strings have the same ID, and if no value exists (or it is
+    // not valid), it is considered as equal to no value
+    val1 = set1->values[opt->column];
+    val2 = set2->values[opt->column];
+    if (val1 != val2 && (val1 > VALUE_NULL || val2 > VALUE_NULL))
       return (0);
-    // If no extry exists, the non-existing entries
-    // are considered as equal
   }
   return (1);
 }
@@ -1902,7 +2250,7 @@ read_ppd_file(const char *filename)
   char key[128], name[64], text[64];
   dstr_t *value = create_dstr(); // value can span multiple lines
   double order;
-  value_t *val;
+  int val, optset;
   option_t *opt, *current_opt = NULL;
   param_t *param;
   icc_mapping_entry_t *entry;
@@ -2138,18 +2486,16 @@ read_ppd_file(const char *filename)
     {
       // Default<option>: <value>
       opt = assure_option(&key[7]);
-      val = option_assure_value(opt, optionset("default"));
-      free(val->value);
-      val->value = strdup(value->data);
+      option_set_value_id(opt, optionset("default"),
+			  value_intern(value->data));
     }
     else if (!prefixcmp(key, "FoomaticRIPDefault"))
     {
       // FoomaticRIPDefault<option>: <value>
       // Used for numerical options only
       opt = assure_option(&key[18]);
-      val = option_assure_value(opt, optionset("default"));
-      free(val->value);
-      val->value = strdup(value->data);
+      option_set_value_id(opt, optionset("default"),
+			  value_intern(value->data));
     }
 
     // Current argument
@@ -2254,15 +2600,20 @@ read_ppd_file(const char *filename)
   fclose(fh);
   free_dstr(value);
 
+  // The option definitions are complete now, forget any commands which
+  // option_get_command() built from incomplete ones
+  for (opt = optionlist; opt; opt = opt->next)
+    opt->command_value = VALUE_NONE;
+
   // Validate default options by resetting them with option_set_value()
   for (opt = optionlist; opt; opt = opt->next)
   {
-    val = option_find_value(opt, optionset("default"));
-    if (val)
+    optset = optionset("default");
+    if ((val = option_get_value_id(opt, optset)) != VALUE_NONE)
     {
       // if fromopt is set, this value has already been validated
-      if (!val->fromoption)
-	option_set_value(opt, optionset("default"), val->value);
+      if (!optionsets[optset].fromoptions[opt->column])
+	option_set_value(opt, optset, value_string(val));
     }
     else
       // Make sure that this option has a default choice, even if none is
@@ -2342,6 +2693,70 @@ ppd_supports_pdf()
 }
 
 
+// Compile the renderer command line into its literal text and the first
+// spot marker of each spot character, where dstrreplace() used to insert
+// the option snippets
+static cmdline_template_t *
+compile_cmdline(int pdfcmdline)
+{
+  cmdline_template_t *tpl = &cmdline_templates[pdfcmdline ? 1 : 0];
+  const char *src = pdfcmdline ? cmd_pdf : cmd;
+  cmdline_slot_t *slot;
+  unsigned char spot;
+  size_t pos;
+
+  if (tpl->source && !strcmp(tpl->source, src))
+    return (tpl);
+
+  free(tpl->source);
+  if ((tpl->source = strdup(src)) == NULL)
+    rip_die(EXIT_PRNERR, "Memory allocation failed for command line template");
+  memset(tpl->spots, 0, sizeof(tpl->spots));
+  tpl->nslots = 0;
+
+  for (pos = 0; tpl->source[pos]; pos ++)
+  {
+    spot = (unsigned char)tpl->source[pos + 1];
+    if (tpl->source[pos] != '%' || !spot || spot == '%' || tpl->spots[spot])
+      continue;
+
+    slot = &tpl->slots[tpl->nslots ++];
+    slot->spot = (char)spot;
+    slot->pos = pos;
+    if (!slot->frags)
+      slot->frags = create_dstr();
+    tpl->spots[spot] = tpl->nslots;
+  }
+
+  return (tpl);
+}
+
+
+// Fill a compiled command line template with the collected snippets,
+// dropping the markers of the spots "%A" to "%M" and "%W" to "%Z"
+static void
+fill_cmdline(dstr_t *cmdline,
+	     cmdline_template_t *tpl)
+{
+  int i;
+  size_t pos = 0;
+  cmdline_slot_t *slot;
+
+  dstrclear(cmdline);
+  for (i = 0; i < tpl->nslots; i ++)
+  {
+    slot = &tpl->slots[i];
+    dstrncat(cmdline, &tpl->source[pos], slot->pos - pos);
+    dstrcat(cmdline, slot->frags->data);
+    pos = slot->pos;
+    if ((slot->spot >= 'A' && slot->spot <= 'M') ||
+	(slot->spot >= 'W' && slot->spot <= 'Z'))
+      pos += 2;
+  }
+  dstrcat(cmdline, &tpl->source[pos]);
+}
+
+
 // build a renderer command line, based on the given option set
 int
 build_commandline(int optset,
@@ -2350,21 +2765,67 @@ build_commandline(int optset,
 {
   option_t *opt;
   const char *userval;
-  char *s, *p;
-  dstr_t *cmdvar = create_dstr();
-  dstr_t *open = create_dstr();
-  dstr_t *close = create_dstr();
-  char letters[] = "%A %B %C %D %E %F %G %H %I %J %K %L %M %W %X %Y %Z";
-  int jcl = 0;
+  char *s;
+  dstr_t *cmdvar;
+  dstr_t *open;
+  dstr_t *close;
+  cmdline_template_t *tpl = NULL;
+  cmdline_cache_t *cache;
+  int currentpage = optionset("currentpage");
+  int header = optionset("header");
+  int spot, yspot = 0;
+  unsigned header_generation;
+  int i;
 
-  dstr_t *local_jclprepend = create_dstr();
+  // The commands only change with the values of the optionset (and of
+  // "header", which "currentpage" is compared to), so reuse the last
+  // result while the generations stay the same
+  header_generation = (optset == currentpage ?
+		       optionsets[header].generation : 0);
+  if (cmdline)
+    tpl = compile_cmdline(pdfcmdline);
 
-  dstrclear(prologprepend);
-  dstrclear(setupprepend);
-  dstrclear(pagesetupprepend);
+  if (!optionsets[optset].cmdline)
+  {
+    cache = calloc(1, sizeof(cmdline_cache_t));
+    if (!cache)
+      rip_die(EXIT_PRNERR, "Memory allocation failed for command line cache");
+    cache->cmdline = create_dstr();
+    cache->prolog = create_dstr();
+    cache->setup = create_dstr();
+    cache->pagesetup = create_dstr();
+    cache->jclprepend = create_dstr();
+    cache->pdfcmdline = -1;
+    optionsets[optset].cmdline = cache;
+  }
+  else
+  {
+    cache = optionsets[optset].cmdline;
+    if (cache->valid &&
+	cache->generation == optionsets[optset].generation &&
+	cache->header_generation == header_generation &&
+	cache->options == option_columns &&
+	(!cmdline || (cache->pdfcmdline == (pdfcmdline ? 1 : 0) &&
+		      cache->template && !strcmp(cache->template, tpl->source))))
+      goto finish;
+  }
 
-  if (cmdline)
-    dstrcpy(cmdline, pdfcmdline ? cmd_pdf : cmd);
+  cmdvar = create_dstr();
+  open = create_dstr();
+  close = create_dstr();
+
+  dstrclear(cache->prolog);
+  dstrclear(cache->setup);
+  dstrclear(cache->pagesetup);
+  dstrclear(cache->jclprepend);
+  cache->jcl = 0;
+
+  if (tpl)
+  {
+    for (i = 0; i < tpl->nslots; i ++)
+      dstrclear(tpl->slots[i].frags);
+    yspot = tpl->spots['Y'];
+  }
 
   for (opt = optionlist_sorted_by_order; opt; opt = opt->next_by_order)
   {
@@ -2393,116 +2854,122 @@ build_commandline(int optset,
 	switch (option_get_section(opt))
 	{
 	  case SECTION_PROLOG:
-	      dstrcatf(prologprepend, "%s%s%s", open->data, cmdvar->data,
+	      dstrcatf(cache->prolog, "%s%s%s", open->data, cmdvar->data,
 		       close->data);
 	      break;
 
 	  case SECTION_ANYSETUP:
-	      if (optset != optionset("currentpage"))
-		dstrcatf(setupprepend, "%s%s%s", open->data, cmdvar->data,
+	      if (optset != currentpage)
+		dstrcatf(cache->setup, "%s%s%s", open->data, cmdvar->data,
 			 close->data);
-	      else if (strcmp(option_get_value(opt, optionset("header")),
-			      userval) != 0)
-		dstrcatf(pagesetupprepend, "%s%s%s", open->data, cmdvar->data,
+	      else if (strcmp(option_get_value(opt, header), userval) != 0)
+		dstrcatf(cache->pagesetup, "%s%s%s", open->data, cmdvar->data,
 			 close->data);
 	      break;
 
 	  case SECTION_DOCUMENTSETUP:
-	      dstrcatf(setupprepend, "%s%s%s", open->data, cmdvar->data,
+	      dstrcatf(cache->setup, "%s%s%s", open->data, cmdvar->data,
 		       close->data);
 	      break;
 
 	  case SECTION_PAGESETUP:
-	      dstrcatf(pagesetupprepend, "%s%s%s", open->data, cmdvar->data,
+	      dstrcatf(cache->pagesetup, "%s%s%s", open->data, cmdvar->data,
 		       close->data);
 	      break;
 
 	  case SECTION_JCLSETUP:          // PCL/JCL argument
 	      s = malloc(cmdvar->len +1);
 	      unhexify(s, cmdvar->len +1, cmdvar->data);
-	      dstrcatf(local_jclprepend, "%s", s);
+	      dstrcatf(cache->jclprepend, "%s", s);
 	      free(s);
 	      break;
 
 	  default:
-	      dstrcatf(setupprepend, "%s%s%s", open->data, cmdvar->data,
+	      dstrcatf(cache->setup, "%s%s%s", open->data, cmdvar->data,
 		       close->data);
 	}
       }
     }
     else if (option_is_jcl_arg(opt))
     {
-      jcl = 1;
+      cache->jcl = 1;
       // Put JCL commands onto JCL stack
       if (cmdvar->len)
       {
 	char *s = malloc(cmdvar->len +1);
 	unhexify(s, cmdvar->len +1, cmdvar->data);
 	if (!startswith(cmdvar->data, jclprefix))
-	  dstrcatf(local_jclprepend, "%s%s\n", jclprefix, s);
+	  dstrcatf(cache->jclprepend, "%s%s\n", jclprefix, s);
 	else
-	  dstrcat(local_jclprepend, s);
+	  dstrcat(cache->jclprepend, s);
 	free(s);
       }
     }
-    else if (option_is_commandline_arg(opt) && cmdline)
+    else if (option_is_commandline_arg(opt) && tpl)
     {
       // Insert the processed argument in the command line
-      // just before every occurrence of the spot marker.
-      p = malloc(3);
-      snprintf(p, 3, "%%%c", opt->spot);
-      s = malloc(cmdvar->len +3);
-      snprintf(s, cmdvar->len +3, "%s%%%c", cmdvar->data, opt->spot);
-      dstrreplace(cmdline, p, s, 0);
-      free(p);
-      free(s);
+      // just before the first occurrence of the spot marker.
+      if ((spot = tpl->spots[(unsigned char)opt->spot]))
+	dstrcat(tpl->slots[spot - 1].frags, cmdvar->data);
     }
 
     // Insert option into command line of CUPS raster driver
-    if (cmdline && strstr(cmdline->data, "%Y"))
-    {
-      if (isempty(userval))
-	continue;
-      s = malloc(strlen(opt->name) + strlen(userval) + 20);
-      sprintf(s, "%s=%s %%Y", opt->name, userval);
-      dstrreplace(cmdline, "%Y", s, 0);
-      free(s);
-    }
+    if (yspot && !isempty(userval))
+      dstrcatf(tpl->slots[yspot - 1].frags, "%s=%s ", opt->name, userval);
   }
 
   // Tidy up after computing option statements for all of P, J, and C types:
 
   // C type finishing
-  // Pluck out all of the %n's from the command line prototype
-  if (cmdline)
+  // Put the snippets in and pluck out all of the %n's from the command line
+  // prototype
+  if (tpl)
   {
-    s = strtok(letters, " ");
-    do
+    fill_cmdline(cache->cmdline, tpl);
+    if (!cache->template || strcmp(cache->template, tpl->source))
     {
-      dstrreplace(cmdline, s, "", 0);
+      free(cache->template);
+      if ((cache->template = strdup(tpl->source)) == NULL)
+	rip_die(EXIT_PRNERR, "Memory allocation failed for command line cache");
     }
-    while ((s = strtok(NULL, " ")));
+    cache->pdfcmdline = pdfcmdline ? 1 : 0;
   }
+  else
+    cache->pdfcmdline = -1;
+
+  cache->generation = optionsets[optset].generation;
+  cache->header_generation = header_generation;
+  cache->options = option_columns;
+  cache->valid = 1;
+
+  free_dstr(cmdvar);
+  free_dstr(open);
+  free_dstr(close);
+
+ finish:
+
+  dstrcpy(prologprepend, cache->prolog->data);
+  dstrcpy(setupprepend, cache->setup->data);
+  dstrcpy(pagesetupprepend, cache->pagesetup->data);
+  if (cmdline)
+    dstrcpy(cmdline, cache->cmdline->data);
 
   // J type finishing
   // Compute the proper stuff to say around the job
-  if (jcl && !jobhasjcl)
+  if (cache->jcl && !jobhasjcl)
   {
     // command to switch to the interpreter
-    dstrcatf(local_jclprepend, "%s", jcltointerpreter);
+    open = create_dstr();
+    dstrcpyf(open, "%s%s", cache->jclprepend->data, jcltointerpreter);
 
     // Arrange for JCL RESET command at the end of job
     dstrcpy(jclappend, jclend);
 
     argv_free(jclprepend);
-    jclprepend = argv_split(local_jclprepend->data, "\r\n", NULL);
+    jclprepend = argv_split(open->data, "\r\n", NULL);
+    free_dstr(open);
   }
 
-  free_dstr(cmdvar);
-  free_dstr(open);
-  free_dstr(close);
-  free_dstr(local_jclprepend);
-
   return (!isempty(cmd));
 }
 
@@ -2716,32 +3183,35 @@ void
 set_options_for_page(int optset,
 		     int page)
 {
-  int score, bestscore;
+  int i, score, bestscore;
+  int *scores;
   option_t *opt;
-  value_t *val, *bestvalue;
-  const char *ranges;
-  const char *optsetname;
+  const char *bestvalue;
+
+  // Score of the page in each "pages:..." optionset
+  scores = calloc(optionset_count + 1, sizeof(int));
+  for (i = 0; i < optionset_count; i ++)
+    if (startswith(optionsets[i].name, "pages:"))
+      scores[i] = get_page_score(&optionsets[i].name[6], page);
 
   for (opt = optionlist; opt; opt = opt->next)
   {
     bestscore = 10000000;
     bestvalue = NULL;
-    for (val = opt->valuelist; val; val = val->next)
+    for (i = 0; i < optionset_count; i ++)
     {
-      optsetname = optionset_name(val->optionset);
-      if (!startswith(optsetname, "pages:"))
-	continue;
-
-      ranges = &optsetname[6]; // after "pages:"
-      score = get_page_score(ranges, page);
-      if (score && score < bestscore)
+      score = scores[i];
+      if (score && score < bestscore &&
+	  optionsets[i].values[opt->column] != VALUE_NONE)
       {
 	bestscore = score;
-	bestvalue = val;
+	bestvalue = value_string(optionsets[i].values[opt->column]);
       }
     }
 
-    if (bestvalue)
-      option_set_value(opt, optset, bestvalue->value);
+    if (bestscore < 10000000)
+      option_set_value(opt, optset, bestvalue);
   }
+
+  free(scores);
 }
@@ -45,7 +45,7 @@ typedef struct choice_s
 {
   char value [128];
   char text [128];
-  char command[65536];
+  char *command;
   struct choice_s *next;
 } choice_t;
 
@@ -93,21 +93,17 @@ typedef struct option_s
   param_t *paramlist;         // for custom values, sorted by stack order
   size_t param_count;
 
-  struct value_s *valuelist;
+  int column;                 // Column of the option in the optionsets'
+                              // value tables
+
+  int command_value;          // Value ID the command below was built for
+  int command_result;         // (see option_get_command()), 0 if none
+  char *command;
 
   struct option_s *next;
   struct option_s *next_by_order;
 } option_t;
 
-// A value for an option
-typedef struct value_s
-{
-  int optionset;
-  char *value;
-  option_t *fromoption; // This is set when this value is set by a composite
-  struct value_s *next;
-} value_t;
-
 
 extern option_t *optionlist;
 extern option_t *optionlist_sorted_by_order;
@@ -113,10 +113,11 @@ _start_process(const char *name,
 	       void *user_arg,
 	       FILE **pipe_in,
 	       FILE **pipe_out,
+	       FILE **pipe_err,
 	       int createprocessgroup)
 {
   pid_t pid;
-  int pfdin[2], pfdout[2];
+  int pfdin[2], pfdout[2], pfderr[2];
   int ret;
   FILE *in, *out;
 
@@ -126,6 +127,9 @@ _start_process(const char *name,
   if (pipe_out)
     if (pipe(pfdout) < 0)
       return (-1);
+  if (pipe_err)
+    if (pipe(pfderr) < 0)
+      return (-1);
 
   _log("Starting process \"%s\" (generation %d)\n", name, kidgeneration +1);
 
@@ -143,6 +147,11 @@ _start_process(const char *name,
       close(pfdout[0]);
       close(pfdout[1]);
     }
+    if (pipe_err)
+    {
+      close(pfderr[0]);
+      close(pfderr[1]);
+    }
     return (-1);
   }
 
@@ -169,6 +178,14 @@ _start_process(const char *name,
     else
       out = NULL;
 
+    if (pipe_err)
+    {
+      close(pfderr[0]);
+      if (dup2(pfderr[1], fileno(stderr)) < 0)
+	_log("%s: Could not dup stderr\n", name);
+      close(pfderr[1]);
+    }
+
     if (createprocessgroup)
       setpgid(0, 0);
 
@@ -196,6 +213,13 @@ _start_process(const char *name,
     if (!*pipe_out)
       _log("fdopen: %s\n", strerror(errno));
   }
+  if (pipe_err)
+  {
+    close(pfderr[1]);
+    *pipe_err = fdopen(pfderr[0], "r");
+    if (!*pipe_err)
+      _log("fdopen: %s\n", strerror(errno));
+  }
 
   // Add the child process to the list of open processes (to be able to kill
   // them in case of a signal.
@@ -232,7 +256,19 @@ start_system_process(const char *name,
 		     FILE **fdin,
 		     FILE **fdout)
 {
-  return (_start_process(name, exec_command, (void*)command, fdin, fdout, 1));
+  return (_start_process(name, exec_command, (void*)command, fdin, fdout,
+			 NULL, 1));
+}
+
+
+pid_t
+start_monitored_system_process(const char *name,
+			       const char *command,
+			       FILE **fdout,
+			       FILE **fderr)
+{
+  return (_start_process(name, exec_command, (void*)command, NULL, fdout,
+			 fderr, 1));
 }
 
 
@@ -243,7 +279,7 @@ start_process(const char *name,
 	      FILE **fdin,
 	      FILE **fdout)
 {
-  return (_start_process(name, proc_func, user_arg, fdin, fdout, 0));
+  return (_start_process(name, proc_func, user_arg, fdin, fdout, NULL, 0));
 }
 
 
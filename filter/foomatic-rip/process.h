@@ -24,6 +24,10 @@ pid_t start_process(const char *name, int (*proc_func)(FILE*, FILE*, void*), voi
 		    FILE **fdin, FILE **fdout);
 pid_t start_system_process(const char *name, const char *command, FILE **fdin,
 			   FILE **fdout);
+// like start_system_process(), but with the command's stdout and stderr
+// both connected to pipes for the caller to read
+pid_t start_monitored_system_process(const char *name, const char *command,
+				     FILE **fdout, FILE **fderr);
 
 const char *get_modern_shell();
 // returns command's return status (see waitpid(2))
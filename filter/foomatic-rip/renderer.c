@@ -14,7 +14,10 @@
 #include <signal.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
 
 #include "foomaticrip.h"
 #include "util.h"
@@ -459,6 +462,691 @@ exec_kid4(FILE *in,
 }
 
 
+//
+// Renderer monitor
+//
+// With "render_monitor" turned on, KID3 does not let the renderer write
+// directly into KID4 and onto our stderr, but reads both of its output
+// streams in an event loop: The job data is passed on to KID4, counted,
+// and scanned for page boundaries, the renderer's messages are passed on
+// to stderr. This way CUPS gets "PAGE:" and "ATTR: job-media-progress"
+// lines while the job is rendered, and not only after the renderer exits.
+//
+// Ghostscript runs with "-q" and so does not tell which page it renders,
+// therefore the pages are counted in the job data: "%%Page:" comments in
+// PostScript, form feeds outside of binary data in PCL 3/5, and
+// BeginPage/EndPage operators in PCL-XL, all of them optionally with PJL
+// around. Copies the printer makes of each page (PJL COPIES or QTY, PCL
+// "ESC & l # X", PCL-XL PageCopies, PostScript "/#copies" or
+// "/NumCopies") go into the "PAGE:" lines. A renderer which issues
+// "PAGE:" lines itself (for example a CUPS raster driver) does its own
+// page accounting.
+//
+
+#define MONITOR_INTERVAL 5 // Seconds between throughput reports
+
+enum // Language of the renderer output
+{
+  OUTPUT_TEXT,            // Start, PJL, or PostScript, scanned line by line
+  OUTPUT_PCL,             // PCL 3/5
+  OUTPUT_PCLXL,           // PCL-XL (PCL 6)
+  OUTPUT_UNKNOWN          // Anything else, pages not counted
+};
+
+enum // Scanner states for PCL 3/5 and PCL-XL
+{
+  PCL_DATA,               // Outside of escape sequences
+  PCL_ESC,                // After ESC
+  PCL_GROUP,              // After parameterized character
+  PCL_VALUE,              // In value field or at parameter character
+  XL_TAG,                 // At data type, attribute, or operator tag
+  XL_ARRAY_TAG,           // At data type of an array length
+  XL_NUMBER               // In number
+};
+
+enum // What a PCL-XL number is
+{
+  XL_NEXT_VALUE,          // Attribute value
+  XL_NEXT_ATTR,           // Attribute ID
+  XL_NEXT_ARRAY,          // Number of array elements
+  XL_NEXT_DATA            // Length of embedded data
+};
+
+typedef struct
+{
+  int lang;               // Language, OUTPUT_*
+  int state;              // PCL_* or XL_*
+  long long skip;         // Bytes of binary data still to skip
+  int in_page;            // Page begun, but not yet finished
+  int copies;             // Copies the printer makes of each page
+  char line[256];         // Current PJL or PostScript line
+  size_t linelen;         // Length of the current line
+  int pcl_param;          // PCL parameterized character
+  int pcl_group;          // PCL group character, 0 if none
+  long pcl_value;         // PCL value field
+  int pcl_negative;       // Value field has a minus sign
+  int pcl_fraction;       // Value field has a decimal point
+  int xl_little;          // PCL-XL stream is little-endian
+  int xl_next;            // What the current number is, XL_NEXT_*
+  int xl_need;            // Bytes of the current number
+  int xl_pos;             // Bytes of the current number read
+  unsigned long xl_number;// Current number
+  unsigned long xl_value; // Last attribute value
+  int xl_elem;            // Size of an array element
+} output_scan_t;
+
+typedef struct
+{
+  double start;           // Time when the renderer got started
+  double first_output;    // Time of first output byte, 0 if none yet
+  double last_activity;   // Time of last output or message
+  double last_report;     // Time of last throughput report
+  long long bytes;        // Bytes passed on to KID4
+  int page;               // Pages done (renderer: current page)
+  int renderer_pages;     // Renderer issues "PAGE:" lines itself
+  output_scan_t scan;     // Page boundaries in the job data
+  char line[1024];        // Incomplete line from renderer's stderr
+  size_t linelen;         // Length of the incomplete line
+} monitor_t;
+
+
+static double
+monitor_time()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec + ts.tv_nsec / 1000000000.0);
+}
+
+
+// Issue a status line for CUPS, or log it when not running under CUPS
+static void
+monitor_status(const char *fmt,
+	       ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  if (spooler == SPOOLER_CUPS)
+  {
+    vfprintf(stderr, fmt, ap);
+    fflush(stderr);
+  }
+  else if (logh)
+  {
+    vfprintf(logh, fmt, ap);
+    fflush(logh);
+  }
+  va_end(ap);
+}
+
+
+static void
+monitor_report(monitor_t *mon,
+	       double now,
+	       const char *what)
+{
+  double elapsed = now - mon->start;
+
+  monitor_status("DEBUG: foomatic-rip: Renderer %s: %d page(s), %lld bytes "
+		 "in %.1f sec (%.1f KB/sec)\n", what, mon->page, mon->bytes,
+		 elapsed,
+		 elapsed > 0.0 ? mon->bytes / 1024.0 / elapsed : 0.0);
+  mon->last_report = now;
+}
+
+
+static void
+monitor_page_done(monitor_t *mon)
+{
+  if (mon->page > 0 && spooler == SPOOLER_CUPS)
+    monitor_status("ATTR: job-media-progress=100\n");
+}
+
+
+// Pass a complete line of the renderer's stderr on and check whether it
+// tells that a new page begins
+static void
+monitor_line(monitor_t *mon,
+	     const char *line)
+{
+  fputs(line, stderr);
+  fflush(stderr);
+
+  if (startswith(line, "PAGE:"))
+  {
+    // The renderer does the page accounting itself, from now on only
+    // track the progress
+    if (mon->renderer_pages)
+      monitor_page_done(mon);
+    else
+      mon->page = 0;
+    mon->renderer_pages = 1;
+    mon->page ++;
+  }
+}
+
+
+// A page begins or ends in the job data
+static void
+monitor_output_page(monitor_t *mon,
+		    int end)
+{
+  output_scan_t *scan = &mon->scan;
+
+  if (!end)
+  {
+    if (!scan->in_page && !mon->renderer_pages && spooler == SPOOLER_CUPS)
+      monitor_status("ATTR: job-media-progress=0\n");
+    scan->in_page = 1;
+    return;
+  }
+
+  scan->in_page = 0;
+  if (mon->renderer_pages)
+    return;
+
+  mon->page ++;
+  if (spooler == SPOOLER_CUPS)
+    monitor_status("PAGE: %d %d\nATTR: job-media-progress=100\n", mon->page,
+		   scan->copies > 0 ? scan->copies : 1);
+}
+
+
+// Look at a complete PJL or PostScript line of the job data
+static void
+monitor_output_line(monitor_t *mon,
+		    char *line)
+{
+  output_scan_t *scan = &mon->scan;
+  char *p;
+
+  if (startswith(line, "%%Page:"))
+  {
+    if (scan->in_page)
+      monitor_output_page(mon, 1);
+    monitor_output_page(mon, 0);
+  }
+  else if (startswith(line, "%%Trailer") || startswith(line, "%%EOF"))
+  {
+    if (scan->in_page)
+      monitor_output_page(mon, 1);
+  }
+  else if (!strncasecmp(line, "@PJL", 4))
+  {
+    if ((p = strcasestr(line, "LANGUAGE")) != NULL &&
+	(p = strchr(p, '=')) != NULL)
+    {
+      for (p ++; isspace(*p); p ++);
+      if (!strncasecmp(p, "PCLXL", 5) || !strncasecmp(p, "POSTSCRIPT", 10))
+	; // PCL-XL starts with its stream header line
+      else if (!strncasecmp(p, "PCL", 3))
+      {
+	scan->lang = OUTPUT_PCL;
+	scan->state = PCL_DATA;
+      }
+      else
+	scan->lang = OUTPUT_UNKNOWN;
+    }
+    else if (((p = strcasestr(line, "COPIES")) != NULL ||
+	      (p = strcasestr(line, "QTY")) != NULL) &&
+	     (p = strchr(p, '=')) != NULL)
+      scan->copies = atoi(p + 1);
+  }
+  else if (startswith(line, ") HP-PCL XL") || startswith(line, "( HP-PCL XL"))
+  {
+    // Stream header, the binding tells the byte order
+    scan->lang = OUTPUT_PCLXL;
+    scan->state = XL_TAG;
+    scan->xl_little = (line[0] == ')');
+  }
+  else if ((p = strstr(line, "/#copies")) != NULL ||
+	   (p = strstr(line, "/NumCopies")) != NULL)
+  {
+    for (p ++; isalnum(*p) || *p == '#'; p ++);
+    if (isdigit(*(p += strspn(p, " \t"))))
+      scan->copies = atoi(p);
+  }
+}
+
+
+static void
+monitor_output_text(monitor_t *mon,
+		    int c)
+{
+  output_scan_t *scan = &mon->scan;
+
+  if (scan->linelen == 1 && scan->line[0] == '\033' && c != '%')
+  {
+    // Escape sequence, but no UEL: PCL without PJL starts with a reset,
+    // everything else we do not know
+    scan->linelen = 0;
+    if (c == 'E')
+    {
+      scan->lang = OUTPUT_PCL;
+      scan->state = PCL_DATA;
+    }
+    else
+      scan->lang = OUTPUT_UNKNOWN;
+    return;
+  }
+
+  if (c == '\n' || c == '\r')
+  {
+    scan->line[scan->linelen] = '\0';
+    scan->linelen = 0;
+    monitor_output_line(mon, scan->line);
+    return;
+  }
+
+  if (scan->linelen < sizeof(scan->line) - 1)
+    scan->line[scan->linelen ++] = (char)c;
+
+  // Lines can start with a UEL, look at what follows it
+  if (scan->linelen == 9 && !memcmp(scan->line, "\033%-12345X", 9))
+    scan->linelen = 0;
+}
+
+
+// Complete PCL escape sequence or parameter of a combined one
+static void
+monitor_output_pcl_command(monitor_t *mon,
+			   int term)
+{
+  output_scan_t *scan = &mon->scan;
+  long value = scan->pcl_negative ? -scan->pcl_value : scan->pcl_value;
+
+  if (term == 'W' ||
+      (scan->pcl_param == '*' && scan->pcl_group == 'b' && term == 'V') ||
+      (scan->pcl_param == '&' && scan->pcl_group == 'p' && term == 'X'))
+  {
+    // Binary data follows, raster data makes a page
+    if (value > 0)
+      scan->skip = value;
+    if (scan->pcl_param == '*' && scan->pcl_group == 'b')
+      monitor_output_page(mon, 0);
+  }
+  else if (scan->pcl_param == '&' && scan->pcl_group == 'l' && term == 'X')
+    scan->copies = (int)value;
+  else if (scan->pcl_param == '%' && !scan->pcl_group && term == 'X' &&
+	   value == -12345)
+  {
+    // UEL, back to PJL
+    scan->lang = OUTPUT_TEXT;
+    scan->linelen = 0;
+  }
+}
+
+
+static void
+monitor_output_pcl(monitor_t *mon,
+		   int c)
+{
+  output_scan_t *scan = &mon->scan;
+
+  switch (scan->state)
+  {
+    case PCL_DATA :
+	if (c == '\033')
+	  scan->state = PCL_ESC;
+	else if (c == '\f')
+	  monitor_output_page(mon, 1);
+	break;
+
+    case PCL_ESC :
+	if (c >= '!' && c <= '/')
+	{
+	  scan->pcl_param = c;
+	  scan->state = PCL_GROUP;
+	}
+	else if (c != '\033')
+	  scan->state = PCL_DATA; // Two-character escape sequence
+	break;
+
+    case PCL_GROUP :
+	scan->pcl_group = (c >= '`' && c <= '~') ? c : 0;
+	scan->pcl_value = 0;
+	scan->pcl_negative = scan->pcl_fraction = 0;
+	scan->state = PCL_VALUE;
+	if (scan->pcl_group)
+	  break;
+	// No group character, c starts the value field, fall through
+
+    case PCL_VALUE :
+	if (isdigit(c))
+	{
+	  if (!scan->pcl_fraction && scan->pcl_value < 100000000)
+	    scan->pcl_value = scan->pcl_value * 10 + c - '0';
+	}
+	else if (c == '-')
+	  scan->pcl_negative = 1;
+	else if (c == '.')
+	  scan->pcl_fraction = 1;
+	else if (c == '+')
+	  ;
+	else if (c >= '@' && c <= '^')
+	{
+	  // Last parameter of the sequence
+	  scan->state = PCL_DATA;
+	  monitor_output_pcl_command(mon, c);
+	}
+	else if (c >= '`' && c <= '~')
+	{
+	  // Parameter of a combined sequence, more follow
+	  monitor_output_pcl_command(mon, toupper(c));
+	  scan->pcl_value = 0;
+	  scan->pcl_negative = scan->pcl_fraction = 0;
+	}
+	else
+	  scan->state = PCL_DATA;
+	break;
+  }
+}
+
+
+static void
+monitor_output_pclxl(monitor_t *mon,
+		     int c)
+{
+  output_scan_t *scan = &mon->scan;
+  // Sizes of ubyte, uint16, uint32, sint16, sint32, and real32
+  static const int sizes[6] = { 1, 2, 4, 2, 4, 4 };
+  int need = 0, next = XL_NEXT_VALUE;
+
+  switch (scan->state)
+  {
+    case XL_TAG :
+	if (c == 0x1b)
+	{
+	  // UEL, back to PJL
+	  scan->lang = OUTPUT_TEXT;
+	  scan->line[0] = '\033';
+	  scan->linelen = 1;
+	}
+	else if (c == 0x43) // BeginPage
+	  monitor_output_page(mon, 0);
+	else if (c == 0x44) // EndPage
+	  monitor_output_page(mon, 1);
+	else if (c >= 0xc0 && c <= 0xc5) // Single values
+	  need = sizes[c - 0xc0];
+	else if (c >= 0xc8 && c <= 0xcd) // Arrays
+	{
+	  scan->xl_elem = sizes[c - 0xc8];
+	  scan->state = XL_ARRAY_TAG;
+	}
+	else if (c >= 0xd0 && c <= 0xd5) // XY pairs
+	  scan->skip = 2 * sizes[c - 0xd0];
+	else if (c >= 0xe0 && c <= 0xe5) // Boxes
+	  scan->skip = 4 * sizes[c - 0xe0];
+	else if (c == 0xf8 || c == 0xf9) // Attribute IDs
+	{
+	  need = c == 0xf8 ? 1 : 2;
+	  next = XL_NEXT_ATTR;
+	}
+	else if (c == 0xfa || c == 0xfb) // Embedded data
+	{
+	  need = c == 0xfa ? 4 : 1;
+	  next = XL_NEXT_DATA;
+	}
+	break;
+
+    case XL_ARRAY_TAG :
+	scan->state = XL_TAG;
+	if (c == 0xc0 || c == 0xc1)
+	{
+	  need = c == 0xc0 ? 1 : 2;
+	  next = XL_NEXT_ARRAY;
+	}
+	break;
+
+    case XL_NUMBER :
+	if (scan->xl_little)
+	  scan->xl_number |= (unsigned long)c << (8 * scan->xl_pos);
+	else
+	  scan->xl_number = (scan->xl_number << 8) | (unsigned long)c;
+
+	if (++ scan->xl_pos < scan->xl_need)
+	  break;
+
+	scan->state = XL_TAG;
+	switch (scan->xl_next)
+	{
+	  case XL_NEXT_VALUE :
+	      scan->xl_value = scan->xl_number;
+	      break;
+	  case XL_NEXT_ATTR :
+	      if (scan->xl_number == 49) // PageCopies
+		scan->copies = (int)scan->xl_value;
+	      break;
+	  case XL_NEXT_ARRAY :
+	      scan->skip = (long long)scan->xl_number * scan->xl_elem;
+	      break;
+	  case XL_NEXT_DATA :
+	      scan->skip = (long long)scan->xl_number;
+	      break;
+	}
+	break;
+  }
+
+  if (need)
+  {
+    scan->state = XL_NUMBER;
+    scan->xl_next = next;
+    scan->xl_need = need;
+    scan->xl_pos = 0;
+    scan->xl_number = 0;
+  }
+}
+
+
+// Scan job data going to KID4 for page boundaries
+static void
+monitor_output_data(monitor_t *mon,
+		    const unsigned char *data,
+		    size_t len)
+{
+  output_scan_t *scan = &mon->scan;
+  size_t n;
+
+  while (len > 0 && scan->lang != OUTPUT_UNKNOWN)
+  {
+    if (scan->skip > 0)
+    {
+      n = (long long)len < scan->skip ? len : (size_t)scan->skip;
+      scan->skip -= (long long)n;
+    }
+    else
+    {
+      n = 1;
+      if (scan->lang == OUTPUT_TEXT)
+	monitor_output_text(mon, *data);
+      else if (scan->lang == OUTPUT_PCL)
+	monitor_output_pcl(mon, *data);
+      else
+	monitor_output_pclxl(mon, *data);
+    }
+
+    data += n;
+    len -= n;
+  }
+}
+
+
+static void
+monitor_stderr_data(monitor_t *mon,
+		    const char *data,
+		    size_t len)
+{
+  const char *p;
+
+  for (p = data; p < data + len; p ++)
+  {
+    mon->line[mon->linelen ++] = *p;
+    if (*p == '\n' || mon->linelen == sizeof(mon->line) - 1)
+    {
+      mon->line[mon->linelen] = '\0';
+      monitor_line(mon, mon->line);
+      mon->linelen = 0;
+    }
+  }
+}
+
+
+static int
+write_all(int fd,
+	  const char *data,
+	  size_t len)
+{
+  ssize_t bytes;
+
+  while (len > 0)
+  {
+    if ((bytes = write(fd, data, len)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+	continue;
+      return (-1);
+    }
+    data += bytes;
+    len -= (size_t)bytes;
+  }
+
+  return (0);
+}
+
+
+// Run the renderer command line and monitor it until it exits, returns
+// its exit status (see waitpid(2))
+static int
+run_monitored_renderer(const char *commandline,
+		       FILE *kid4in)
+{
+  monitor_t mon;
+  pid_t pid;
+  FILE *rendout = NULL, *renderr = NULL;
+  struct pollfd pfds[2];
+  char buf[65536];
+  ssize_t bytes;
+  double now;
+  int i, killed = 0;
+
+  memset(&mon, 0, sizeof(mon));
+
+  // We handle a vanished KID4 ourselves, by closing the renderer's output
+  signal(SIGPIPE, SIG_IGN);
+
+  pid = start_monitored_system_process("renderer", commandline, &rendout,
+				       &renderr);
+  if (pid < 0 || !rendout || !renderr)
+    rip_die(EXIT_PRNERR_NORETRY_BAD_SETTINGS,
+	    "Cannot start renderer with monitoring\n");
+
+  mon.start = mon.last_activity = mon.last_report = monitor_time();
+
+  pfds[0].fd = fileno(rendout);
+  pfds[0].events = POLLIN;
+  pfds[1].fd = fileno(renderr);
+  pfds[1].events = POLLIN;
+
+  while (pfds[0].fd >= 0 || pfds[1].fd >= 0)
+  {
+    if (poll(pfds, 2, 1000) < 0)
+    {
+      if (errno == EINTR)
+	continue;
+      _log("Renderer monitor: poll() failed: %s\n", strerror(errno));
+      break;
+    }
+
+    now = monitor_time();
+
+    for (i = 0; i < 2; i ++)
+    {
+      if (pfds[i].fd < 0 || !(pfds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+	continue;
+
+      if ((bytes = read(pfds[i].fd, buf, sizeof(buf))) < 0 &&
+	  (errno == EINTR || errno == EAGAIN))
+	continue;
+
+      if (bytes <= 0)
+      {
+	// End of this stream
+	pfds[i].fd = -1;
+	continue;
+      }
+
+      mon.last_activity = now;
+
+      if (i == 0)
+      {
+	if (mon.bytes == 0)
+	  mon.first_output = now;
+	mon.bytes += bytes;
+	monitor_output_data(&mon, (unsigned char *)buf, (size_t)bytes);
+	if (write_all(fileno(kid4in), buf, (size_t)bytes) < 0)
+	{
+	  _log("Renderer monitor: Could not pass data on to kid4: %s\n",
+	       strerror(errno));
+	  fclose(rendout);
+	  rendout = NULL;
+	  pfds[0].fd = -1;
+	}
+      }
+      else
+	monitor_stderr_data(&mon, buf, (size_t)bytes);
+    }
+
+    if (now - mon.last_report >= MONITOR_INTERVAL)
+      monitor_report(&mon, now, "progress");
+
+    if (renderer_timeout > 0 && !killed &&
+	now - mon.last_activity >= renderer_timeout)
+    {
+      monitor_status("ERROR: foomatic-rip: Renderer showed no activity for %d "
+		     "seconds, killing it\n", renderer_timeout);
+      kill(-pid, SIGTERM);
+      killed = 1;
+    }
+    else if (killed && now - mon.last_activity >= 2 * renderer_timeout)
+    {
+      kill(-pid, SIGKILL);
+      mon.last_activity = now;
+    }
+  }
+
+  if (mon.linelen > 0)
+  {
+    mon.line[mon.linelen] = '\0';
+    monitor_line(&mon, mon.line);
+  }
+  if (mon.scan.linelen > 0 && mon.scan.lang == OUTPUT_TEXT)
+  {
+    mon.scan.line[mon.scan.linelen] = '\0';
+    monitor_output_line(&mon, mon.scan.line);
+  }
+  if (mon.scan.in_page)
+    monitor_output_page(&mon, 1);
+  if (mon.renderer_pages)
+    monitor_page_done(&mon);
+
+  if (rendout)
+    fclose(rendout);
+  fclose(renderr);
+
+  now = monitor_time();
+  monitor_report(&mon, now, "finished");
+  monitor_status("DEBUG: foomatic-rip: Renderer latency: first output after "
+		 "%.3f sec, total %.3f sec\n",
+		 mon.first_output > 0.0 ? mon.first_output - mon.start : 0.0,
+		 now - mon.start);
+
+  return (wait_for_process(pid));
+}
+
+
+
 int
 exec_kid3(FILE *in,
 	  FILE *out,
@@ -486,7 +1174,7 @@ exec_kid3(FILE *in,
     free_dstr(commandline);
     return (EXIT_PRNERR_NORETRY_BAD_SETTINGS);
   }
-  if (dup2(fileno(kid4in), fileno(stdout)) < 0)
+  if (!render_monitor && dup2(fileno(kid4in), fileno(stdout)) < 0)
   {
     _log("kid3: Could not dup stdout to kid4\n");
     fclose(kid4in);
@@ -508,7 +1196,10 @@ exec_kid3(FILE *in,
   }
 
   // Actually run the thing
-  status = run_system_process("renderer", commandline->data);
+  if (render_monitor)
+    status = run_monitored_renderer(commandline->data, kid4in);
+  else
+    status = run_system_process("renderer", commandline->data);
 
   if (in)
     fclose(in);
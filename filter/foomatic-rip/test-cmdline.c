@@ -0,0 +1,288 @@
+//
+// Tests for the renderer command line of foomatic-rip: the compiled
+// command line template must give the same command lines as inserting
+// the option snippets with dstrreplace().
+//
+// Copyright © 2024 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Contents:
+//
+//   main()            - Compare the command lines for all templates and
+//                       values.
+//   get_current_job() - Job of the test.
+//   reference()       - Build the command line with dstrreplace().
+//
+
+//
+// Include necessary headers...
+//
+
+#include "foomaticrip.h"
+#include "options.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+//
+// Globals of foomaticrip.c used by the command line functions...
+//
+
+dstr_t		*postpipe = NULL;
+char		printer_model[256] = "";
+int		spooler = SPOOLER_DIRECT;
+int		jobhasjcl = 0;
+int		pdfconvertedtops = 0;
+char		cupsfilter[256] = "";
+char		**jclprepend = NULL;
+dstr_t		*jclappend = NULL;
+
+
+//
+// Local globals...
+//
+
+// PPD file with command line options at repeated, dropped, and kept spots,
+// and PostScript options which only show up in "%Y"
+static const char	*TestPPD =
+  "*PPD-Adobe: \"4.3\"\n"
+  "*FormatVersion: \"4.3\"\n"
+  "*ModelName: \"Test Command Line\"\n"
+  "*OpenUI *Resolution/Resolution: PickOne\n"
+  "*FoomaticRIPOption Resolution: enum CmdLine A\n"
+  "*OrderDependency: 100 AnySetup *Resolution\n"
+  "*DefaultResolution: 300\n"
+  "*Resolution 300/300 dpi: \" -r300\"\n"
+  "*Resolution 600/600 dpi: \" -r600x600\"\n"
+  "*CloseUI: *Resolution\n"
+  "*OpenUI *Dither/Dithering: PickOne\n"
+  "*FoomaticRIPOption Dither: enum CmdLine A\n"
+  "*OrderDependency: 110 AnySetup *Dither\n"
+  "*DefaultDither: None\n"
+  "*Dither None/None: \"\"\n"
+  "*Dither FS/Floyd-Steinberg: \" -dFS\"\n"
+  "*CloseUI: *Dither\n"
+  "*FoomaticRIPOption Density: int CmdLine B\n"
+  "*FoomaticRIPOptionPrototype Density: \" -dDensity=%s\"\n"
+  "*FoomaticRIPOptionRange Density: 0 100\n"
+  "*OrderDependency: 120 AnySetup *Density\n"
+  "*FoomaticRIPDefaultDensity: 50\n"
+  "*OpenUI *Quality/Quality: PickOne\n"
+  "*FoomaticRIPOption Quality: enum CmdLine Q\n"
+  "*OrderDependency: 130 AnySetup *Quality\n"
+  "*DefaultQuality: Normal\n"
+  "*Quality Draft/Draft: \" -q1\"\n"
+  "*Quality Normal/Normal: \" -q2\"\n"
+  "*CloseUI: *Quality\n"
+  "*OpenUI *Duplex/Duplex: PickOne\n"
+  "*OrderDependency: 50 AnySetup *Duplex\n"
+  "*DefaultDuplex: None\n"
+  "*Duplex None/Off: \"<</Duplex false>>setpagedevice\"\n"
+  "*Duplex DuplexNoTumble/Long Edge: \"<</Duplex true>>setpagedevice\"\n"
+  "*CloseUI: *Duplex\n";
+
+// Command line templates
+static const char	*Templates[] =
+{
+  "gs -q%A%B -sOutputFile=- -",
+  "prog%A -x%B %A %Z %B -y",
+  "gs -sDEVICE=cups %Y%A -c '%%Y' %B",
+  "prog %Q%A 100% done%N %%A %",
+  "%B%A%Y",
+  ""
+};
+
+// Values to set, as "option=value" pairs
+static const char	*Values[][4] =
+{
+  { NULL },
+  { "Resolution=600", NULL },
+  { "Dither=FS", "Density=75", NULL },
+  { "Resolution=300", "Dither=None", "Quality=Draft", NULL },
+  { "Duplex=DuplexNoTumble", "Density=0", NULL }
+};
+
+
+//
+// Local functions...
+//
+
+static void	reference(int optset, dstr_t *cmdline, const char *source);
+
+
+//
+// 'main()' - Compare the command lines for all templates and values.
+//
+
+int					// O - Exit status
+main(void)
+{
+  int		errors = 0,		// Number of failed tests
+		failed,			// Failed tests of the template
+		i, j, k,		// Looping vars
+		pdf,			// PDF command line?
+		optset;			// Optionset of the values
+  const char	*tmpdir;		// Temporary directory
+  char		ppdfile[1024],		// PPD file
+		name[128],		// Option name
+		*value;			// Option value
+  FILE		*fp;			// PPD file
+  dstr_t	*compiled,		// Command line from the template
+		*expected;		// Command line from dstrreplace()
+
+
+  if ((tmpdir = getenv("TMPDIR")) == NULL || !*tmpdir)
+    tmpdir = "/tmp";
+
+  snprintf(ppdfile, sizeof(ppdfile), "%s/test-cmdline.%d.ppd", tmpdir,
+	   (int)getpid());
+  if ((fp = fopen(ppdfile, "w")) == NULL)
+  {
+    perror(ppdfile);
+    return (1);
+  }
+  fputs(TestPPD, fp);
+  fclose(fp);
+
+  jclappend = create_dstr();
+  options_init();
+  read_ppd_file(ppdfile);
+  unlink(ppdfile);
+
+  compiled = create_dstr();
+  expected = create_dstr();
+  optset   = optionset("userval");
+
+  for (i = 0; i < (int)(sizeof(Templates) / sizeof(Templates[0])); i ++)
+  {
+    failed = 0;
+
+    for (pdf = 0; pdf < 2; pdf ++)
+    {
+      strlcpy(pdf ? cmd_pdf : cmd, Templates[i], sizeof(cmd));
+
+      // The values accumulate, so each set also gets built on top of the
+      // previous ones, and built twice to use the cached result
+      optionset_copy_values(optionset("default"), optset);
+
+      for (j = 0; j < (int)(sizeof(Values) / sizeof(Values[0])); j ++)
+      {
+	for (k = 0; Values[j][k]; k ++)
+	{
+	  strlcpy(name, Values[j][k], sizeof(name));
+	  if ((value = strchr(name, '=')) != NULL)
+	    *value++ = '\0';
+	  option_set_value(find_option(name), optset, value);
+	}
+
+	reference(optset, expected, Templates[i]);
+
+	for (k = 0; k < 2; k ++)
+	{
+	  build_commandline(optset, compiled, pdf);
+
+	  if (strcmp(compiled->data, expected->data))
+	  {
+	    printf("\"%s\" (%s, values %d): FAIL\n  got      \"%s\"\n"
+		   "  expected \"%s\"\n", Templates[i], pdf ? "PDF" : "PS", j,
+		   compiled->data, expected->data);
+	    failed ++;
+	  }
+	}
+      }
+    }
+
+    if (failed)
+      errors ++;
+    else
+      printf("\"%s\": PASS\n", Templates[i]);
+  }
+
+  free_dstr(compiled);
+  free_dstr(expected);
+  options_free();
+  free_dstr(jclappend);
+
+  return (errors != 0);
+}
+
+
+//
+// 'get_current_job()' - Job of the test.
+//
+
+jobparams_t *				// O - Job
+get_current_job()
+{
+  static jobparams_t	job;		// Job
+
+
+  return (&job);
+}
+
+
+//
+// 'reference()' - Build the command line with dstrreplace().
+//
+// This is how build_commandline() inserted the option snippets before it
+// compiled the command line into a template.
+//
+
+static void
+reference(int        optset,		// I - Optionset
+	  dstr_t     *cmdline,		// O - Command line
+	  const char *source)		// I - Command line prototype
+{
+  option_t	*opt;			// Current option
+  const char	*userval;		// Value of the option
+  dstr_t	*cmdvar;		// Snippet of the option
+  char		letters[] = "%A %B %C %D %E %F %G %H %I %J %K %L %M %W %X %Y %Z",
+		*s,			// Replacement
+		p[3];			// Spot marker
+
+
+  cmdvar = create_dstr();
+  dstrcpy(cmdline, source);
+
+  for (opt = optionlist_sorted_by_order; opt; opt = opt->next_by_order)
+  {
+    if (option_is_composite(opt))
+      continue;
+
+    userval = option_get_value(opt, optset);
+    option_get_command(cmdvar, opt, optset, -1);
+
+    if (!option_is_ps_command(opt) && !option_is_jcl_arg(opt) &&
+	option_is_commandline_arg(opt))
+    {
+      snprintf(p, sizeof(p), "%%%c", opt->spot);
+      s = malloc(cmdvar->len + 3);
+      snprintf(s, cmdvar->len + 3, "%s%%%c", cmdvar->data, opt->spot);
+      dstrreplace(cmdline, p, s, 0);
+      free(s);
+    }
+
+    if (strstr(cmdline->data, "%Y"))
+    {
+      if (isempty(userval))
+	continue;
+      s = malloc(strlen(opt->name) + strlen(userval) + 20);
+      sprintf(s, "%s=%s %%Y", opt->name, userval);
+      dstrreplace(cmdline, "%Y", s, 0);
+      free(s);
+    }
+  }
+
+  s = strtok(letters, " ");
+  do
+  {
+    dstrreplace(cmdline, s, "", 0);
+  }
+  while ((s = strtok(NULL, " ")));
+
+  free_dstr(cmdvar);
+}
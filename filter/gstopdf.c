@@ -15,6 +15,7 @@
 
 #include <cupsfilters/filter.h>
 #include <ppd/ppd-filter.h>
+#include "filter-trace.h"
 #include <signal.h>
 
 
@@ -65,8 +66,8 @@ main(int  argc,				// I - Number of command-line args
   //
 
   cf_filter_out_format_t outformat = CF_FILTER_OUT_FORMAT_PDF;
-  ret = ppdFilterCUPSWrapper(argc, argv, cfFilterGhostscript, &outformat,
-			     &JobCanceled);
+  ret = trace_cups_wrapper(argc, argv, "gstopdf", cfFilterGhostscript,
+			   &outformat, &JobCanceled);
 
   if (ret)
     fprintf(stderr, "ERROR: gstopdf filter failed.\n");
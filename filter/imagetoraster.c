@@ -15,6 +15,7 @@
 
 #include <cupsfilters/filter.h>
 #include <ppd/ppd-filter.h>
+#include "filter-trace.h"
 #include <signal.h>
 
 
@@ -65,8 +66,8 @@ main(int  argc,				// I - Number of command-line args
   // Fire up the cfFilterImageToRaster() filter function
   //
 
-  ret = ppdFilterCUPSWrapper(argc, argv, cfFilterImageToRaster, NULL,
-			     &JobCanceled);
+  ret = trace_cups_wrapper(argc, argv, "imagetoraster", cfFilterImageToRaster,
+			   NULL, &JobCanceled);
 
   if (ret)
     fprintf(stderr, "ERROR: imagetoraster filter function failed.\n");
@@ -13,6 +13,7 @@
 
 #include <cupsfilters/filter.h>
 #include <ppd/ppd-filter.h>
+#include "filter-trace.h"
 #include <signal.h>
 
 
@@ -64,8 +65,8 @@ main(int  argc,	   // I - Number of command-line arguments
   // Fire up the cfFilterMuPDFToPWG() filter function
   //
   
-  ret = ppdFilterCUPSWrapper(argc, argv, cfFilterMuPDFToPWG, NULL,
-			     &JobCanceled);
+  ret = trace_cups_wrapper(argc, argv, "mupdftopwg", cfFilterMuPDFToPWG, NULL,
+			   &JobCanceled);
 
   if (ret)
     fprintf(stderr, "ERROR: mupdftopwg filter function failed.\n");
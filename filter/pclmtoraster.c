@@ -13,6 +13,7 @@
 
 #include <cupsfilters/filter.h>
 #include <ppd/ppd-filter.h>
+#include "filter-trace.h"
 
 
 //
@@ -40,8 +41,8 @@ int main(int argc, char **argv)
       outformat = CF_FILTER_OUT_FORMAT_CUPS_RASTER;
   }
 
-  ret = ppdFilterCUPSWrapper(argc, argv, cfFilterPCLmToRaster, &outformat,
-			     &JobCanceled);
+  ret = trace_cups_wrapper(argc, argv, "pclmtoraster", cfFilterPCLmToRaster,
+			   &outformat, &JobCanceled);
 
   if (ret)
     fprintf(stderr, "ERROR: pclmtoraster filter function failed.\n");
@@ -13,6 +13,7 @@
 
 #include <cupsfilters/filter.h>
 #include <ppd/ppd-filter.h>
+#include "filter-trace.h"
 #include <signal.h>
 
 
@@ -63,7 +64,8 @@ main(int  argc,				// I - Number of command-line args
   // Fire up the ppdFilterPDFToPDF() filter function
   //
 
-  ret = ppdFilterCUPSWrapper(argc, argv, ppdFilterPDFToPDF, NULL, &JobCanceled);
+  ret = trace_cups_wrapper(argc, argv, "pdftopdf", ppdFilterPDFToPDF, NULL,
+			   &JobCanceled);
 
   if (ret)
     fprintf(stderr, "ERROR: pdftopdf filter function failed.\n");
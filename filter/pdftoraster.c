@@ -13,6 +13,7 @@
 
 #include <cupsfilters/filter.h>
 #include <ppd/ppd-filter.h>
+#include "filter-trace.h"
 #include <signal.h>
 
 //
@@ -62,8 +63,8 @@ main(int  argc,	   // I - Number of command-line arguments
   // Fire up the cfFilterPDFToRaster() filter function
   //
 
-  ret = ppdFilterCUPSWrapper(argc, argv, cfFilterPDFToRaster, NULL,
-			     &JobCanceled);
+  ret = trace_cups_wrapper(argc, argv, "pdftoraster", cfFilterPDFToRaster,
+			   NULL, &JobCanceled);
 
   if (ret)
     fprintf(stderr, "ERROR: pdftoraster filter function failed.\n");
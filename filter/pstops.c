@@ -15,6 +15,7 @@
 
 #include <cupsfilters/filter.h>
 #include <ppd/ppd-filter.h>
+#include "filter-trace.h"
 #include <signal.h>
 
 
@@ -65,7 +66,8 @@ main(int  argc,				// I - Number of command-line args
   // Fire up the ppdFilterPSToPS() filter function
   //
 
-  ret = ppdFilterCUPSWrapper(argc, argv, ppdFilterPSToPS, NULL, &JobCanceled);
+  ret = trace_cups_wrapper(argc, argv, "pstops", ppdFilterPSToPS, NULL,
+			   &JobCanceled);
 
   if (ret)
     fprintf(stderr, "ERROR: pstops filter function failed.\n");
@@ -15,6 +15,7 @@
 
 #include <cupsfilters/filter.h>
 #include <ppd/ppd-filter.h>
+#include "filter-trace.h"
 #include <signal.h>
 
 
@@ -66,8 +67,8 @@ main(int  argc,				// I - Number of command-line args
   //
 
   cf_filter_out_format_t outformat = CF_FILTER_OUT_FORMAT_PCLM;
-  ret = ppdFilterCUPSWrapper(argc, argv, cfFilterPWGToPDF, &outformat,
-			     &JobCanceled);
+  ret = trace_cups_wrapper(argc, argv, "pwgtopclm", cfFilterPWGToPDF,
+			   &outformat, &JobCanceled);
 
   if (ret)
     fprintf(stderr, "ERROR: pwgtopclm filter failed.\n");
@@ -13,6 +13,7 @@
 
 #include <cupsfilters/filter.h>
 #include <ppd/ppd-filter.h>
+#include "filter-trace.h"
 #include <signal.h>
 
 
@@ -63,8 +64,8 @@ main(int  argc,	   // I - Number of command-line arguments
   // Fire up the cfFilterPWGToRaster() filter function
   //
 
-  ret = ppdFilterCUPSWrapper(argc, argv, cfFilterPWGToRaster, NULL,
-			     &JobCanceled);
+  ret = trace_cups_wrapper(argc, argv, "pwgtoraster", cfFilterPWGToRaster,
+			   NULL, &JobCanceled);
 
   if (ret)
     fprintf(stderr, "ERROR: pwgtoraster filter function failed.\n");
@@ -0,0 +1,1584 @@
+//
+// Raster line compression for the PCL and ESC/P drivers of cups-filters.
+//
+// The encoders write into a caller-supplied buffer and fail instead of
+// writing past its end, so a driver can size its buffer with
+// raster_compress_bound() or use a smaller one and fall back to
+// uncompressed data when compression does not pay off. The decoders
+// are for the tests and are strict about malformed input.
+//
+// Copyright © 2024 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Contents:
+//
+//   raster_compress_bound() - Get the worst-case size of an encoded row.
+//   raster_codec_free()     - Free the seed rows of a codec.
+//   raster_codec_init()     - Initialize a codec.
+//   raster_codec_reset()    - Reset the seed rows, as after a Y offset.
+//   raster_decode_block()   - Decode the rows of an adaptive block.
+//   raster_decode_row()     - Decode a row.
+//   raster_encode_empty()   - Encode empty rows of an adaptive block.
+//   raster_encode_row()     - Encode a row.
+//   encode_adaptive()       - Encode a row of an adaptive block.
+//   encode_delta_row()      - Encode a row with delta row compression.
+//   encode_near_lossless()  - Encode a row with near lossless compression.
+//   encode_packbits()       - Encode a row with TIFF PackBits.
+//   encode_repeat()         - Encode empty or duplicate adaptive rows.
+//   encode_replacement()    - Encode a row with replacement delta row
+//                             compression.
+//   encode_rle()            - Encode a row with run-length encoding.
+//   decode_delta_row()      - Decode a delta row compressed row.
+//   decode_near_lossless()  - Decode a near lossless compressed row.
+//   decode_packbits()       - Decode a TIFF PackBits row.
+//   decode_replacement()    - Decode a replacement delta row compressed
+//                             row.
+//   decode_rle()            - Decode a run-length encoded row.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "raster-compress.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+//
+// Macros to write to the bounded output buffer...
+//
+
+#define PUT(b)		do { if (out >= outend) return (-1); \
+			     *out++ = (unsigned char)(b); } while (0)
+#define PUTN(p, n)	do { if ((size_t)(outend - out) < (size_t)(n)) \
+			       return (-1); \
+			     memcpy(out, p, n); out += (n); } while (0)
+
+
+//
+// Local functions...
+//
+
+static ssize_t	encode_adaptive(raster_codec_t *rc,
+				const unsigned char *line, size_t length,
+				unsigned char *out, unsigned char *outend);
+static ssize_t	encode_delta_row(const unsigned char *line,
+				 const unsigned char *line_end,
+				 const unsigned char *seed, int seed_valid,
+				 unsigned char *out, unsigned char *outend);
+static ssize_t	encode_near_lossless(const unsigned char *line, size_t length,
+				     const unsigned char *seed, int bpp,
+				     unsigned char *out, unsigned char *outend);
+static ssize_t	encode_packbits(const unsigned char *line,
+				const unsigned char *line_end,
+				unsigned char *out, unsigned char *outend);
+static ssize_t	encode_repeat(raster_codec_t *rc, int cmd, int rows,
+			      unsigned char *out, unsigned char *outend);
+static ssize_t	encode_replacement(const unsigned char *line,
+				   const unsigned char *line_end,
+				   const unsigned char *seed, int seed_valid,
+				   unsigned char *out, unsigned char *outend);
+static ssize_t	encode_rle(const unsigned char *line,
+			   const unsigned char *line_end,
+			   unsigned char *out, unsigned char *outend);
+static ssize_t	decode_delta_row(const unsigned char *in,
+				 const unsigned char *inend,
+				 unsigned char *out, size_t length);
+static ssize_t	decode_near_lossless(const unsigned char *in,
+				     const unsigned char *inend,
+				     unsigned char *out, size_t length,
+				     int bpp);
+static ssize_t	decode_packbits(const unsigned char *in,
+				const unsigned char *inend,
+				unsigned char *out, size_t length);
+static ssize_t	decode_replacement(const unsigned char *in,
+				   const unsigned char *inend,
+				   unsigned char *out, size_t length);
+static ssize_t	decode_rle(const unsigned char *in,
+			   const unsigned char *inend,
+			   unsigned char *out, size_t length);
+
+
+//
+// 'raster_compress_bound()' - Get the worst-case size of an encoded row.
+//
+
+size_t					// O - Maximum number of bytes
+raster_compress_bound(int    mode,	// I - Compression mode
+		      size_t length,	// I - Bytes per row
+		      int    bpp)	// I - Bytes per pixel (mode 10)
+{
+  switch (mode)
+  {
+    case RASTER_COMPRESS_RLE :
+        // One count byte per data byte when no bytes repeat
+	return (2 * length);
+
+    case RASTER_COMPRESS_PACKBITS :
+        // One header byte for each single literal byte before a repeated
+	// pair, plus a single byte at the end
+	return (length + (length + 2) / 3 + 2);
+
+    case RASTER_COMPRESS_DELTA_ROW :
+        // One command byte per 8 changed bytes, one offset byte per 31
+	// unchanged bytes
+	return (length + length / 8 + length / 31 + 2);
+
+    case RASTER_COMPRESS_ADAPTIVE :
+        // Row header plus the row, as it is only compressed if that
+	// makes it smaller
+	return (length + 3);
+
+    case RASTER_COMPRESS_REPLACEMENT :
+        // Two command bytes per 8 changed bytes after an unchanged one,
+	// plus count bytes of long literal sequences
+	return (length + length / 8 + length / 255 + 4);
+
+    case RASTER_COMPRESS_NEAR_LOSSLESS :
+        // 3 bytes for a pixel which is not a small difference, plus the
+	// command, offset and count bytes
+	if (bpp < 1)
+	  bpp = 1;
+	return (4 * (length / bpp) + 2);
+
+    default :
+	return (length);
+  }
+}
+
+
+//
+// 'raster_codec_free()' - Free the seed rows of a codec.
+//
+
+void
+raster_codec_free(raster_codec_t *rc)	// I - Codec
+{
+  free(rc->seed);
+  free(rc->seed_valid);
+  free(rc->scratch);
+
+  rc->seed       = NULL;
+  rc->seed_valid = NULL;
+  rc->scratch    = NULL;
+  rc->merge      = NULL;
+}
+
+
+//
+// 'raster_codec_init()' - Initialize a codec.
+//
+// Delta row compression keeps one seed row per plane, near lossless
+// compression one for all of them. Adaptive compression sends whole
+// rows, so it has one plane and rows of at most RASTER_ADAPTIVE_ROW
+// bytes.
+//
+
+int					// O - 0 on success, -1 on error
+raster_codec_init(raster_codec_t *rc,	// I - Codec
+		  int            mode,	// I - Compression mode
+		  size_t         length,// I - Maximum bytes per row
+		  int            planes,// I - Number of planes
+		  int            bpp)	// I - Bytes per pixel (mode 10)
+{
+  memset(rc, 0, sizeof(raster_codec_t));
+
+  switch (mode)
+  {
+    case RASTER_COMPRESS_NONE :
+    case RASTER_COMPRESS_RLE :
+    case RASTER_COMPRESS_PACKBITS :
+        break;
+
+    case RASTER_COMPRESS_NEAR_LOSSLESS :
+        if (bpp != 1 && bpp != 3)
+	  return (-1);
+        planes = 1;
+	// Fall through
+
+    case RASTER_COMPRESS_DELTA_ROW :
+    case RASTER_COMPRESS_REPLACEMENT :
+        if (planes < 1)
+	  planes = 1;
+
+        rc->seed       = calloc((size_t)planes, length);
+	rc->seed_valid = calloc((size_t)planes, 1);
+	if (!rc->seed || !rc->seed_valid)
+	{
+	  raster_codec_free(rc);
+	  return (-1);
+	}
+        break;
+
+    case RASTER_COMPRESS_ADAPTIVE :
+        if (length > RASTER_ADAPTIVE_ROW)
+	  return (-1);
+
+        planes         = 1;
+        rc->seed       = calloc(1, length + 1);
+	rc->seed_valid = calloc(1, 1);
+	rc->scratch    = malloc(2 * length + 2);
+	if (!rc->seed || !rc->seed_valid || !rc->scratch)
+	{
+	  raster_codec_free(rc);
+	  return (-1);
+	}
+        break;
+
+    default :
+        return (-1);
+  }
+
+  rc->mode   = mode;
+  rc->bpp    = bpp;
+  rc->length = length;
+  rc->planes = planes;
+
+  return (0);
+}
+
+
+//
+// 'raster_codec_reset()' - Reset the seed rows, as after a Y offset.
+//
+// The printer clears its seed rows; the delta row encoders then send the
+// next row of each plane as literal data. An adaptive block must also be
+// reset before its first row, as its rows are not merged with or
+// compressed against those of the previous block.
+//
+
+void
+raster_codec_reset(raster_codec_t *rc)	// I - Codec
+{
+  rc->merge = NULL;
+
+  if (!rc->seed)
+    return;
+
+  memset(rc->seed, 0, (size_t)rc->planes * rc->length);
+  memset(rc->seed_valid, 0, (size_t)rc->planes);
+}
+
+
+//
+// 'raster_decode_block()' - Decode the rows of an adaptive block.
+//
+// Returns the number of rows stored in "rows", each "length" bytes, or
+// -1 for malformed data or more than "maxrows" rows.
+//
+
+int					// O - Number of rows or -1
+raster_decode_block(
+    raster_codec_t      *rc,		// I - Codec
+    const unsigned char *in,		// I - Block
+    size_t              inlen,		// I - Length of block
+    unsigned char       *rows,		// O - Rows
+    size_t              length,		// I - Bytes per row
+    int                 maxrows)	// I - Maximum number of rows
+{
+  const unsigned char	*inend = in + inlen;
+					// End of block
+  unsigned char		*row;		// Current row
+  int			cmd,		// Row command
+			n = 0;		// Number of rows
+  size_t		count;		// Row bytes or repeat count
+  ssize_t		bytes;		// Decoded bytes
+
+
+  if (rc->mode != RASTER_COMPRESS_ADAPTIVE || length > rc->length ||
+      inlen > RASTER_ADAPTIVE_BLOCK)
+    return (-1);
+
+  while (in < inend)
+  {
+    if (inend - in < 3)
+      return (-1);
+
+    cmd   = in[0];
+    count = (size_t)((in[1] << 8) | in[2]);
+    in    += 3;
+
+    if (cmd == 4 || cmd == 5)
+    {
+      //
+      // Empty or duplicate rows...
+      //
+
+      if (count > (size_t)(maxrows - n))
+        return (-1);
+
+      if (cmd == 4 && count)
+        memset(rc->seed, 0, length);
+
+      for (; count > 0; count --, n ++)
+        memcpy(rows + (size_t)n * length, rc->seed, length);
+      continue;
+    }
+
+    if (count > (size_t)(inend - in) || n >= maxrows)
+      return (-1);
+
+    row = rows + (size_t)n * length;
+
+    switch (cmd)
+    {
+      case RASTER_COMPRESS_NONE :
+          if (count > length)
+	    return (-1);
+	  memcpy(row, in, count);
+	  bytes = (ssize_t)count;
+          break;
+
+      case RASTER_COMPRESS_RLE :
+	  bytes = decode_rle(in, in + count, row, length);
+          break;
+
+      case RASTER_COMPRESS_PACKBITS :
+	  bytes = decode_packbits(in, in + count, row, length);
+          break;
+
+      case RASTER_COMPRESS_DELTA_ROW :
+          memcpy(row, rc->seed, length);
+	  bytes = decode_delta_row(in, in + count, row, length);
+          break;
+
+      default :
+          return (-1);
+    }
+
+    if (bytes < 0)
+      return (-1);
+
+    // Short rows are filled with zeros
+    memset(row + bytes, 0, length - (size_t)bytes);
+    memcpy(rc->seed, row, length);
+
+    in += count;
+    n ++;
+  }
+
+  return (n);
+}
+
+
+//
+// 'raster_decode_row()' - Decode a row.
+//
+// Returns the number of bytes decoded, which is the full row for the
+// seed row based modes, or -1 for malformed data.
+//
+
+ssize_t					// O - Number of bytes or -1
+raster_decode_row(raster_codec_t      *rc,	// I - Codec
+		  int                 plane,	// I - Plane of the row
+		  const unsigned char *in,	// I - Encoded data
+		  size_t              inlen,	// I - Length of encoded data
+		  unsigned char       *out,	// O - Row
+		  size_t              length)	// I - Bytes per row
+{
+  unsigned char	*seed;			// Seed row
+  ssize_t	bytes;			// Decoded bytes
+
+
+  if (length > rc->length || plane < 0 ||
+      (rc->seed && plane >= rc->planes))
+    return (-1);
+
+  switch (rc->mode)
+  {
+    case RASTER_COMPRESS_RLE :
+	return (decode_rle(in, in + inlen, out, length));
+
+    case RASTER_COMPRESS_PACKBITS :
+	return (decode_packbits(in, in + inlen, out, length));
+
+    case RASTER_COMPRESS_DELTA_ROW :
+    case RASTER_COMPRESS_NEAR_LOSSLESS :
+        seed = rc->seed + (rc->mode == RASTER_COMPRESS_DELTA_ROW ?
+			   (size_t)plane * rc->length : 0);
+	memcpy(out, seed, length);
+
+	if (rc->mode == RASTER_COMPRESS_DELTA_ROW)
+	  bytes = decode_delta_row(in, in + inlen, out, length);
+	else
+	  bytes = decode_near_lossless(in, in + inlen, out, length, rc->bpp);
+
+	if (bytes >= 0)
+	  memcpy(seed, out, length);
+	return (bytes);
+
+    case RASTER_COMPRESS_REPLACEMENT :
+        seed = rc->seed + (size_t)plane * rc->length;
+	memcpy(out, seed, length);
+
+	if ((bytes = decode_replacement(in, in + inlen, out, length)) >= 0)
+	  memcpy(seed, out, length);
+	return (bytes);
+
+    case RASTER_COMPRESS_ADAPTIVE :
+        if (raster_decode_block(rc, in, inlen, out, length, 1) != 1)
+	  return (-1);
+	return ((ssize_t)length);
+
+    default :
+        if (inlen > length)
+	  return (-1);
+	memcpy(out, in, inlen);
+	return ((ssize_t)inlen);
+  }
+}
+
+
+//
+// 'raster_encode_empty()' - Encode empty rows of an adaptive block.
+//
+// Empty rows directly following an empty row entry in the same block are
+// merged into it, in which case nothing is written and 0 is returned.
+//
+
+ssize_t					// O - Number of bytes or -1
+raster_encode_empty(raster_codec_t *rc,	// I - Codec
+		    int            rows,// I - Number of empty rows
+		    unsigned char  *out,// O - Encoded data
+		    size_t         outsize)
+					// I - Size of output buffer
+{
+  ssize_t	bytes;			// Encoded bytes
+
+
+  if (rc->mode != RASTER_COMPRESS_ADAPTIVE || rows < 0)
+    return (-1);
+
+  if ((bytes = encode_repeat(rc, 4, rows, out, out + outsize)) >= 0 && rows)
+  {
+    // The printer clears the seed row; don't rely on it until the next
+    // non-empty row
+    memset(rc->seed, 0, rc->length);
+    rc->seed_valid[0] = 0;
+  }
+
+  return (bytes);
+}
+
+
+//
+// 'raster_encode_row()' - Encode a row.
+//
+// Returns the number of bytes written to "out", or -1 if they do not fit
+// into "outsize" bytes. The seed row is only updated on success.
+//
+// Adaptive rows are appended to a block by passing the end of the block
+// so far as "out"; they may then be merged into the previous row entry,
+// see raster_encode_empty().
+//
+
+ssize_t					// O - Number of bytes or -1
+raster_encode_row(raster_codec_t      *rc,	// I - Codec
+		  int                 plane,	// I - Plane of the row
+		  const unsigned char *line,	// I - Row
+		  size_t              length,	// I - Bytes per row
+		  unsigned char       *out,	// O - Encoded data
+		  size_t              outsize)	// I - Size of output buffer
+{
+  unsigned char	*seed;			// Seed row
+  ssize_t	bytes;			// Encoded bytes
+
+
+  if (length > rc->length || plane < 0 ||
+      (rc->seed && plane >= rc->planes))
+    return (-1);
+
+  switch (rc->mode)
+  {
+    case RASTER_COMPRESS_RLE :
+	return (encode_rle(line, line + length, out, out + outsize));
+
+    case RASTER_COMPRESS_PACKBITS :
+	return (encode_packbits(line, line + length, out, out + outsize));
+
+    case RASTER_COMPRESS_DELTA_ROW :
+    case RASTER_COMPRESS_REPLACEMENT :
+        seed = rc->seed + (size_t)plane * rc->length;
+	if (rc->mode == RASTER_COMPRESS_DELTA_ROW)
+	  bytes = encode_delta_row(line, line + length, seed,
+				   rc->seed_valid[plane], out, out + outsize);
+	else
+	  bytes = encode_replacement(line, line + length, seed,
+				     rc->seed_valid[plane], out,
+				     out + outsize);
+	if (bytes >= 0)
+	{
+	  memcpy(seed, line, length);
+	  rc->seed_valid[plane] = 1;
+	}
+	return (bytes);
+
+    case RASTER_COMPRESS_NEAR_LOSSLESS :
+	bytes = encode_near_lossless(line, length, rc->seed, rc->bpp,
+				     out, out + outsize);
+	if (bytes >= 0)
+	  memcpy(rc->seed, line, length);
+	return (bytes);
+
+    case RASTER_COMPRESS_ADAPTIVE :
+        return (encode_adaptive(rc, line, length, out, out + outsize));
+
+    default :
+        if (length > outsize)
+	  return (-1);
+	memcpy(out, line, length);
+	return ((ssize_t)length);
+  }
+}
+
+
+//
+// 'encode_adaptive()' - Encode a row of an adaptive block.
+//
+// Each row starts with a command byte and a 16-bit length or repeat
+// count. Empty and duplicate rows are sent as such, other rows with
+// whichever of delta row, PackBits or run-length encoding is smallest,
+// or uncompressed.
+//
+
+static ssize_t				// O - Number of bytes or -1
+encode_adaptive(raster_codec_t      *rc,// I - Codec
+		const unsigned char *line,
+					// I - Row
+		size_t              length,
+					// I - Bytes per row
+		unsigned char       *out,
+					// I - Output buffer
+		unsigned char       *outend)
+					// I - End of output buffer
+{
+  const unsigned char	*line_end = line + length,
+					// End of row
+			*data = line;	// Data of the best encoding
+  unsigned char		*trial = rc->scratch,
+					// Buffer for the next trial
+			*spare = rc->scratch + length + 1;
+					// Other trial buffer
+  size_t		best = length,	// Size of the best encoding
+			i;		// Looping var
+  int			cmd = RASTER_COMPRESS_NONE;
+					// Best encoding
+  ssize_t		bytes;		// Encoded bytes
+
+
+  //
+  // Empty and duplicate rows...
+  //
+
+  for (i = 0; i < length && !line[i]; i ++);
+
+  if (i == length)
+  {
+    if ((bytes = encode_repeat(rc, 4, 1, out, outend)) >= 0)
+    {
+      memset(rc->seed, 0, rc->length);
+      rc->seed_valid[0] = 0;
+    }
+
+    return (bytes);
+  }
+
+  if (rc->seed_valid[0] && !memcmp(line, rc->seed, length))
+    return (encode_repeat(rc, 5, 1, out, outend));
+
+  //
+  // Try the encodings; each has to be smaller than the best so far...
+  //
+
+  if (rc->seed_valid[0] &&
+      (bytes = encode_delta_row(line, line_end, rc->seed, 1, trial,
+				trial + best - 1)) >= 0)
+  {
+    cmd   = RASTER_COMPRESS_DELTA_ROW;
+    best  = (size_t)bytes;
+    data  = trial;
+    trial = spare;
+    spare = (unsigned char *)data;
+  }
+
+  if (best > 1 &&
+      (bytes = encode_packbits(line, line_end, trial,
+			       trial + best - 1)) >= 0)
+  {
+    cmd   = RASTER_COMPRESS_PACKBITS;
+    best  = (size_t)bytes;
+    data  = trial;
+    trial = spare;
+    spare = (unsigned char *)data;
+  }
+
+  if (best > 1 &&
+      (bytes = encode_rle(line, line_end, trial, trial + best - 1)) >= 0)
+  {
+    cmd   = RASTER_COMPRESS_RLE;
+    best  = (size_t)bytes;
+    data  = trial;
+  }
+
+  //
+  // Write the row...
+  //
+
+  if ((size_t)(outend - out) < best + 3)
+    return (-1);
+
+  out[0] = (unsigned char)cmd;
+  out[1] = (unsigned char)(best >> 8);
+  out[2] = (unsigned char)best;
+  memcpy(out + 3, data, best);
+
+  memcpy(rc->seed, line, length);
+  rc->seed_valid[0] = 1;
+  rc->merge         = NULL;
+
+  return ((ssize_t)(best + 3));
+}
+
+
+//
+// 'encode_delta_row()' - Encode a row with delta row compression.
+//
+
+static ssize_t				// O - Number of bytes or -1
+encode_delta_row(
+    const unsigned char *line,		// I - Row
+    const unsigned char *line_end,	// I - End of row
+    const unsigned char *seed,		// I - Seed row
+    int                 seed_valid,	// I - Seed row valid?
+    unsigned char       *out,		// I - Output buffer
+    unsigned char       *outend)	// I - End of output buffer
+{
+  unsigned char		*outstart = out;// Start of output
+  const unsigned char	*line_ptr,	// Current byte pointer
+			*start;		// Start of compression sequence
+  int			count,		// Count of bytes for output
+			offset;		// Offset of bytes for output
+
+
+  line_ptr = line;
+
+  while (line_ptr < line_end)
+  {
+    //
+    // Find the next non-matching sequence...
+    //
+
+    start = line_ptr;
+
+    if (!seed_valid)
+    {
+      //
+      // The seed buffer is invalid, so do the next 8 bytes, max...
+      //
+
+      offset = 0;
+
+      if ((count = line_end - line_ptr) > 8)
+	count = 8;
+
+      line_ptr += count;
+    }
+    else
+    {
+      //
+      // The seed buffer is valid, so compare against it...
+      //
+
+      while (line_ptr < line_end &&
+	     *line_ptr == *seed)
+      {
+	line_ptr ++;
+	seed ++;
+      }
+
+      if (line_ptr == line_end)
+	break;
+
+      offset = line_ptr - start;
+
+      //
+      // Find up to 8 non-matching bytes...
+      //
+
+      start = line_ptr;
+      count = 0;
+      while (line_ptr < line_end &&
+	     *line_ptr != *seed &&
+	     count < 8)
+      {
+	line_ptr ++;
+	seed ++;
+	count ++;
+      }
+    }
+
+    //
+    // Place mode 3 compression data in the buffer; see HP manuals
+    // for details...
+    //
+
+    if (offset >= 31)
+    {
+      //
+      // Output multi-byte offset...
+      //
+
+      PUT(((count - 1) << 5) | 31);
+
+      offset -= 31;
+      while (offset >= 255)
+      {
+	PUT(255);
+	offset -= 255;
+      }
+
+      PUT(offset);
+    }
+    else
+    {
+      //
+      // Output single-byte offset...
+      //
+
+      PUT(((count - 1) << 5) | offset);
+    }
+
+    PUTN(start, count);
+  }
+
+  return (out - outstart);
+}
+
+
+//
+// 'encode_near_lossless()' - Encode a row with near lossless compression.
+//
+// Each sequence starts with a command byte that looks like:
+//
+//     CMD SRC SRC OFF OFF CNT CNT CNT
+//
+// For the purpose of these drivers, CMD and SRC are always 0.
+//
+// If the offset >= 3 then additional offset bytes follow the first
+// command byte, each byte == 255 until the last one.
+//
+// If the count >= 7, then additional count bytes follow each group of
+// pixels, each byte == 255 until the last one.
+//
+// The offset and count are in RGB tuples (not bytes, as for Mode 3 and
+// 9). Gray rows are sent as RGB with equal components.
+//
+
+static ssize_t				// O - Number of bytes or -1
+encode_near_lossless(
+    const unsigned char *line,		// I - Row
+    size_t              length,		// I - Bytes per row
+    const unsigned char *seed,		// I - Seed row
+    int                 bpp,		// I - Bytes per pixel (1 or 3)
+    unsigned char       *out,		// I - Output buffer
+    unsigned char       *outend)	// I - End of output buffer
+{
+  unsigned char		*outstart = out;// Start of output
+  const unsigned char	*pixel,		// Current pixel
+			*spixel;	// Seed pixel
+  size_t		i,		// Current pixel
+			pixels,		// Number of pixels
+			start;		// Start of sequence
+  int			count,		// Count of pixels for output
+			offset,		// Offset of pixels for output
+			temp;		// Temporary count
+  int			gi = bpp == 3 ? 1 : 0,
+					// Offset of green in the pixel
+			bi = bpp == 3 ? 2 : 0;
+					// Offset of blue in the pixel
+  int			r, g, b;	// RGB deltas
+
+
+  pixels = length / bpp;
+
+  for (i = 0; i < pixels;)
+  {
+    //
+    // Find the next non-matching sequence...
+    //
+
+    start = i;
+    while (i < pixels && !memcmp(line + i * bpp, seed + i * bpp, bpp))
+      i ++;
+
+    if (i == pixels)
+      break;
+
+    offset = i - start;
+
+    //
+    // Find non-matching pixels...
+    //
+
+    start = i;
+    while (i < pixels && memcmp(line + i * bpp, seed + i * bpp, bpp))
+      i ++;
+
+    count = i - start;
+
+    if (offset >= 3)
+    {
+      //
+      // Output multi-byte offset...
+      //
+
+      if (count > 7)
+	PUT(0x1f);
+      else
+	PUT(0x18 | (count - 1));
+
+      offset -= 3;
+      while (offset >= 255)
+      {
+	PUT(255);
+	offset -= 255;
+      }
+
+      PUT(offset);
+    }
+    else
+    {
+      //
+      // Output single-byte offset...
+      //
+
+      if (count > 7)
+	PUT((offset << 3) | 0x07);
+      else
+	PUT((offset << 3) | (count - 1));
+    }
+
+    temp   = count - 8;
+    pixel  = line + start * bpp;
+    spixel = seed + start * bpp;
+
+    while (count > 0)
+    {
+      if (count <= temp)
+      {
+	//
+	// This is exceedingly lame...  The replacement counts are
+	// intermingled with the data...
+	//
+
+	if (temp >= 255)
+	  PUT(255);
+	else
+	  PUT(temp);
+
+	temp -= 255;
+      }
+
+      //
+      // Get difference between current and seed pixels...
+      //
+
+      r = pixel[0] - spixel[0];
+      g = pixel[gi] - spixel[gi];
+      b = ((pixel[bi] & 0xfe) - (spixel[bi] & 0xfe)) / 2;
+
+      if (r < -16 || r > 15 || g < -16 || g > 15 || b < -16 || b > 15)
+      {
+	//
+	// Pack 24-bit RGB into 23 bits...  Lame...
+	//
+
+	PUT(pixel[0] >> 1);
+
+	if (pixel[0] & 1)
+	  PUT(0x80 | (pixel[gi] >> 1));
+	else
+	  PUT(pixel[gi] >> 1);
+
+	if (pixel[gi] & 1)
+	  PUT(0x80 | (pixel[bi] >> 1));
+	else
+	  PUT(pixel[bi] >> 1);
+      }
+      else
+      {
+	//
+	// Pack 15-bit RGB difference...
+	//
+
+	PUT(0x80 | (((unsigned)r << 2) & 0x7c) | (((unsigned)g >> 3) & 0x03));
+	PUT((((unsigned)g << 5) & 0xe0) | (b & 0x1f));
+      }
+
+      count --;
+      pixel  += bpp;
+      spixel += bpp;
+    }
+
+    //
+    // Make sure we have the ending count if the replacement count was
+    // exactly 8 + 255n...
+    //
+
+    if (temp == 0)
+      PUT(0);
+  }
+
+  return (out - outstart);
+}
+
+
+//
+// 'encode_packbits()' - Encode a row with TIFF PackBits.
+//
+
+static ssize_t				// O - Number of bytes or -1
+encode_packbits(
+    const unsigned char *line,		// I - Row
+    const unsigned char *line_end,	// I - End of row
+    unsigned char       *out,		// I - Output buffer
+    unsigned char       *outend)	// I - End of output buffer
+{
+  unsigned char		*outstart = out;// Start of output
+  const unsigned char	*line_ptr,	// Current byte pointer
+			*start;		// Start of compression sequence
+  int			count;		// Count of bytes for output
+
+
+  line_ptr = line;
+
+  while (line_ptr < line_end)
+  {
+    if ((line_ptr + 1) >= line_end)
+    {
+      //
+      // Single byte on the end...
+      //
+
+      PUT(0x00);
+      PUT(*line_ptr++);
+    }
+    else if (line_ptr[0] == line_ptr[1])
+    {
+      //
+      // Repeated sequence...
+      //
+
+      line_ptr ++;
+      count = 2;
+
+      while (line_ptr < (line_end - 1) &&
+	     line_ptr[0] == line_ptr[1] &&
+	     count < 127)
+      {
+	line_ptr ++;
+	count ++;
+      }
+
+      PUT(257 - count);
+      PUT(*line_ptr++);
+    }
+    else
+    {
+      //
+      // Non-repeated sequence...
+      //
+
+      start    = line_ptr;
+      line_ptr ++;
+      count    = 1;
+
+      while (line_ptr < (line_end - 1) &&
+	     line_ptr[0] != line_ptr[1] &&
+	     count < 127)
+      {
+	line_ptr ++;
+	count ++;
+      }
+
+      PUT(count - 1);
+      PUTN(start, count);
+    }
+  }
+
+  return (out - outstart);
+}
+
+
+//
+// 'encode_repeat()' - Encode empty or duplicate adaptive rows.
+//
+// Nothing is written if the rows do not fit.
+//
+
+static ssize_t				// O - Number of bytes or -1
+encode_repeat(raster_codec_t *rc,	// I - Codec
+	      int            cmd,	// I - 4 = empty, 5 = duplicate
+	      int            rows,	// I - Number of rows
+	      unsigned char  *out,	// I - Output buffer
+	      unsigned char  *outend)	// I - End of output buffer
+{
+  unsigned char	*outstart = out;	// Start of output
+  int		avail = 0,		// Rows that fit into the last entry
+		count;			// Rows of an entry
+
+
+  if (rc->merge && rc->merge + 3 == out && rc->merge[0] == cmd)
+    avail = 65535 - ((rc->merge[1] << 8) | rc->merge[2]);
+
+  if (rows > avail &&
+      (outend - out) / 3 < (rows - avail + 65534) / 65535)
+    return (-1);
+
+  if (avail > 0)
+  {
+    count = rows < avail ? rows : avail;
+    rows  -= count;
+    count += (rc->merge[1] << 8) | rc->merge[2];
+
+    rc->merge[1] = (unsigned char)(count >> 8);
+    rc->merge[2] = (unsigned char)count;
+  }
+
+  while (rows > 0)
+  {
+    count = rows < 65535 ? rows : 65535;
+    rows  -= count;
+
+    out[0]    = (unsigned char)cmd;
+    out[1]    = (unsigned char)(count >> 8);
+    out[2]    = (unsigned char)count;
+    rc->merge = out;
+    out       += 3;
+  }
+
+  return (out - outstart);
+}
+
+
+//
+// 'encode_replacement()' - Encode a row with replacement delta row
+//                          compression.
+//
+// Each sequence of changed bytes starts with a command byte that looks
+// like:
+//
+//     0 OFF OFF OFF OFF CNT CNT CNT
+//
+// for literal bytes or
+//
+//     1 OFF OFF CNT CNT CNT CNT CNT
+//
+// for a repeated byte. If the offset or count field is all ones, more
+// offset or count bytes follow, each byte == 255 until the last one. The
+// count is the number of bytes - 1 for literal bytes and - 2 for
+// repeated bytes.
+//
+
+static ssize_t				// O - Number of bytes or -1
+encode_replacement(
+    const unsigned char *line,		// I - Row
+    const unsigned char *line_end,	// I - End of row
+    const unsigned char *seed,		// I - Seed row
+    int                 seed_valid,	// I - Seed row valid?
+    unsigned char       *out,		// I - Output buffer
+    unsigned char       *outend)	// I - End of output buffer
+{
+  unsigned char		*outstart = out;// Start of output
+  const unsigned char	*line_ptr,	// Current byte pointer
+			*last,		// End of last changed sequence
+			*start,		// Start of literal bytes
+			*end,		// End of changed sequence
+			*run_end;	// End of repeated bytes
+  size_t		count,		// Count of bytes for output
+			offset;		// Offset of bytes for output
+
+
+  line_ptr = line;
+  last     = line;
+
+  while (line_ptr < line_end)
+  {
+    //
+    // Find the next changed sequence; without a valid seed row that is
+    // the whole row...
+    //
+
+    if (seed_valid)
+    {
+      while (line_ptr < line_end && *line_ptr == seed[line_ptr - line])
+	line_ptr ++;
+
+      if (line_ptr == line_end)
+	break;
+
+      for (end = line_ptr + 1;
+	   end < line_end && *end != seed[end - line];
+	   end ++);
+    }
+    else
+      end = line_end;
+
+    offset = line_ptr - last;
+
+    while (line_ptr < end)
+    {
+      for (run_end = line_ptr + 1;
+	   run_end < end && *run_end == *line_ptr;
+	   run_end ++);
+
+      if (run_end - line_ptr >= 3)
+      {
+	//
+	// Repeated byte...
+	//
+
+	count = run_end - line_ptr;
+
+	PUT(0x80 | ((offset < 3 ? offset : 3) << 5) |
+	    (count < 33 ? count - 2 : 31));
+
+	if (offset >= 3)
+	{
+	  for (offset -= 3; offset >= 255; offset -= 255)
+	    PUT(255);
+	  PUT(offset);
+	}
+
+	if (count >= 33)
+	{
+	  for (count -= 33; count >= 255; count -= 255)
+	    PUT(255);
+	  PUT(count);
+	}
+
+	PUT(*line_ptr);
+	line_ptr = run_end;
+      }
+      else
+      {
+	//
+	// Literal bytes up to the next run of 3 or more...
+	//
+
+	start    = line_ptr;
+	line_ptr = run_end;
+
+	while (line_ptr < end)
+	{
+	  for (run_end = line_ptr + 1;
+	       run_end < end && *run_end == *line_ptr;
+	       run_end ++);
+
+	  if (run_end - line_ptr >= 3)
+	    break;
+
+	  line_ptr = run_end;
+	}
+
+	count = line_ptr - start;
+
+	PUT(((offset < 15 ? offset : 15) << 3) | (count < 8 ? count - 1 : 7));
+
+	if (offset >= 15)
+	{
+	  for (offset -= 15; offset >= 255; offset -= 255)
+	    PUT(255);
+	  PUT(offset);
+	}
+
+	if (count >= 8)
+	{
+	  for (count -= 8; count >= 255; count -= 255)
+	    PUT(255);
+	  PUT(count);
+	}
+
+	PUTN(start, line_ptr - start);
+      }
+
+      offset = 0;
+    }
+
+    last = end;
+  }
+
+  return (out - outstart);
+}
+
+
+//
+// 'encode_rle()' - Encode a row with run-length encoding.
+//
+
+static ssize_t				// O - Number of bytes or -1
+encode_rle(
+    const unsigned char *line,		// I - Row
+    const unsigned char *line_end,	// I - End of row
+    unsigned char       *out,		// I - Output buffer
+    unsigned char       *outend)	// I - End of output buffer
+{
+  unsigned char		*outstart = out;// Start of output
+  const unsigned char	*line_ptr;	// Current byte pointer
+  int			count;		// Count of bytes for output
+
+
+  for (line_ptr = line; line_ptr < line_end; line_ptr += count)
+  {
+    for (count = 1;
+	 (line_ptr + count) < line_end &&
+	     line_ptr[0] == line_ptr[count] &&
+	     count < 256;
+	 count ++);
+
+    PUT(count - 1);
+    PUT(line_ptr[0]);
+  }
+
+  return (out - outstart);
+}
+
+
+//
+// 'decode_delta_row()' - Decode a delta row compressed row.
+//
+// "out" contains the seed row on entry.
+//
+
+static ssize_t				// O - Number of bytes or -1
+decode_delta_row(
+    const unsigned char *in,		// I - Encoded data
+    const unsigned char *inend,		// I - End of encoded data
+    unsigned char       *out,		// I - Row
+    size_t              length)		// I - Bytes per row
+{
+  size_t	pos = 0,		// Position in row
+		offset,			// Offset of replaced bytes
+		count;			// Number of replaced bytes
+
+
+  while (in < inend)
+  {
+    count  = (*in >> 5) + 1;
+    offset = *in++ & 31;
+
+    if (offset == 31)
+    {
+      do
+      {
+        if (in >= inend)
+	  return (-1);
+	offset += *in;
+      }
+      while (*in++ == 255);
+    }
+
+    if (offset > length - pos || count > length - pos - offset ||
+	count > (size_t)(inend - in))
+      return (-1);
+
+    pos += offset;
+    memcpy(out + pos, in, count);
+    pos += count;
+    in  += count;
+  }
+
+  return ((ssize_t)length);
+}
+
+
+//
+// 'decode_near_lossless()' - Decode a near lossless compressed row.
+//
+// "out" contains the seed row on entry. The lowest bit of blue is not
+// transferred.
+//
+
+static ssize_t				// O - Number of bytes or -1
+decode_near_lossless(
+    const unsigned char *in,		// I - Encoded data
+    const unsigned char *inend,		// I - End of encoded data
+    unsigned char       *out,		// I - Row
+    size_t              length,		// I - Bytes per row
+    int                 bpp)		// I - Bytes per pixel (1 or 3)
+{
+  size_t	pos = 0,		// Position in row (pixels)
+		pixels = length / bpp,	// Number of pixels
+		offset,			// Offset of replaced pixels
+		count;			// Number of replaced pixels
+  unsigned char	*pixel;			// Current pixel
+  int		more,			// More count bytes follow?
+		r, g, b;		// Components or deltas
+
+
+  while (in < inend)
+  {
+    offset = (*in >> 3) & 3;
+    count  = (*in & 7) + 1;
+    more   = count == 8;
+    in ++;
+
+    if (offset == 3)
+    {
+      do
+      {
+        if (in >= inend)
+	  return (-1);
+	offset += *in;
+      }
+      while (*in++ == 255);
+    }
+
+    if (offset > pixels - pos)
+      return (-1);
+    pos += offset;
+
+    for (;;)
+    {
+      if (count > pixels - pos)
+        return (-1);
+
+      for (; count > 0; count --, pos ++)
+      {
+	if (in >= inend)
+	  return (-1);
+
+	pixel = out + pos * bpp;
+
+	if (*in & 0x80)
+	{
+	  //
+	  // 15-bit RGB difference, 5 bits each, two's complement
+	  //
+
+	  if (inend - in < 2)
+	    return (-1);
+
+	  r = (in[0] >> 2) & 0x1f;
+	  g = ((in[0] & 0x03) << 3) | (in[1] >> 5);
+	  b = in[1] & 0x1f;
+	  in += 2;
+
+	  r = r >= 16 ? r - 32 : r;
+	  g = g >= 16 ? g - 32 : g;
+	  b = b >= 16 ? b - 32 : b;
+
+	  r += pixel[0];
+	  g += pixel[bpp == 3 ? 1 : 0];
+	  b = (pixel[bpp == 3 ? 2 : 0] & 0xfe) + 2 * b;
+	}
+	else
+	{
+	  //
+	  // 23-bit RGB
+	  //
+
+	  if (inend - in < 3)
+	    return (-1);
+
+	  r = (in[0] << 1) | (in[1] >> 7);
+	  g = ((in[1] & 0x7f) << 1) | (in[2] >> 7);
+	  b = (in[2] & 0x7f) << 1;
+	  in += 3;
+	}
+
+	pixel[0] = (unsigned char)r;
+	if (bpp == 3)
+	{
+	  pixel[1] = (unsigned char)g;
+	  pixel[2] = (unsigned char)b;
+	}
+      }
+
+      if (!more)
+	break;
+
+      //
+      // Replacement count bytes after the first 8 pixels and after each
+      // further 255 pixels
+      //
+
+      if (in >= inend)
+	return (-1);
+      count = *in++;
+      more  = count == 255;
+    }
+  }
+
+  return ((ssize_t)length);
+}
+
+
+//
+// 'decode_packbits()' - Decode a TIFF PackBits row.
+//
+
+static ssize_t				// O - Number of bytes or -1
+decode_packbits(
+    const unsigned char *in,		// I - Encoded data
+    const unsigned char *inend,		// I - End of encoded data
+    unsigned char       *out,		// I - Row
+    size_t              length)		// I - Bytes per row
+{
+  size_t	pos = 0,		// Position in row
+		count;			// Count of bytes
+  int		header;			// Header byte
+
+
+  while (in < inend)
+  {
+    header = *in++;
+
+    if (header == 128)
+      continue;
+    else if (header < 128)
+    {
+      count = header + 1;
+      if (count > (size_t)(inend - in) || count > length - pos)
+	return (-1);
+      memcpy(out + pos, in, count);
+      in += count;
+    }
+    else
+    {
+      count = 257 - header;
+      if (in >= inend || count > length - pos)
+	return (-1);
+      memset(out + pos, *in++, count);
+    }
+
+    pos += count;
+  }
+
+  return ((ssize_t)pos);
+}
+
+
+//
+// 'decode_replacement()' - Decode a replacement delta row compressed
+//                          row.
+//
+// "out" contains the seed row on entry.
+//
+
+static ssize_t				// O - Number of bytes or -1
+decode_replacement(
+    const unsigned char *in,		// I - Encoded data
+    const unsigned char *inend,		// I - End of encoded data
+    unsigned char       *out,		// I - Row
+    size_t              length)		// I - Bytes per row
+{
+  size_t	pos = 0,		// Position in row
+		offset,			// Offset of replaced bytes
+		count,			// Number of replaced bytes
+		maxoffset,		// Offset with more offset bytes
+		maxcount;		// Count with more count bytes
+  int		cmd;			// Command byte
+
+
+  while (in < inend)
+  {
+    cmd = *in++;
+
+    if (cmd & 0x80)
+    {
+      offset    = (cmd >> 5) & 3;
+      count     = (cmd & 31) + 2;
+      maxoffset = 3;
+      maxcount  = 33;
+    }
+    else
+    {
+      offset    = (cmd >> 3) & 15;
+      count     = (cmd & 7) + 1;
+      maxoffset = 15;
+      maxcount  = 8;
+    }
+
+    if (offset == maxoffset)
+    {
+      do
+      {
+        if (in >= inend)
+	  return (-1);
+	offset += *in;
+      }
+      while (*in++ == 255);
+    }
+
+    if (count == maxcount)
+    {
+      do
+      {
+        if (in >= inend)
+	  return (-1);
+	count += *in;
+      }
+      while (*in++ == 255);
+    }
+
+    if (offset > length - pos || count > length - pos - offset)
+      return (-1);
+
+    pos += offset;
+
+    if (cmd & 0x80)
+    {
+      if (in >= inend)
+        return (-1);
+      memset(out + pos, *in++, count);
+    }
+    else
+    {
+      if (count > (size_t)(inend - in))
+        return (-1);
+      memcpy(out + pos, in, count);
+      in += count;
+    }
+
+    pos += count;
+  }
+
+  return ((ssize_t)length);
+}
+
+
+//
+// 'decode_rle()' - Decode a run-length encoded row.
+//
+
+static ssize_t				// O - Number of bytes or -1
+decode_rle(
+    const unsigned char *in,		// I - Encoded data
+    const unsigned char *inend,		// I - End of encoded data
+    unsigned char       *out,		// I - Row
+    size_t              length)		// I - Bytes per row
+{
+  size_t	pos = 0,		// Position in row
+		count;			// Count of bytes
+
+
+  while (in < inend)
+  {
+    if (inend - in < 2)
+      return (-1);
+
+    count = in[0] + 1;
+    if (count > length - pos)
+      return (-1);
+
+    memset(out + pos, in[1], count);
+    pos += count;
+    in  += 2;
+  }
+
+  return ((ssize_t)pos);
+}
@@ -0,0 +1,79 @@
+//
+// Raster line compression for the PCL and ESC/P drivers of cups-filters.
+//
+// Copyright © 2024 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _RASTER_COMPRESS_H_
+#  define _RASTER_COMPRESS_H_
+
+//
+// Include necessary headers...
+//
+
+#  include <stddef.h>
+#  include <sys/types.h>
+
+
+//
+// Constants...
+//
+
+#  define RASTER_COMPRESS_NONE		0	// No compression
+#  define RASTER_COMPRESS_RLE		1	// Run-length encoding
+#  define RASTER_COMPRESS_PACKBITS	2	// TIFF PackBits
+#  define RASTER_COMPRESS_DELTA_ROW	3	// Delta row
+#  define RASTER_COMPRESS_ADAPTIVE	5	// Adaptive (blocks of rows)
+#  define RASTER_COMPRESS_REPLACEMENT	9	// Replacement delta row
+#  define RASTER_COMPRESS_NEAR_LOSSLESS	10	// Near lossless RGB
+
+#  define RASTER_ADAPTIVE_BLOCK		32767	// Maximum adaptive block size
+#  define RASTER_ADAPTIVE_ROW		(RASTER_ADAPTIVE_BLOCK - 3)
+						// Maximum adaptive row size
+
+
+//
+// Types...
+//
+
+typedef struct raster_codec_s		// Row encoder/decoder state
+{
+  int		mode;			// Compression mode
+  int		bpp;			// Bytes per pixel for near lossless
+					// (1 = gray, 3 = RGB)
+  size_t	length;			// Maximum bytes per row
+  int		planes;			// Number of seed rows
+  unsigned char	*seed;			// Seed rows or NULL
+  unsigned char	*seed_valid;		// Seed row contents valid?
+  unsigned char	*scratch;		// Trial encodings (adaptive)
+  unsigned char	*merge;			// Last empty/duplicate row entry
+					// (adaptive)
+} raster_codec_t;
+
+
+//
+// Functions...
+//
+
+extern size_t	raster_compress_bound(int mode, size_t length, int bpp);
+extern void	raster_codec_free(raster_codec_t *rc);
+extern int	raster_codec_init(raster_codec_t *rc, int mode, size_t length,
+				  int planes, int bpp);
+extern void	raster_codec_reset(raster_codec_t *rc);
+extern int	raster_decode_block(raster_codec_t *rc,
+				    const unsigned char *in, size_t inlen,
+				    unsigned char *rows, size_t length,
+				    int maxrows);
+extern ssize_t	raster_decode_row(raster_codec_t *rc, int plane,
+				  const unsigned char *in, size_t inlen,
+				  unsigned char *out, size_t length);
+extern ssize_t	raster_encode_empty(raster_codec_t *rc, int rows,
+				    unsigned char *out, size_t outsize);
+extern ssize_t	raster_encode_row(raster_codec_t *rc, int plane,
+				  const unsigned char *line, size_t length,
+				  unsigned char *out, size_t outsize);
+
+#endif // !_RASTER_COMPRESS_H_
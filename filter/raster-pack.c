@@ -0,0 +1,422 @@
+//
+// Horizontal dot packing for the ESC/P driver of cups-filters.
+//
+// The softweave of rastertoescpx packs every DotColStep-th pixel of a
+// dithered line into each pass, which cfPackHorizontal() and
+// cfPackHorizontal2() do one pixel at a time.  The kernels here gather
+// 16 pixels per iteration with SSE2 pack instructions for the common
+// steps 1, 2, 4 and 8 and leave the last pixels of a line to the library
+// routines, so the output is identical to theirs.  Other steps and
+// non-SSE2 builds use the library routines directly.
+//
+// All functions also report the extent of the non-zero output bytes, so
+// that the driver knows which part of a band to send and to clear.  The
+// kernels track it as they pack, the library wrappers scan the packed
+// bytes.
+//
+// Copyright © 2024 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Contents:
+//
+//   raster_pack_name()   - Get the name of a pack function.
+//   raster_pack_select() - Select the pack function for a bit depth and
+//                          step.
+//   pack1_library()      - Pack 1-bit pixels with cfPackHorizontal().
+//   pack2_library()      - Pack 2-bit pixels with cfPackHorizontal2().
+//   trim_bytes()         - Add non-zero bytes to an extent.
+//   gather_sse2()        - Load 16 pixels at a constant step.
+//   pack1_sse2()         - Pack 1-bit pixels with SSE2.
+//   pack2_sse2()         - Pack 2-bit pixels with SSE2.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "raster-pack.h"
+#include <cupsfilters/driver.h>
+#include <string.h>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif // __SSE2__
+
+
+//
+// Local functions...
+//
+
+static void	pack1_library(const unsigned char *ipixels,
+			      unsigned char *obytes, int width,
+			      unsigned char clearto, int step,
+			      int *left, int *right);
+static void	pack2_library(const unsigned char *ipixels,
+			      unsigned char *obytes, int width,
+			      unsigned char clearto, int step,
+			      int *left, int *right);
+static void	trim_bytes(const unsigned char *obytes, int start,
+			   int end, int *left, int *right);
+
+#ifdef __SSE2__
+static inline __m128i	gather_sse2(const unsigned char *ipixels,
+				    const int step);
+static inline void	pack1_sse2(const unsigned char *ipixels,
+				   unsigned char *obytes, int width,
+				   unsigned char clearto, const int step,
+				   int *left, int *right);
+static inline void	pack2_sse2(const unsigned char *ipixels,
+				   unsigned char *obytes, int width,
+				   const int step, int *left, int *right);
+
+//
+// Kernels with a constant step, so that gather_sse2() is inlined
+// without its switch; called with a different step, they use the
+// library routines...
+//
+
+#  define PACK_SSE2(step) \
+static void \
+pack1_sse2_##step(const unsigned char *ipixels, unsigned char *obytes, \
+		  int width, unsigned char clearto, int s, int *left, \
+		  int *right) \
+{ \
+  if (s != step) \
+    pack1_library(ipixels, obytes, width, clearto, s, left, right); \
+  else \
+    pack1_sse2(ipixels, obytes, width, clearto, step, left, right); \
+} \
+static void \
+pack2_sse2_##step(const unsigned char *ipixels, unsigned char *obytes, \
+		  int width, unsigned char clearto, int s, int *left, \
+		  int *right) \
+{ \
+  if (s != step) \
+    pack2_library(ipixels, obytes, width, clearto, s, left, right); \
+  else \
+    pack2_sse2(ipixels, obytes, width, step, left, right); \
+}
+
+PACK_SSE2(1)
+PACK_SSE2(2)
+PACK_SSE2(4)
+PACK_SSE2(8)
+#endif // __SSE2__
+
+
+//
+// Pack functions...
+//
+
+static const struct
+{
+  int			bits,		// Bits per pixel
+			step;		// Step or 0 for any
+  raster_pack_func_t	func;		// Function
+  const char		*name;		// Name for messages
+} packs[] =
+{
+#ifdef __SSE2__
+  { 1, 1, pack1_sse2_1, "sse2-1bit-step1" },
+  { 1, 2, pack1_sse2_2, "sse2-1bit-step2" },
+  { 1, 4, pack1_sse2_4, "sse2-1bit-step4" },
+  { 1, 8, pack1_sse2_8, "sse2-1bit-step8" },
+  { 2, 1, pack2_sse2_1, "sse2-2bit-step1" },
+  { 2, 2, pack2_sse2_2, "sse2-2bit-step2" },
+  { 2, 4, pack2_sse2_4, "sse2-2bit-step4" },
+  { 2, 8, pack2_sse2_8, "sse2-2bit-step8" },
+#endif // __SSE2__
+  { 1, 0, pack1_library, "library-1bit" },
+  { 2, 0, pack2_library, "library-2bit" }
+};
+
+
+//
+// 'raster_pack_name()' - Get the name of a pack function.
+//
+
+const char *				// O - Name
+raster_pack_name(
+    raster_pack_func_t func)		// I - Pack function
+{
+  size_t	i;			// Looping var
+
+
+  for (i = 0; i < sizeof(packs) / sizeof(packs[0]); i ++)
+    if (packs[i].func == func)
+      return (packs[i].name);
+
+  return ("unknown");
+}
+
+
+//
+// 'raster_pack_select()' - Select the pack function for a bit depth and
+//                          step.
+//
+// Bit depths other than 2 use the 1-bit functions, like rastertoescpx
+// does.
+//
+
+raster_pack_func_t			// O - Pack function
+raster_pack_select(int bits,		// I - Bits per pixel (1 or 2)
+		   int step)		// I - Step between packed pixels
+{
+  size_t	i;			// Looping var
+
+
+  if (bits != 2)
+    bits = 1;
+
+  for (i = 0; i < sizeof(packs) / sizeof(packs[0]); i ++)
+    if (packs[i].bits == bits && (packs[i].step == step || !packs[i].step))
+      return (packs[i].func);
+
+  return (pack1_library);
+}
+
+
+//
+// 'pack1_library()' - Pack 1-bit pixels with cfPackHorizontal().
+//
+
+static void
+pack1_library(
+    const unsigned char *ipixels,	// I - Input pixels
+    unsigned char       *obytes,	// O - Output bytes
+    int                 width,		// I - Number of pixels to pack
+    unsigned char       clearto,	// I - Initial value of the bytes
+    int                 step,		// I - Step between pixels
+    int                 *left,		// O - First non-zero byte
+    int                 *right)		// O - Last non-zero byte + 1
+{
+  cfPackHorizontal(ipixels, obytes, width, clearto, step);
+
+  *left = *right = 0;
+  trim_bytes(obytes, 0, (width + 7) / 8, left, right);
+}
+
+
+//
+// 'pack2_library()' - Pack 2-bit pixels with cfPackHorizontal2().
+//
+
+static void
+pack2_library(
+    const unsigned char *ipixels,	// I - Input pixels
+    unsigned char       *obytes,	// O - Output bytes
+    int                 width,		// I - Number of pixels to pack
+    unsigned char       clearto,	// I - Unused
+    int                 step,		// I - Step between pixels
+    int                 *left,		// O - First non-zero byte
+    int                 *right)		// O - Last non-zero byte + 1
+{
+  (void)clearto;
+
+  cfPackHorizontal2(ipixels, obytes, width, step);
+
+  *left = *right = 0;
+  trim_bytes(obytes, 0, (width + 3) / 4, left, right);
+}
+
+
+//
+// 'trim_bytes()' - Add non-zero bytes to an extent.
+//
+// The bytes must follow those already in the extent.
+//
+
+static void
+trim_bytes(const unsigned char *obytes,	// I  - Output bytes
+	   int                 start,	// I  - First byte to check
+	   int                 end,	// I  - Last byte to check + 1
+	   int                 *left,	// IO - First non-zero byte
+	   int                 *right)	// IO - Last non-zero byte + 1
+{
+  while (start < end && !obytes[start])
+    start ++;
+
+  if (start >= end)
+    return;
+
+  while (!obytes[end - 1])
+    end --;
+
+  if (!*right)
+    *left = start;
+
+  *right = end;
+}
+
+
+#ifdef __SSE2__
+//
+// 'gather_sse2()' - Load 16 pixels at a constant step.
+//
+// Reads 16 * step bytes.  The pixels are masked to the low byte of their
+// 16-, 32- or 64-bit lane and narrowed with the pack instructions, which
+// do not saturate values that fit in a byte.
+//
+
+static inline __m128i			// O - Pixels 0, step, ... 15 * step
+gather_sse2(
+    const unsigned char *ipixels,	// I - Input pixels
+    const int           step)		// I - Step (1, 2, 4 or 8)
+{
+  __m128i	mask,			// Low byte of each lane
+		a, b, c, d;		// Partially packed pixels
+
+
+#  define LOAD(n) _mm_and_si128(_mm_loadu_si128((const __m128i *)(ipixels + 16 * (n))), mask)
+
+  switch (step)
+  {
+    case 1 :
+        return (_mm_loadu_si128((const __m128i *)ipixels));
+
+    case 2 :
+        mask = _mm_set1_epi16(0x00ff);
+	return (_mm_packus_epi16(LOAD(0), LOAD(1)));
+
+    case 4 :
+        mask = _mm_set1_epi32(0x000000ff);
+	a    = _mm_packs_epi32(LOAD(0), LOAD(1));
+	b    = _mm_packs_epi32(LOAD(2), LOAD(3));
+	return (_mm_packus_epi16(a, b));
+
+    default :
+        mask = _mm_set_epi32(0, 0x000000ff, 0, 0x000000ff);
+	a    = _mm_packs_epi32(LOAD(0), LOAD(1));
+	b    = _mm_packs_epi32(LOAD(2), LOAD(3));
+	c    = _mm_packs_epi32(LOAD(4), LOAD(5));
+	d    = _mm_packs_epi32(LOAD(6), LOAD(7));
+	return (_mm_packus_epi16(_mm_packs_epi32(a, b),
+				 _mm_packs_epi32(c, d)));
+  }
+
+#  undef LOAD
+}
+
+
+//
+// 'pack1_sse2()' - Pack 1-bit pixels with SSE2.
+//
+
+static inline void
+pack1_sse2(
+    const unsigned char *ipixels,	// I - Input pixels
+    unsigned char       *obytes,	// O - Output bytes
+    int                 width,		// I - Number of pixels to pack
+    unsigned char       clearto,	// I - Initial value of the bytes
+    const int           step,		// I - Step (1, 2, 4 or 8)
+    int                 *left,		// O - First non-zero byte
+    int                 *right)		// O - Last non-zero byte + 1
+{
+  __m128i	pixels,			// 16 pixels
+		zero = _mm_setzero_si128();
+					// Zero pixels
+  int		bits,			// Bits of the 16 pixels
+		pos = 0,		// Current output byte
+		l = 0, r = 0;		// Extent of the non-zero bytes
+
+
+  //
+  // Loop while more than 16 pixels are left, so that a gather of 16 * step
+  // bytes does not read past the last pixel...
+  //
+
+  while (width > 16)
+  {
+    pixels = gather_sse2(ipixels, step);
+
+    //
+    // Reverse each group of 8 pixels so that the first one ends up in
+    // the high bit of the movemask byte...
+    //
+
+    pixels = _mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels, 0x1b), 0x1b);
+    pixels = _mm_or_si128(_mm_slli_epi16(pixels, 8), _mm_srli_epi16(pixels, 8));
+    bits   = ~_mm_movemask_epi8(_mm_cmpeq_epi8(pixels, zero));
+
+    obytes[pos]     = clearto ^ (unsigned char)bits;
+    obytes[pos + 1] = clearto ^ (unsigned char)(bits >> 8);
+
+    if (obytes[pos] || obytes[pos + 1])
+    {
+      if (!r)
+        l = obytes[pos] ? pos : pos + 1;
+
+      r = obytes[pos + 1] ? pos + 2 : pos + 1;
+    }
+
+    ipixels += 16 * step;
+    pos     += 2;
+    width   -= 16;
+  }
+
+  cfPackHorizontal(ipixels, obytes + pos, width, clearto, step);
+  trim_bytes(obytes, pos, pos + (width + 7) / 8, &l, &r);
+
+  *left  = l;
+  *right = r;
+}
+
+
+//
+// 'pack2_sse2()' - Pack 2-bit pixels with SSE2.
+//
+
+static inline void
+pack2_sse2(
+    const unsigned char *ipixels,	// I - Input pixels
+    unsigned char       *obytes,	// O - Output bytes
+    int                 width,		// I - Number of pixels to pack
+    const int           step,		// I - Step (1, 2, 4 or 8)
+    int                 *left,		// O - First non-zero byte
+    int                 *right)		// O - Last non-zero byte + 1
+{
+  __m128i	pixels,			// 16 pixels
+		low = _mm_set1_epi16(0x00ff),
+					// Low byte of each 16-bit lane
+		mask = _mm_set1_epi32(0x000000ff);
+					// Low byte of each 32-bit lane
+  int		bytes,			// 4 packed bytes
+		pos = 0,		// Current output byte
+		l = 0, r = 0;		// Extent of the non-zero bytes
+
+
+  while (width > 16)
+  {
+    pixels = gather_sse2(ipixels, step);
+
+    //
+    // Combine the pixels p0 to p3 of each 32-bit lane as
+    // "p0 << 6 | p1 << 4 | p2 << 2 | p3", truncated to a byte like
+    // cfPackHorizontal2() does, first in pairs in the 16-bit lanes...
+    //
+
+    pixels = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(pixels, low), 2),
+			  _mm_srli_epi16(pixels, 8));
+    pixels = _mm_and_si128(_mm_or_si128(_mm_slli_epi32(pixels, 4),
+					_mm_srli_epi32(pixels, 16)), mask);
+    pixels = _mm_packs_epi32(pixels, pixels);
+    bytes  = _mm_cvtsi128_si32(_mm_packus_epi16(pixels, pixels));
+
+    memcpy(obytes + pos, &bytes, 4);
+
+    if (bytes)
+      trim_bytes(obytes, pos, pos + 4, &l, &r);
+
+    ipixels += 16 * step;
+    pos     += 4;
+    width   -= 16;
+  }
+
+  cfPackHorizontal2(ipixels, obytes + pos, width, step);
+  trim_bytes(obytes, pos, pos + (width + 3) / 4, &l, &r);
+
+  *left  = l;
+  *right = r;
+}
+#endif // __SSE2__
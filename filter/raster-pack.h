@@ -0,0 +1,37 @@
+//
+// Horizontal dot packing for the ESC/P driver of cups-filters.
+//
+// Copyright © 2024 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _RASTER_PACK_H_
+#  define _RASTER_PACK_H_
+
+
+//
+// Types...
+//
+
+typedef void (*raster_pack_func_t)(const unsigned char *ipixels,
+				   unsigned char *obytes, int width,
+				   unsigned char clearto, int step,
+				   int *left, int *right);
+					// Pack every step-th pixel of a line
+					// like cfPackHorizontal() or
+					// cfPackHorizontal2() (clearto unused)
+					// and get the extent of the non-zero
+					// bytes (0 and 0 if none); fastest
+					// with the step it was selected for
+
+
+//
+// Functions...
+//
+
+extern const char		*raster_pack_name(raster_pack_func_t func);
+extern raster_pack_func_t	raster_pack_select(int bits, int step);
+
+#endif // !_RASTER_PACK_H_
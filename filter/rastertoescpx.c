@@ -28,6 +28,9 @@
 #include <cupsfilters/driver.h>
 #include <ppd/ppd.h>
 #include "escp.h"
+#include "color-store.h"
+#include "raster-compress.h"
+#include "raster-pack.h"
 #include <signal.h>
 #include <string.h>
 #include <ctype.h>
@@ -44,6 +47,8 @@ typedef struct cups_weave_str
   int			x, y,			// Column/Line on the page
 			plane,			// Color plane
 			dirty,			// Is this buffer dirty?
+			left,			// First non-zero byte in rows
+			right,			// Last non-zero byte in rows + 1
 			row,			// Row in the buffer
 			count;			// Max rows this pass
   unsigned char		*buffer;		// Data buffer
@@ -54,13 +59,17 @@ typedef struct cups_weave_str
 // Globals...
 //
 
+color_store_t	Colors;			// Color data of the PPD
 cf_rgb_t	*RGB;			// RGB color separation data
 cf_cmyk_t	*CMYK;			// CMYK color separation data
 unsigned char	*PixelBuffer,		// Pixel buffer
 		*CMYKBuffer,		// CMYK buffer
 		*OutputBuffers[7],	// Output buffers
 		*DotBuffers[7],		// Dot buffers
-		*CompBuffer;		// Compression buffer
+		*CompBuffer,		// Compression buffer
+		*TrimBuffer;		// Non-zero bytes of band rows
+raster_codec_t	Codec;			// Compression state
+raster_pack_func_t PackFunc;		// Pack function for DotColStep
 short		*InputBuffer;		// Color separation buffer
 cups_weave_t	*DotAvailList,		// Available buffers
 		*DotUsedList,		// Used buffers
@@ -241,15 +250,16 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
   fprintf(stderr, "DEBUG: MediaType = %s\n", header->MediaType);
   fprintf(stderr, "DEBUG: Resolution = %s\n", resolution);
 
+  color_store_open(&Colors, ppd, colormodel, header->MediaType, resolution,
+		   logfunc, ld);
+
   if (header->cupsColorSpace == CUPS_CSPACE_RGB ||
       header->cupsColorSpace == CUPS_CSPACE_W)
-    RGB = ppdRGBLoad(ppd, colormodel, header->MediaType, resolution,
-		     logfunc, ld);
+    RGB = Colors.rgb;
   else
     RGB = NULL;
 
-  CMYK = ppdCMYKLoad(ppd, colormodel, header->MediaType, resolution,
-		     logfunc, ld);
+  CMYK = Colors.cmyk;
 
   if (RGB)
     fputs("DEBUG: Loaded RGB separation from PPD.\n", stderr);
@@ -273,67 +283,44 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
   switch (PrinterPlanes)
   {
     case 1 : // K
-        DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Black", logfunc, ld);
+        DitherLuts[0] = color_store_lut(&Colors, "Black");
         break;
 
     case 2 : // Kk
-        DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Black", logfunc, ld);
-        DitherLuts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "LightBlack", logfunc, ld);
+        DitherLuts[0] = color_store_lut(&Colors, "Black");
+        DitherLuts[1] = color_store_lut(&Colors, "LightBlack");
         break;
 
     case 3 : // CMY
-        DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Cyan", logfunc, ld);
-        DitherLuts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Magenta", logfunc, ld);
-        DitherLuts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Yellow", logfunc, ld);
+        DitherLuts[0] = color_store_lut(&Colors, "Cyan");
+        DitherLuts[1] = color_store_lut(&Colors, "Magenta");
+        DitherLuts[2] = color_store_lut(&Colors, "Yellow");
         break;
 
     case 4 : // CMYK
-        DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Cyan", logfunc, ld);
-        DitherLuts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Magenta", logfunc, ld);
-        DitherLuts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Yellow", logfunc, ld);
-        DitherLuts[3] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Black", logfunc, ld);
+        DitherLuts[0] = color_store_lut(&Colors, "Cyan");
+        DitherLuts[1] = color_store_lut(&Colors, "Magenta");
+        DitherLuts[2] = color_store_lut(&Colors, "Yellow");
+        DitherLuts[3] = color_store_lut(&Colors, "Black");
         break;
 
     case 6 : // CcMmYK
-        DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Cyan", logfunc, ld);
-        DitherLuts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "LightCyan", logfunc, ld);
-        DitherLuts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Magenta", logfunc, ld);
-        DitherLuts[3] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "LightMagenta", logfunc, ld);
-        DitherLuts[4] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Yellow", logfunc, ld);
-        DitherLuts[5] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Black", logfunc, ld);
+        DitherLuts[0] = color_store_lut(&Colors, "Cyan");
+        DitherLuts[1] = color_store_lut(&Colors, "LightCyan");
+        DitherLuts[2] = color_store_lut(&Colors, "Magenta");
+        DitherLuts[3] = color_store_lut(&Colors, "LightMagenta");
+        DitherLuts[4] = color_store_lut(&Colors, "Yellow");
+        DitherLuts[5] = color_store_lut(&Colors, "Black");
         break;
 
     case 7 : // CcMmYKk
-        DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Cyan", logfunc, ld);
-        DitherLuts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "LightCyan", logfunc, ld);
-        DitherLuts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Magenta", logfunc, ld);
-        DitherLuts[3] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "LightMagenta", logfunc, ld);
-        DitherLuts[4] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Yellow", logfunc, ld);
-        DitherLuts[5] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Black", logfunc, ld);
-        DitherLuts[6] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "LightBlack", logfunc, ld);
+        DitherLuts[0] = color_store_lut(&Colors, "Cyan");
+        DitherLuts[1] = color_store_lut(&Colors, "LightCyan");
+        DitherLuts[2] = color_store_lut(&Colors, "Magenta");
+        DitherLuts[3] = color_store_lut(&Colors, "LightMagenta");
+        DitherLuts[4] = color_store_lut(&Colors, "Yellow");
+        DitherLuts[5] = color_store_lut(&Colors, "Black");
+        DitherLuts[6] = color_store_lut(&Colors, "LightBlack");
         break;
     default : // ERROR
         fputs("ERROR: Unexpected number of channels\n", stderr);
@@ -843,9 +830,12 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
   DotRowCurrent = 0;
   DotRowMax     = DotRowCount * DotRowStep;
   DotBufferSize = (header->cupsWidth / DotColStep * BitPlanes + 7) / 8;
+  PackFunc      = raster_pack_select(BitPlanes,
+				   DotRowMax == 1 ? 1 : DotColStep);
 
   fprintf(stderr, "DEBUG: DotBufferSize = %d\n", DotBufferSize);
   fprintf(stderr, "DEBUG: DotColStep = %d\n", DotColStep);
+  fprintf(stderr, "DEBUG: PackFunc = %s\n", raster_pack_name(PackFunc));
   fprintf(stderr, "DEBUG: DotRowMax = %d\n", DotRowMax);
   fprintf(stderr, "DEBUG: DotRowStep = %d\n", DotRowStep);
   fprintf(stderr, "DEBUG: DotRowFeed = %d\n", DotRowFeed);
@@ -919,7 +909,9 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
       band->buffer = calloc(DotRowCount, DotBufferSize);
     }
 
-    if (!DotAvailList)
+    TrimBuffer = malloc(DotRowCount * DotBufferSize);
+
+    if (!DotAvailList || !TrimBuffer)
     {
       fputs("ERROR: Unable to allocate band list\n", stderr);
       exit(1);
@@ -1050,7 +1042,13 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
   if (RGB)
     CMYKBuffer = malloc(header->cupsWidth * PrinterPlanes);
 
-  CompBuffer = malloc(10 * DotBufferSize * DotRowMax);
+  //
+  // Compressed data is only sent when it is smaller than the original...
+  //
+
+  raster_codec_init(&Codec, RASTER_COMPRESS_PACKBITS, DotBufferSize * DotRowMax,
+		    1, 1);
+  CompBuffer = malloc(DotBufferSize * DotRowMax);
 }
 
 
@@ -1148,6 +1146,8 @@ EndPage(ppd_file_t         *ppd,	// I - PPD file
       free(band->buffer);
       free(band);
     }
+
+    free(TrimBuffer);
   }
   else
   {
@@ -1168,7 +1168,8 @@ EndPage(ppd_file_t         *ppd,	// I - PPD file
   for (i = 0; i < PrinterPlanes; i ++)
   {
     cfDitherDelete(DitherStates[i]);
-    cfLutDelete(DitherLuts[i]);
+    if (!color_store_owns(&Colors, DitherLuts[i]))
+      cfLutDelete(DitherLuts[i]);
   }
 
   free(OutputBuffers[0]);
@@ -1176,14 +1177,15 @@ EndPage(ppd_file_t         *ppd,	// I - PPD file
   free(PixelBuffer);
   free(InputBuffer);
   free(CompBuffer);
+  raster_codec_free(&Codec);
 
-  cfCMYKDelete(CMYK);
+  if (!color_store_owns(&Colors, CMYK))
+    cfCMYKDelete(CMYK);
 
   if (RGB)
-  {
-    cfRGBDelete(RGB);
     free(CMYKBuffer);
-  }
+
+  color_store_close(&Colors);
 }
 
 
@@ -1312,13 +1314,10 @@ CompressData(ppd_file_t          *ppd,	// I - PPD file information
 	     const int           ystep,	// I - Spacing between lines
 	     const int           offset)// I - Head offset
 {
-  register const unsigned char *line_ptr,
-					// Current byte pointer
-        	*line_end,		// End-of-line byte pointer
-        	*start;			// Start of compression sequence
-  register unsigned char *comp_ptr;	// Pointer into compression buffer
-  register int  count;			// Count of bytes for output
-  register int	bytes;			// Number of bytes per row
+  const unsigned char *line_ptr,	// Current byte pointer
+		*line_end;		// End-of-line byte pointer
+  ssize_t	comp_bytes;		// Number of compressed bytes
+  int		bytes;			// Number of bytes per row
   static int	ctable[7][7] =		// Colors
 		{
 		  {  0,  0,  0,  0,  0,  0,  0 },	// K
@@ -1331,94 +1330,26 @@ CompressData(ppd_file_t          *ppd,	// I - PPD file information
 		};
 
 
-  switch (type)
-  {
-    case 0 :
-        //
-	// Do no compression...
-        //
+  line_ptr = line;
+  line_end = line + length;
 
-	line_ptr = (const unsigned char *)line;
-	line_end = (const unsigned char *)line + length;
-	break;
-
-    default :
-        //
-        // Do TIFF pack-bits encoding...
-        //
-
-	line_ptr = (const unsigned char *)line;
-	line_end = (const unsigned char *)line + length;
-	comp_ptr = CompBuffer;
-
-	while (line_ptr < line_end && (comp_ptr - CompBuffer) < length)
-	{
-	  if ((line_ptr + 1) >= line_end)
-	  {
-	    //
-	    // Single byte on the end...
-	    //
-
-	    *comp_ptr++ = 0x00;
-	    *comp_ptr++ = *line_ptr++;
-	  }
-	  else if (line_ptr[0] == line_ptr[1])
-	  {
-	    //
-	    // Repeated sequence...
-	    //
-
-	    line_ptr ++;
-	    count = 2;
-
-	    while (line_ptr < (line_end - 1) &&
-        	   line_ptr[0] == line_ptr[1] &&
-        	   count < 127)
-	    {
-              line_ptr ++;
-              count ++;
-	    }
-
-	    *comp_ptr++ = 257 - count;
-	    *comp_ptr++ = *line_ptr++;
-	  }
-	  else
-	  {
-	    //
-	    // Non-repeated sequence...
-	    //
-
-	    start    = line_ptr;
-	    line_ptr ++;
-	    count    = 1;
-
-	    while (line_ptr < (line_end - 1) &&
-        	   line_ptr[0] != line_ptr[1] &&
-        	   count < 127)
-	    {
-              line_ptr ++;
-              count ++;
-	    }
-
-	    *comp_ptr++ = count - 1;
+  if (type != 0)
+  {
+    //
+    // Do TIFF pack-bits encoding, as long as the result is smaller than
+    // the original data...
+    //
 
-	    memcpy(comp_ptr, start, count);
-	    comp_ptr += count;
-	  }
-	}
+    comp_bytes = raster_encode_row(&Codec, 0, line, length, CompBuffer,
+				   length > 0 ? length - 1 : 0);
 
-        if ((comp_ptr - CompBuffer) < length)
-	{
-          line_ptr = (const unsigned char *)CompBuffer;
-          line_end = (const unsigned char *)comp_ptr;
-	}
-	else
-	{
-	  type     = 0;
-	  line_ptr = (const unsigned char *)line;
-	  line_end = (const unsigned char *)line + length;
-	}
-	break;
+    if (comp_bytes >= 0)
+    {
+      line_ptr = CompBuffer;
+      line_end = CompBuffer + comp_bytes;
+    }
+    else
+      type = 0;
   }
 
   //
@@ -1503,8 +1434,14 @@ OutputBand(ppd_file_t         *ppd,	// I - PPD file
            cups_page_header2_t *header,	// I - Page header
            cups_weave_t       *band)	// I - Current band
 {
-  int	xstep,				// Spacing between columns
-	ystep;				// Spacing between rows
+  int		xstep,			// Spacing between columns
+		ystep,			// Spacing between rows
+		left,			// First byte to send
+		bytes,			// Bytes to send per row
+		columns,		// Columns to skip
+		units,			// Positioning units per inch
+		row;			// Looping var
+  unsigned char	*data;			// Rows to send
 
 
   //
@@ -1537,15 +1474,58 @@ OutputBand(ppd_file_t         *ppd,	// I - PPD file
     OutputFeed = 0;
   }
 
-  CompressData(ppd, band->buffer, band->count * DotBufferSize, band->plane,
-	       header->cupsCompression, band->count, xstep, ystep, band->x);
+  //
+  // Only send the non-zero bytes of the rows.  Leading zero bytes are
+  // skipped with the head offset when they are a whole number of
+  // positioning units, which are 1/1440" for ESC ( \ and the ESC ( U
+  // unit for ESC \ (see CompressData() and StartPage())...
+  //
+
+  left    = band->left;
+  columns = left * 8 / BitPlanes * DotColStep;
+
+  if (BitPlanes == 1)
+    units = 1440;
+  else if (ppd->model_number & ESCP_EXT_UNITS)
+    units = header->HWResolution[0];
+  else
+    units = header->HWResolution[1];
+
+  if ((columns * units) % header->HWResolution[0])
+  {
+    left    = 0;
+    columns = 0;
+  }
+  else
+    columns = columns * units / header->HWResolution[0];
+
+  bytes = band->right - left;
+
+  if (bytes < DotBufferSize)
+  {
+    for (row = 0, data = TrimBuffer; row < band->count; row ++, data += bytes)
+      memcpy(data, band->buffer + row * DotBufferSize + left, bytes);
+
+    data = TrimBuffer;
+  }
+  else
+    data = band->buffer;
+
+  CompressData(ppd, data, band->count * bytes, band->plane,
+	       header->cupsCompression, band->count, xstep, ystep,
+	       band->x + columns);
 
   //
-  // Clear the band...
+  // Clear the non-zero bytes of the band...
   //
 
-  memset(band->buffer, 0, band->count * DotBufferSize);
+  for (row = 0; row < band->count; row ++)
+    memset(band->buffer + row * DotBufferSize + band->left, 0,
+	   band->right - band->left);
+
   band->dirty = 0;
+  band->left  = 0;
+  band->right = 0;
 
   //
   // Flush the output buffers...
@@ -1572,7 +1552,9 @@ ProcessLine(ppd_file_t         *ppd,	// I - PPD file
 		offset,			// Offset to current line
 		pass,			// Pass number
 		xstep,			// X step value
-		ystep;			// Y step value
+		ystep,			// Y step value
+		left,			// First non-zero byte of a row
+		right;			// Last non-zero byte of a row + 1
   cups_weave_t	*band;			// Current band
 
 
@@ -1639,15 +1621,11 @@ ProcessLine(ppd_file_t         *ppd,	// I - PPD file
       // Handle microweaved output...
       //
 
-      if (cfCheckBytes(OutputBuffers[plane], width))
-	continue;
+      (*PackFunc)(OutputBuffers[plane], DotBuffers[plane], width, 0, 1,
+		  &left, &right);
 
-      if (BitPlanes == 1)
-	cfPackHorizontal(OutputBuffers[plane], DotBuffers[plane],
-	                   width, 0, 1);
-      else
-	cfPackHorizontal2(OutputBuffers[plane], DotBuffers[plane],
-                	    width, 1);
+      if (left >= right)
+	continue;
 
       if (OutputFeed > 0)
       {
@@ -1678,15 +1656,25 @@ ProcessLine(ppd_file_t         *ppd,	// I - PPD file
         band   = DotBands[subrow][plane];
 	offset = band->row * DotBufferSize;
 
-        if (BitPlanes == 1)
-	  cfPackHorizontal(OutputBuffers[plane] + pass,
-	                     band->buffer + offset, subwidth, 0, DotColStep);
-        else
-	  cfPackHorizontal2(OutputBuffers[plane] + pass,
-	                      band->buffer + offset, subwidth, DotColStep);
+        (*PackFunc)(OutputBuffers[plane] + pass, band->buffer + offset,
+		    subwidth, 0, DotColStep, &left, &right);
 
         band->row ++;
-	band->dirty |= !cfCheckBytes(band->buffer + offset, DotBufferSize);
+
+        if (left < right)
+	{
+	  //
+	  // Grow the extent of the non-zero bytes of the band...
+	  //
+
+	  if (!band->dirty || left < band->left)
+	    band->left = left;
+	  if (!band->dirty || right > band->right)
+	    band->right = right;
+
+	  band->dirty = 1;
+	}
+
 	if (band->row >= band->count)
 	{
 	  if (band->dirty)
@@ -15,8 +15,15 @@
 //   Shutdown()     - Shutdown a printer.
 //   CancelJob()    - Cancel the current job...
 //   CompressData() - Compress a line of graphics.
+//   AddBlockRows() - Add rows to the adaptive compression block.
+//   FlushBlock()   - Send the adaptive compression block.
+//   BandTransfer() - Add a raster transfer command to the output band.
+//   FlushBand()    - Send the output band.
 //   OutputLine()   - Output the specified number of lines of graphics.
 //   ReadLine()     - Read graphics from the page stream.
+//   PrintPage()    - Convert and send a page.
+//   StartWorker()  - Convert a page in a worker process.
+//   FinishWorkers() - Send the pages of the worker processes.
 //   main()         - Main entry and processing of driver.
 //
 
@@ -25,12 +32,24 @@
 //
 
 #include "pcl-common.h"
+#include "color-store.h"
+#include "raster-compress.h"
 #include <cupsfilters/colormanager.h>
 #include <cupsfilters/driver.h>
 #include <cupsfilters/filter.h>
 #include <ppd/ppd.h>
 #include <ppd/ppd-filter.h>
 #include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+//
+// Constants...
+//
+
+#define BAND_ROWS	64		// Rows per output band
+
 
 //
 // Output modes...
@@ -45,10 +64,25 @@ typedef enum
 } pcl_output_t;
 
 
+//
+// Pages converted by worker processes...
+//
+
+typedef struct pcl_worker_s
+{
+  pid_t		pid;			// Process ID or 0
+  int		fd;			// Temporary file with the output
+  int		page;			// Page number
+  int		copies;			// Number of copies
+  size_t	bytes;			// Size of raster data
+} pcl_worker_t;
+
+
 //
 // Globals...
 //
 
+color_store_t	Colors;			// Color data of the PPD
 cf_rgb_t	*RGB;			// RGB color separation data
 cf_cmyk_t	*CMYK;			// CMYK color separation data
 unsigned char	*PixelBuffer,		// Pixel buffer
@@ -56,13 +90,19 @@ unsigned char	*PixelBuffer,		// Pixel buffer
 		*OutputBuffers[6],	// Output buffers
 		*DotBuffers[6],		// Bit buffers
 		*CompBuffer,		// Compression buffer
-		*SeedBuffer,		// Mode 3 seed buffers
 		BlankValue;		// The blank value
+size_t		CompBufferSize,		// Size of compression buffer
+		CompBufferUsed;		// Bytes of adaptive block in buffer
+raster_codec_t	Codec;			// Compression state and seed rows
+unsigned char	*Band;			// Raster commands and data of a band
+size_t		BandSize,		// Size of band buffer
+		BandUsed,		// Bytes used in band buffer
+		BandCombine;		// End of last command without data
+int		BandRows;		// Rows in band
 short		*InputBuffer;		// Color separation buffer
 cf_lut_t	*DitherLuts[6];		// Lookup tables for dithering
 cf_dither_t	*DitherStates[6];	// Dither state tables
 int		PrinterPlanes,		// Number of color planes
-		SeedInvalid,		// Contents of seed buffer invalid?
 		DotBits[6],		// Number of bits per color
 		DotBufferSizes[6],	// Size of one row of color dots
 		DotBufferSize,		// Size of complete line
@@ -80,6 +120,11 @@ const int	ColorOrders[7][7] =	// Order of color planes
 		  { 5, 0, 1, 2, 3, 4, 6 }	// KCMYcmk
 		};
 int		Canceled;		// Is the job canceled?
+pcl_worker_t	*Workers;		// Worker processes, oldest page first
+int		NumWorkers,		// Number of worker processes
+		MaxWorkers = 1;		// Maximum number of worker processes
+size_t		PageMemory,		// Maximum raster data of workers
+		PageMemoryUsed;		// Raster data of workers
 cf_logfunc_t logfunc;               // Log function
 void            *ld;                    // Log function data
 
@@ -98,8 +143,22 @@ void	Shutdown(ppd_file_t *ppd, int job_id, const char *user,
 void	CancelJob(int sig);
 void	CompressData(unsigned char *line, int length, int plane, int pend,
 	             int type);
+void	AddBlockRows(unsigned char *line, int length, int rows);
+void	FlushBlock(void);
+void	BandTransfer(int value, int cmd, const unsigned char *data);
+void	FlushBand(void);
 void	OutputLine(ppd_file_t *ppd, cups_page_header2_t *header);
-int	ReadLine(cups_raster_t *ras, cups_page_header2_t *header);
+int	ReadLine(cups_raster_t *ras, const unsigned char *pixels,
+		 cups_page_header2_t *header);
+void	PrintPage(cf_filter_data_t *data, ppd_file_t *ppd,
+		  cups_raster_t *ras, const unsigned char *pixels,
+		  cups_page_header2_t *header, int job_id, const char *user,
+		  const char *title, int num_options, cups_option_t *options);
+int	StartWorker(cf_filter_data_t *data, ppd_file_t *ppd,
+		    cups_raster_t *ras, cups_page_header2_t *header,
+		    int job_id, const char *user, const char *title,
+		    int num_options, cups_option_t *options);
+int	FinishWorkers(int keep);
 
 
 //
@@ -119,6 +178,8 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
 {
   int		i;			// Temporary/looping var
   int		plane;			// Current plane
+  int		seeds;			// Number of compression seed rows
+  size_t	seedlen;		// Length of compression seed rows
   int		cm_disabled;	// Device Color Inhibited
   char		s[255];			// Temporary value
   const char	*colormodel;		// Color model string
@@ -355,15 +416,16 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
     else
       cm_disabled = cfCmIsPrinterCmDisabled(data);
 
-    if (ppd && !cm_disabled)
+    color_store_open(&Colors, ppd, colormodel, header->MediaType, resolution,
+		     logfunc, ld);
+
+    if (!cm_disabled)
     {
       if (header->cupsColorSpace == CUPS_CSPACE_RGB ||
 	  header->cupsColorSpace == CUPS_CSPACE_W)
-	RGB = ppdRGBLoad(ppd, colormodel, header->MediaType, resolution,
-			  logfunc, ld);
+	RGB = Colors.rgb;
 
-      CMYK = ppdCMYKLoad(ppd, colormodel, header->MediaType, resolution,
-			  logfunc, ld);
+      CMYK = Colors.cmyk;
     }
 
     if (RGB)
@@ -395,43 +457,29 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
     switch (PrinterPlanes)
     {
       case 1 : // K
-          DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Black", logfunc, ld);
+          DitherLuts[0] = color_store_lut(&Colors, "Black");
           break;
 
       case 3 : // CMY
-          DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Cyan", logfunc, ld);
-          DitherLuts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Magenta", logfunc, ld);
-          DitherLuts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Yellow", logfunc, ld);
+          DitherLuts[0] = color_store_lut(&Colors, "Cyan");
+          DitherLuts[1] = color_store_lut(&Colors, "Magenta");
+          DitherLuts[2] = color_store_lut(&Colors, "Yellow");
           break;
 
       case 4 : // CMYK
-          DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Cyan", logfunc, ld);
-          DitherLuts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Magenta", logfunc, ld);
-          DitherLuts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Yellow", logfunc, ld);
-          DitherLuts[3] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Black", logfunc, ld);
+          DitherLuts[0] = color_store_lut(&Colors, "Cyan");
+          DitherLuts[1] = color_store_lut(&Colors, "Magenta");
+          DitherLuts[2] = color_store_lut(&Colors, "Yellow");
+          DitherLuts[3] = color_store_lut(&Colors, "Black");
           break;
 
       case 6 : // CcMmYK
-          DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Cyan", logfunc, ld);
-          DitherLuts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "LightCyan", logfunc, ld);
-          DitherLuts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Magenta", logfunc, ld);
-          DitherLuts[3] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "LightMagenta", logfunc, ld);
-          DitherLuts[4] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Yellow", logfunc, ld);
-          DitherLuts[5] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Black", logfunc, ld);
+          DitherLuts[0] = color_store_lut(&Colors, "Cyan");
+          DitherLuts[1] = color_store_lut(&Colors, "LightCyan");
+          DitherLuts[2] = color_store_lut(&Colors, "Magenta");
+          DitherLuts[3] = color_store_lut(&Colors, "LightMagenta");
+          DitherLuts[4] = color_store_lut(&Colors, "Yellow");
+          DitherLuts[5] = color_store_lut(&Colors, "Black");
           break;
     }
 
@@ -454,6 +502,34 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
 
   fprintf(stderr, "DEBUG: PrinterPlanes = %d\n", PrinterPlanes);
 
+  if (header->cupsCompression == RASTER_COMPRESS_ADAPTIVE)
+  {
+    //
+    // Adaptive compression sends whole rows in blocks of at most 32767
+    // bytes, so it needs a single plane per row and short enough rows...
+    //
+
+    if (OutputMode == OUTPUT_DITHERED)
+    {
+      for (plane = 0, i = 0; plane < PrinterPlanes; plane ++)
+        i += DotBits[plane];
+
+      seedlen = (header->cupsWidth + 7) / 8;
+    }
+    else
+    {
+      i       = OutputMode == OUTPUT_RGB ? 1 : PrinterPlanes;
+      seedlen = header->cupsBytesPerLine / i;
+    }
+
+    if (i > 1 || seedlen > RASTER_ADAPTIVE_ROW)
+    {
+      fputs("DEBUG: Using delta row instead of adaptive compression.\n",
+	    stderr);
+      header->cupsCompression = RASTER_COMPRESS_DELTA_ROW;
+    }
+  }
+
   //
   // Initialize the printer...
   //
@@ -825,12 +901,50 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
   }
 
   if (header->cupsCompression)
-    CompBuffer = calloc(DotBufferSize * 4, sizeof(unsigned char));
+  {
+    //
+    // Delta row compression needs a seed row for each bit plane that is
+    // sent...
+    //
+
+    if (OutputMode == OUTPUT_DITHERED)
+    {
+      seedlen = (header->cupsWidth + 7) / 8;
+      for (plane = 0, seeds = 0; plane < PrinterPlanes; plane ++)
+        seeds += DotBits[plane];
+    }
+    else
+    {
+      seedlen = DotBufferSize;
+      seeds   = PrinterPlanes;
+    }
+
+    if (raster_codec_init(&Codec, header->cupsCompression, seedlen, seeds,
+			  PrinterPlanes == 1 ? 1 : 3))
+    {
+      fprintf(stderr, "DEBUG: Compression mode %d not supported.\n",
+	      header->cupsCompression);
+      memset(&Codec, 0, sizeof(Codec));
+    }
+
+    if (Codec.mode == RASTER_COMPRESS_ADAPTIVE)
+      CompBufferSize = RASTER_ADAPTIVE_BLOCK;
+    else
+      CompBufferSize = raster_compress_bound(Codec.mode, seedlen, Codec.bpp);
 
-  if (header->cupsCompression >= 3)
-    SeedBuffer = calloc(DotBufferSize, sizeof(unsigned char));
+    CompBuffer     = malloc(CompBufferSize);
+    CompBufferUsed = 0;
+  }
+
+  //
+  // Raster commands are collected for a band of rows and sent at once...
+  //
 
-  SeedInvalid = 1;
+  BandSize    = BAND_ROWS * ((size_t)DotBufferSize + 64);
+  Band        = malloc(BandSize);
+  BandUsed    = 0;
+  BandCombine = 0;
+  BandRows    = 0;
 
   fprintf(stderr, "BlankValue=%d\n", BlankValue);
 }
@@ -847,6 +961,13 @@ EndPage(ppd_file_t         *ppd,	// I - PPD file
   int	plane;				// Current plane
 
 
+  //
+  // Send the last rows of an adaptive compression block...
+  //
+
+  FlushBlock();
+  FlushBand();
+
   //
   // End graphics mode...
   //
@@ -873,33 +994,38 @@ EndPage(ppd_file_t         *ppd,	// I - PPD file
   //
 
   free(PixelBuffer);
+  free(Band);
+
+  Band     = NULL;
+  BandSize = 0;
 
   if (OutputMode == OUTPUT_DITHERED)
   {
     for (plane = 0; plane < PrinterPlanes; plane ++)
     {
       cfDitherDelete(DitherStates[plane]);
-      cfLutDelete(DitherLuts[plane]);
+      if (!color_store_owns(&Colors, DitherLuts[plane]))
+	cfLutDelete(DitherLuts[plane]);
     }
 
     free(DotBuffers[0]);
     free(InputBuffer);
     free(OutputBuffers[0]);
 
-    cfCMYKDelete(CMYK);
+    if (!color_store_owns(&Colors, CMYK))
+      cfCMYKDelete(CMYK);
 
     if (RGB)
-    {
-      cfRGBDelete(RGB);
       free(CMYKBuffer);
-    }
+
+    color_store_close(&Colors);
   }
 
   if (header->cupsCompression)
+  {
     free(CompBuffer);
-
-  if (header->cupsCompression >= 3)
-    free(SeedBuffer);
+    raster_codec_free(&Codec);
+  }
 }
 
 
@@ -958,9 +1084,21 @@ Shutdown(ppd_file_t         *ppd,	// I - PPD file
 void
 CancelJob(int sig)			// I - Signal
 {
+  int	i;				// Looping var
+
+
   (void)sig;
 
   Canceled = 1;
+
+  //
+  // Let the worker of the oldest page eject it, the later pages are not
+  // printed...
+  //
+
+  for (i = 0; i < NumWorkers; i ++)
+    if (Workers[i].pid > 0)
+      kill(Workers[i].pid, i ? SIGKILL : SIGTERM);
 }
 
 
@@ -976,609 +1114,215 @@ CompressData(unsigned char *line,	// I - Data to compress
 	     int           type)	// I - Type of compression
 {
   unsigned char	*line_ptr,		// Current byte pointer
-        	*line_end,		// End-of-line byte pointer
-        	*comp_ptr,		// Pointer into compression buffer
-        	*start,			// Start of compression sequence
-		*seed;			// Seed buffer pointer
-  int           count,			// Count of bytes for output
-		offset,			// Offset of bytes for output
-		temp;			// Temporary count
-  int		r, g, b;		// RGB deltas for mode 10 compression
+        	*line_end;		// End-of-line byte pointer
+  ssize_t	bytes;			// Number of compressed bytes
 
 
-  switch (type)
+  if (type == RASTER_COMPRESS_ADAPTIVE && Codec.mode == type)
   {
-    default :
-        //
-        // Do no compression; with a mode-0 only printer, we can compress blank
-        // lines...
-        //
+    //
+    // Rows go into the current block...
+    //
 
-	line_ptr = line;
+    AddBlockRows(line, length, 1);
+    return;
+  }
+  else if (type && Codec.mode == type)
+  {
+    //
+    // Compress the line; the compression buffer has room for the worst
+    // case...
+    //
 
-        if (cfCheckBytes(line, length))
-          line_end = line;		// Blank line
-        else
-	  line_end = line + length;	// Non-blank line
-	break;
+    bytes    = raster_encode_row(&Codec, plane, line, length, CompBuffer,
+				 CompBufferSize);
+    line_ptr = CompBuffer;
+    line_end = CompBuffer + (bytes > 0 ? bytes : 0);
+  }
+  else
+  {
+    //
+    // Do no compression; with a mode-0 only printer, we can compress blank
+    // lines...
+    //
 
-    case 1 :
-        //
-        // Do run-length encoding...
-        //
+    line_ptr = line;
 
-	line_end = line + length;
-	for (line_ptr = line, comp_ptr = CompBuffer;
-	     line_ptr < line_end;
-	     comp_ptr += 2, line_ptr += count)
-	{
-	  for (count = 1;
-               (line_ptr + count) < line_end &&
-	           line_ptr[0] == line_ptr[count] &&
-        	   count < 256;
-               count ++);
-
-	  comp_ptr[0] = count - 1;
-	  comp_ptr[1] = line_ptr[0];
-	}
+    if (cfCheckBytes(line, length))
+      line_end = line;			// Blank line
+    else
+      line_end = line + length;		// Non-blank line
+  }
 
-        line_ptr = CompBuffer;
-        line_end = comp_ptr;
-	break;
+  //
+  // Set the length of the data and write a raster plane...
+  //
 
-    case 2 :
-        //
-        // Do TIFF pack-bits encoding...
-        //
+  BandTransfer((int)(line_end - line_ptr), pend, line_ptr);
+}
 
-	line_ptr = line;
-	line_end = line + length;
-	comp_ptr = CompBuffer;
 
-	while (line_ptr < line_end)
-	{
-	  if ((line_ptr + 1) >= line_end)
-	  {
-	    //
-	    // Single byte on the end...
-	    //
-
-	    *comp_ptr++ = 0x00;
-	    *comp_ptr++ = *line_ptr++;
-	  }
-	  else if (line_ptr[0] == line_ptr[1])
-	  {
-	    // 
-	    // Repeated sequence...
-	    //
-
-	    line_ptr ++;
-	    count = 2;
-
-	    while (line_ptr < (line_end - 1) &&
-        	   line_ptr[0] == line_ptr[1] &&
-        	   count < 127)
-	    {
-              line_ptr ++;
-              count ++;
-	    }
-
-	    *comp_ptr++ = 257 - count;
-	    *comp_ptr++ = *line_ptr++;
-	  }
-	  else
-	  {
-	    //
-	    // Non-repeated sequence...
-	    //
-
-	    start    = line_ptr;
-	    line_ptr ++;
-	    count    = 1;
-
-	    while (line_ptr < (line_end - 1) &&
-        	   line_ptr[0] != line_ptr[1] &&
-        	   count < 127)
-	    {
-              line_ptr ++;
-              count ++;
-	    }
-
-	    *comp_ptr++ = count - 1;
-
-	    memcpy(comp_ptr, start, count);
-	    comp_ptr += count;
-	  }
-	}
+//
+// 'AddBlockRows()' - Add rows to the adaptive compression block.
+//
+// The block is sent first when the rows do not fit anymore.
+//
 
-        line_ptr = CompBuffer;
-        line_end = comp_ptr;
-	break;
+void
+AddBlockRows(unsigned char *line,	// I - Row or NULL for empty rows
+	     int           length,	// I - Number of bytes
+	     int           rows)	// I - Number of empty rows if no row
+{
+  int		tries;			// Number of tries
+  ssize_t	bytes;			// Number of compressed bytes
 
-    case 3 :
-        //
-        // Do delta-row compression...
-        //
 
-	line_ptr = line;
-	line_end = line + length;
+  for (tries = 0; tries < 2; tries ++)
+  {
+    if (line)
+      bytes = raster_encode_row(&Codec, 0, line, length,
+				CompBuffer + CompBufferUsed,
+				CompBufferSize - CompBufferUsed);
+    else
+      bytes = raster_encode_empty(&Codec, rows, CompBuffer + CompBufferUsed,
+				  CompBufferSize - CompBufferUsed);
 
-	comp_ptr = CompBuffer;
-	seed     = SeedBuffer + plane * length;
+    if (bytes >= 0)
+    {
+      CompBufferUsed += bytes;
+      break;
+    }
 
-	while (line_ptr < line_end)
-        {
-	  //
-          // Find the next non-matching sequence...
-	  //
+    FlushBlock();
+  }
+}
 
-          start = line_ptr;
 
-	  if (SeedInvalid)
-	  {
-	    //
-	    // The seed buffer is invalid, so do the next 8 bytes, max...
-	    //
+//
+// 'FlushBlock()' - Send the adaptive compression block.
+//
+// The next block starts without a seed row, as after a Y offset.
+//
 
-	    offset = 0;
+void
+FlushBlock(void)
+{
+  if (!CompBufferUsed)
+    return;
 
-	    if ((count = line_end - line_ptr) > 8)
-	      count = 8;
+  BandTransfer((int)CompBufferUsed, 'W', CompBuffer);
 
-	    line_ptr += count;
-	  }
-	  else
-	  {
-	    //
-	    // The seed buffer is valid, so compare against it...
-	    //
-
-            while (*line_ptr == *seed &&
-                   line_ptr < line_end)
-            {
-              line_ptr ++;
-              seed ++;
-            }
-
-            if (line_ptr == line_end)
-              break;
-
-            offset = line_ptr - start;
-
-	    //
-            // Find up to 8 non-matching bytes...
-	    //
-
-            start = line_ptr;
-            count = 0;
-            while (*line_ptr != *seed &&
-                   line_ptr < line_end &&
-                   count < 8)
-            {
-              line_ptr ++;
-              seed ++;
-              count ++;
-            }
-
-	    //
-	    // Bail out if we don't have count to compress
-	    //
-
-	    if (count == 0)
-	      break;
-	  }
+  CompBufferUsed = 0;
+  raster_codec_reset(&Codec);
+}
 
-	  //
-          // Place mode 3 compression data in the buffer; see HP manuals
-          // for details...
-	  //
 
-          if (offset >= 31)
-          {
-	    //
-            // Output multi-byte offset...
-	    //
+//
+// 'BandTransfer()' - Add a raster transfer command to the output band.
+//
+// A command directly following one without data, like a Y offset or an
+// empty row, is combined with it ("ESC*b5y120W").
+//
 
-            *comp_ptr++ = ((count - 1) << 5) | 31;
+void
+BandTransfer(int                 value,	// I - Number of bytes or rows
+	     int                 cmd,	// I - Command ('V', 'W' or 'Y')
+	     const unsigned char *data)	// I - Data or NULL
+{
+  char		digits[16],		// Digits of value
+		*digit;			// Current digit
+  size_t	bytes,			// Number of data bytes
+		needed,			// Bytes needed in the band
+		newsize;		// New size of band buffer
+  unsigned char	*newband,		// New band buffer
+		*ptr;			// Pointer into band buffer
+  unsigned	temp;			// Value to format
 
-            offset -= 31;
-            while (offset >= 255)
-            {
-              *comp_ptr++ = 255;
-              offset    -= 255;
-            }
 
-            *comp_ptr++ = offset;
-          }
-          else
-          {
-	    //
-            // Output single-byte offset...
-	    //
+  bytes = (data && value > 0) ? (size_t)value : 0;
 
-            *comp_ptr++ = ((count - 1) << 5) | offset;
-          }
+  //
+  // Format the value...
+  //
 
-          memcpy(comp_ptr, start, count);
-          comp_ptr += count;
-        }
+  digit = digits + sizeof(digits);
+  temp  = value > 0 ? (unsigned)value : 0;
 
-	line_ptr = CompBuffer;
-	line_end = comp_ptr;
+  do
+  {
+    *--digit = (char)('0' + temp % 10);
+    temp     /= 10;
+  }
+  while (temp);
 
-        memcpy(SeedBuffer + plane * length, line, length);
-	break;
+  //
+  // Make room in the band; if that is not possible, send the band and
+  // write the command directly...
+  //
 
-    case 10 :
-        //
-        // Mode 10 "near lossless" RGB compression...
-        //
+  needed = 3 + (size_t)(digits + sizeof(digits) - digit) + 1 + bytes;
 
-	line_ptr = line;
-	line_end = line + length;
+  if (BandUsed + needed > BandSize)
+  {
+    newsize = 2 * BandSize;
+    if (newsize < BandUsed + needed)
+      newsize = BandUsed + needed;
 
-	comp_ptr = CompBuffer;
-	seed     = SeedBuffer;
+    if ((newband = realloc(Band, newsize)) == NULL)
+    {
+      FlushBand();
+      printf("\033*b%d%c", value, cmd);
+      cfWritePrintData(data, bytes);
+      return;
+    }
 
-        if (PrinterPlanes == 1)
-	{
-	  //
-	  // Do grayscale compression to RGB...
-	  //
+    Band     = newband;
+    BandSize = newsize;
+  }
 
-	  while (line_ptr < line_end)
-          {
-	    //
-            // Find the next non-matching sequence...
-	    //
-
-            start = line_ptr;
-            while (line_ptr < line_end &&
-	           *line_ptr == *seed)
-            {
-              line_ptr ++;
-              seed ++;
-            }
-
-            if (line_ptr == line_end)
-              break;
-
-            offset = line_ptr - start;
-
-	    //
-            // Find non-matching grayscale pixels...
-	    //
-
-            start = line_ptr;
-            while (line_ptr < line_end &&
-	           *line_ptr != *seed)
-            {
-              line_ptr ++;
-              seed ++;
-            }
-
-            count = line_ptr - start;
-
-	    //
-	    // Bail out if we don't have count to compress
-	    //
-
-	    if (count == 0)
-	      break;
-
-#if 0
-            fprintf(stderr,
-		    "DEBUG: offset=%d, count=%d, comp_ptr=%p(%d of %d)...\n",
-	            offset, count, comp_ptr, comp_ptr - CompBuffer,
-		    BytesPerLine * 5);
-#endif // 0
-
-	    //
-            // Place mode 10 compression data in the buffer; each sequence
-	    // starts with a command byte that looks like:
-	    //
-	    //     CMD SRC SRC OFF OFF CNT CNT CNT
-	    //
-	    // For the purpose of this driver, CMD and SRC are always 0.
-	    //
-	    // If the offset >= 3 then additional offset bytes follow the
-	    // first command byte, each byte == 255 until the last one.
-	    //
-	    // If the count >= 7, then additional count bytes follow each
-	    // group of pixels, each byte == 255 until the last one.
-	    //
-	    // The offset and count are in RGB tuples (not bytes, as for
-	    // Mode 3 and 9)...
-	    //
-
-            if (offset >= 3)
-            {
-	      //
-	      // Output multi-byte offset...
-	      //
-
-              if (count > 7)
-		*comp_ptr++ = 0x1f;
-	      else
-		*comp_ptr++ = 0x18 | (count - 1);
-
-              offset -= 3;
-              while (offset >= 255)
-              {
-        	*comp_ptr++ = 255;
-        	offset      -= 255;
-              }
-
-              *comp_ptr++ = offset;
-            }
-            else
-            {
-	      //
-              // Output single-byte offset...
-	      //
-
-              if (count > 7)
-		*comp_ptr++ = (offset << 3) | 0x07;
-	      else
-		*comp_ptr++ = (offset << 3) | (count - 1);
-            }
-
-	    temp = count - 8;
-	    seed -= count;
-
-            while (count > 0)
-	    {
-	      if (count <= temp)
-	      {
-		//
-		// This is exceedingly lame...  The replacement counts
-		// are intermingled with the data...
-		//
-
-        	if (temp >= 255)
-        	  *comp_ptr++ = 255;
-        	else
-        	  *comp_ptr++ = temp;
-
-        	temp -= 255;
-	      }
-
-	      //
-	      // Get difference between current and see pixels...
-	      //
-
-              r = *start - *seed;
-	      g = r;
-	      b = ((*start & 0xfe) - (*seed & 0xfe)) / 2;
-
-              if (r < -16 || r > 15 || g < -16 || g > 15 || b < -16 || b > 15)
-	      {
-		//
-		// Pack 24-bit RGB into 23 bits...  Lame...
-		//
-
-                g = *start;
-
-		*comp_ptr++ = g >> 1;
-
-		if (g & 1)
-		  *comp_ptr++ = 0x80 | (g >> 1);
-		else
-		  *comp_ptr++ = g >> 1;
-
-		if (g & 1)
-		  *comp_ptr++ = 0x80 | (g >> 1);
-		else
-		  *comp_ptr++ = g >> 1;
-              }
-	      else
-	      {
-		//
-		// Pack 15-bit RGB difference...
-		//
-
-        	*comp_ptr++ = 0x80 | (((unsigned)r << 2) & 0x7c) | (((unsigned)g >> 3) & 0x03);
-*comp_ptr++ = (((unsigned)g << 5) & 0xe0) | (b & 0x1f);
-	      }
-
-              count --;
-	      start ++;
-	      seed ++;
-            }
-
-	    //
-	    // Make sure we have the ending count if the replacement count
-	    // was exactly 8 + 255n...
-	    //
-
-	    if (temp == 0)
-	      *comp_ptr++ = 0;
-          }
-	}
-	else
-	{
-	  //
-	  // Do RGB compression...
-	  //
+  //
+  // Add the command and data...
+  //
 
-	  while (line_ptr < line_end)
-          {
-	    //
-            // Find the next non-matching sequence...
-	    //
-
-            start = line_ptr;
-            while (line_ptr[0] == seed[0] &&
-                   line_ptr[1] == seed[1] &&
-                   line_ptr[2] == seed[2] &&
-                   (line_ptr + 2) < line_end)
-            {
-              line_ptr += 3;
-              seed += 3;
-            }
-
-            if (line_ptr == line_end)
-              break;
-
-            offset = (line_ptr - start) / 3;
-
-	    //
-            // Find non-matching RGB tuples...
-	    //
-
-            start = line_ptr;
-            while ((line_ptr[0] != seed[0] ||
-                    line_ptr[1] != seed[1] ||
-                    line_ptr[2] != seed[2]) &&
-                   (line_ptr + 2) < line_end)
-            {
-              line_ptr += 3;
-              seed += 3;
-            }
-
-            count = (line_ptr - start) / 3;
-
-	    //
-	    // Bail out if we don't have count to compress
-	    //
-
-	    if (count == 0)
-	      break;
-
-	    //
-	    // Place mode 10 compression data in the buffer; each sequence
-	    // starts with a command byte that looks like:
-	    //
-	    //     CMD SRC SRC OFF OFF CNT CNT CNT
-	    //
-	    // For the purpose of this driver, CMD and SRC are always 0.
-	    //
-	    // If the offset >= 3 then additional offset bytes follow the
-	    // first command byte, each byte == 255 until the last one.
-	    //
-	    // If the count >= 7, then additional count bytes follow each
-	    // group of pixels, each byte == 255 until the last one.
-	    //
-	    // The offset and count are in RGB tuples (not bytes, as for
-	    // Mode 3 and 9)...
-	    //
-
-            if (offset >= 3)
-            {
-	      //
-	      // Output multi-byte offset...
-	      //
-
-              if (count > 7)
-		*comp_ptr++ = 0x1f;
-	      else
-		*comp_ptr++ = 0x18 | (count - 1);
-
-              offset -= 3;
-              while (offset >= 255)
-              {
-        	*comp_ptr++ = 255;
-        	offset      -= 255;
-              }
-
-              *comp_ptr++ = offset;
-            }
-            else
-            {
-	      //
-              // Output single-byte offset...
-	      //
-
-              if (count > 7)
-		*comp_ptr++ = (offset << 3) | 0x07;
-	      else
-		*comp_ptr++ = (offset << 3) | (count - 1);
-            }
-
-	    temp = count - 8;
-	    seed -= count * 3;
-
-            while (count > 0)
-	    {
-	      if (count <= temp)
-	      {
-		//
-		// This is exceedingly lame...  The replacement counts
-		// are intermingled with the data...
-		//
-
-        	if (temp >= 255)
-        	  *comp_ptr++ = 255;
-        	else
-        	  *comp_ptr++ = temp;
-
-        	temp -= 255;
-	      }
-
-	      //
-	      // Get difference between current and see pixels...
-	      //
-
-              r = start[0] - seed[0];
-	      g = start[1] - seed[1];
-	      b = ((start[2] & 0xfe) - (seed[2] & 0xfe)) / 2;
-
-              if (r < -16 || r > 15 || g < -16 || g > 15 || b < -16 || b > 15)
-	      {
-		//
-		// Pack 24-bit RGB into 23 bits...  Lame...
-		//
-
-		*comp_ptr++ = start[0] >> 1;
-
-		if (start[0] & 1)
-		  *comp_ptr++ = 0x80 | (start[1] >> 1);
-		else
-		  *comp_ptr++ = start[1] >> 1;
-
-		if (start[1] & 1)
-		  *comp_ptr++ = 0x80 | (start[2] >> 1);
-		else
-		  *comp_ptr++ = start[2] >> 1;
-              }
-	      else
-	      {
-		//
-		// Pack 15-bit RGB difference...
-		//
-
-        	*comp_ptr++ = 0x80 | (((unsigned)r << 2) & 0x7c) | (((unsigned)g >> 3) & 0x03);
-*comp_ptr++ = (((unsigned)g << 5) & 0xe0) | (b & 0x1f);
-	      }
-
-              count --;
-	      start += 3;
-	      seed += 3;
-            }
-
-	    //
-	    // Make sure we have the ending count if the replacement count
-	    // was exactly 8 + 255n...
-	    //
-
-	    if (temp == 0)
-	      *comp_ptr++ = 0;
-          }
-        }
+  ptr = Band + BandUsed;
+
+  if (BandCombine && BandCombine == BandUsed)
+    ptr[-1] = (unsigned char)tolower(ptr[-1]);
+  else
+  {
+    *ptr++ = 0x1b;
+    *ptr++ = '*';
+    *ptr++ = 'b';
+  }
 
-	line_ptr = CompBuffer;
-	line_end = comp_ptr;
+  memcpy(ptr, digit, (size_t)(digits + sizeof(digits) - digit));
+  ptr    += digits + sizeof(digits) - digit;
+  *ptr++ = (unsigned char)cmd;
 
-        memcpy(SeedBuffer, line, length);
-	break;
+  if (bytes)
+  {
+    memcpy(ptr, data, bytes);
+    ptr += bytes;
   }
 
-  //
-  // Set the length of the data and write a raster plane...
-  //
+  BandUsed    = (size_t)(ptr - Band);
+  BandCombine = bytes ? 0 : BandUsed;
+}
+
+
+//
+// 'FlushBand()' - Send the output band.
+//
+
+void
+FlushBand(void)
+{
+  if (BandUsed)
+    cfWritePrintData(Band, BandUsed);
 
-  printf("\033*b%d%c", (int)(line_end - line_ptr), pend);
-  cfWritePrintData(line_ptr, line_end - line_ptr);
+  BandUsed    = 0;
+  BandCombine = 0;
+  BandRows    = 0;
 }
 
 
@@ -1605,7 +1349,16 @@ OutputLine(ppd_file_t         *ppd,	// I - PPD file
 
   if (OutputFeed > 0)
   {
-    if (header->cupsCompression < 3)
+    if (Codec.mode == RASTER_COMPRESS_ADAPTIVE)
+    {
+      //
+      // Send empty rows in the adaptive compression block...
+      //
+
+      AddBlockRows(NULL, 0, OutputFeed);
+      OutputFeed = 0;
+    }
+    else if (header->cupsCompression < 3)
     {
       //
       // Send blank raster lines...
@@ -1613,7 +1366,7 @@ OutputLine(ppd_file_t         *ppd,	// I - PPD file
 
       while (OutputFeed > 0)
       {
-	printf("\033*b0W");
+	BandTransfer(0, 'W', NULL);
 	OutputFeed --;
       }
     }
@@ -1623,9 +1376,9 @@ OutputLine(ppd_file_t         *ppd,	// I - PPD file
       // Send Y offset command and invalidate the seed buffer...
       //
 
-      printf("\033*b%dY", OutputFeed);
-      OutputFeed  = 0;
-      SeedInvalid = 1;
+      BandTransfer(OutputFeed, 'Y', NULL);
+      OutputFeed = 0;
+      raster_codec_reset(&Codec);
     }
   }
 
@@ -1714,10 +1467,11 @@ OutputLine(ppd_file_t         *ppd,	// I - PPD file
   }
 
   //
-  // The seed buffer, if any, now should contain valid data...
+  // Send the band when it is complete...
   //
 
-  SeedInvalid = 0;
+  if (++ BandRows >= BAND_ROWS)
+    FlushBand();
 }
 
 
@@ -1726,7 +1480,8 @@ OutputLine(ppd_file_t         *ppd,	// I - PPD file
 //
 
 int					// O - Number of lines (0 if blank)
-ReadLine(cups_raster_t      *ras,	// I - Raster stream
+ReadLine(cups_raster_t       *ras,	// I - Raster stream
+	 const unsigned char *pixels,	// I - Line in memory or NULL
          cups_page_header2_t *header)	// I - Page header
 {
   int	plane,				// Current color plane
@@ -1737,7 +1492,10 @@ ReadLine(cups_raster_t      *ras,	// I - Raster stream
   // Read raster data...
   //
 
-  cupsRasterReadPixels(ras, PixelBuffer, header->cupsBytesPerLine);
+  if (pixels)
+    memcpy(PixelBuffer, pixels, header->cupsBytesPerLine);
+  else
+    cupsRasterReadPixels(ras, PixelBuffer, header->cupsBytesPerLine);
 
   //
   // See if it is blank; if so, return right away...
@@ -1815,6 +1573,287 @@ ReadLine(cups_raster_t      *ras,	// I - Raster stream
 }
 
 
+//
+// 'PrintPage()' - Convert and send a page.
+//
+// The raster data comes from the raster stream or, for worker processes,
+// from memory; workers don't report their progress within the page.
+//
+
+void
+PrintPage(cf_filter_data_t    *data,	// I - filter data
+	  ppd_file_t          *ppd,	// I - PPD file
+	  cups_raster_t       *ras,	// I - Raster stream
+	  const unsigned char *pixels,	// I - Raster data or NULL
+	  cups_page_header2_t *header,	// I - Page header
+	  int                 job_id,	// I - Job ID
+	  const char          *user,	// I - User printing job
+	  const char          *title,	// I - Title of job
+	  int                 num_options,
+					// I - Number of command-line options
+	  cups_option_t       *options)	// I - Command-line options
+{
+  int	y;				// Current line
+
+
+  StartPage(data, ppd, header, job_id, user, title, num_options, options);
+
+  for (y = 0; y < (int)header->cupsHeight; y ++)
+  {
+    //
+    // Let the user know how far we have progressed...
+    //
+
+    if (Canceled)
+      break;
+
+    if ((y & 127) == 0 && !pixels)
+    {
+      fprintf(stderr, "INFO: Printing page %d, %d%% complete.\n",
+	      Page, 100 * y / header->cupsHeight);
+      fprintf(stderr, "ATTR: job-media-progress=%d\n",
+	      100 * y / header->cupsHeight);
+    }
+
+    //
+    // Read and write a line of graphics or whitespace...
+    //
+
+    if (ReadLine(ras, pixels ? pixels + (size_t)y * header->cupsBytesPerLine :
+		 NULL, header))
+      OutputLine(ppd, header);
+    else
+      OutputFeed ++;
+  }
+
+  //
+  // Eject the page...
+  //
+
+  EndPage(ppd, header);
+}
+
+
+//
+// 'StartWorker()' - Convert a page in a worker process.
+//
+// The raster data of the page is read into memory and converted by a
+// forked copy of the filter into a temporary file, which FinishWorkers()
+// sends in page order. Returns 0 if the page needs to be converted by
+// the filter itself, as there is not enough memory or no temporary file.
+//
+
+int					// O - 1 if page was handled, 0 otherwise
+StartWorker(cf_filter_data_t    *data,	// I - filter data
+	    ppd_file_t          *ppd,	// I - PPD file
+	    cups_raster_t       *ras,	// I - Raster stream
+	    cups_page_header2_t *header,// I - Page header
+	    int                 job_id,	// I - Job ID
+	    const char          *user,	// I - User printing job
+	    const char          *title,	// I - Title of job
+	    int                 num_options,
+					// I - Number of command-line options
+	    cups_option_t       *options)
+					// I - Command-line options
+{
+  pcl_worker_t	*w;			// New worker
+  unsigned char	*pixels;		// Raster data of page
+  size_t	bytes;			// Size of raster data
+  unsigned	y;			// Current line
+  int		fd;			// Temporary file
+  pid_t		pid;			// Worker process ID
+  sigset_t	mask,			// SIGTERM blocked
+		oldmask;		// Previous signal mask
+  char		filename[1024];		// Temporary filename
+
+
+  //
+  // Wait for older pages until there is a free worker and enough memory;
+  // a page bigger than the memory limit is converted on its own...
+  //
+
+  bytes = (size_t)header->cupsBytesPerLine * header->cupsHeight;
+
+  FinishWorkers(MaxWorkers - 1);
+
+  while (NumWorkers > 0 && PageMemoryUsed + bytes > PageMemory)
+    FinishWorkers(NumWorkers - 1);
+
+  if ((pixels = malloc(bytes ? bytes : 1)) == NULL)
+    return (0);
+
+  if ((fd = cupsTempFd(filename, sizeof(filename))) < 0)
+  {
+    free(pixels);
+    return (0);
+  }
+
+  unlink(filename);
+
+  for (y = 0; y < header->cupsHeight; y ++)
+    cupsRasterReadPixels(ras, pixels + (size_t)y * header->cupsBytesPerLine,
+			 header->cupsBytesPerLine);
+
+  fflush(stdout);
+
+  //
+  // Block SIGTERM until the worker is in the list, so that CancelJob()
+  // sees it, and start no worker for a canceled job...
+  //
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGTERM);
+  sigprocmask(SIG_BLOCK, &mask, &oldmask);
+
+  if (Canceled)
+  {
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+    close(fd);
+    free(pixels);
+    return (1);
+  }
+
+  if ((pid = fork()) == 0)
+  {
+    //
+    // Worker process, send the page to the temporary file...
+    //
+
+    NumWorkers = 0;
+
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+
+    dup2(fd, 1);
+    close(fd);
+
+    PrintPage(data, ppd, NULL, pixels, header, job_id, user, title,
+	      num_options, options);
+
+    fflush(stdout);
+    _exit(Canceled ? 2 : 0);
+  }
+  else if (pid < 0)
+  {
+    //
+    // Convert the page here...
+    //
+
+    fprintf(stderr, "DEBUG: Unable to fork worker: %s\n", strerror(errno));
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+    close(fd);
+
+    if (!FinishWorkers(0))
+    {
+      fprintf(stderr, "PAGE: %d %d\n", Page, header->NumCopies);
+      fprintf(stderr, "INFO: Starting page %d.\n", Page);
+
+      PrintPage(data, ppd, NULL, pixels, header, job_id, user, title,
+		num_options, options);
+
+      fprintf(stderr, "INFO: Finished page %d.\n", Page);
+    }
+
+    free(pixels);
+    return (1);
+  }
+
+  free(pixels);
+
+  w         = Workers + NumWorkers;
+  w->pid    = pid;
+  w->fd     = fd;
+  w->page   = Page;
+  w->copies = header->NumCopies;
+  w->bytes  = bytes;
+
+  NumWorkers ++;
+  PageMemoryUsed += bytes;
+
+  sigprocmask(SIG_SETMASK, &oldmask, NULL);
+
+  return (1);
+}
+
+
+//
+// 'FinishWorkers()' - Send the pages of the worker processes.
+//
+// The oldest pages are sent until only "keep" workers are left. Once the
+// job is canceled, only the oldest unsent page is sent, as the page being
+// printed without workers, and the workers of the following pages are
+// killed and their pages dropped. Returns 1 in that case.
+//
+
+int					// O - 1 if pages were dropped
+FinishWorkers(int keep)			// I - Number of workers to keep
+{
+  pcl_worker_t	*w;			// Oldest worker
+  int		status;			// Exit status of worker
+  ssize_t	bytes;			// Bytes read
+  char		buffer[65536];		// Copy buffer
+  sigset_t	mask,			// SIGTERM blocked
+		oldmask;		// Previous signal mask
+  static int	dropping = 0;		// Drop the remaining pages?
+
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGTERM);
+
+  while (NumWorkers > keep)
+  {
+    w = Workers;
+
+    if (dropping)
+      kill(w->pid, SIGKILL);
+
+    while (waitpid(w->pid, &status, 0) < 0 && errno == EINTR);
+
+    w->pid = 0;
+
+    if (dropping)
+      fprintf(stderr, "DEBUG: Dropping page %d of canceled job.\n", w->page);
+    else if (!WIFEXITED(status) || WEXITSTATUS(status) > 2)
+      fprintf(stderr, "ERROR: Unable to convert page %d.\n", w->page);
+    else
+    {
+      fprintf(stderr, "PAGE: %d %d\n", w->page, w->copies);
+      fprintf(stderr, "INFO: Starting page %d.\n", w->page);
+
+      lseek(w->fd, 0, SEEK_SET);
+      while ((bytes = read(w->fd, buffer, sizeof(buffer))) > 0)
+        cfWritePrintData(buffer, (size_t)bytes);
+
+      fprintf(stderr, "INFO: Finished page %d.\n", w->page);
+    }
+
+    if (!dropping && (Canceled || (WIFEXITED(status) &&
+				   WEXITSTATUS(status) == 2)))
+    {
+      // Canceled, this is the last page
+      dropping = 1;
+      Page     = w->page;
+    }
+
+    close(w->fd);
+
+    //
+    // Block SIGTERM while the list is shifted, so that CancelJob() does
+    // not see a half-moved entry...
+    //
+
+    sigprocmask(SIG_BLOCK, &mask, &oldmask);
+
+    PageMemoryUsed -= w->bytes;
+    NumWorkers --;
+    memmove(Workers, Workers + 1, (size_t)NumWorkers * sizeof(pcl_worker_t));
+
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+  }
+
+  return (dropping);
+}
+
+
 //
 // 'main()' - Main entry and processing of driver.
 //
@@ -1824,10 +1863,10 @@ main(int  argc,				// I - Number of command-line arguments
      char *argv[])			// I - Command-line arguments
 {
   int			fd;		// File descriptor
+  const char		*val;		// Option value
   int empty = 1;
   cups_raster_t		*ras;		// Raster stream for printing
   cups_page_header2_t	header;		// Page header from file
-  int			y;		// Current line
   ppd_file_t		*ppd;		// PPD file
   int			job_id;		// Job ID
   int			num_options;	// Number of options
@@ -1868,6 +1907,28 @@ main(int  argc,				// I - Number of command-line arguments
 
   num_options = cupsParseOptions(argv[5], 0, &options);
 
+  //
+  // Convert up to "pcl-page-workers" pages at a time, reading ahead at
+  // most "pcl-page-memory" MB of raster data...
+  //
+
+  if ((val = cupsGetOption("pcl-page-workers", num_options,
+			   options)) != NULL)
+    MaxWorkers = atoi(val);
+
+  if (MaxWorkers > 64)
+    MaxWorkers = 64;
+
+  if ((val = cupsGetOption("pcl-page-memory", num_options,
+			   options)) != NULL && atoi(val) > 0)
+    PageMemory = (size_t)atoi(val) * 1048576;
+  else
+    PageMemory = (size_t)256 * 1048576;
+
+  if (MaxWorkers > 1 &&
+      (Workers = calloc((size_t)MaxWorkers, sizeof(pcl_worker_t))) == NULL)
+    MaxWorkers = 1;
+
   //
   // Open the PPD file...
   //
@@ -1949,51 +2010,36 @@ main(int  argc,				// I - Number of command-line arguments
 
     Page ++;
 
-    fprintf(stderr, "PAGE: %d %d\n", Page, header.NumCopies);
-    fprintf(stderr, "INFO: Starting page %d.\n", Page);
-
-    StartPage(data, ppd, &header, atoi(argv[1]), argv[2], argv[3],
-              num_options, options);
-
-    for (y = 0; y < (int)header.cupsHeight; y ++)
+    if (MaxWorkers > 1)
     {
       //
-      // Let the user know how far we have progressed...
+      // Convert the page in a worker process if possible, otherwise send
+      // the pages of the workers first...
       //
 
-      if (Canceled)
-	break;
-
-      if ((y & 127) == 0)
-      {
-        fprintf(stderr, "INFO: Printing page %d, %d%% complete.\n",
-		Page, 100 * y / header.cupsHeight);
-        fprintf(stderr, "ATTR: job-media-progress=%d\n",
-		100 * y / header.cupsHeight);
-      }
-
-      //
-      // Read and write a line of graphics or whitespace...
-      //
+      if (StartWorker(data, ppd, ras, &header, job_id, argv[2], argv[3],
+		      num_options, options))
+	continue;
 
-      if (ReadLine(ras, &header))
-        OutputLine(ppd, &header);
-      else
-        OutputFeed ++;
+      if (FinishWorkers(0))
+        break;
     }
 
-    //
-    // Eject the page...
-    //
+    fprintf(stderr, "PAGE: %d %d\n", Page, header.NumCopies);
+    fprintf(stderr, "INFO: Starting page %d.\n", Page);
 
-    fprintf(stderr, "INFO: Finished page %d.\n", Page);
+    PrintPage(data, ppd, ras, NULL, &header, job_id, argv[2], argv[3],
+	      num_options, options);
 
-    EndPage(ppd, &header);
+    fprintf(stderr, "INFO: Finished page %d.\n", Page);
 
     if (Canceled)
       break;
   }
 
+  if (MaxWorkers > 1)
+    FinishWorkers(0);
+
   if (!empty)
     Shutdown(ppd, job_id, argv[2], argv[3], num_options, options);
 
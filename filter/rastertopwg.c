@@ -13,6 +13,7 @@
 
 #include <cupsfilters/filter.h>
 #include <ppd/ppd-filter.h>
+#include "filter-trace.h"
 #include <signal.h>
 
 
@@ -63,7 +64,8 @@ main(int  argc,	   // I - Number of command-line arguments
   // Fire up the cfFilterRasterToPWG() filter function
   //
 
-  ret = ppdFilterCUPSWrapper(argc, argv, cfFilterRasterToPWG, NULL, &JobCanceled);
+  ret = trace_cups_wrapper(argc, argv, "rastertopwg", cfFilterRasterToPWG,
+			   NULL, &JobCanceled);
 
   if (ret)
     fprintf(stderr, "ERROR: rastertopwg filter function failed.\n");
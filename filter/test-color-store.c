@@ -0,0 +1,359 @@
+//
+// Tests for the shared color data store of rastertopclx and
+// rastertoescpx.
+//
+// Copyright © 2024 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Contents:
+//
+//   main()          - Build a store, map it, and compare it with the PPD.
+//   compare()       - Compare mapped color data with data from the PPD.
+//   log_message()   - Log function remembering the last message.
+//   try_write()     - Check whether writing to data faults.
+//   write_faulted() - Leave try_write() on a fault.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "color-store.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <dirent.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <unistd.h>
+#include <utime.h>
+
+
+//
+// Constants...
+//
+
+#define LUT_SIZE	((CF_MAX_LUT + 1) * sizeof(cf_lut_t))
+					// Bytes of a dither LUT
+
+
+//
+// Local globals...
+//
+
+// PPD file with all the color data the store keeps
+static const char	*TestPPD =
+  "*PPD-Adobe: \"4.3\"\n"
+  "*FormatVersion: \"4.3\"\n"
+  "*LanguageVersion: English\n"
+  "*LanguageEncoding: ISOLatin1\n"
+  "*Manufacturer: \"Test\"\n"
+  "*ModelName: \"Test Color Store\"\n"
+  "*NickName: \"Test Color Store\"\n"
+  "*ShortNickName: \"Test Color Store\"\n"
+  "*ColorDevice: True\n"
+  "*cupsRGBProfile CMYK: \"2 4 8\"\n"
+  "*cupsRGBSample CMYK: \"0 0 0 0 0 0 1\"\n"
+  "*cupsRGBSample CMYK: \"0 0 1 1 1 0 0\"\n"
+  "*cupsRGBSample CMYK: \"0 1 0 1 0 1 0\"\n"
+  "*cupsRGBSample CMYK: \"0 1 1 1 0 0 0\"\n"
+  "*cupsRGBSample CMYK: \"1 0 0 0 1 1 0\"\n"
+  "*cupsRGBSample CMYK: \"1 0 1 0 1 0 0\"\n"
+  "*cupsRGBSample CMYK: \"1 1 0 0 0 1 0\"\n"
+  "*cupsRGBSample CMYK: \"1 1 1 0 0 0 0\"\n"
+  "*cupsInkChannels CMYK: \"4\"\n"
+  "*cupsInkLimit CMYK: \"3.0\"\n"
+  "*cupsBlackGeneration CMYK: \"0.2 0.8\"\n"
+  "*cupsAllGamma CMYK: \"1.2\"\n"
+  "*cupsBlackDither CMYK: \"0.5 1.0\"\n"
+  "*cupsCyanDither CMYK: \"0.3 0.6 1.0\"\n"
+  "*cupsMagentaDither CMYK: \"0.3 0.6 1.0\"\n"
+  "*cupsYellowDither CMYK: \"1.0\"\n";
+
+static sigjmp_buf	WriteJump;	// Where to go on a fault
+static char		LastMessage[1024] = "";
+					// Last message logged
+
+
+//
+// Local functions...
+//
+
+static int	compare(color_store_t *mapped, color_store_t *loaded);
+static void	log_message(void *data, cf_loglevel_t level,
+			    const char *message, ...);
+static int	try_write(volatile unsigned char *ptr);
+static void	write_faulted(int sig);
+
+
+//
+// 'main()' - Build a store, map it, and compare it with the PPD.
+//
+
+int					// O - Exit status
+main(void)
+{
+  int		errors = 0;		// Number of failed tests
+  const char	*tmpdir;		// Temporary directory
+  char		dir[1024],		// Cache directory
+		ppdfile[1024];		// PPD file
+  FILE		*fp;			// PPD file
+  ppd_file_t	*ppd;			// Parsed PPD file
+  color_store_t	loaded,			// Color data from the PPD file
+		mapped,			// Color data from the store
+		rebuilt;		// Color data after changing the PPD
+  struct utimbuf times;			// Times of the changed PPD file
+  DIR		*dirp;			// Cache directory
+  struct dirent	*dent;			// Cache directory entry
+
+
+  if ((tmpdir = getenv("TMPDIR")) == NULL || !*tmpdir)
+    tmpdir = "/tmp";
+
+  snprintf(dir, sizeof(dir), "%s/test-color-store.XXXXXX", tmpdir);
+  if (!mkdtemp(dir))
+  {
+    perror(dir);
+    return (1);
+  }
+
+  snprintf(ppdfile, sizeof(ppdfile), "%s/test.ppd", dir);
+  if ((fp = fopen(ppdfile, "w")) == NULL)
+  {
+    perror(ppdfile);
+    return (1);
+  }
+  fputs(TestPPD, fp);
+  fclose(fp);
+
+  setenv("PPD", ppdfile, 1);
+  setenv("CUPS_CACHEDIR", dir, 1);
+
+  if ((ppd = ppdOpenFile(ppdfile)) == NULL)
+  {
+    puts("ppdOpenFile: FAIL");
+    return (1);
+  }
+
+  //
+  // The first process builds the store from the PPD file...
+  //
+
+  color_store_open(&loaded, ppd, "CMYK", "", "600dpi", log_message, NULL);
+
+  if (loaded.map || !loaded.rgb || !loaded.cmyk ||
+      !color_store_lut(&loaded, "Black") || !color_store_lut(&loaded, "Cyan") ||
+      strncmp(LastMessage, "Saved color data", 16))
+  {
+    printf("build store: FAIL (%s)\n", LastMessage);
+    errors ++;
+  }
+  else
+    puts("build store: PASS");
+
+  //
+  // ... and the next ones map it, with the same data...
+  //
+
+  color_store_open(&mapped, ppd, "CMYK", "", "600dpi", log_message, NULL);
+
+  if (!mapped.map || strncmp(LastMessage, "Mapped color data", 17) ||
+      compare(&mapped, &loaded))
+  {
+    printf("map store: FAIL (%s)\n", LastMessage);
+    errors ++;
+  }
+  else
+    puts("map store: PASS");
+
+  //
+  // ... which is shared, so it must not be writable...
+  //
+
+  if (mapped.map &&
+      (!color_store_owns(&mapped, mapped.cmyk) ||
+       !color_store_owns(&mapped, color_store_lut(&mapped, "Black")) ||
+       !try_write((unsigned char *)mapped.cmyk->channels[0]) ||
+       !try_write((unsigned char *)color_store_lut(&mapped, "Black")) ||
+       !try_write(mapped.rgb->colors[1][1][1])))
+  {
+    puts("read-only mapping: FAIL");
+    errors ++;
+  }
+  else
+    puts("read-only mapping: PASS");
+
+  color_store_close(&mapped);
+
+  //
+  // A changed PPD file makes the store get rebuilt...
+  //
+
+  times.actime  = 1000000000;
+  times.modtime = 1000000000;
+  utime(ppdfile, &times);
+
+  color_store_open(&rebuilt, ppd, "CMYK", "", "600dpi", log_message, NULL);
+
+  if (rebuilt.map || strncmp(LastMessage, "Saved color data", 16))
+  {
+    printf("rebuild store: FAIL (%s)\n", LastMessage);
+    errors ++;
+  }
+  else
+    puts("rebuild store: PASS");
+
+  color_store_close(&rebuilt);
+  color_store_close(&loaded);
+  ppdClose(ppd);
+
+  //
+  // Clean up...
+  //
+
+  if ((dirp = opendir(dir)) != NULL)
+  {
+    while ((dent = readdir(dirp)) != NULL)
+      if (dent->d_name[0] != '.')
+      {
+	snprintf(ppdfile, sizeof(ppdfile), "%s/%s", dir, dent->d_name);
+	unlink(ppdfile);
+      }
+    closedir(dirp);
+  }
+  rmdir(dir);
+
+  return (errors != 0);
+}
+
+
+//
+// 'compare()' - Compare mapped color data with data from the PPD.
+//
+
+static int				// O - 0 if equal, 1 otherwise
+compare(color_store_t *mapped,		// I - Mapped color data
+	color_store_t *loaded)		// I - Color data from the PPD file
+{
+  int		i,			// Looping var
+		r, g, b,		// Cube position
+		size;			// Cube size
+  const char	*names[] =		// Inks with LUTs
+  { "Black", "LightBlack", "Cyan", "LightCyan", "Magenta", "LightMagenta",
+    "Yellow" };
+  cf_lut_t	*mlut,			// Mapped LUT
+		*llut;			// Loaded LUT
+
+
+  if (!mapped->rgb || !mapped->cmyk ||
+      mapped->rgb->cube_size != loaded->rgb->cube_size ||
+      mapped->rgb->num_channels != loaded->rgb->num_channels ||
+      memcmp(mapped->rgb->cube_index, loaded->rgb->cube_index,
+	     sizeof(loaded->rgb->cube_index)) ||
+      memcmp(mapped->rgb->cube_mult, loaded->rgb->cube_mult,
+	     sizeof(loaded->rgb->cube_mult)) ||
+      mapped->cmyk->num_channels != loaded->cmyk->num_channels ||
+      memcmp(mapped->cmyk->black_lut, loaded->cmyk->black_lut,
+	     sizeof(loaded->cmyk->black_lut)) ||
+      memcmp(mapped->cmyk->color_lut, loaded->cmyk->color_lut,
+	     sizeof(loaded->cmyk->color_lut)) ||
+      mapped->cmyk->ink_limit != loaded->cmyk->ink_limit)
+    return (1);
+
+  size = loaded->rgb->cube_size;
+  for (r = 0; r < size; r ++)
+    for (g = 0; g < size; g ++)
+      for (b = 0; b < size; b ++)
+	if (memcmp(mapped->rgb->colors[r][g][b], loaded->rgb->colors[r][g][b],
+		   (size_t)loaded->rgb->num_channels))
+	  return (1);
+
+  for (i = 0; i < loaded->cmyk->num_channels; i ++)
+    if (memcmp(mapped->cmyk->channels[i], loaded->cmyk->channels[i],
+	       256 * sizeof(short)))
+      return (1);
+
+  for (i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i ++)
+  {
+    mlut = color_store_lut(mapped, names[i]);
+    llut = color_store_lut(loaded, names[i]);
+
+    if ((mlut == NULL) != (llut == NULL) ||
+	(llut && memcmp(mlut, llut, LUT_SIZE)))
+      return (1);
+  }
+
+  return (0);
+}
+
+
+//
+// 'log_message()' - Log function remembering the last message.
+//
+
+static void
+log_message(void          *data,	// I - Log data (unused)
+	    cf_loglevel_t level,	// I - Log level (unused)
+	    const char    *message,	// I - Message format
+	    ...)			// I - Arguments
+{
+  va_list	ap;			// Arguments
+
+
+  (void)data;
+  (void)level;
+
+  va_start(ap, message);
+  vsnprintf(LastMessage, sizeof(LastMessage), message, ap);
+  va_end(ap);
+}
+
+
+//
+// 'try_write()' - Check whether writing to data faults.
+//
+
+static int				// O - 1 if the write faulted, 0 if not
+try_write(volatile unsigned char *ptr)	// I - Data to write to
+{
+  int			faulted;	// Did the write fault?
+  struct sigaction	action,		// Fault handler
+			oldsegv,	// Previous SIGSEGV handler
+			oldbus;		// Previous SIGBUS handler
+
+
+  memset(&action, 0, sizeof(action));
+  sigemptyset(&action.sa_mask);
+  action.sa_handler = write_faulted;
+  sigaction(SIGSEGV, &action, &oldsegv);
+  sigaction(SIGBUS, &action, &oldbus);
+
+  if (sigsetjmp(WriteJump, 1) == 0)
+  {
+    *ptr    = (unsigned char)(*ptr + 1);
+    faulted = 0;
+  }
+  else
+    faulted = 1;
+
+  sigaction(SIGSEGV, &oldsegv, NULL);
+  sigaction(SIGBUS, &oldbus, NULL);
+
+  return (faulted);
+}
+
+
+//
+// 'write_faulted()' - Leave try_write() on a fault.
+//
+
+static void
+write_faulted(int sig)			// I - Signal number (unused)
+{
+  (void)sig;
+
+  siglongjmp(WriteJump, 1);
+}
@@ -0,0 +1,591 @@
+//
+// Tests and microbenchmark for the raster line compression of the PCL
+// and ESC/P drivers of cups-filters.
+//
+// Copyright © 2024 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Contents:
+//
+//   main()        - Run the tests or the benchmark.
+//   bench_mode()  - Measure the encoding speed of a mode.
+//   fill_row()    - Fill a row with random, printer-like data.
+//   fuzz_block()  - Check adaptive blocks of many rows.
+//   fuzz_mode()   - Feed random data to the decoder of a mode.
+//   test_mode()   - Check round trips and bounds of a mode.
+//   usage()       - Show program usage.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "raster-compress.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+//
+// Modes to test...
+//
+
+static const struct
+{
+  int		mode;			// Compression mode
+  int		bpp;			// Bytes per pixel
+  const char	*name;			// Name for messages
+} modes[] =
+{
+  { RASTER_COMPRESS_NONE,		1, "none" },
+  { RASTER_COMPRESS_RLE,		1, "rle" },
+  { RASTER_COMPRESS_PACKBITS,		1, "packbits" },
+  { RASTER_COMPRESS_DELTA_ROW,		1, "delta-row" },
+  { RASTER_COMPRESS_ADAPTIVE,		1, "adaptive" },
+  { RASTER_COMPRESS_REPLACEMENT,	1, "replacement-delta-row" },
+  { RASTER_COMPRESS_NEAR_LOSSLESS,	1, "near-lossless-gray" },
+  { RASTER_COMPRESS_NEAR_LOSSLESS,	3, "near-lossless-rgb" }
+};
+
+#define NUM_MODES	(int)(sizeof(modes) / sizeof(modes[0]))
+#define MAX_LENGTH	4096		// Maximum bytes per row
+#define CANARY		0xa5		// Byte after the output buffer
+
+
+//
+// Local functions...
+//
+
+static void	bench_mode(int m, int rows);
+static void	fill_row(unsigned char *row, const unsigned char *prev,
+			 size_t length, int bpp);
+static int	fuzz_block(int iterations);
+static int	fuzz_mode(int m, int iterations);
+static int	test_mode(int m, int iterations);
+static void	usage(void);
+
+
+//
+// 'main()' - Run the tests or the benchmark.
+//
+// Usage:
+//
+//    test-raster-compress [-n iterations] [-s seed]
+//    test-raster-compress bench [-n rows]
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line arguments
+     char *argv[])			// I - Command-line arguments
+{
+  int		i, m;			// Looping vars
+  int		bench = 0,		// Run the benchmark?
+		iterations = 2000,	// Iterations/rows
+		errors = 0;		// Number of failed modes
+  unsigned	seed = 1;		// Random seed
+
+
+  for (i = 1; i < argc; i ++)
+  {
+    if (!strcmp(argv[i], "bench"))
+      bench = 1;
+    else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+      iterations = atoi(argv[++ i]);
+    else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+      seed = (unsigned)strtoul(argv[++ i], NULL, 10);
+    else
+      usage();
+  }
+
+  srand(seed);
+
+  if (bench)
+  {
+    puts("mode,rows,bytes-in,bytes-out,sec,mb-per-sec");
+    for (m = 0; m < NUM_MODES; m ++)
+      bench_mode(m, iterations * 10);
+    return (0);
+  }
+
+  for (m = 0; m < NUM_MODES; m ++)
+  {
+    if (test_mode(m, iterations) || fuzz_mode(m, iterations))
+    {
+      printf("%s: FAIL (seed %u)\n", modes[m].name, seed);
+      errors ++;
+    }
+    else
+      printf("%s: PASS\n", modes[m].name);
+  }
+
+  if (fuzz_block(iterations))
+  {
+    printf("adaptive-block: FAIL (seed %u)\n", seed);
+    errors ++;
+  }
+  else
+    puts("adaptive-block: PASS");
+
+  return (errors != 0);
+}
+
+
+//
+// 'bench_mode()' - Measure the encoding speed of a mode.
+//
+
+static void
+bench_mode(int m,			// I - Index in modes[]
+	   int rows)			// I - Number of rows
+{
+  raster_codec_t	rc;		// Codec
+  unsigned char		*page,		// Rows of a page
+			*out;		// Encoded row
+  size_t		length = 8 * 600 * 3,
+					// 8" at 600 DPI, 3 bytes per pixel
+			total = 0;	// Encoded bytes
+  int			i,		// Looping var
+			pagerows = 64;	// Different rows
+  ssize_t		bytes;		// Bytes of a row
+  struct timespec	start, end;	// Time
+  double		secs;		// Elapsed time
+
+
+  if (raster_codec_init(&rc, modes[m].mode, length, 1, modes[m].bpp))
+    return;
+
+  page = malloc(pagerows * length);
+  out  = malloc(raster_compress_bound(modes[m].mode, length, modes[m].bpp));
+
+  for (i = 0; i < pagerows; i ++)
+    fill_row(page + i * length, i ? page + (i - 1) * length : NULL, length,
+	     modes[m].bpp);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < rows; i ++)
+  {
+    bytes = raster_encode_row(&rc, 0, page + (i % pagerows) * length,
+			      length, out,
+			      raster_compress_bound(modes[m].mode, length,
+						    modes[m].bpp));
+    if (bytes > 0)
+      total += bytes;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  secs = (end.tv_sec - start.tv_sec) + 0.000000001 * (end.tv_nsec - start.tv_nsec);
+  printf("%s,%d,%lu,%lu,%.4f,%.1f\n", modes[m].name, rows,
+	 (unsigned long)(rows * length), (unsigned long)total, secs,
+	 secs > 0.0 ? rows * length / secs / 1048576.0 : 0.0);
+
+  free(page);
+  free(out);
+  raster_codec_free(&rc);
+}
+
+
+//
+// 'fill_row()' - Fill a row with random, printer-like data.
+//
+// Rows are blank, solid, runs, dithered noise, or small changes of the
+// previous row, which exercises all paths of the encoders.
+//
+
+static void
+fill_row(unsigned char       *row,	// O - Row
+	 const unsigned char *prev,	// I - Previous row or NULL
+	 size_t              length,	// I - Bytes per row
+	 int                 bpp)	// I - Bytes per pixel
+{
+  size_t	i, j, n;		// Looping vars
+  int		kind = rand() % 6;	// Kind of row
+
+
+  if (kind == 5 && !prev)
+    kind = 3;
+
+  switch (kind)
+  {
+    case 0 :				// Blank
+        memset(row, 0, length);
+	break;
+
+    case 1 :				// Solid
+        memset(row, rand() & 255, length);
+	break;
+
+    case 2 :				// Runs of random length
+        for (i = 0; i < length; i += n)
+	{
+	  n = 1 + rand() % (rand() % 2 ? 4 : 400);
+	  if (n > length - i)
+	    n = length - i;
+	  memset(row + i, rand() & 255, n);
+	}
+	break;
+
+    case 3 :				// Noise
+        for (i = 0; i < length; i ++)
+	  row[i] = rand() & 255;
+	break;
+
+    case 4 :				// Alternating single and pairs
+        for (i = 0; i < length; i ++)
+	  row[i] = (i % 3) ? 0xff : (unsigned char)i;
+	break;
+
+    default :				// Small changes of the last row
+        memcpy(row, prev, length);
+	n = rand() % 40;
+	for (j = 0; j < n; j ++)
+	{
+	  i = rand() % length;
+	  if (rand() % 2)
+	    row[i] += (unsigned char)(rand() % 31 - 15);
+	  else
+	    row[i] = rand() & 255;
+	}
+	if (rand() % 4 == 0)
+	{
+	  // A long changed stretch
+	  i = rand() % length;
+	  n = rand() % (length - i + 1);
+	  for (j = i; j < i + n; j ++)
+	    row[j] ^= rand() & 255;
+	}
+	break;
+  }
+
+  (void)bpp;
+}
+
+
+//
+// 'fuzz_block()' - Check adaptive blocks of many rows.
+//
+// Rows and runs of empty rows are appended to a block, which is sent
+// and started again when the next row does not fit, as rastertopclx
+// does. The decoded blocks must give back all rows.
+//
+
+static int				// O - 0 on success, 1 on failure
+fuzz_block(int iterations)		// I - Number of rows
+{
+  raster_codec_t	enc,		// Encoder
+			dec;		// Decoder
+  unsigned char		*block,		// Block of rows
+			*page,		// Rows sent
+			*decoded;	// Rows decoded
+  size_t		length = 1 + rand() % MAX_LENGTH,
+					// Bytes per row
+			used = 0;	// Bytes used in block
+  int			rows = 0,	// Rows in page
+			sent = 0,	// Rows sent before this block
+			blocks = 0,	// Number of blocks
+			empty,		// Number of empty rows
+			n,		// Decoded rows
+			ret = 1;	// Return value
+  ssize_t		bytes;		// Encoded bytes
+
+
+  if (raster_codec_init(&enc, RASTER_COMPRESS_ADAPTIVE, length, 1, 1) ||
+      raster_codec_init(&dec, RASTER_COMPRESS_ADAPTIVE, length, 1, 1))
+    return (1);
+
+  block   = malloc(RASTER_ADAPTIVE_BLOCK);
+  page    = calloc((size_t)iterations * 80 + 1, length);
+  decoded = malloc(((size_t)iterations * 80 + 1) * length);
+
+  while (rows < iterations || used)
+  {
+    empty = 0;
+    bytes = 0;
+
+    if (rows >= iterations)
+      bytes = -1;			// Send the last block
+    else if (rand() % 8 == 0)
+    {
+      empty = 1 + rand() % (rand() % 2 ? 3 : 80);
+      memset(page + rows * length, 0, (size_t)empty * length);
+      bytes = raster_encode_empty(&enc, empty, block + used,
+				  RASTER_ADAPTIVE_BLOCK - used);
+    }
+    else
+    {
+      if (rows && rand() % 4 == 0)
+	memcpy(page + rows * length, page + (rows - 1) * length, length);
+      else
+	fill_row(page + rows * length,
+		 rows ? page + (rows - 1) * length : NULL, length, 1);
+
+      bytes = raster_encode_row(&enc, 0, page + rows * length, length,
+				block + used, RASTER_ADAPTIVE_BLOCK - used);
+    }
+
+    if (bytes < 0)
+    {
+      //
+      // Decode the block and start a new one...
+      //
+
+      n = raster_decode_block(&dec, block, used, decoded + sent * length,
+			      length, iterations * 80 + 1 - sent);
+      if (n < 0 || memcmp(decoded + sent * length, page + sent * length,
+			  (size_t)n * length))
+      {
+        printf("adaptive-block: block %d of %lu bytes decoded wrong (%d rows)\n",
+	       blocks, (unsigned long)used, n);
+	goto done;
+      }
+
+      sent += n;
+      used = 0;
+      blocks ++;
+      raster_codec_reset(&enc);
+      raster_codec_reset(&dec);
+      continue;
+    }
+
+    used += (size_t)bytes;
+    rows += empty ? empty : 1;
+  }
+
+  if (sent != rows)
+  {
+    printf("adaptive-block: decoded %d rows of %d\n", sent, rows);
+    goto done;
+  }
+
+  ret = 0;
+
+  done:
+
+  free(block);
+  free(page);
+  free(decoded);
+  raster_codec_free(&enc);
+  raster_codec_free(&dec);
+
+  return (ret);
+}
+
+
+//
+// 'fuzz_mode()' - Feed random data to the decoder of a mode.
+//
+// The decoder must reject or decode it without reading or writing out of
+// bounds (which the sanitizers catch).
+//
+
+static int				// O - 0 on success, 1 on failure
+fuzz_mode(int m,			// I - Index in modes[]
+	  int iterations)		// I - Number of inputs
+{
+  raster_codec_t	rc;		// Codec
+  unsigned char		in[2 * MAX_LENGTH],
+					// Random input
+			*out;		// Decoded row (exact size)
+  size_t		inlen,		// Input length
+			length,		// Row length
+			j;		// Looping var
+  ssize_t		bytes;		// Decoded bytes
+  int			i;		// Looping var
+
+
+  if (raster_codec_init(&rc, modes[m].mode, MAX_LENGTH, 2, modes[m].bpp))
+    return (1);
+
+  for (i = 0; i < iterations; i ++)
+  {
+    length = 1 + rand() % (rand() % 2 ? 16 : MAX_LENGTH);
+    inlen  = rand() % sizeof(in);
+    for (j = 0; j < inlen; j ++)
+      in[j] = (rand() % 4) ? rand() & 255 : (unsigned char)(rand() % 2 ? 255 : 0);
+
+    out   = malloc(length);
+    bytes = raster_decode_row(&rc, i & 1, in, inlen, out, length);
+    free(out);
+
+    if (bytes > (ssize_t)length)
+    {
+      printf("%s: decoder returned %ld bytes for a %lu byte row\n",
+	     modes[m].name, (long)bytes, (unsigned long)length);
+      raster_codec_free(&rc);
+      return (1);
+    }
+  }
+
+  raster_codec_free(&rc);
+  return (0);
+}
+
+
+//
+// 'test_mode()' - Check round trips and bounds of a mode.
+//
+// Each row is first encoded into a random, possibly too small buffer,
+// which must either work or fail without touching the byte after the
+// buffer and without changing the seed row. Then the row is encoded,
+// checked against raster_compress_bound(), and decoded again.
+//
+
+static int				// O - 0 on success, 1 on failure
+test_mode(int m,			// I - Index in modes[]
+	  int iterations)		// I - Number of rows
+{
+  raster_codec_t	enc,		// Encoder
+			dec;		// Decoder
+  unsigned char		rows[2][MAX_LENGTH],
+					// Current and previous row
+			*row, *prev,	// Current and previous row
+			*out,		// Encoded row
+			*decoded,	// Decoded row
+			*seedcopy;	// Copy of encoder seed rows
+  size_t		length = 1 + rand() % MAX_LENGTH,
+					// Bytes per row
+			bound,		// Worst case size
+			small,		// Size of small buffer
+			i;		// Looping var
+  ssize_t		bytes,		// Encoded bytes
+			dbytes;		// Decoded bytes
+  int			planes = 4,	// Number of planes
+			plane,		// Current plane
+			iter,		// Iteration
+			bpp = modes[m].bpp,
+			ret = 1;	// Return value
+
+
+  if (bpp == 3)
+    length = length / 3 * 3 + 3;
+
+  if (raster_codec_init(&enc, modes[m].mode, MAX_LENGTH + 3, planes, bpp) ||
+      raster_codec_init(&dec, modes[m].mode, MAX_LENGTH + 3, planes, bpp))
+    return (1);
+
+  bound    = raster_compress_bound(modes[m].mode, MAX_LENGTH + 3, bpp);
+  out      = malloc(bound + 1);
+  decoded  = malloc(MAX_LENGTH + 3);
+  seedcopy = enc.seed ? malloc((size_t)enc.planes * enc.length) : NULL;
+  prev     = NULL;
+
+  for (iter = 0; iter < iterations; iter ++)
+  {
+    row   = rows[iter & 1];
+    plane = enc.planes > 1 ? rand() % enc.planes : 0;
+
+    // Sometimes a new row length, sometimes a Y offset
+    if (rand() % 50 == 0)
+    {
+      length = 1 + rand() % MAX_LENGTH;
+      if (bpp == 3)
+        length = length / 3 * 3 + 3;
+      prev = NULL;
+      raster_codec_reset(&enc);
+      raster_codec_reset(&dec);
+    }
+    else if (rand() % 20 == 0)
+    {
+      raster_codec_reset(&enc);
+      raster_codec_reset(&dec);
+    }
+
+    fill_row(row, prev, length, bpp);
+    bound = raster_compress_bound(modes[m].mode, length, bpp);
+
+    // Too small (or just big enough) buffer
+    small = rand() % (bound + 1);
+    if (seedcopy)
+      memcpy(seedcopy, enc.seed, (size_t)enc.planes * enc.length);
+    out[small] = CANARY;
+
+    if ((bytes = raster_encode_row(&enc, plane, row, length, out,
+				   small)) < 0)
+    {
+      if (out[small] != CANARY)
+      {
+	printf("%s: wrote past a %lu byte buffer\n", modes[m].name,
+	       (unsigned long)small);
+	goto done;
+      }
+
+      if (seedcopy &&
+	  memcmp(seedcopy, enc.seed, (size_t)enc.planes * enc.length))
+      {
+	printf("%s: seed changed by failed encode\n", modes[m].name);
+	goto done;
+      }
+
+      out[bound] = CANARY;
+      bytes      = raster_encode_row(&enc, plane, row, length, out, bound);
+      if (bytes < 0 || out[bound] != CANARY)
+      {
+	printf("%s: encoding into %lu bytes failed\n", modes[m].name,
+	       (unsigned long)bound);
+	goto done;
+      }
+    }
+
+    if ((size_t)bytes > bound)
+    {
+      printf("%s: %ld bytes over bound of %lu\n", modes[m].name,
+	     (long)bytes, (unsigned long)bound);
+      goto done;
+    }
+
+    // Round trip
+    dbytes = raster_decode_row(&dec, plane, out, (size_t)bytes, decoded,
+			       length);
+    if (dbytes != (ssize_t)length)
+    {
+      printf("%s: decoded %ld bytes of %lu\n", modes[m].name, (long)dbytes,
+	     (unsigned long)length);
+      goto done;
+    }
+
+    for (i = 0; i < length; i ++)
+    {
+      // The lowest bit of blue is not transferred in near lossless mode
+      unsigned char expected = row[i];
+      if (modes[m].mode == RASTER_COMPRESS_NEAR_LOSSLESS && bpp == 3 &&
+	  i % 3 == 2)
+	expected &= 0xfe;
+
+      if (decoded[i] != expected)
+      {
+	printf("%s: row %d byte %lu is 0x%02x, expected 0x%02x\n",
+	       modes[m].name, iter, (unsigned long)i, decoded[i], expected);
+	goto done;
+      }
+    }
+
+    prev = row;
+  }
+
+  ret = 0;
+
+  done:
+
+  free(out);
+  free(decoded);
+  free(seedcopy);
+  raster_codec_free(&enc);
+  raster_codec_free(&dec);
+
+  return (ret);
+}
+
+
+//
+// 'usage()' - Show program usage.
+//
+
+static void
+usage(void)
+{
+  puts("Usage: test-raster-compress [-n iterations] [-s seed]");
+  puts("       test-raster-compress bench [-n rows]");
+  exit(1);
+}
@@ -0,0 +1,354 @@
+//
+// Tests and microbenchmark for the horizontal dot packing of the ESC/P
+// driver of cups-filters.
+//
+// Copyright © 2024 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Contents:
+//
+//   main()        - Run the tests or the benchmark.
+//   bench_pack()  - Measure the speed of a pack function.
+//   fill_line()   - Fill a line with random, dither-like pixels.
+//   library()     - Pack a line with the library routines.
+//   test_pack()   - Compare a pack function with the library routines.
+//   trim()        - Get the extent of the non-zero bytes.
+//   usage()       - Show program usage.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "raster-pack.h"
+#include <cupsfilters/driver.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+//
+// Constants...
+//
+
+#define MAX_STEP	8		// Largest step to test
+#define MAX_WIDTH	1000		// Maximum pixels per pass
+#define CANARY		0xa5		// Initial output bytes
+
+
+//
+// Local functions...
+//
+
+static void	bench_pack(int bits, int step, int rows);
+static void	fill_line(unsigned char *line, int length, int bits);
+static void	library(int bits, const unsigned char *ipixels,
+			unsigned char *obytes, int width,
+			unsigned char clearto, int step);
+static int	test_pack(int bits, int step, int iterations);
+static void	trim(const unsigned char *bytes, int length, int *left,
+		     int *right);
+static void	usage(void);
+
+
+//
+// 'main()' - Run the tests or the benchmark.
+//
+// Usage:
+//
+//    test-raster-pack [-n iterations] [-s seed]
+//    test-raster-pack bench [-n rows]
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line arguments
+     char *argv[])			// I - Command-line arguments
+{
+  int		i,			// Looping var
+		bits,			// Bits per pixel
+		step;			// Step between pixels
+  int		bench = 0,		// Run the benchmark?
+		iterations = 2000,	// Iterations/rows
+		errors = 0;		// Number of failed functions
+  unsigned	seed = 1;		// Random seed
+
+
+  for (i = 1; i < argc; i ++)
+  {
+    if (!strcmp(argv[i], "bench"))
+      bench = 1;
+    else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+      iterations = atoi(argv[++ i]);
+    else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+      seed = (unsigned)strtoul(argv[++ i], NULL, 10);
+    else
+      usage();
+  }
+
+  srand(seed);
+
+  if (bench)
+  {
+    puts("function,bits,step,rows,pixels,sec,mpixels-per-sec");
+    for (bits = 1; bits <= 2; bits ++)
+      for (step = 1; step <= MAX_STEP; step *= 2)
+        bench_pack(bits, step, iterations * 10);
+    return (0);
+  }
+
+  for (bits = 1; bits <= 2; bits ++)
+    for (step = 1; step <= MAX_STEP; step ++)
+    {
+      if (test_pack(bits, step, iterations))
+      {
+	printf("%s step %d: FAIL (seed %u)\n",
+	       raster_pack_name(raster_pack_select(bits, step)), step, seed);
+	errors ++;
+      }
+      else
+	printf("%s step %d: PASS\n",
+	       raster_pack_name(raster_pack_select(bits, step)), step);
+    }
+
+  return (errors != 0);
+}
+
+
+//
+// 'bench_pack()' - Measure the speed of a pack function.
+//
+// Packs all passes of 8" lines at 2880 DPI, as the softweave of
+// rastertoescpx does, with the selected function and the library
+// routines.  The library routines are followed by a scan of the packed
+// bytes for their extent, like the driver did with cfCheckBytes().
+//
+
+static void
+bench_pack(int bits,			// I - Bits per pixel
+	   int step,			// I - Step between pixels
+	   int rows)			// I - Number of rows
+{
+  raster_pack_func_t	func;		// Pack function
+  unsigned char		*line,		// Dithered line
+			*out;		// Packed pass
+  int			width = 8 * 2880,
+					// Pixels per line
+			subwidth = width / step,
+					// Pixels per pass
+			i,		// Looping var
+			pass,		// Pass
+			which,		// Selected or library function
+			left, right;	// Extent of the non-zero bytes
+  struct timespec	start, end;	// Time
+  double		secs;		// Elapsed time
+
+
+  line = malloc(width);
+  out  = malloc((subwidth * bits + 7) / 8 + 1);
+
+  fill_line(line, width, bits);
+
+  for (which = 0; which < 2; which ++)
+  {
+    func = raster_pack_select(bits, step);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < rows; i ++)
+      for (pass = 0; pass < step; pass ++)
+      {
+	if (which)
+	{
+	  library(bits, line + pass, out, subwidth, 0, step);
+	  trim(out, (subwidth * bits + 7) / 8, &left, &right);
+	}
+	else
+	  (*func)(line + pass, out, subwidth, 0, step, &left, &right);
+      }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    secs = (end.tv_sec - start.tv_sec) + 0.000000001 * (end.tv_nsec - start.tv_nsec);
+    printf("%s,%d,%d,%d,%lu,%.4f,%.1f\n",
+	   which ? "library" : raster_pack_name(func), bits, step, rows,
+	   (unsigned long)rows * subwidth * step, secs,
+	   secs > 0.0 ? (double)rows * subwidth * step / secs / 1000000.0 :
+			0.0);
+  }
+
+  free(line);
+  free(out);
+}
+
+
+//
+// 'fill_line()' - Fill a line with random, dither-like pixels.
+//
+// Lines are blank, sparse or dense dots, or random bytes, which the
+// library routines also accept.
+//
+
+static void
+fill_line(unsigned char *line,		// O - Line
+	  int           length,		// I - Number of pixels
+	  int           bits)		// I - Bits per pixel
+{
+  int	i,				// Looping var
+	kind = rand() % 4;		// Kind of line
+
+
+  for (i = 0; i < length; i ++)
+  {
+    switch (kind)
+    {
+      case 0 :
+          line[i] = 0;
+	  break;
+      case 1 :
+          line[i] = (rand() % 8) ? 0 : rand() & ((1 << bits) - 1);
+	  break;
+      case 2 :
+          line[i] = rand() & ((1 << bits) - 1);
+	  break;
+      default :
+          line[i] = rand();
+	  break;
+    }
+  }
+}
+
+
+//
+// 'library()' - Pack a line with the library routines.
+//
+
+static void
+library(int                 bits,	// I - Bits per pixel
+	const unsigned char *ipixels,	// I - Input pixels
+	unsigned char       *obytes,	// O - Output bytes
+	int                 width,	// I - Number of pixels to pack
+	unsigned char       clearto,	// I - Initial value of the bytes
+	int                 step)	// I - Step between pixels
+{
+  if (bits == 1)
+    cfPackHorizontal(ipixels, obytes, width, clearto, step);
+  else
+    cfPackHorizontal2(ipixels, obytes, width, step);
+}
+
+
+//
+// 'test_pack()' - Compare a pack function with the library routines.
+//
+// The input line is allocated with the exact size, so that reads past
+// the last pixel show up with memory checkers, and the whole output
+// buffers, including bytes after the packed pixels, must match.  The
+// extent of the non-zero bytes must match a scan of the packed bytes.
+//
+
+static int				// O - 0 on success, 1 on failure
+test_pack(int bits,			// I - Bits per pixel
+	  int step,			// I - Step between pixels
+	  int iterations)		// I - Number of lines
+{
+  raster_pack_func_t	funcs[2];	// Pack functions
+  unsigned char		*line,		// Dithered line
+			expected[MAX_WIDTH / 4 + 16],
+					// Output of the library
+			actual[MAX_WIDTH / 4 + 16];
+					// Output of the pack function
+  unsigned char		clearto;	// Initial value of the bytes
+  int			i, j,		// Looping vars
+			width,		// Pixels per pass
+			pass,		// Pass
+			length,		// Bytes in the line
+			left, right,	// Extent from the pack function
+			eleft, eright;	// Expected extent
+
+
+  // The function for the step, and one selected for another step, which
+  // must give the same output
+  funcs[0] = raster_pack_select(bits, step);
+  funcs[1] = raster_pack_select(bits, step == 1 ? 2 : 1);
+
+  for (i = 0; i < iterations; i ++)
+  {
+    width   = i < 64 ? i : rand() % MAX_WIDTH;
+    pass    = rand() % step;
+    clearto = bits == 1 && (rand() & 1) ? 0xff : 0;
+    length  = width ? pass + (width - 1) * step + 1 : 1;
+
+    if ((line = malloc(length)) == NULL)
+      return (1);
+
+    fill_line(line, length, bits);
+
+    memset(expected, CANARY, sizeof(expected));
+    library(bits, line + pass, expected, width, clearto, step);
+    trim(expected, (width * bits + 7) / 8, &eleft, &eright);
+
+    for (j = 0; j < 2; j ++)
+    {
+      memset(actual, CANARY, sizeof(actual));
+      (*funcs[j])(line + pass, actual, width, clearto, step, &left, &right);
+
+      if (memcmp(expected, actual, sizeof(expected)))
+      {
+	printf("%s, %d-bit step %d: %d pixels at pass %d differ from the "
+	       "library\n", raster_pack_name(funcs[j]), bits, step, width,
+	       pass);
+	free(line);
+	return (1);
+      }
+
+      if (left != eleft || right != eright)
+      {
+	printf("%s, %d-bit step %d: %d pixels at pass %d have extent "
+	       "%d-%d, expected %d-%d\n", raster_pack_name(funcs[j]), bits,
+	       step, width, pass, left, right, eleft, eright);
+	free(line);
+	return (1);
+      }
+    }
+
+    free(line);
+  }
+
+  return (0);
+}
+
+
+//
+// 'trim()' - Get the extent of the non-zero bytes.
+//
+
+static void
+trim(const unsigned char *bytes,	// I - Packed bytes
+     int                 length,	// I - Number of bytes
+     int                 *left,		// O - First non-zero byte
+     int                 *right)	// O - Last non-zero byte + 1
+{
+  for (*left = 0; *left < length && !bytes[*left]; (*left) ++);
+
+  if (*left >= length)
+  {
+    *left = *right = 0;
+    return;
+  }
+
+  for (*right = length; !bytes[*right - 1]; (*right) --);
+}
+
+
+//
+// 'usage()' - Show program usage.
+//
+
+static void
+usage(void)
+{
+  puts("Usage: test-raster-pack [-n iterations] [-s seed]");
+  puts("       test-raster-pack bench [-n rows]");
+  exit(1);
+}
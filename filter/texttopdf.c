@@ -13,6 +13,7 @@
 
 #include <cupsfilters/filter.h>
 #include <ppd/ppd-filter.h>
+#include "filter-trace.h"
 #include <signal.h>
 #include <config.h>
 
@@ -84,8 +85,8 @@ main(int  argc,	   // I - Number of command-line arguments
   else
     parameters.classification = NULL;
 
-  ret = ppdFilterCUPSWrapper(argc, argv, cfFilterTextToPDF, &parameters,
-			     &JobCanceled);
+  ret = trace_cups_wrapper(argc, argv, "texttopdf", cfFilterTextToPDF,
+			   &parameters, &JobCanceled);
 
   if (ret)
     fprintf(stderr, "ERROR: texttopdf filter function failed.\n");
@@ -13,6 +13,7 @@
 
 #include <cupsfilters/filter.h>
 #include <ppd/ppd-filter.h>
+#include "filter-trace.h"
 #include <signal.h>
 
 
@@ -63,8 +64,8 @@ main(int  argc,	   // I - Number of command-line arguments
   // Fire up the cfFilterTextToText() filter function
   //
 
-  ret = ppdFilterCUPSWrapper(argc, argv, cfFilterTextToText, NULL,
-			     &JobCanceled);
+  ret = trace_cups_wrapper(argc, argv, "texttotext", cfFilterTextToText, NULL,
+			   &JobCanceled);
 
   if (ret)
     fprintf(stderr, "ERROR: texttotext filter function failed.\n");
@@ -13,6 +13,7 @@
 
 #include <cupsfilters/filter.h>
 #include <ppd/ppd-filter.h>
+#include "filter-trace.h"
 #include <config.h>
 #include <signal.h>
 
@@ -92,8 +93,8 @@ main(int  argc,				// I - Number of command-line args
   snprintf(buf, sizeof(buf), "%s/data", datadir);
   universal_parameters.bannertopdf_template_dir = buf;
 
-  ret = ppdFilterCUPSWrapper(argc, argv, ppdFilterUniversal,
-			     &universal_parameters, &JobCanceled);
+  ret = trace_cups_wrapper(argc, argv, "universal", ppdFilterUniversal,
+			   &universal_parameters, &JobCanceled);
 
   if (ret)
     fprintf(stderr, "ERROR: universal filter failed.\n");
@@ -19,21 +19,46 @@
 #include <stdio.h>
 #include <sys/stat.h>
 #include <stdlib.h>
+#include <dirent.h>
+#include <utime.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/wait.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif /* HAVE_SYS_SENDFILE_H */
 #include <cups/cups.h>
+#ifdef HAVE_CUPS_DNSSD
+#include <cups/dnssd.h>
+#endif /* HAVE_CUPS_DNSSD */
 #include <ppd/ppd.h>
 #include <cups/raster.h>
 #include <cupsfilters/ipp.h>
 #include <cupsfilters/ipp.h>
 
 #define MAX_OUTPUT_LEN 8192
+#define SERVICE_HASH_SIZE 1024	/* Buckets of the service key hash */
+
+/* IPP entry which is held back in incremental mode */
+typedef struct pending_ipp_s {
+  char		*key;		/* Service key */
+  char		*line;		/* ippfind output line, without scheme */
+} pending_ipp_t;
 
 static int              debug = 0;
+static int		incremental = -1; /* Output each printer as soon as
+					     ippfind reports it, -1 = auto */
+static int		use_cache = 1;	/* Use the PPD cache? */
+static int		use_ippfind = 0; /* Use ippfind even if we can
+					    browse DNS-SD by ourselves */
 static int		job_canceled = 0;
 static void		cancel_job(int sig);
 static cups_array_t     *uuids = NULL;
+static cups_array_t     *found_uris = NULL; /* Collect the URIs of
+					       discovered printers instead
+					       of listing them */
 
 static int
 compare_service_uri(char *a,	char *b)
@@ -41,6 +66,28 @@ compare_service_uri(char *a,	char *b)
   return (strcmp(a,b));
 }
 
+static int
+hash_service_key(const char *key, void *data)
+{
+  unsigned int hash = 2166136261U; /* FNV-1a */
+
+  (void)data;
+
+  for (; *key; key ++)
+    hash = (hash ^ (unsigned char)*key) * 16777619U;
+
+  return ((int)(hash % SERVICE_HASH_SIZE));
+}
+
+static double
+get_time(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec + ts.tv_nsec / 1000000000.0);
+}
+
 static int
 convert_to_port(char *a)
 {
@@ -125,7 +172,10 @@ listPrintersInArray(int reg_type_no, int mode, int isFax,
 		     scheme, NULL,
 		     (is_local ? "localhost" : service_hostname),
 		     port, "/%s", resource);
-    printf("%s\n", service_uri);
+    if (found_uris)
+      cupsArrayAdd(found_uris, strdup(service_uri));
+    else
+      printf("%s\n", service_uri);
   } else {
     /* DNS-SD-service-name-based URI */
     service_name = ptr;
@@ -149,10 +199,13 @@ listPrintersInArray(int reg_type_no, int mode, int isFax,
 		     scheme, NULL,
 		     service_host_name, 0, "/");
 
-    if (mode == 0)
+    if (mode == 0) {
       /* Manual call, only show URI, nothing more */
-      printf("%s\n", service_uri);
-    else {
+      if (found_uris)
+	cupsArrayAdd(found_uris, strdup(service_uri));
+      else
+	printf("%s\n", service_uri);
+    } else {
       /* Call by CUPS, either as PPD generator
 	 (/usr/lib/cups/driver/, with "list" command line argument)
 	 or as backend in discovery mode (/usr/lib/cups/backend/,
@@ -344,18 +397,419 @@ listPrintersInArray(int reg_type_no, int mode, int isFax,
 
   read_error:
     free(service_uri);
+    if (incremental)
+      fflush(stdout);
     return;
   }
 
   free(service_uri);
+  if (incremental)
+    fflush(stdout);
   return;
 }
 
+/*
+ * 'get_service_key()' - Key to identify the IPP and IPPS entries of the
+ *                       same printer in an ippfind output line (without
+ *                       scheme), the UUID if available, otherwise the
+ *                       service name and domain.
+ */
+
+static void
+get_service_key(int mode, const char *line, char *key, size_t keysize)
+{
+  const char	*field = line,
+		*end;
+  int		i;
+
+  if (mode < 0) {
+    /* Host name, resource, port: the whole line, as in the sorted mode */
+    snprintf(key, keysize, "%s", line);
+    return;
+  }
+
+  if (mode > 0) {
+    /* UUID is the 8th field: name, domain, MFG, MDL, product, ty, pdl, UUID */
+    for (i = 0; i < 7 && field; i ++)
+      if ((field = strchr(field, '\t')) != NULL)
+	field ++;
+    if (field && *field != '\t' && *field) {
+      end = strchr(field, '\t');
+      snprintf(key, keysize, "%.*s",
+	       (int)(end ? end - field : strlen(field)), field);
+      return;
+    }
+  }
+
+  /* Service name and domain */
+  if ((end = strchr(line, '\t')) != NULL)
+    end = strchr(end + 1, '\t');
+  snprintf(key, keysize, "%.*s",
+	   (int)(end ? end - line : strlen(line)), line);
+}
+
+/*
+ * 'flush_pending_ipp()' - List the held back IPP entries.
+ */
+
+static void
+flush_pending_ipp(cups_array_t *pending, int mode, int isFax)
+{
+  pending_ipp_t	*entry;
+
+  for (entry = (pending_ipp_t *)cupsArrayFirst(pending); entry;
+       entry = (pending_ipp_t *)cupsArrayNext(pending)) {
+    cupsArrayRemove(pending, entry);
+    listPrintersInArray(0, mode, isFax, entry->line);
+    free(entry->key);
+    free(entry->line);
+    free(entry);
+  }
+}
+
+/*
+ * 'list_printer_incrementally()' - Output one entry of ippfind's output
+ *                                  right away, suppressing IPP entries
+ *                                  of printers which also have IPPS.
+ *
+ * IPPS entries are listed as soon as they arrive. An IPPS entry can come
+ * at any time during the search, so IPP entries are held back until the
+ * search has finished, when they are listed if no IPPS entry of the same
+ * printer came. Once listed, an entry cannot be taken back.
+ */
+
+static void
+list_printer_incrementally(int mode, int reg_type_no, int isFax,
+			   int is_ipps, char *line, cups_array_t *ipp_seen,
+			   cups_array_t *ipps_seen, cups_array_t *pending)
+{
+  char		key[MAX_OUTPUT_LEN];
+  pending_ipp_t	*entry;
+
+  get_service_key(mode, line, key, sizeof(key));
+
+  if (is_ipps) {
+    if (cupsArrayFind(ipps_seen, key))
+      return;
+    cupsArrayAdd(ipps_seen, strdup(key));
+
+    /* IPPS wins, drop a held back IPP entry of the same printer */
+    for (entry = (pending_ipp_t *)cupsArrayFirst(pending); entry;
+	 entry = (pending_ipp_t *)cupsArrayNext(pending))
+      if (!strcmp(entry->key, key)) {
+	if (debug)
+	  fprintf(stderr, "DEBUG: Replacing IPP by IPPS entry for %s\n", key);
+	cupsArrayRemove(pending, entry);
+	free(entry->key);
+	free(entry->line);
+	free(entry);
+	break;
+      }
+
+    listPrintersInArray(2, mode, isFax, line);
+  } else {
+    if (cupsArrayFind(ipps_seen, key) || cupsArrayFind(ipp_seen, key))
+      return;
+    cupsArrayAdd(ipp_seen, strdup(key));
+
+    if (reg_type_no == 0) {
+      /* No IPPS entries to wait for */
+      listPrintersInArray(0, mode, isFax, line);
+      return;
+    }
+
+    if ((entry = (pending_ipp_t *)calloc(1, sizeof(pending_ipp_t))) == NULL)
+      return;
+    entry->key = strdup(key);
+    entry->line = strdup(line);
+    cupsArrayAdd(pending, entry);
+  }
+}
+
+#ifdef HAVE_CUPS_DNSSD
+/*
+ * In-process DNS-SD browsing
+ *
+ * Runs in the child process instead of ippfind and writes the same lines
+ * to stdout as the ippfind command line of list_printers() does, so that
+ * the output is processed the same way. Browse and resolve callbacks
+ * are called on the DNS-SD thread, they only tell the main thread via a
+ * pipe whether resolves are pending, so that it can detect when the
+ * browsing has settled (ippfind's "-T 0").
+ */
+
+#define DNSSD_QUIET_TIME 1.0	/* Stop after this many seconds without
+				   pending resolves and new services */
+#define DNSSD_MAX_TIME 10.0	/* Stop at the latest after this time */
+
+typedef struct dnssd_browse_data_s {
+  cups_dnssd_t	*dnssd;
+  int		mode,			/* Mode of list_printers() */
+		isFax,
+		pending,		/* Resolves in progress */
+		found,			/* Number of printers output */
+		event_pipe[2];		/* Tells main thread about activity */
+  cups_array_t	*services;		/* Services already being resolved */
+} dnssd_browse_data_t;
+
+typedef struct dnssd_service_s {
+  dnssd_browse_data_t *data;
+  char		*key,			/* Name, type, domain */
+		*name,			/* Service name */
+		*domain;		/* Domain */
+  int		is_ipps,		/* IPPS service? */
+		done;			/* Resolved? */
+} dnssd_service_t;
+
+static int
+compare_dnssd_services(dnssd_service_t *a, dnssd_service_t *b)
+{
+  return (strcmp(a->key, b->key));
+}
+
+/*
+ * 'dnssd_pdl_supported()' - Check a TXT "pdl" list for a MIME type, like
+ *                           ippfind's --txt-pdl.
+ */
+
+static int
+dnssd_pdl_supported(const char *pdl, const char *type)
+{
+  size_t len = strlen(type);
+
+  while (pdl && *pdl) {
+    if (!strncasecmp(pdl, type, len) && (pdl[len] == ',' || !pdl[len]))
+      return (1);
+    if ((pdl = strchr(pdl, ',')) != NULL)
+      pdl ++;
+  }
+
+  return (0);
+}
+
+/*
+ * 'dnssd_event()' - Tell the main thread whether resolves are pending.
+ */
+
+static void
+dnssd_event(dnssd_browse_data_t *data)
+{
+  char c = (data->pending ? 'b' : 'i');
+
+  if (write(data->event_pipe[1], &c, 1) < 0 && debug)
+    perror("DEBUG: Unable to signal DNS-SD event");
+}
+
+static void
+dnssd_error_cb(void *cb_data, const char *message)
+{
+  (void)cb_data;
+
+  fprintf(stderr, "ERROR: DNS-SD: %s\n", message);
+}
+
+/*
+ * 'dnssd_resolve_cb()' - Output a resolved service in ippfind's format.
+ */
+
+static void
+dnssd_resolve_cb(cups_dnssd_resolve_t *res, void *cb_data,
+		 cups_dnssd_flags_t flags, uint32_t if_index,
+		 const char *fullname, const char *host, uint16_t port,
+		 int num_txt, cups_option_t *txt)
+{
+  dnssd_service_t	*service = (dnssd_service_t *)cb_data;
+  dnssd_browse_data_t	*data = service->data;
+  const char		*pdl,
+			*rfo,
+			*val;
+  const char		*scheme = (service->is_ipps ? "ipps" : "ipp");
+
+  (void)res;
+  (void)fullname;
+
+  if (service->done)
+    return;
+  service->done = 1;
+  data->pending --;
+
+  if (flags & CUPS_DNSSD_FLAGS_ERROR) {
+    if (debug)
+      fprintf(stderr, "DEBUG: Unable to resolve %s\n", service->key);
+    dnssd_event(data);
+    return;
+  }
+
+  /* Same filter as on the ippfind command line: no remote CUPS queues,
+     fax-out if requested, and one of the driverless PDLs */
+  pdl = cupsGetOption("pdl", num_txt, txt);
+  rfo = cupsGetOption("rfo", num_txt, txt);
+  if (cupsGetOption("printer-type", num_txt, txt) ||
+      (data->isFax && !rfo) ||
+      !(dnssd_pdl_supported(pdl, "image/pwg-raster") ||
+	dnssd_pdl_supported(pdl, "application/PCLm") ||
+	dnssd_pdl_supported(pdl, "image/urf") ||
+	dnssd_pdl_supported(pdl, "application/pdf"))) {
+    dnssd_event(data);
+    return;
+  }
+
+#define TXT(key) ((val = cupsGetOption(key, num_txt, txt)) != NULL ? val : "")
+  if (data->mode < 0)
+    printf("\n%s\t%s\t%s\t%d\t%s", scheme, host,
+	   (data->isFax ? TXT("rfo") : TXT("rp")), port,
+	   (if_index == CUPS_DNSSD_IF_INDEX_LOCAL ? "L" : ""));
+  else if (data->mode > 0) {
+    printf("%s\t%s\t%s\t", scheme, service->name, service->domain);
+    printf("%s\t", TXT("usb_MFG"));
+    printf("%s\t", TXT("usb_MDL"));
+    printf("%s\t", TXT("product"));
+    printf("%s\t", TXT("ty"));
+    printf("%s\t", TXT("pdl"));
+    printf("%s\t", TXT("UUID"));
+    printf("%s\t\n", TXT("rfo"));
+  } else
+    printf("%s\t%s\t%s\t\n", scheme, service->name, service->domain);
+#undef TXT
+  fflush(stdout);
+
+  data->found ++;
+  dnssd_event(data);
+}
+
+/*
+ * 'dnssd_browse_cb()' - Start resolving a newly found service.
+ */
+
+static void
+dnssd_browse_cb(cups_dnssd_browse_t *browse, void *cb_data,
+		cups_dnssd_flags_t flags, uint32_t if_index,
+		const char *name, const char *regtype, const char *domain)
+{
+  dnssd_browse_data_t	*data = (dnssd_browse_data_t *)cb_data;
+  dnssd_service_t	key,
+			*service;
+  char			keystr[1024];
+
+  (void)browse;
+
+  if (!(flags & CUPS_DNSSD_FLAGS_ADD))
+    return;
+
+  snprintf(keystr, sizeof(keystr), "%s.%s.%s", name, regtype, domain);
+  key.key = keystr;
+  if (cupsArrayFind(data->services, &key))
+    return;
+
+  if ((service = (dnssd_service_t *)calloc(1, sizeof(dnssd_service_t))) ==
+      NULL)
+    return;
+  service->data    = data;
+  service->key     = strdup(keystr);
+  service->name    = strdup(name);
+  service->domain  = strdup(domain);
+  /* "local." -> "local", as in the URIs built from ippfind's output */
+  if (service->domain[0] &&
+      service->domain[strlen(service->domain) - 1] == '.')
+    service->domain[strlen(service->domain) - 1] = '\0';
+  service->is_ipps = !strncasecmp(regtype, "_ipps.", 6);
+  cupsArrayAdd(data->services, service);
+
+  data->pending ++;
+  if (!cupsDNSSDResolveNew(data->dnssd, if_index, name, regtype, domain,
+			   dnssd_resolve_cb, service)) {
+    service->done = 1;
+    data->pending --;
+  }
+  dnssd_event(data);
+}
+
+/*
+ * 'browse_printers_dnssd()' - Browse for driverless printers with the
+ *                             CUPS DNS-SD API. Returns -1 if DNS-SD is
+ *                             not available, otherwise ippfind's exit
+ *                             status (0 = found, 1 = nothing found).
+ */
+
+static int
+browse_printers_dnssd(int mode, int reg_type_no, int isFax)
+{
+  dnssd_browse_data_t	data;
+  dnssd_service_t	*service;
+  struct pollfd		pfd;
+  char			events[256];
+  double		start,
+			quiet_since;
+  int			bytes,
+			idle = 1;
+
+  memset(&data, 0, sizeof(data));
+  data.mode  = mode;
+  data.isFax = isFax;
+  if (pipe(data.event_pipe))
+    return (-1);
+  if ((data.dnssd = cupsDNSSDNew(dnssd_error_cb, NULL)) == NULL) {
+    close(data.event_pipe[0]);
+    close(data.event_pipe[1]);
+    return (-1);
+  }
+  data.services = cupsArrayNew((cups_array_func_t)compare_dnssd_services,
+			       NULL);
+
+  if ((reg_type_no >= 1 &&
+       !cupsDNSSDBrowseNew(data.dnssd, CUPS_DNSSD_IF_INDEX_ANY, "_ipps._tcp",
+			   NULL, dnssd_browse_cb, &data)) ||
+      (reg_type_no <= 1 &&
+       !cupsDNSSDBrowseNew(data.dnssd, CUPS_DNSSD_IF_INDEX_ANY, "_ipp._tcp",
+			   NULL, dnssd_browse_cb, &data))) {
+    cupsDNSSDDelete(data.dnssd);
+    cupsArrayDelete(data.services);
+    close(data.event_pipe[0]);
+    close(data.event_pipe[1]);
+    return (-1);
+  }
+
+  /* Wait until there were no new services and no pending resolves for
+     DNSSD_QUIET_TIME */
+  start = quiet_since = get_time();
+  pfd.fd = data.event_pipe[0];
+  pfd.events = POLLIN;
+  while (!job_canceled && get_time() - start < DNSSD_MAX_TIME &&
+	 (!idle || get_time() - quiet_since < DNSSD_QUIET_TIME)) {
+    if (poll(&pfd, 1, 100) > 0 &&
+	(bytes = read(data.event_pipe[0], events, sizeof(events))) > 0) {
+      idle = (events[bytes - 1] == 'i');
+      quiet_since = get_time();
+    }
+  }
+
+  cupsDNSSDDelete(data.dnssd);
+  fflush(stdout);
+  if (debug)
+    fprintf(stderr, "DEBUG: DNS-SD: %d services, %d printers listed\n",
+	    cupsArrayCount(data.services), data.found);
+
+  for (service = (dnssd_service_t *)cupsArrayFirst(data.services); service;
+       service = (dnssd_service_t *)cupsArrayNext(data.services)) {
+    free(service->key);
+    free(service->name);
+    free(service->domain);
+    free(service);
+  }
+  cupsArrayDelete(data.services);
+  close(data.event_pipe[0]);
+  close(data.event_pipe[1]);
+
+  return (data.found ? 0 : 1);
+}
+#endif /* HAVE_CUPS_DNSSD */
+
 int
 list_printers (int mode, int reg_type_no, int isFax)
 {
   int		ippfind_pid = 0,	/* Process ID of ippfind for IPP */
-                post_proc_pipe[2],	/* Pipe to post-processing for IPP */
+                post_proc_pipe[2] = { -1, -1 },
+					/* Pipe to post-processing for IPP */
 		wait_res,		/* Process ID from wait() */
 		wait_status,		/* Status from child */
   	        exit_status = 0,	/* Exit status */
@@ -365,9 +819,15 @@ list_printers (int mode, int reg_type_no, int isFax)
 					   IPPS */
                 *service_uri_list_ipp;  /* Array to store ippfind output for
 					   IPP */
-  cups_file_t	*fp;
-  int		bytes;
+  cups_array_t  *ipp_seen = NULL,	/* Service keys of IPP entries */
+                *ipps_seen = NULL,	/* Service keys of IPPS entries */
+                *pending = NULL;	/* Held back IPP entries */
+  int		bytes,
+		used = 0,		/* Bytes in buffer */
+		is_ipps;
   char		*ptr,
+		*line,
+		*eol,
 		buffer[MAX_OUTPUT_LEN],	/* Copy buffer */
 		*ippfind_output;
 
@@ -378,6 +838,23 @@ list_printers (int mode, int reg_type_no, int isFax)
     cupsArrayNew3((cups_array_func_t)compare_service_uri, NULL, NULL, 0, NULL,
 		  (cups_afree_func_t)free);
 
+  if (incremental < 0)
+    /* By default only CUPS gets the printers while they are found, the
+       manual call lists them sorted */
+    incremental = (mode > 0);
+
+  if (incremental) {
+    ipp_seen =
+      cupsArrayNew3((cups_array_func_t)compare_service_uri, NULL,
+		    (cups_ahash_func_t)hash_service_key, SERVICE_HASH_SIZE,
+		    NULL, (cups_afree_func_t)free);
+    ipps_seen =
+      cupsArrayNew3((cups_array_func_t)compare_service_uri, NULL,
+		    (cups_ahash_func_t)hash_service_key, SERVICE_HASH_SIZE,
+		    NULL, (cups_afree_func_t)free);
+    pending = cupsArrayNew(NULL, NULL);
+  }
+
  /*
   * Use CUPS' ippfind utility to discover all printers designed for
   * driverless use (IPP Everywhere or Apple Raster), and only IPP
@@ -468,6 +945,17 @@ list_printers (int mode, int reg_type_no, int isFax)
     close(post_proc_pipe[0]);
     close(post_proc_pipe[1]);
 
+#ifdef HAVE_CUPS_DNSSD
+    /* Browse by ourselves, fall back to ippfind if DNS-SD is not
+       available */
+    if (!use_ippfind && (i = browse_printers_dnssd(mode, reg_type_no,
+						   isFax)) >= 0)
+      exit(i);
+    if (debug)
+      fprintf(stderr, "DEBUG: DNS-SD not available, using %s\n",
+	      CUPS_IPPFIND);
+#endif /* HAVE_CUPS_DNSSD */
+
     execvp(CUPS_IPPFIND, ippfind_argv);
     perror("ERROR: Unable to execute ippfind utility");
 
@@ -487,47 +975,69 @@ list_printers (int mode, int reg_type_no, int isFax)
 	    ippfind_pid);
 
   close(post_proc_pipe[1]);
+  post_proc_pipe[1] = -1;
 
  /*
-  * Reading the ippfind output into CUPS Arrays
+  * Reading the ippfind output, either into CUPS Arrays or listing each
+  * printer immediately (incremental mode)
   */
-  fp = cupsFileOpenFd(post_proc_pipe[0], "r");
-  if (fp) {
-    while ((bytes = cupsFileGetLine(fp, buffer, sizeof(buffer))) > 0 ||
-	   (bytes < 0 && (errno == EAGAIN || errno == EINTR))) {
-      ptr = buffer;
-      while (ptr && !isalnum(*ptr & 255)) ptr ++;
-      if ((!strncasecmp(ptr, "ipps", 4) && ptr[4] == '\t')) {
-	ptr += 4;
-	*ptr = '\0';
-	ptr ++;
-	ippfind_output = (char *)malloc(MAX_OUTPUT_LEN*(sizeof(char)));
-	snprintf(ippfind_output, MAX_OUTPUT_LEN, "%s", ptr);
-	cupsArrayAdd(service_uri_list_ipps, ippfind_output);
-      } else if ((!strncasecmp(ptr, "ipp", 3) && ptr[3] == '\t')) {
-	ptr += 3;
-	*ptr = '\0';
-	ptr ++;
-	ippfind_output = (char *)malloc(MAX_OUTPUT_LEN*(sizeof(char)));
-	snprintf(ippfind_output, MAX_OUTPUT_LEN, "%s", ptr);
-	cupsArrayAdd(service_uri_list_ipp, ippfind_output);
-      } else
+
+  for (;;) {
+    if ((bytes = read(post_proc_pipe[0], buffer + used,
+		      sizeof(buffer) - 1 - used)) < 0) {
+      if (errno == EINTR || errno == EAGAIN)
 	continue;
-    }
-    if (bytes < 0) {
       /* Read error - bail if we don't see EAGAIN or EINTR... */
-      if (errno != EAGAIN && errno != EINTR)
-      {
-	perror("ERROR: Unable to read ippfind output");
-	exit_status = 1;
-	goto error;
+      perror("ERROR: Unable to read ippfind output");
+      exit_status = 1;
+      goto error;
+    }
+    used += bytes;
+    buffer[used] = '\0';
+
+    /* Process complete lines, at the end of the output also the last one.
+       A partial line is kept for the next read, only a line filling the
+       whole buffer is processed truncated */
+    for (line = buffer;
+	 (eol = strchr(line, '\n')) != NULL ||
+	   ((bytes == 0 ||
+	     (line == buffer && used == sizeof(buffer) - 1)) && *line);
+	 line = eol ? eol + 1 : buffer + used) {
+      if (eol)
+	*eol = '\0';
+      ptr = line;
+      while (*ptr && !isalnum(*ptr & 255)) ptr ++;
+      if ((!strncasecmp(ptr, "ipps", 4) && ptr[4] == '\t'))
+	is_ipps = 1;
+      else if ((!strncasecmp(ptr, "ipp", 3) && ptr[3] == '\t'))
+	is_ipps = 0;
+      else
+	continue;
+      ptr += (is_ipps ? 4 : 3);
+      *ptr = '\0';
+      ptr ++;
+      if (incremental)
+	list_printer_incrementally(mode, reg_type_no, isFax, is_ipps, ptr,
+				   ipp_seen, ipps_seen, pending);
+      else {
+	ippfind_output = (char *)malloc(MAX_OUTPUT_LEN*(sizeof(char)));
+	snprintf(ippfind_output, MAX_OUTPUT_LEN, "%s", ptr);
+	cupsArrayAdd((is_ipps ? service_uri_list_ipps : service_uri_list_ipp),
+		     ippfind_output);
       }
     }
-  } else {
-    perror("ERROR: Unable to open ippfind output data stream");
-    exit_status = 1;
-    goto error;
+    used -= (int)(line - buffer);
+    memmove(buffer, line, used + 1);
+
+    if (bytes == 0)
+      break;
   }
+  close(post_proc_pipe[0]);
+  post_proc_pipe[0] = -1;
+
+  /* The search has finished, no IPPS entry can come any more */
+  if (incremental)
+    flush_pending_ipp(pending, mode, isFax);
 
   for (int j = 0; j < cupsArrayCount(service_uri_list_ipp); j ++)
   {
@@ -583,18 +1093,576 @@ list_printers (int mode, int reg_type_no, int isFax)
   */
 
  error:
+  if (post_proc_pipe[0] >= 0)
+    close(post_proc_pipe[0]);
+  if (post_proc_pipe[1] >= 0)
+    close(post_proc_pipe[1]);
   cupsArrayDelete(service_uri_list_ipps);
   cupsArrayDelete(service_uri_list_ipp);
+  if (pending)
+    flush_pending_ipp(pending, mode, isFax);
+  cupsArrayDelete(pending);
+  cupsArrayDelete(ipp_seen);
+  cupsArrayDelete(ipps_seen);
   return (exit_status);
 }
 
+/*
+ * PPD cache
+ *
+ * Generated PPDs are kept in "<cache dir>/<hash of the IPP response>.ppd",
+ * so printers with identical capabilities share one PPD. For each driver
+ * URI an index file "<hash of the URI>.idx" records the printer's UUID,
+ * config change date, boot time and config/state change times of the
+ * time the PPD was made and which PPD belongs to it. If a cheap IPP
+ * request for only these attributes returns the same values, the PPD is
+ * taken from the cache without polling the full capabilities. The change
+ * times count from the printer's boot, so they are only compared when
+ * the printer has not been rebooted since.
+ *
+ * Every use of a cache file updates its modification time. Once a day
+ * the files which were not used for PPD_CACHE_MAX_AGE get removed, so
+ * that printers which went away do not fill the cache forever.
+ */
+
+/* Attributes which do not describe capabilities and do not go into the
+   PPD, skipped when hashing the IPP response */
+static const char * const ppd_cache_volatile_attrs[] = {
+  "printer-alert",
+  "printer-alert-description",
+  "printer-config-change-date-time",
+  "printer-config-change-time",
+  "printer-current-time",
+  "printer-dns-sd-name",
+  "printer-geo-location",
+  "printer-info",
+  "printer-is-accepting-jobs",
+  "printer-location",
+  "printer-name",
+  "printer-organization",
+  "printer-organizational-unit",
+  "printer-state",
+  "printer-state-change-date-time",
+  "printer-state-change-time",
+  "printer-state-message",
+  "printer-state-reasons",
+  "printer-supply",
+  "printer-supply-description",
+  "printer-up-time",
+  "printer-uri-supported",
+  "printer-uuid",
+  "queued-job-count",
+  NULL
+};
+
+/* Attributes which differ between printers of the same model, skipped
+   when hashing and removed from the IPP response before a PPD gets
+   generated from it, so that the PPD can be shared */
+static const char * const ppd_cache_device_attrs[] = {
+  "printer-icons",
+  "printer-more-info",
+  "printer-supply-info-uri",
+  NULL
+};
+
+/* Allowed difference of the boot time computed from printer-up-time */
+#define PPD_CACHE_BOOT_SLACK 60
+
+/* Cache files not used for this many seconds get removed */
+#define PPD_CACHE_MAX_AGE (30 * 86400)
+
+/* Seconds between two runs of ppd_cache_prune() */
+#define PPD_CACHE_PRUNE_INTERVAL 86400
+
+/* Attributes for the cheap revalidation request */
+static const char * const ppd_cache_pattrs[] = {
+  "printer-uuid",
+  "printer-config-change-date-time",
+  "printer-config-change-time",
+  "printer-state-change-time",
+  "printer-up-time"
+};
+
+/* What an index file records about a printer */
+typedef struct ppd_cache_entry_s {
+  char		uuid[256];		/* printer-uuid */
+  long		config_change_date,	/* printer-config-change-date-time */
+		boot_time;		/* Now - printer-up-time */
+  int		config_change_time,	/* printer-config-change-time */
+		state_change_time;	/* printer-state-change-time */
+  char		ppd_hash[65];		/* Hash of the IPP response */
+} ppd_cache_entry_t;
+
+/*
+ * 'ppd_cache_prune()' - Remove the cache files which were not used for
+ *                       PPD_CACHE_MAX_AGE, at most once a day.
+ */
+
+static void
+ppd_cache_prune(const char *cachedir)
+{
+  char		filename[1024];
+  const char	*ext;
+  DIR		*dir;
+  struct dirent	*dent;
+  struct stat	st;
+  time_t	now = time(NULL),
+		max_age;
+  int		fd,
+		removed = 0;
+
+  /* The modification time of ".pruned" tells when we did it last */
+  snprintf(filename, sizeof(filename), "%s/.pruned", cachedir);
+  if (!stat(filename, &st) && now - st.st_mtime < PPD_CACHE_PRUNE_INTERVAL)
+    return;
+  if ((fd = open(filename, O_WRONLY | O_CREAT, 0640)) < 0)
+    return;
+  close(fd);
+  utime(filename, NULL);
+
+  if ((dir = opendir(cachedir)) == NULL)
+    return;
+
+  while ((dent = readdir(dir)) != NULL) {
+    /* Index files and PPDs, and temporary files left over by a crash */
+    ext = strrchr(dent->d_name, '.');
+    if (!strncmp(dent->d_name, ".tmp-", 5))
+      max_age = PPD_CACHE_PRUNE_INTERVAL;
+    else if (ext && (!strcmp(ext, ".idx") || !strcmp(ext, ".ppd")))
+      max_age = PPD_CACHE_MAX_AGE;
+    else
+      continue;
+
+    snprintf(filename, sizeof(filename), "%s/%s", cachedir, dent->d_name);
+    if (!stat(filename, &st) && S_ISREG(st.st_mode) &&
+	now - st.st_mtime > max_age && !unlink(filename))
+      removed ++;
+  }
+
+  closedir(dir);
+
+  if (debug)
+    fprintf(stderr, "DEBUG: Removed %d unused files from PPD cache %s\n",
+	    removed, cachedir);
+}
+
+/*
+ * 'ppd_cache_dir()' - Find (and create) the cache directory, NULL if
+ *                     caching is not possible.
+ */
+
+static const char *
+ppd_cache_dir(void)
+{
+  static char	cachedir[1024];
+  static int	pruned = 0;
+  const char	*val;
+
+  if ((val = getenv("DRIVERLESS_CACHE_DIR")) != NULL) {
+    if (!val[0])
+      return (NULL);
+    snprintf(cachedir, sizeof(cachedir), "%s", val);
+  } else if ((val = getenv("CUPS_CACHEDIR")) != NULL)
+    /* Called by CUPS */
+    snprintf(cachedir, sizeof(cachedir), "%s/driverless", val);
+  else if ((val = getenv("XDG_CACHE_HOME")) != NULL)
+    snprintf(cachedir, sizeof(cachedir), "%s/driverless", val);
+  else if ((val = getenv("HOME")) != NULL)
+    snprintf(cachedir, sizeof(cachedir), "%s/.cache/driverless", val);
+  else
+    return (NULL);
+
+  if (mkdir(cachedir, 0750) && errno != EEXIST) {
+    if (debug)
+      fprintf(stderr, "DEBUG: Cannot create PPD cache directory %s: %s\n",
+	      cachedir, strerror(errno));
+    return (NULL);
+  }
+
+  if (!pruned) {
+    ppd_cache_prune(cachedir);
+    pruned = 1;
+  }
+
+  return (cachedir);
+}
+
+/*
+ * 'ppd_cache_index_name()' - Name of the index file for a driver URI.
+ */
+
+static void
+ppd_cache_index_name(const char *cachedir, const char *uri, int isFax,
+		     char *filename, size_t filenamesize)
+{
+  char		key[2048];
+  unsigned char	hash[32];
+  char		hashstr[65];
+
+  snprintf(key, sizeof(key), "%s\n%d", uri, isFax);
+  cupsHashData("sha2-256", key, strlen(key), hash, sizeof(hash));
+  snprintf(filename, filenamesize, "%s/%s.idx", cachedir,
+	   cupsHashString(hash, sizeof(hash), hashstr, sizeof(hashstr)));
+}
+
+/*
+ * 'ppd_cache_get_entry()' - Fill an index entry from an IPP response.
+ */
+
+static void
+ppd_cache_get_entry(ipp_t *response, ppd_cache_entry_t *entry)
+{
+  ipp_attribute_t *attr;
+
+  memset(entry, 0, sizeof(ppd_cache_entry_t));
+  if ((attr = ippFindAttribute(response, "printer-uuid", IPP_TAG_URI)) !=
+      NULL)
+    snprintf(entry->uuid, sizeof(entry->uuid), "%s",
+	     ippGetString(attr, 0, NULL));
+  if ((attr = ippFindAttribute(response, "printer-config-change-time",
+			       IPP_TAG_INTEGER)) != NULL)
+    entry->config_change_time = ippGetInteger(attr, 0);
+  if ((attr = ippFindAttribute(response, "printer-state-change-time",
+			       IPP_TAG_INTEGER)) != NULL)
+    entry->state_change_time = ippGetInteger(attr, 0);
+  if ((attr = ippFindAttribute(response, "printer-config-change-date-time",
+			       IPP_TAG_DATE)) != NULL)
+    entry->config_change_date = (long)ippDateToTime(ippGetDate(attr, 0));
+  if ((attr = ippFindAttribute(response, "printer-up-time",
+			       IPP_TAG_INTEGER)) != NULL)
+    entry->boot_time = (long)time(NULL) - ippGetInteger(attr, 0);
+}
+
+/*
+ * 'ppd_cache_strip_response()' - Remove the per-device attributes from an
+ *                                IPP response.
+ */
+
+static void
+ppd_cache_strip_response(ipp_t *response)
+{
+  ipp_attribute_t *attr;
+  int		i;
+
+  for (i = 0; ppd_cache_device_attrs[i]; i ++)
+    if ((attr = ippFindAttribute(response, ppd_cache_device_attrs[i],
+				 IPP_TAG_ZERO)) != NULL)
+      ippDeleteAttribute(response, attr);
+}
+
+/*
+ * 'ppd_cache_hash_response()' - Hash the capability attributes of an IPP
+ *                               response.
+ */
+
+static int
+ppd_cache_hash_response(ipp_t *response, char *hashstr, size_t hashsize)
+{
+  ipp_attribute_t *attr;
+  const char	*name;
+  char		*data = NULL,		/* Attributes as text */
+		*newdata;
+  size_t	datalen = 0,
+		datasize = 0,
+		len;
+  unsigned char	hash[32];
+  int		i;
+
+  for (attr = ippFirstAttribute(response); attr;
+       attr = ippNextAttribute(response)) {
+    if ((name = ippGetName(attr)) == NULL)
+      continue;
+    for (i = 0; ppd_cache_volatile_attrs[i]; i ++)
+      if (!strcmp(name, ppd_cache_volatile_attrs[i]))
+	break;
+    if (ppd_cache_volatile_attrs[i] || !strncmp(name, "marker-", 7))
+      continue;
+    for (i = 0; ppd_cache_device_attrs[i]; i ++)
+      if (!strcmp(name, ppd_cache_device_attrs[i]))
+	break;
+    if (ppd_cache_device_attrs[i])
+      continue;
+
+    len = strlen(name) + ippAttributeString(attr, NULL, 0) + 3;
+    if (datalen + len > datasize) {
+      datasize = 2 * (datalen + len);
+      if ((newdata = realloc(data, datasize)) == NULL) {
+	free(data);
+	return (0);
+      }
+      data = newdata;
+    }
+    datalen += (size_t)snprintf(data + datalen, datasize - datalen, "%s=",
+				name);
+    datalen += ippAttributeString(attr, data + datalen, datasize - datalen);
+    data[datalen ++] = '\n';
+  }
+
+  if (!data)
+    return (0);
+
+  cupsHashData("sha2-256", data, datalen, hash, sizeof(hash));
+  cupsHashString(hash, sizeof(hash), hashstr, hashsize);
+  free(data);
+
+  return (1);
+}
+
+/*
+ * 'ppd_cache_read_index()' - Read the index entry for a driver URI.
+ */
+
+static int
+ppd_cache_read_index(const char *filename, ppd_cache_entry_t *entry)
+{
+  FILE	*fp;
+  char	line[1024],
+	*value;
+
+  memset(entry, 0, sizeof(ppd_cache_entry_t));
+  if ((fp = fopen(filename, "r")) == NULL)
+    return (0);
+
+  while (fgets(line, sizeof(line), fp)) {
+    line[strcspn(line, "\n")] = '\0';
+    if ((value = strchr(line, ' ')) == NULL)
+      continue;
+    *value++ = '\0';
+    if (!strcmp(line, "uuid"))
+      snprintf(entry->uuid, sizeof(entry->uuid), "%s", value);
+    else if (!strcmp(line, "config-change-time"))
+      entry->config_change_time = atoi(value);
+    else if (!strcmp(line, "state-change-time"))
+      entry->state_change_time = atoi(value);
+    else if (!strcmp(line, "config-change-date"))
+      entry->config_change_date = atol(value);
+    else if (!strcmp(line, "boot-time"))
+      entry->boot_time = atol(value);
+    else if (!strcmp(line, "ppd"))
+      snprintf(entry->ppd_hash, sizeof(entry->ppd_hash), "%s", value);
+  }
+  fclose(fp);
+
+  return (entry->ppd_hash[0] != '\0');
+}
+
+/*
+ * 'ppd_cache_write_file()' - Atomically write a cache file, either from
+ *                            a string or by copying another file.
+ */
+
+static int
+ppd_cache_write_file(const char *cachedir, const char *filename,
+		     const char *data, const char *srcname)
+{
+  char	tmpname[1024],
+	buffer[65536];
+  int	fd,
+	srcfd = -1,
+	ok = 1;
+  ssize_t bytes;
+
+  snprintf(tmpname, sizeof(tmpname), "%s/.tmp-XXXXXX", cachedir);
+  if ((fd = mkstemp(tmpname)) < 0)
+    return (0);
+  fchmod(fd, 0640);
+
+  if (data)
+    ok = (write(fd, data, strlen(data)) == (ssize_t)strlen(data));
+  else if ((srcfd = open(srcname, O_RDONLY)) >= 0) {
+    while ((bytes = read(srcfd, buffer, sizeof(buffer))) > 0)
+      if (write(fd, buffer, (size_t)bytes) != bytes) {
+	ok = 0;
+	break;
+      }
+    if (bytes < 0)
+      ok = 0;
+    close(srcfd);
+  } else
+    ok = 0;
+
+  if (close(fd))
+    ok = 0;
+  if (!ok || rename(tmpname, filename)) {
+    unlink(tmpname);
+    return (0);
+  }
+
+  return (1);
+}
+
+/*
+ * 'ppd_cache_lookup()' - Check with a cheap IPP request whether the
+ *                        cached PPD for the driver URI is still valid.
+ */
+
+static int
+ppd_cache_lookup(const char *cachedir, const char *uri, int isFax,
+		 char *ppdname, size_t ppdnamesize)
+{
+  char			indexname[1024];
+  ppd_cache_entry_t	cached,
+			current;
+  ipp_t			*response;
+  struct stat		st;
+
+  ppd_cache_index_name(cachedir, uri, isFax, indexname, sizeof(indexname));
+  if (!ppd_cache_read_index(indexname, &cached))
+    return (0);
+  snprintf(ppdname, ppdnamesize, "%s/%s.ppd", cachedir, cached.ppd_hash);
+  if (stat(ppdname, &st))
+    return (0);
+
+  /* Without a change date or change times we cannot tell whether the
+     printer got reconfigured */
+  if (!cached.config_change_date && !cached.config_change_time &&
+      !cached.state_change_time)
+    return (0);
+
+  if ((response = cfGetPrinterAttributes4(uri, ppd_cache_pattrs,
+					  sizeof(ppd_cache_pattrs) /
+					  sizeof(ppd_cache_pattrs[0]),
+					  NULL, 0, 0, isFax)) == NULL)
+    return (0);
+  ppd_cache_get_entry(response, &current);
+  ippDelete(response);
+
+  if (strcmp(cached.uuid, current.uuid) ||
+      (cached.config_change_date && current.config_change_date ?
+       cached.config_change_date != current.config_change_date :
+       /* The change times restart with a reboot of the printer */
+       !cached.boot_time || !current.boot_time ||
+       labs(cached.boot_time - current.boot_time) > PPD_CACHE_BOOT_SLACK ||
+       (cached.config_change_time ?
+	cached.config_change_time != current.config_change_time :
+	cached.state_change_time != current.state_change_time))) {
+    if (debug)
+      fprintf(stderr, "DEBUG: Cached PPD for %s is outdated\n", uri);
+    return (0);
+  }
+
+  if (debug)
+    fprintf(stderr, "DEBUG: Using cached PPD file %s\n", ppdname);
+  utime(indexname, NULL);
+  utime(ppdname, NULL);
+  return (1);
+}
+
+/*
+ * 'ppd_cache_store()' - Record the PPD for a driver URI in the cache.
+ *                       "ppdname" is the generated PPD, which gets moved
+ *                       into the cache if it is on the same file system,
+ *                       otherwise copied. If NULL, the PPD is already in
+ *                       the cache. Returns 1 if "ppdname" got moved.
+ */
+
+static int
+ppd_cache_store(const char *cachedir, const char *uri, int isFax,
+		ipp_t *response, const char *ppd_hash, const char *ppdname)
+{
+  char			indexname[1024],
+			cachedname[1024],
+			data[1024];
+  ppd_cache_entry_t	entry;
+  int			moved = 0;
+
+  if (ppdname) {
+    snprintf(cachedname, sizeof(cachedname), "%s/%s.ppd", cachedir,
+	     ppd_hash);
+    if (!rename(ppdname, cachedname)) {
+      chmod(cachedname, 0640);
+      moved = 1;
+    } else if (!ppd_cache_write_file(cachedir, cachedname, NULL, ppdname)) {
+      if (debug)
+	fprintf(stderr, "DEBUG: Unable to write PPD cache file %s\n",
+		cachedname);
+      return (0);
+    }
+  } else {
+    /* The cached PPD is used for one more printer */
+    snprintf(cachedname, sizeof(cachedname), "%s/%s.ppd", cachedir,
+	     ppd_hash);
+    utime(cachedname, NULL);
+  }
+
+  ppd_cache_get_entry(response, &entry);
+  ppd_cache_index_name(cachedir, uri, isFax, indexname, sizeof(indexname));
+  snprintf(data, sizeof(data),
+	   "uri %s\nuuid %s\nconfig-change-date %ld\nboot-time %ld\n"
+	   "config-change-time %d\nstate-change-time %d\nppd %s\n",
+	   uri, entry.uuid, entry.config_change_date, entry.boot_time,
+	   entry.config_change_time, entry.state_change_time, ppd_hash);
+  ppd_cache_write_file(cachedir, indexname, data, NULL);
+
+  return (moved);
+}
+
+/*
+ * 'copy_ppd_to_stdout()' - Copy a PPD file to stdout, with sendfile() if
+ *                          available.
+ */
+
+static int
+copy_ppd_to_stdout(const char *ppdname)
+{
+  int		fd,
+		out = fileno(stdout);
+  char		buffer[65536];
+  ssize_t	bytes,
+		written;
+  char		*ptr;
+#ifdef HAVE_SYS_SENDFILE_H
+  struct stat	st;
+  off_t		offset = 0;
+#endif /* HAVE_SYS_SENDFILE_H */
+
+  if ((fd = open(ppdname, O_RDONLY)) < 0) {
+    fprintf(stderr, "ERROR: Unable to open PPD file %s: %s\n", ppdname,
+	    strerror(errno));
+    return (-1);
+  }
+
+  fflush(stdout);
+
+#ifdef HAVE_SYS_SENDFILE_H
+  /* Let the kernel copy the file, fall back to read()/write() for what
+     remains if sendfile() does not work for stdout */
+  if (!fstat(fd, &st)) {
+    while (offset < st.st_size &&
+	   ((bytes = sendfile(out, fd, &offset, st.st_size - offset)) > 0 ||
+	    (bytes < 0 && errno == EINTR)));
+    if (offset >= st.st_size) {
+      close(fd);
+      return (0);
+    }
+    lseek(fd, offset, SEEK_SET);
+  }
+#endif /* HAVE_SYS_SENDFILE_H */
+
+  while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
+    for (ptr = buffer; bytes > 0; ptr += written, bytes -= written)
+      if ((written = write(out, ptr, bytes)) < 0) {
+	if (errno == EINTR) {
+	  written = 0;
+	  continue;
+	}
+	close(fd);
+	return (-1);
+      }
+
+  close(fd);
+  return (bytes < 0 ? -1 : 0);
+}
+
 int
 generate_ppd (const char *uri, int isFax)
 {
   ipp_t *response = NULL;
-  char buffer[65536], ppdname[1024], ppdgenerator_msg[1024];
-  int  fd,
-       bytes;
+  char ppdname[1024], ppdgenerator_msg[1024],
+       ppd_hash[65];
+  const char *cachedir = NULL;
+  int  ret,
+       is_temp = 1;	/* ppdname is a temporary file */
   char *ptr1,
        *ptr2;
 
@@ -609,6 +1677,14 @@ generate_ppd (const char *uri, int isFax)
     isFax = 1;
   }
 
+  /* Use the cached PPD if the printer has not been reconfigured since */
+
+  if (use_cache && (cachedir = ppd_cache_dir()) != NULL &&
+      ppd_cache_lookup(cachedir, uri, isFax, ppdname, sizeof(ppdname))) {
+    is_temp = 0;
+    goto output;
+  }
+
   /* Request printer properties via IPP to generate a PPD file for the
      printer */
 
@@ -631,9 +1707,29 @@ generate_ppd (const char *uri, int isFax)
     goto fail;
   }
 
-  /* Generate the PPD file */
-  if (!ppdCreatePPDFromIPP(ppdname, sizeof(ppdname), response, NULL, NULL, 0,
-			   0, ppdgenerator_msg, sizeof(ppdgenerator_msg))) {
+  /* A printer with the same capabilities may already have a PPD in the
+     cache */
+  ppd_hash[0] = '\0';
+  if (cachedir &&
+      ppd_cache_hash_response(response, ppd_hash, sizeof(ppd_hash))) {
+    snprintf(ppdname, sizeof(ppdname), "%s/%s.ppd", cachedir, ppd_hash);
+    if (!access(ppdname, R_OK)) {
+      if (debug)
+	fprintf(stderr, "DEBUG: Using cached PPD file %s of a printer with "
+		"the same capabilities\n", ppdname);
+      ppd_cache_store(cachedir, uri, isFax, response, ppd_hash, NULL);
+      ippDelete(response);
+      is_temp = 0;
+      goto output;
+    }
+    ppd_cache_strip_response(response);
+  }
+
+  /* Generate the PPD file as a temporary file, ppd_cache_store() moves it
+     into the cache, or copies it if the cache is on another file system */
+  ret = ppdCreatePPDFromIPP(ppdname, sizeof(ppdname), response, NULL, NULL,
+			    0, 0, ppdgenerator_msg, sizeof(ppdgenerator_msg));
+  if (!ret) {
     if (strlen(ppdgenerator_msg) > 0)
       fprintf(stderr, "ERROR: Unable to create PPD file: %s\n",
 	      ppdgenerator_msg);
@@ -648,16 +1744,21 @@ generate_ppd (const char *uri, int isFax)
     fprintf(stderr, "DEBUG: Created temporary PPD file: %s\n", ppdname);
   }
 
+  if (ppd_hash[0] &&
+      ppd_cache_store(cachedir, uri, isFax, response, ppd_hash, ppdname)) {
+    snprintf(ppdname, sizeof(ppdname), "%s/%s.ppd", cachedir, ppd_hash);
+    is_temp = 0;
+  }
+
   ippDelete(response);
 
+ output:
   /* Output of PPD file to stdout */
-  fd = open(ppdname, O_RDONLY);
-  while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
-    bytes = fwrite(buffer, 1, bytes, stdout);
-  close(fd);
-  unlink(ppdname);
+  ret = copy_ppd_to_stdout(ppdname);
+  if (is_temp)
+    unlink(ppdname);
 
-  return 0;
+  return (ret ? 1 : 0);
 
  fail:
   if (response)
@@ -666,15 +1767,414 @@ generate_ppd (const char *uri, int isFax)
   return 1;
 }
 
+/*
+ * Batch mode
+ *
+ * Phase 1 polls the printers in parallel worker processes, each worker
+ * saves the IPP response in a temporary directory and reports the hash
+ * of its capabilities through a pipe. Phase 2 generates one PPD for
+ * each distinct capability set and writes it for all printers which
+ * have these capabilities.
+ */
+
+typedef struct batch_printer_s {
+  char		*uri;			/* Printer URI */
+  char		*outname;		/* Output PPD file */
+  int		isFax;			/* Fax queue? */
+  pid_t		pid;			/* Worker process, 0 if done */
+  int		fd,			/* Result pipe of the worker, -1 if
+					   closed */
+		used;			/* Bytes in result */
+  double	start,			/* When the worker was started */
+		latency;		/* Time until the result came in */
+  char		status;			/* 'C' = cached, 'R' = polled,
+					   'F' = failed, 0 = pending */
+  char		hash[65];		/* Capability hash */
+  char		filename[1024];		/* Cached PPD or IPP response */
+  char		result[2048];		/* Result line of the worker */
+} batch_printer_t;
+
+/*
+ * 'batch_fetch()' - Get the capabilities of one printer (worker process).
+ */
+
+static void
+batch_fetch(int idx, batch_printer_t *printer, const char *cachedir,
+	    const char *tmpdir, int result_fd)
+{
+  ipp_t	*response;
+  char	result[2048];
+  int	fd;
+
+  if (cachedir &&
+      ppd_cache_lookup(cachedir, printer->uri, printer->isFax,
+		       printer->filename,
+		       sizeof(printer->filename))) {
+    snprintf(result, sizeof(result), "%d C - %s\n", idx, printer->filename);
+  } else if ((response = cfGetPrinterAttributes4(printer->uri, NULL, 0, NULL,
+						 0, 0, printer->isFax)) == NULL) {
+    snprintf(result, sizeof(result), "%d F - -\n", idx);
+  } else {
+    snprintf(printer->filename, sizeof(printer->filename), "%s/%d.ipp",
+	     tmpdir, idx);
+    ippSetState(response, IPP_STATE_IDLE);
+    if (!ppd_cache_hash_response(response, printer->hash,
+				 sizeof(printer->hash)) ||
+	(fd = open(printer->filename, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+      snprintf(result, sizeof(result), "%d F - -\n", idx);
+    else {
+      if (cachedir)
+	ppd_cache_store(cachedir, printer->uri, printer->isFax, response,
+			printer->hash, NULL);
+      ppd_cache_strip_response(response);
+      ippWriteFile(fd, response);
+      close(fd);
+      snprintf(result, sizeof(result), "%d R %s %s\n", idx, printer->hash,
+	       printer->filename);
+    }
+    ippDelete(response);
+  }
+
+  if (write(result_fd, result, strlen(result)) < 0)
+    _exit(1);
+}
+
+/*
+ * 'batch_finish()' - Take the result of a worker after its pipe got closed
+ *                    and reap it.
+ */
+
+static void
+batch_finish(int idx, batch_printer_t *printer)
+{
+  int	ridx;
+  char	status,
+	hash[65],
+	filename[1024];
+
+  printer->latency = get_time() - printer->start;
+  printer->result[printer->used] = '\0';
+
+  /* A worker which crashed or got killed leaves no complete line */
+  if (!strchr(printer->result, '\n') ||
+      sscanf(printer->result, "%d %c %64s %1023s", &ridx, &status, hash,
+	     filename) != 4 ||
+      ridx != idx)
+    status = 'F';
+
+  printer->status = status;
+  if (status != 'F') {
+    if (strcmp(hash, "-"))
+      snprintf(printer->hash, sizeof(printer->hash), "%s", hash);
+    snprintf(printer->filename, sizeof(printer->filename), "%s", filename);
+  }
+
+  close(printer->fd);
+  printer->fd = -1;
+  if (printer->pid > 0)
+    while (waitpid(printer->pid, NULL, 0) < 0 && errno == EINTR);
+  printer->pid = 0;
+}
+
+/*
+ * 'batch_output_name()' - Make a PPD file name from a printer URI.
+ */
+
+static char *
+batch_output_name(const char *outdir, const char *uri)
+{
+  char	name[1024],
+	*ptr,
+	*filename;
+
+  if ((ptr = strstr(uri, "://")) != NULL)
+    uri = ptr + 3;
+  snprintf(name, sizeof(name), "%s", uri);
+  for (ptr = name + strlen(name) - 1; ptr > name && *ptr == '/'; ptr --)
+    *ptr = '\0';
+  for (ptr = name; *ptr; ptr ++)
+    if (!isalnum(*ptr & 255) && *ptr != '-' && *ptr != '.')
+      *ptr = '_';
+
+  filename = malloc(strlen(outdir) + strlen(name) + 6);
+  sprintf(filename, "%s/%s.ppd", outdir, name);
+  return (filename);
+}
+
+/*
+ * 'batch_generate()' - Generate PPDs for many printers.
+ */
+
+int
+batch_generate(cups_array_t *uris, const char *outdir, int max_workers,
+	       int isFax)
+{
+  batch_printer_t *printers,
+		*p,
+		*q;
+  int		num_printers,
+		i,
+		j,
+		next = 0,		/* Next printer to start a worker for */
+		running = 0,		/* Number of running workers */
+		num_fds,
+		result_pipe[2],
+		fd,
+		bytes,
+		num_distinct = 0,
+		num_cached = 0,
+		num_failed = 0,
+		exit_status = 0;
+  const char	*cachedir = NULL,
+		*uri;
+  char		tmpdir[1024],
+		ppdname[1024],
+		ppdgenerator_msg[1024];
+  pid_t		pid;
+  struct pollfd	*fds;			/* Result pipes of running workers */
+  int		*fd_printers;		/* Printer of each result pipe */
+  ipp_t		*response;
+  double	start = get_time(),
+		gen_start;
+
+  if ((num_printers = cupsArrayCount(uris)) == 0) {
+    fprintf(stderr, "ERROR: No printers to generate PPD files for\n");
+    return (1);
+  }
+
+  if (mkdir(outdir, 0755) && errno != EEXIST) {
+    fprintf(stderr, "ERROR: Unable to create output directory %s: %s\n",
+	    outdir, strerror(errno));
+    return (1);
+  }
+
+  snprintf(tmpdir, sizeof(tmpdir), "%s/driverless-XXXXXX",
+	   getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+  if (!mkdtemp(tmpdir)) {
+    perror("ERROR: Unable to create temporary directory");
+    return (1);
+  }
+
+  if (use_cache)
+    cachedir = ppd_cache_dir();
+
+  printers = (batch_printer_t *)calloc(num_printers, sizeof(batch_printer_t));
+  fds = (struct pollfd *)calloc(max_workers, sizeof(struct pollfd));
+  fd_printers = (int *)calloc(max_workers, sizeof(int));
+  for (i = 0, uri = (const char *)cupsArrayFirst(uris); uri;
+       i ++, uri = (const char *)cupsArrayNext(uris)) {
+    /* The scheme of a driver URI selects a printer or fax PPD */
+    printers[i].isFax = isFax;
+    if (!strncasecmp(uri, "driverless:", 11)) {
+      uri += 11;
+      printers[i].isFax = 0;
+    } else if (!strncasecmp(uri, "driverless-fax:", 15)) {
+      uri += 15;
+      printers[i].isFax = 1;
+    }
+    printers[i].uri = strdup(uri);
+    printers[i].outname = batch_output_name(outdir, uri);
+    printers[i].fd = -1;
+  }
+
+ /*
+  * Phase 1: Poll the printers, at most max_workers at a time. Each
+  * worker has its own result pipe, so that we see the end of file when
+  * it exits, even without reporting...
+  */
+
+  while ((next < num_printers || running > 0) && !job_canceled) {
+    while (next < num_printers && running < max_workers) {
+      p = printers + next;
+      if (pipe(result_pipe)) {
+	perror("ERROR: Unable to create result pipe");
+	break;
+      }
+      p->start = get_time();
+      if ((pid = fork()) == 0) {
+	close(result_pipe[0]);
+	batch_fetch(next, p, cachedir, tmpdir, result_pipe[1]);
+	_exit(0);
+      } else if (pid < 0) {
+	perror("ERROR: Unable to start worker process");
+	close(result_pipe[0]);
+	close(result_pipe[1]);
+	break;
+      }
+      close(result_pipe[1]);
+      p->pid = pid;
+      p->fd = result_pipe[0];
+      next ++;
+      running ++;
+      if (debug)
+	fprintf(stderr, "DEBUG: Polling %s (PID %d)\n", p->uri, (int)pid);
+    }
+
+    if (running == 0)
+      break;
+
+    for (i = 0, num_fds = 0; i < next; i ++)
+      if (printers[i].fd >= 0) {
+	fds[num_fds].fd      = printers[i].fd;
+	fds[num_fds].events  = POLLIN;
+	fds[num_fds].revents = 0;
+	fd_printers[num_fds] = i;
+	num_fds ++;
+      }
+
+    /* Time out now and then to check for a cancel request */
+    if (poll(fds, num_fds, 1000) < 0) {
+      if (errno == EINTR || errno == EAGAIN)
+	continue;
+      perror("ERROR: Unable to read worker results");
+      break;
+    }
+
+    for (j = 0; j < num_fds; j ++) {
+      if (!fds[j].revents)
+	continue;
+      p = printers + fd_printers[j];
+      bytes = read(p->fd, p->result + p->used,
+		   sizeof(p->result) - 1 - p->used);
+      if (bytes < 0 && (errno == EINTR || errno == EAGAIN))
+	continue;
+      if (bytes > 0 && p->used + bytes < (int)sizeof(p->result) - 1) {
+	p->used += bytes;
+	continue;
+      }
+      if (bytes > 0)
+	p->used += bytes;
+
+      /* End of file, error, or more than a result line */
+      batch_finish(fd_printers[j], p);
+      running --;
+    }
+  }
+
+  for (i = 0; i < num_printers; i ++) {
+    p = printers + i;
+    if (p->fd >= 0)
+      close(p->fd);
+    if (p->pid > 0) {
+      kill(p->pid, SIGTERM);
+      while (waitpid(p->pid, NULL, 0) < 0 && errno == EINTR);
+    }
+  }
+  free(fds);
+  free(fd_printers);
+
+ /*
+  * Phase 2: Generate one PPD per capability set and write it for all
+  * printers having it...
+  */
+
+  for (i = 0; i < num_printers && !job_canceled; i ++) {
+    p = printers + i;
+    if (p->status == 'C') {
+      num_cached ++;
+      if (!ppd_cache_write_file(outdir, p->outname, NULL, p->filename))
+	p->status = 'F';
+      continue;
+    }
+    if (p->status != 'R' || !p->hash[0])
+      continue;
+
+    /* Already written for a printer with the same capabilities? */
+    for (j = 0, q = printers; j < i; j ++, q ++)
+      if (q->status == 'R' && !strcmp(q->hash, p->hash))
+	break;
+    if (j < i) {
+      unlink(p->outname);
+      if (link(q->outname, p->outname) &&
+	  !ppd_cache_write_file(outdir, p->outname, NULL, q->outname))
+	p->status = 'F';
+      continue;
+    }
+
+    num_distinct ++;
+
+    /* PPD may already be in the cache from an earlier run */
+    if (cachedir) {
+      snprintf(ppdname, sizeof(ppdname), "%s/%s.ppd", cachedir, p->hash);
+      if (!access(ppdname, R_OK)) {
+	if (!ppd_cache_write_file(outdir, p->outname, NULL, ppdname))
+	  p->status = 'F';
+	utime(ppdname, NULL);
+	continue;
+      }
+    }
+
+    gen_start = get_time();
+    response = ippNew();
+    if ((fd = open(p->filename, O_RDONLY)) < 0 ||
+	ippReadFile(fd, response) != IPP_STATE_DATA ||
+	!ppdCreatePPDFromIPP(ppdname, sizeof(ppdname), response, NULL, NULL,
+			     0, 0, ppdgenerator_msg,
+			     sizeof(ppdgenerator_msg))) {
+      fprintf(stderr, "ERROR: Unable to create PPD file for %s: %s\n",
+	      p->uri, ppdgenerator_msg[0] ? ppdgenerator_msg : strerror(errno));
+      p->status = 'F';
+    } else {
+      if (!ppd_cache_write_file(outdir, p->outname, NULL, ppdname))
+	p->status = 'F';
+      if (cachedir)
+	ppd_cache_store(cachedir, p->uri, p->isFax, response, p->hash,
+			ppdname);
+      unlink(ppdname);
+    }
+    if (fd >= 0)
+      close(fd);
+    ippDelete(response);
+    p->latency += get_time() - gen_start;
+    ppdgenerator_msg[0] = '\0';
+  }
+
+ /*
+  * Report...
+  */
+
+  for (i = 0; i < num_printers; i ++) {
+    p = printers + i;
+    if (p->status == 'R')
+      unlink(p->filename);
+    if (p->status != 'C' && p->status != 'R') {
+      num_failed ++;
+      exit_status = 1;
+    }
+    printf("%s\t%s\t%.3f\t%s\n", p->uri,
+	   (p->status == 'C' ? "cached" :
+	    p->status == 'R' ? "polled" : "failed"),
+	   p->latency,
+	   (p->status == 'C' || p->status == 'R' ? p->outname : "-"));
+    free(p->uri);
+    free(p->outname);
+  }
+  rmdir(tmpdir);
+  free(printers);
+
+  fprintf(stderr,
+	  "DEBUG: %d printers, %d from cache, %d distinct capability sets, "
+	  "%d failed, %.3f sec\n",
+	  num_printers, num_cached, num_distinct, num_failed,
+	  get_time() - start);
+
+  return (exit_status);
+}
+
 int
 main(int argc, char*argv[]) {
   int i,
       reg_type_no = 1, /* reg_type 0 for only IPP
                                    1 for both IPPS/IPP
                                    2 for only IPPS        Default is 1*/
-      isFax = 0;       /* if driverless-fax is called  0 - not called
+      isFax = 0,       /* if driverless-fax is called  0 - not called
 			                               1 - called */
-  char *val;
+      max_workers = 8; /* Parallel polls in batch mode */
+  char *val,
+       *ptr,
+       line[2048];
+  const char *outdir = ".";
+  cups_array_t *batch_uris;
 #if defined(HAVE_SIGACTION) && !defined(HAVE_SIGSET)
   struct sigaction action;		/* Actions for POSIX signals */
 #endif /* HAVE_SIGACTION && !HAVE_SIGSET */
@@ -727,6 +2227,19 @@ main(int argc, char*argv[]) {
 	/* Output debug messages on stderr also when not running under CUPS
 	   ("list" and "cat" options) */
 	debug = 1;
+      } else if (!strcasecmp(argv[i], "--ippfind")) {
+	/* Discover printers with ippfind, not with the built-in DNS-SD
+	   browsing */
+	use_ippfind = 1;
+      } else if (!strcasecmp(argv[i], "--no-cache")) {
+	/* Always poll the printer and generate a new PPD */
+	use_cache = 0;
+      } else if (!strcasecmp(argv[i], "--incremental")) {
+	/* Output each printer as soon as it is found */
+	incremental = 1;
+      } else if (!strcasecmp(argv[i], "--no-incremental")) {
+	/* Output all printers sorted, when the search is complete */
+	incremental = 0;
       } else if (!strcasecmp(argv[i], "list")) {
 	/* List a driver URI and metadata for each printer suitable for
 	   driverless printing */
@@ -746,6 +2259,40 @@ main(int argc, char*argv[]) {
       } else if (!strcasecmp(argv[i], "--std-ipp-uris")) {
 	/* Show URIS in standard form */
 	exit(list_printers(-1, reg_type_no, isFax));
+      } else if (!strcasecmp(argv[i], "batch")) {
+	/* Generate PPD files for many printers, polling them in parallel */
+	batch_uris = cupsArrayNew(NULL, NULL);
+	for (i ++; i < argc; i ++)
+	  if ((!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) &&
+	      i + 1 < argc)
+	    max_workers = atoi(argv[++ i]);
+	  else if ((!strcmp(argv[i], "-o") ||
+		    !strcmp(argv[i], "--output-dir")) && i + 1 < argc)
+	    outdir = argv[++ i];
+	  else if (!strcmp(argv[i], "-")) {
+	    /* URIs from stdin, one per line, also accepts the output of
+	       "driverless list" */
+	    while (fgets(line, sizeof(line), stdin)) {
+	      val = line;
+	      if (*val == '"' && (ptr = strchr(val + 1, '"')) != NULL) {
+		val ++;
+		*ptr = '\0';
+	      }
+	      val[strcspn(val, " \t\r\n")] = '\0';
+	      if (*val)
+		cupsArrayAdd(batch_uris, strdup(val));
+	    }
+	  } else
+	    cupsArrayAdd(batch_uris, strdup(argv[i]));
+	if (max_workers < 1)
+	  max_workers = 1;
+	if (cupsArrayCount(batch_uris) == 0) {
+	  /* No URIs supplied, take all printers currently found via DNS-SD */
+	  found_uris = batch_uris;
+	  list_printers(0, reg_type_no, isFax);
+	  found_uris = NULL;
+	}
+	exit(batch_generate(batch_uris, outdir, max_workers, isFax));
       } else if (!strncasecmp(argv[i], "cat", 3)) {
 	/* Generate the PPD file for the given driver URI */
 	debug = 1;
@@ -819,8 +2366,28 @@ main(int argc, char*argv[]) {
 	                            "driverless\n"
 	  "                          printing\n"
 	  "  --std-ipp-uris          Show URIS in standard form\n"
+	  "  --incremental           List each printer as soon as it is "
+	                            "found (default\n"
+	  "                          when called by CUPS)\n"
+	  "  --no-incremental        List all printers sorted after the "
+	                            "search is complete\n"
+	  "                          (default when called manually)\n"
+	  "  --ippfind               Discover printers with ippfind instead "
+	                            "of the built-in\n"
+	  "                          DNS-SD browsing\n"
+	  "  --no-cache              Do not use cached PPD files, always poll "
+	                            "the printer\n"
 	  "  cat <driver URI>        Generate the PPD file for the driver URI\n"
 	  "                          <driver URI> (to be used by CUPS).\n"
+	  "  batch [-j <n>] [-o <dir>] [<URI> ... | -]\n"
+	  "                          Generate PPD files for the given printer "
+	                            "or driver URIs,\n"
+	  "                          the URIs read from stdin (\"-\"), or all "
+	                            "printers found,\n"
+	  "                          polling up to <n> (default 8) printers at "
+	                            "a time, and\n"
+	  "                          write them into <dir> (default current "
+	                            "directory).\n"
 	  "  <printer URI>           Generate the PPD file for the IPP/IPPS "
 	                            "printer URI\n"
 	  "                          <printer URI>.\n"
@@ -0,0 +1,83 @@
+#!/bin/sh
+#
+# Tests for the batch mode of driverless: Polls unreachable printers with
+# several workers, which must all be reported as failed without hanging,
+# and, if ippeveprinter is available, polls a test printer twice, the
+# second time from the PPD cache.
+#
+# Copyright © 2024 by OpenPrinting.
+#
+# Licensed under Apache License v2.0.  See the file "LICENSE" for more
+# information.
+#
+# Usage: test-driverless-batch.sh
+#
+
+builddir="${builddir:-.}"
+driverless="$builddir/driverless"
+status=0
+
+if test ! -x "$driverless"; then
+	echo "driverless not built, skipping."
+	exit 77
+fi
+
+if ! command -v timeout >/dev/null 2>&1; then
+	echo "timeout not found, skipping."
+	exit 77
+fi
+
+tmpdir="$(mktemp -d "${TMPDIR:-/tmp}/test-driverless-batch-XXXXXX")"
+trap 'kill $server 2>/dev/null; rm -rf "$tmpdir"' 0
+DRIVERLESS_CACHE_DIR="$tmpdir/cache"
+export DRIVERLESS_CACHE_DIR
+
+# Nothing listens on the discard port, each worker fails right away
+echo "Unreachable printers:"
+timeout 120 "$driverless" batch -j 2 -o "$tmpdir/ppd" \
+	ipp://127.0.0.1:9/ipp/print/1 \
+	ipp://127.0.0.1:9/ipp/print/2 \
+	driverless-fax:ipp://127.0.0.1:9/ipp/faxout \
+	>"$tmpdir/out" 2>"$tmpdir/err"
+result=$?
+cat "$tmpdir/out"
+if test $result = 124; then
+	echo "FAILED: driverless batch did not finish"
+	status=1
+elif test $result != 1; then
+	echo "FAILED: exit status $result, expected 1"
+	status=1
+fi
+if test "$(grep -c '	failed	' "$tmpdir/out")" != 3; then
+	echo "FAILED: expected 3 failed printers"
+	status=1
+fi
+
+if ! command -v ippeveprinter >/dev/null 2>&1; then
+	echo "ippeveprinter not found, skipping test printer."
+	exit $status
+fi
+
+port=$((8631 + $$ % 1000))
+ippeveprinter -p $port -n localhost "Test Printer" >"$tmpdir/server.log" 2>&1 &
+server=$!
+sleep 2
+
+for expected in polled cached; do
+	echo "Test printer, expecting $expected:"
+	timeout 120 "$driverless" batch -o "$tmpdir/ppd" \
+		ipp://localhost:$port/ipp/print >"$tmpdir/out" 2>"$tmpdir/err"
+	result=$?
+	cat "$tmpdir/out"
+	if test $result != 0 || ! grep -q "	$expected	" "$tmpdir/out"; then
+		echo "FAILED: exit status $result, expected $expected"
+		status=1
+	fi
+done
+
+if ! grep -q '^\*PPD-Adobe' "$tmpdir/ppd/localhost_${port}_ipp_print.ppd" 2>/dev/null; then
+	echo "FAILED: no PPD file written"
+	status=1
+fi
+
+exit $status